@@ -4,6 +4,8 @@
 
 #include "bench.h"
 
+#include "crypto/sha256.h"
+#include "crypto/skunk_multi.h"
 #include "key.h"
 #include "validation.h"
 #include "util.h"
@@ -11,6 +13,8 @@
 int
 main(int argc, char** argv)
 {
+    SHA256AutoDetect();
+    skunk_multi::AutoDetect();
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
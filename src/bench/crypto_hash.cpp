@@ -0,0 +1,81 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "primitives/block.h"
+#include "utilstrencodings.h"
+
+static CBlockHeader BenchHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = uint256S("00000000a5c3d0e0b2f1f8ab6f0c1e7d3f6b2b4e7d8c9a0b1c2d3e4f5a6b7c8d");
+    header.hashMerkleRoot = uint256S("4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    header.nTime = 1510000000;
+    header.nBits = 0x1e0ffff0;
+    return header;
+}
+
+static void SkunkHeaderPlain(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    uint256 hash;
+    while (state.KeepRunning()) {
+        hash = SkunkHash(BEGIN(header.nVersion), END(header.nNonce));
+        header.nNonce++;
+    }
+}
+
+static void SkunkHeaderMidstate(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    const CSkunkHeaderHasher hasher(header);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        hash = hasher.GetHash(header);
+        header.nNonce++;
+    }
+}
+
+static void SkunkHeaderBatch(benchmark::State& state)
+{
+    std::vector<CBlockHeader> vHeaders(64, BenchHeader());
+    std::vector<uint256> vHashes(vHeaders.size());
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vHeaders.size(); i++)
+            vHeaders[i].nNonce++;
+        SkunkHashBatch(&vHeaders[0], vHeaders.size(), &vHashes[0]);
+    }
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<unsigned char> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+static void MerkleRoot(benchmark::State& state)
+{
+    std::vector<uint256> leaves(1000);
+    for (size_t i = 0; i < leaves.size(); i++)
+        GetRandBytes(leaves[i].begin(), 32);
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        uint256 hash = ComputeMerkleRoot(leaves, &mutation);
+        leaves[mutation].begin()[0] = hash.begin()[0];
+    }
+}
+
+BENCHMARK(SkunkHeaderPlain);
+BENCHMARK(SkunkHeaderMidstate);
+BENCHMARK(SkunkHeaderBatch);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(MerkleRoot);
@@ -0,0 +1,56 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cachedb.h"
+
+#include "governance.h"
+#include "masternode-payments.h"
+#include "masternodeman.h"
+#include "netfulfilledman.h"
+#include "util.h"
+
+CCacheDB* pcachedb = NULL;
+
+/** Keeps flushes apart, taken before the locks of the flushed caches */
+static CCriticalSection cs_flushCacheDB;
+
+CCacheDB::CCacheDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "cachedb", nCacheSize, fMemory, fWipe), fRewrite(false)
+{
+}
+
+bool CCacheDB::WriteCache(CDBBatch& batch)
+{
+    try {
+        if(!WriteBatch(batch, true)) {
+            fRewrite = true;
+            return false;
+        }
+    } catch (const dbwrapper_error& e) {
+        fRewrite = true;
+        return error("CCacheDB::WriteCache -- %s", e.what());
+    }
+    fRewrite = false;
+    return true;
+}
+
+void FlushCacheDB()
+{
+    if(!pcachedb) return;
+
+    int64_t nStart = GetTimeMillis();
+
+    // Every cache stages its changes under its own lock only, one after the
+    // other, and the batch is committed once none of them is held anymore.
+    LOCK(cs_flushCacheDB);
+    bool fAll = pcachedb->IsRewriteRequested();
+    CDBBatch batch(*pcachedb);
+    mnodeman.WriteCacheDB(*pcachedb, batch, fAll);
+    mnpayments.WriteCacheDB(*pcachedb, batch, fAll);
+    governance.WriteCacheDB(*pcachedb, batch, fAll);
+    netfulfilledman.WriteCacheDB(*pcachedb, batch);
+    size_t nSize = batch.SizeEstimate();
+    if(!pcachedb->WriteCache(batch)) return;
+
+    LogPrint("cachedb", "FlushCacheDB -- flushed %d bytes%s in %dms\n", nSize, fAll ? " (full rewrite)" : "", GetTimeMillis() - nStart);
+}
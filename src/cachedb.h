@@ -0,0 +1,157 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CACHEDB_H
+#define CACHEDB_H
+
+#include "dbwrapper.h"
+#include "uint256.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CCacheDB;
+
+extern CCacheDB* pcachedb;
+
+//! Default memory allocated to the masternode/governance cache database (MiB)
+static const int64_t nDefaultCacheDBCache = 8;
+
+// Record prefixes of the per-entry maps, one record per map entry
+static const char DB_CACHE_MASTERNODE = 'm';
+static const char DB_CACHE_SEEN_MNB = 'b';
+static const char DB_CACHE_SEEN_MNP = 'p';
+static const char DB_CACHE_PAYMENT_VOTE = 'v';
+static const char DB_CACHE_PAYMENT_BLOCK = 'k';
+static const char DB_CACHE_GOVERNANCE_OBJECT = 'g';
+static const char DB_CACHE_GOVERNANCE_VOTE = 'n';
+static const char DB_CACHE_GOVERNANCE_ERASED = 'e';
+static const char DB_CACHE_GOVERNANCE_WATCHDOG = 'w';
+static const char DB_CACHE_GOVERNANCE_LAST_MN_OBJECT = 'l';
+static const char DB_CACHE_GOVERNANCE_INVALID_VOTE = 'i';
+static const char DB_CACHE_GOVERNANCE_ORPHAN_VOTE = 'o';
+// Prefix of the small bookkeeping containers, stored as one record each
+static const char DB_CACHE_RECORD = 'R';
+
+/**
+ * What is stored for a map value. Values with parts which are stored as
+ * records of their own overload this to return a serialization wrapper.
+ */
+template<typename V>
+const V& CacheDBRecord(const V& value)
+{
+    return value;
+}
+
+/**
+ * Access to the masternode, payment, governance and fulfilled request caches
+ * on disk (datadir/cachedb).
+ *
+ * Large maps are stored one record per entry. The owners of those maps
+ * remember the keys they add, change or erase in a dirty set, and a flush
+ * only serializes those. All caches are flushed in a single atomic batch, so
+ * a crash leaves the last consistent snapshot.
+ */
+class CCacheDB : public CDBWrapper
+{
+public:
+    CCacheDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+private:
+    CCacheDB(const CCacheDB&);
+    void operator=(const CCacheDB&);
+
+    /// Whether the next flush has to replace every entry, see RequestRewrite
+    bool fRewrite;
+
+public:
+    /// Stage the entries of mapIn whose keys are in setDirty: written if still in the map, erased otherwise
+    template<typename K, typename V>
+    void WriteMap(CDBBatch& batch, char chPrefix, const std::map<K, V>& mapIn, std::set<K>& setDirty)
+    {
+        for(typename std::set<K>::const_iterator it = setDirty.begin(); it != setDirty.end(); ++it) {
+            typename std::map<K, V>::const_iterator mi = mapIn.find(*it);
+            if(mi == mapIn.end()) {
+                batch.Erase(std::make_pair(chPrefix, *it));
+            } else {
+                batch.Write(std::make_pair(chPrefix, *it), CacheDBRecord(mi->second));
+            }
+        }
+        setDirty.clear();
+    }
+
+    /// Stage the erasure of everything stored under chPrefix followed by every entry of mapIn
+    template<typename K, typename V>
+    void RewriteMap(CDBBatch& batch, char chPrefix, const std::map<K, V>& mapIn)
+    {
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(chPrefix);
+        while(pcursor->Valid()) {
+            std::pair<char, K> key;
+            if(!pcursor->GetKey(key) || key.first != chPrefix) break;
+            if(!mapIn.count(key.second)) {
+                batch.Erase(key);
+            }
+            pcursor->Next();
+        }
+        for(typename std::map<K, V>::const_iterator it = mapIn.begin(); it != mapIn.end(); ++it) {
+            batch.Write(std::make_pair(chPrefix, it->first), CacheDBRecord(it->second));
+        }
+    }
+
+    /// Load every entry stored under chPrefix into mapOut, deserializing each straight into place
+    template<typename K, typename V>
+    bool ReadMap(char chPrefix, std::map<K, V>& mapOut)
+    {
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(chPrefix);
+        while(pcursor->Valid()) {
+            std::pair<char, K> key;
+            if(!pcursor->GetKey(key) || key.first != chPrefix) break;
+            if(!pcursor->GetValue(REF(CacheDBRecord(mapOut[key.second])))) {
+                mapOut.erase(key.second);
+                return error("CCacheDB::ReadMap -- failed to read entry with prefix '%c'", chPrefix);
+            }
+            pcursor->Next();
+        }
+        return true;
+    }
+
+    template<typename V>
+    void WriteRecord(CDBBatch& batch, const std::string& strName, const V& value)
+    {
+        batch.Write(std::make_pair(DB_CACHE_RECORD, strName), value);
+    }
+
+    void EraseRecord(CDBBatch& batch, const std::string& strName)
+    {
+        batch.Erase(std::make_pair(DB_CACHE_RECORD, strName));
+    }
+
+    template<typename V>
+    bool ReadRecord(const std::string& strName, V& value)
+    {
+        return Read(std::make_pair(DB_CACHE_RECORD, strName), value);
+    }
+
+    /**
+     * Make the next flush replace all stored entries with what is in memory,
+     * for caches which were loaded from elsewhere or reset, and after a failed
+     * flush dropped the changes it staged.
+     */
+    void RequestRewrite() { fRewrite = true; }
+    bool IsRewriteRequested() const { return fRewrite; }
+
+    /// Commit a flush; on failure the next flush writes everything again
+    bool WriteCache(CDBBatch& batch);
+};
+
+/// Write all changes to the masternode, payment, governance and fulfilled request caches
+void FlushCacheDB();
+
+#endif
@@ -0,0 +1,46 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATSINDEX_H
+#define BITCOIN_COINSTATSINDEX_H
+
+#include "amount.h"
+#include "crypto/muhash.h"
+#include "serialize.h"
+
+/**
+ * Statistics about the unspent transaction output set as of a block, kept
+ * per block hash by -coinstatsindex. They are rolled forward from the parent
+ * block's statistics when a block is connected, so a disconnect leaves the
+ * parent's record in place and needs nothing undone.
+ */
+struct CCoinStatsIndexValue {
+    MuHash3072 muhash;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(muhash);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+    }
+
+    CCoinStatsIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        muhash = MuHash3072();
+        nTransactionOutputs = 0;
+        nBogoSize = 0;
+        nTotalAmount = 0;
+    }
+};
+
+#endif // BITCOIN_COINSTATSINDEX_H
@@ -0,0 +1,185 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+
+/** 2^3072 - 1103717 is the largest 3072-bit safe prime */
+const Num3072::limb_t MAX_PRIME_DIFF = 1103717;
+
+/** Number of 32 byte blocks expanded from the hash of an element */
+const int EXPAND_BLOCKS = Num3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE;
+
+Num3072::limb_t ReadLimb(const unsigned char* ptr)
+{
+    return Num3072::LIMB_SIZE == 64 ? (Num3072::limb_t)ReadLE64(ptr) : (Num3072::limb_t)ReadLE32(ptr);
+}
+
+void WriteLimb(unsigned char* ptr, Num3072::limb_t x)
+{
+    if (Num3072::LIMB_SIZE == 64) {
+        WriteLE64(ptr, (uint64_t)x);
+    } else {
+        WriteLE32(ptr, (uint32_t)x);
+    }
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLimb(data + i * (LIMB_SIZE / 8));
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+bool Num3072::IsOverflow() const
+{
+    // Only numbers in [2^3072 - MAX_PRIME_DIFF, 2^3072) are not reduced
+    if (limbs[0] <= (limb_t)(0 - MAX_PRIME_DIFF - 1)) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != (limb_t)(0 - 1)) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtract the modulus by adding MAX_PRIME_DIFF and dropping the 2^3072 bit
+    limb_t carry = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && carry; ++i) {
+        limbs[i] += carry;
+        carry = limbs[i] < carry;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook multiplication into a 6144-bit product
+    limb_t tmp[2 * LIMBS];
+    memset(tmp, 0, sizeof(tmp));
+    for (int i = 0; i < LIMBS; ++i) {
+        limb_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            double_limb_t t = (double_limb_t)limbs[i] * a.limbs[j] + tmp[i + j] + carry;
+            tmp[i + j] = (limb_t)t;
+            carry = (limb_t)(t >> LIMB_SIZE);
+        }
+        tmp[i + LIMBS] = carry;
+    }
+
+    // Reduce using 2^3072 == MAX_PRIME_DIFF (mod p)
+    limb_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t t = (double_limb_t)tmp[i + LIMBS] * MAX_PRIME_DIFF + tmp[i] + carry;
+        limbs[i] = (limb_t)t;
+        carry = (limb_t)(t >> LIMB_SIZE);
+    }
+    while (carry) {
+        double_limb_t t = (double_limb_t)carry * MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && t; ++i) {
+            t += limbs[i];
+            limbs[i] = (limb_t)t;
+            t >>= LIMB_SIZE;
+        }
+        carry = (limb_t)t;
+    }
+
+    if (IsOverflow()) FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // a^(p-2) by square-and-multiply; p-2 = 2^3072 - (MAX_PRIME_DIFF + 2) has
+    // all bits set except for a few in the lowest limb.
+    Num3072 out;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        limb_t e = i == 0 ? (limb_t)(0 - MAX_PRIME_DIFF - 2) : (limb_t)(0 - 1);
+        for (int b = LIMB_SIZE - 1; b >= 0; --b) {
+            out.Multiply(out);
+            if ((e >> b) & 1) out.Multiply(*this);
+        }
+    }
+    return out;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    Num3072 reduced(*this);
+    if (reduced.IsOverflow()) reduced.FullReduce();
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLimb(out + i * (LIMB_SIZE / 8), reduced.limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    // Expand the SHA256 of the element to 3072 bits with SHA256 in counter mode
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    for (int i = 0; i < EXPAND_BLOCKS; ++i) {
+        unsigned char counter[4];
+        WriteLE32(counter, i);
+        CSHA256().Write(key, sizeof(key)).Write(counter, sizeof(counter)).Finalize(expanded + i * CSHA256::OUTPUT_SIZE);
+    }
+    Num3072 num(expanded);
+    return num;
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An element of the multiplicative group of integers modulo 2^3072 - 1103717. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const size_t BYTE_SIZE = 384;
+
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    /** Interpret 384 bytes as a little endian number */
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    /** Write the fully reduced number as 384 bytes little endian */
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A multiplicative hash of a set of byte strings (MuHash).
+ *
+ * Every element is hashed to a number modulo a 3072-bit prime, and the set
+ * hash is the product of those numbers. Elements can be added and removed in
+ * any order, and the hash of a set only depends on its contents, which allows
+ * keeping the hash of a large set up to date at the cost of one
+ * multiplication per change. Removals are collected in a separate
+ * denominator, so the expensive inversion only happens in Finalize.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    /** The hash of the empty set */
+    MuHash3072() {}
+
+    /** Add an element to the set */
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    /** Remove an element from the set */
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    /** Add all elements of another set */
+    MuHash3072& operator*=(const MuHash3072& mul);
+    /** Remove all elements of another set */
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    /** Compute the 32 byte hash of the set */
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        numerator.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+        denominator.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        numerator = Num3072(data);
+        s.read((char*)data, sizeof(data));
+        denominator = Num3072(data);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 2 * Num3072::BYTE_SIZE;
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
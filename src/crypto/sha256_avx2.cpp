@@ -0,0 +1,184 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// This is a translation of the portable SHA-256 transform to AVX2
+// intrinsics, computing 8 independent double-SHA256 hashes of 64 byte
+// inputs at once, one in every 32-bit lane.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256d64_avx2 {
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+__m256i inline Set(uint32_t x) { return _mm256_set1_epi32(x); }
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z) { return Add(Add(x, y), z); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z, __m256i w) { return Add(Add(x, y), Add(z, w)); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z, __m256i w, __m256i v) { return Add(Add(x, y, z), Add(w, v)); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+__m256i inline ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+__m256i inline ShL(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+__m256i inline RotR(__m256i x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+
+__m256i inline Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+__m256i inline Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m256i inline Sigma0(__m256i x) { return Xor(RotR(x, 2), RotR(x, 13), RotR(x, 22)); }
+__m256i inline Sigma1(__m256i x) { return Xor(RotR(x, 6), RotR(x, 11), RotR(x, 25)); }
+__m256i inline sigma0(__m256i x) { return Xor(RotR(x, 7), RotR(x, 18), ShR(x, 3)); }
+__m256i inline sigma1(__m256i x) { return Xor(RotR(x, 17), RotR(x, 19), ShR(x, 10)); }
+
+/** Initialize SHA-256 state. */
+void inline Initialize(__m256i* s)
+{
+    s[0] = Set(0x6a09e667ul);
+    s[1] = Set(0xbb67ae85ul);
+    s[2] = Set(0x3c6ef372ul);
+    s[3] = Set(0xa54ff53aul);
+    s[4] = Set(0x510e527ful);
+    s[5] = Set(0x9b05688cul);
+    s[6] = Set(0x1f83d9abul);
+    s[7] = Set(0x5be0cd19ul);
+}
+
+/** One round of SHA-256. */
+void inline Round(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e, __m256i f, __m256i g, __m256i& h, uint32_t k, __m256i w)
+{
+    __m256i t1 = Add(h, Sigma1(e), Ch(e, f, g), Set(k), w);
+    __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Expand the message schedule in place for round i >= 16. */
+__m256i inline Expand(__m256i* w, int i)
+{
+    return w[i & 15] = Add(w[i & 15], sigma1(w[(i + 14) & 15]), w[(i + 9) & 15], sigma0(w[(i + 1) & 15]));
+}
+
+/** Perform one SHA-256 transformation of the state with the message words in w, which are overwritten. */
+void inline Transform(__m256i* s, __m256i* w)
+{
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 16; i += 8) {
+        Round(a, b, c, d, e, f, g, h, K[i + 0], w[i + 0]);
+        Round(h, a, b, c, d, e, f, g, K[i + 1], w[i + 1]);
+        Round(g, h, a, b, c, d, e, f, K[i + 2], w[i + 2]);
+        Round(f, g, h, a, b, c, d, e, K[i + 3], w[i + 3]);
+        Round(e, f, g, h, a, b, c, d, K[i + 4], w[i + 4]);
+        Round(d, e, f, g, h, a, b, c, K[i + 5], w[i + 5]);
+        Round(c, d, e, f, g, h, a, b, K[i + 6], w[i + 6]);
+        Round(b, c, d, e, f, g, h, a, K[i + 7], w[i + 7]);
+    }
+    for (int i = 16; i < 64; i += 8) {
+        Round(a, b, c, d, e, f, g, h, K[i + 0], Expand(w, i + 0));
+        Round(h, a, b, c, d, e, f, g, K[i + 1], Expand(w, i + 1));
+        Round(g, h, a, b, c, d, e, f, K[i + 2], Expand(w, i + 2));
+        Round(f, g, h, a, b, c, d, e, K[i + 3], Expand(w, i + 3));
+        Round(e, f, g, h, a, b, c, d, K[i + 4], Expand(w, i + 4));
+        Round(d, e, f, g, h, a, b, c, K[i + 5], Expand(w, i + 5));
+        Round(c, d, e, f, g, h, a, b, K[i + 6], Expand(w, i + 6));
+        Round(b, c, d, e, f, g, h, a, K[i + 7], Expand(w, i + 7));
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+/** Read the big endian 32-bit words at offset of every input into the lanes of a vector. */
+__m256i inline Read(const unsigned char* in, int offset)
+{
+    __m256i ret = _mm256_set_epi32(
+        ReadLE32(in + 0 + offset),
+        ReadLE32(in + 64 + offset),
+        ReadLE32(in + 128 + offset),
+        ReadLE32(in + 192 + offset),
+        ReadLE32(in + 256 + offset),
+        ReadLE32(in + 320 + offset),
+        ReadLE32(in + 384 + offset),
+        ReadLE32(in + 448 + offset));
+    return _mm256_shuffle_epi8(ret, _mm256_set_epi32(0x0C0D0E0FUL, 0x08090A0BUL, 0x04050607UL, 0x00010203UL, 0x0C0D0E0FUL, 0x08090A0BUL, 0x04050607UL, 0x00010203UL));
+}
+
+/** Write the lanes of a vector as big endian 32-bit words at offset of every output. */
+void inline Write(unsigned char* out, int offset, __m256i v)
+{
+    v = _mm256_shuffle_epi8(v, _mm256_set_epi32(0x0C0D0E0FUL, 0x08090A0BUL, 0x04050607UL, 0x00010203UL, 0x0C0D0E0FUL, 0x08090A0BUL, 0x04050607UL, 0x00010203UL));
+    WriteLE32(out + 0 + offset, _mm256_extract_epi32(v, 7));
+    WriteLE32(out + 32 + offset, _mm256_extract_epi32(v, 6));
+    WriteLE32(out + 64 + offset, _mm256_extract_epi32(v, 5));
+    WriteLE32(out + 96 + offset, _mm256_extract_epi32(v, 4));
+    WriteLE32(out + 128 + offset, _mm256_extract_epi32(v, 3));
+    WriteLE32(out + 160 + offset, _mm256_extract_epi32(v, 2));
+    WriteLE32(out + 192 + offset, _mm256_extract_epi32(v, 1));
+    WriteLE32(out + 224 + offset, _mm256_extract_epi32(v, 0));
+}
+
+} // namespace
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], t[8], w[16];
+
+    // First hash: the 64 byte input, then a block of padding
+    Initialize(s);
+    for (int i = 0; i < 16; i++)
+        w[i] = Read(in, 4 * i);
+    Transform(s, w);
+    for (int i = 0; i < 8; i++)
+        t[i] = s[i];
+    w[0] = Set(0x80000000ul);
+    for (int i = 1; i < 15; i++)
+        w[i] = Set(0);
+    w[15] = Set(0x200);
+    Transform(t, w);
+
+    // Second hash: the first hash followed by padding
+    Initialize(s);
+    for (int i = 0; i < 8; i++)
+        w[i] = t[i];
+    w[8] = Set(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = Set(0);
+    w[15] = Set(0x100);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++)
+        Write(out, 4 * i, s[i]);
+}
+
+}
+
+#endif
@@ -0,0 +1,253 @@
+// Copyright (c) 2018 The MobitGlobal Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/skunk_multi.h"
+
+#include "crypto/common.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ENABLE_SKUNK_MULTI 1
+#endif
+
+#ifdef ENABLE_SKUNK_MULTI
+// Internal implementation code.
+namespace
+{
+/** Lane-parallel kernels. Every lane runs the same instruction stream as the
+ * scalar sph_skein512/sph_cubehash512 code, just on N independent inputs held
+ * side by side in GCC vector types, so the compiler emits SSE/AVX2 ops. */
+namespace multi
+{
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint64_t u64x8 __attribute__((vector_size(64)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+
+#define SKUNK_INLINE inline __attribute__((always_inline))
+#define ROTL64V(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+#define ROTL32V(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint64_t SKEIN512_IV[8] = {
+    0x4903ADFF749C51CEull, 0x0D95DE399746DF03ull, 0x8FD1934127C79BCEull, 0x9A255629FF352CB1ull,
+    0x5DB62599DF6CA7B0ull, 0xEABE394CA9D5C3F4ull, 0x991112C71A75B523ull, 0xAE18A40B660FCC33ull};
+
+static const uint32_t CUBEHASH512_IV[32] = {
+    0x2AEA2A61, 0x50F494D4, 0x2D538B8B, 0x4167D83E, 0x3FEE2313, 0xC701CF8C, 0xCC39968E, 0x50AC5695,
+    0x4D42C787, 0xA647A8B3, 0x97CF0BEF, 0x825B4537, 0xEEF864D2, 0xF22090C4, 0xD0E5CD33, 0xA23911AE,
+    0xFCD398D9, 0x148FE485, 0x1B017BEF, 0xB6444532, 0x6A536159, 0x2FF5781C, 0x91FA7934, 0x0DBADEA9,
+    0xD65C8A2B, 0xA5A70E75, 0xB1C62456, 0xBC796576, 0x1921C8F7, 0xE7989AF1, 0x7795D246, 0xD43E3B44};
+
+/** Threefish-512 rotation constants, [even/odd][mix stage][pair]. */
+static const int SKEIN_ROT[2][4][4] = {
+    {{46, 36, 19, 37}, {33, 27, 14, 42}, {17, 49, 36, 39}, {44, 9, 54, 56}},
+    {{39, 30, 34, 24}, {13, 50, 10, 17}, {25, 29, 39, 43}, {8, 35, 56, 22}}};
+
+/** Word pairing for each of the four mix stages of a Threefish-512 quad round. */
+static const int SKEIN_PERM[4][8] = {
+    {0, 1, 2, 3, 4, 5, 6, 7}, {2, 1, 4, 7, 6, 5, 0, 3}, {4, 1, 6, 3, 0, 5, 2, 7}, {6, 1, 0, 7, 2, 5, 4, 3}};
+
+/** One UBI compression: h = Threefish_h,t(m) ^ m. The tweak is shared by all lanes. */
+template<typename V64>
+SKUNK_INLINE void SkeinUbi(V64* h, const V64* m, uint64_t t0, uint64_t t1)
+{
+    V64 k[9];
+    V64 p[8];
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+
+    k[8] = h[0] ^ 0x1BD11BDAA9FC1A22ull;
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        if (i > 0) k[8] ^= h[i];
+        p[i] = m[i];
+    }
+
+    for (int s = 0; s < 18; s++) {
+        for (int i = 0; i < 8; i++) p[i] += k[(s + i) % 9];
+        p[5] += t[s % 3];
+        p[6] += t[(s + 1) % 3];
+        p[7] += (uint64_t)s;
+        for (int stage = 0; stage < 4; stage++) {
+            for (int j = 0; j < 4; j++) {
+                const int a = SKEIN_PERM[stage][2 * j];
+                const int b = SKEIN_PERM[stage][2 * j + 1];
+                p[a] += p[b];
+                p[b] = ROTL64V(p[b], SKEIN_ROT[s & 1][stage][j]) ^ p[a];
+            }
+        }
+    }
+    for (int i = 0; i < 8; i++) p[i] += k[(18 + i) % 9];
+    p[5] += t[18 % 3];
+    p[6] += t[(18 + 1) % 3];
+    p[7] += (uint64_t)18;
+
+    for (int i = 0; i < 8; i++) h[i] = m[i] ^ p[i];
+}
+
+/** One CubeHash round as written in the specification (r = 16 of these per block). */
+template<typename V32>
+SKUNK_INLINE void CubehashRound(V32* x)
+{
+    V32 tmp;
+    for (int i = 0; i < 16; i++) {
+        x[16 + i] += x[i];
+        x[i] = ROTL32V(x[i], 7);
+    }
+    for (int i = 0; i < 8; i++) {
+        tmp = x[i]; x[i] = x[i + 8]; x[i + 8] = tmp;
+    }
+    for (int i = 0; i < 16; i++) x[i] ^= x[16 + i];
+    for (int i = 16; i < 32; i++) {
+        if (i & 2) continue;
+        tmp = x[i]; x[i] = x[i + 2]; x[i + 2] = tmp;
+    }
+    for (int i = 0; i < 16; i++) {
+        x[16 + i] += x[i];
+        x[i] = ROTL32V(x[i], 11);
+    }
+    for (int i = 0; i < 16; i++) {
+        if (i & 4) continue;
+        tmp = x[i]; x[i] = x[i + 4]; x[i + 4] = tmp;
+    }
+    for (int i = 0; i < 16; i++) x[i] ^= x[16 + i];
+    for (int i = 16; i < 32; i += 2) {
+        tmp = x[i]; x[i] = x[i + 1]; x[i + 1] = tmp;
+    }
+}
+
+template<typename V32>
+SKUNK_INLINE void CubehashSixteenRounds(V32* x)
+{
+    for (int r = 0; r < 16; r++) CubehashRound(x);
+}
+
+/** Skein-512 of N 80-byte inputs followed by CubeHash-512 of the 64-byte digests. */
+template<typename V64, typename V32, int N>
+SKUNK_INLINE void SkeinCubehash80(const unsigned char* const* in, unsigned char* out)
+{
+    V64 h[8];
+    V64 m[8];
+
+    for (int i = 0; i < 8; i++) h[i] = V64() + SKEIN512_IV[i];
+
+    // First message block: bytes 0..63, tweak position 64, first + message type.
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < N; l++) m[i][l] = ReadLE64(in[l] + 8 * i);
+    SkeinUbi(h, m, 64, (uint64_t)224 << 55);
+
+    // Final message block: bytes 64..79 zero padded, tweak position 80, final + message type.
+    for (int i = 0; i < 8; i++) {
+        m[i] = V64();
+        if (i < 2)
+            for (int l = 0; l < N; l++) m[i][l] = ReadLE64(in[l] + 64 + 8 * i);
+    }
+    SkeinUbi(h, m, 80, (uint64_t)352 << 55);
+
+    // Output block: counter 0, tweak position 8, first + final + output type.
+    for (int i = 0; i < 8; i++) m[i] = V64();
+    SkeinUbi(h, m, 8, (uint64_t)510 << 55);
+
+    V32 x[32];
+    for (int i = 0; i < 32; i++) x[i] = V32() + CUBEHASH512_IV[i];
+
+    // The 64-byte Skein digest is two 32-byte CubeHash blocks.
+    for (int blk = 0; blk < 2; blk++) {
+        for (int i = 0; i < 8; i++) {
+            const int w = blk * 8 + i;
+            V32 word;
+            for (int l = 0; l < N; l++) word[l] = (uint32_t)(h[w >> 1][l] >> (32 * (w & 1)));
+            x[i] ^= word;
+        }
+        CubehashSixteenRounds(x);
+    }
+
+    // Padding block (a single 0x80 byte), then the finalization rounds.
+    x[0] ^= (uint32_t)0x80;
+    CubehashSixteenRounds(x);
+    x[31] ^= (uint32_t)1;
+    for (int i = 0; i < 10; i++) CubehashSixteenRounds(x);
+
+    for (int l = 0; l < N; l++)
+        for (int i = 0; i < 16; i++) WriteLE32(out + 64 * l + 4 * i, x[i][l]);
+}
+
+__attribute__((target("avx2"), optimize("unroll-loops"))) void SkeinCubehash80_AVX2(const unsigned char* const* in, unsigned char* out)
+{
+    SkeinCubehash80<u64x8, u32x8, 8>(in, out);
+}
+
+__attribute__((target("sse4.1"), optimize("unroll-loops"))) void SkeinCubehash80_SSE41(const unsigned char* const* in, unsigned char* out)
+{
+    SkeinCubehash80<u64x4, u32x4, 4>(in, out);
+}
+
+#undef SKUNK_INLINE
+#undef ROTL64V
+#undef ROTL32V
+} // namespace multi
+
+struct Kernel
+{
+    const char* name;
+    size_t lanes;
+    void (*fn)(const unsigned char* const*, unsigned char*);
+};
+
+const Kernel KERNEL_SCALAR = {"scalar", 0, NULL};
+const Kernel KERNEL_SSE41 = {"sse4.1", 4, multi::SkeinCubehash80_SSE41};
+const Kernel KERNEL_AVX2 = {"avx2", 8, multi::SkeinCubehash80_AVX2};
+
+const Kernel* pkernel = &KERNEL_SCALAR;
+
+const Kernel& GetKernel()
+{
+    return *pkernel;
+}
+} // namespace
+#endif // ENABLE_SKUNK_MULTI
+
+namespace skunk_multi {
+
+std::string AutoDetect(UseKernel use)
+{
+#ifdef ENABLE_SKUNK_MULTI
+    __builtin_cpu_init();
+    if ((use & USE_AVX2) && __builtin_cpu_supports("avx2")) {
+        pkernel = &KERNEL_AVX2;
+    } else if ((use & USE_SSE41) && __builtin_cpu_supports("sse4.1")) {
+        pkernel = &KERNEL_SSE41;
+    } else {
+        pkernel = &KERNEL_SCALAR;
+    }
+#endif
+    return KernelName();
+}
+
+size_t Lanes()
+{
+#ifdef ENABLE_SKUNK_MULTI
+    return GetKernel().lanes;
+#else
+    return 0;
+#endif
+}
+
+const char* KernelName()
+{
+#ifdef ENABLE_SKUNK_MULTI
+    return GetKernel().name;
+#else
+    return "scalar";
+#endif
+}
+
+void SkeinCubehash80(const unsigned char* const* in, unsigned char* out)
+{
+#ifdef ENABLE_SKUNK_MULTI
+    GetKernel().fn(in, out);
+#endif
+}
+
+} // namespace skunk_multi
@@ -0,0 +1,43 @@
+// Copyright (c) 2018 The MobitGlobal Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SKUNK_MULTI_H
+#define BITCOIN_CRYPTO_SKUNK_MULTI_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Multi-lane Skein-512 -> CubeHash-512 front half of the Skunk chain for
+ * 80-byte block headers. The kernel is picked by AutoDetect() from CPUID;
+ * outputs are bit-identical to running sph_skein512 and sph_cubehash512 on
+ * each input.
+ */
+namespace skunk_multi {
+
+/** Which of the vector kernels AutoDetect may pick */
+enum UseKernel : uint8_t {
+    STANDARD = 0,
+    USE_SSE41 = 1 << 0,
+    USE_AVX2 = 1 << 1,
+    USE_ALL = USE_SSE41 | USE_AVX2,
+};
+
+/** Select the widest kernel the CPU supports, among those allowed by use.
+ *  Until this is called no vector kernel is used. Returns the name of the kernel.
+ */
+std::string AutoDetect(UseKernel use = USE_ALL);
+
+/** Number of headers processed per call to SkeinCubehash80, or 0 if no vector kernel is usable. */
+size_t Lanes();
+
+/** Name of the selected kernel ("avx2", "sse4.1" or "scalar"). */
+const char* KernelName();
+
+/** Hash Lanes() consecutive 80-byte inputs from in[], writing Lanes() 64-byte CubeHash-512 digests to out. */
+void SkeinCubehash80(const unsigned char* const* in, unsigned char* out);
+
+} // namespace skunk_multi
+
+#endif // BITCOIN_CRYPTO_SKUNK_MULTI_H
@@ -55,6 +55,7 @@ void CDSNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, con
 
 void CDSNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
 {
+    mnodeman.SyncTransaction(tx, pblock);
     instantsend.SyncTransaction(tx, pblock);
     CPrivateSend::SyncTransaction(tx, pblock);
 }
@@ -35,6 +35,7 @@ CGovernanceObject::CGovernanceObject()
   fDirtyCache(true),
   fExpired(false),
   fUnparsable(false),
+  fDirtyDB(true),
   mapCurrentMNVotes(),
   mapOrphanVotes(),
   fileVotes()
@@ -63,6 +64,7 @@ CGovernanceObject::CGovernanceObject(uint256 nHashParentIn, int nRevisionIn, int
   fDirtyCache(true),
   fExpired(false),
   fUnparsable(false),
+  fDirtyDB(true),
   mapCurrentMNVotes(),
   mapOrphanVotes(),
   fileVotes()
@@ -91,6 +93,7 @@ CGovernanceObject::CGovernanceObject(const CGovernanceObject& other)
   fDirtyCache(other.fDirtyCache),
   fExpired(other.fExpired),
   fUnparsable(other.fUnparsable),
+  fDirtyDB(other.fDirtyDB),
   mapCurrentMNVotes(other.mapCurrentMNVotes),
   mapOrphanVotes(other.mapOrphanVotes),
   fileVotes(other.fileVotes)
@@ -99,7 +102,8 @@ CGovernanceObject::CGovernanceObject(const CGovernanceObject& other)
 bool CGovernanceObject::ProcessVote(CNode* pfrom,
                                     const CGovernanceVote& vote,
                                     CGovernanceException& exception,
-                                    CConnman& connman)
+                                    CConnman& connman,
+                                    bool fSignatureVerified)
 {
     if(!mnodeman.Has(vote.GetMasternodeOutpoint())) {
         std::ostringstream ostr;
@@ -120,6 +124,7 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
     vote_m_it it = mapCurrentMNVotes.find(vote.GetMasternodeOutpoint());
     if(it == mapCurrentMNVotes.end()) {
         it = mapCurrentMNVotes.insert(vote_m_t::value_type(vote.GetMasternodeOutpoint(), vote_rec_t())).first;
+        fDirtyDB = true;
     }
     vote_rec_t& recVote = it->second;
     vote_signal_enum_t eSignal = vote.GetSignal();
@@ -168,8 +173,9 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
             return false;
         }
     }
-    // Finally check that the vote is actually valid (done last because of cost of signature verification)
-    if(!vote.IsValid(true)) {
+    // Finally check that the vote is actually valid (done last because of cost of signature verification,
+    // which is skipped when the vote verification queue already checked the signature)
+    if(!vote.IsValid(!fSignatureVerified)) {
         std::ostringstream ostr;
         ostr << "CGovernanceObject::ProcessVote -- Invalid vote"
                 << ", MN outpoint = " << vote.GetMasternodeOutpoint().ToStringShort()
@@ -194,6 +200,7 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
         fileVotes.AddVote(vote);
     }
     fDirtyCache = true;
+    fDirtyDB = true;
     return true;
 }
 
@@ -204,6 +211,7 @@ void CGovernanceObject::ClearMasternodeVotes()
         if(!mnodeman.Has(it->first)) {
             fileVotes.RemoveVotesFromMasternode(it->first);
             mapCurrentMNVotes.erase(it++);
+            fDirtyDB = true;
         }
         else {
             ++it;
@@ -658,8 +666,12 @@ void CGovernanceObject::Relay(CConnman& connman)
         return;
     }
 
+    // The network serialization only covers the signed fields, so the
+    // framed message stays valid for as long as mapRelay keeps it
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *this;
     CInv inv(MSG_GOVERNANCE_OBJECT, GetHash());
-    connman.RelayInv(inv, MIN_GOVERNANCE_PEER_PROTO_VERSION);
+    connman.RelayInv(inv, ss, MIN_GOVERNANCE_PEER_PROTO_VERSION);
 }
 
 void CGovernanceObject::UpdateSentinelVariables()
@@ -692,6 +704,7 @@ void CGovernanceObject::UpdateSentinelVariables()
         fCachedDelete = true;
         if(nDeletionTime == 0) {
             nDeletionTime = GetAdjustedTime();
+            fDirtyDB = true;
         }
     }
     if(GetAbsoluteYesCount(VOTE_SIGNAL_ENDORSED) >= nAbsVoteReq) fCachedEndorsed = true;
@@ -721,6 +734,7 @@ void CGovernanceObject::swap(CGovernanceObject& first, CGovernanceObject& second
     swap(first.fCachedEndorsed, second.fCachedEndorsed);
     swap(first.fDirtyCache, second.fDirtyCache);
     swap(first.fExpired, second.fExpired);
+    swap(first.fDirtyDB, second.fDirtyDB);
 }
 
 void CGovernanceObject::CheckOrphanVotes(CConnman& connman)
@@ -182,6 +182,9 @@ private:
     /// Failed to parse object data
     bool fUnparsable;
 
+    /// object changed since it was last written to the cache database
+    bool fDirtyDB;
+
     vote_m_t mapCurrentMNVotes;
 
     /// Limited map of votes orphaned by MN
@@ -248,6 +251,14 @@ public:
         fDirtyCache = true;
     }
 
+    bool IsSetDirtyDB() const {
+        return fDirtyDB;
+    }
+
+    void SetDirtyDB(bool fDirtyIn) {
+        fDirtyDB = fDirtyIn;
+    }
+
     CGovernanceObjectVoteFile& GetVoteFile() {
         return fileVotes;
     }
@@ -304,8 +315,9 @@ public:
 
     ADD_SERIALIZE_METHODS;
 
+    // The cache database leaves out the vote file, it stores every vote as a record of its own
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion, bool fVoteFile = true)
     {
         // SERIALIZE DATA FOR SAVING/LOADING OR NETWORK FUNCTIONS
 
@@ -323,7 +335,9 @@ public:
             READWRITE(nDeletionTime);
             READWRITE(fExpired);
             READWRITE(mapCurrentMNVotes);
-            READWRITE(fileVotes);
+            if(fVoteFile) {
+                READWRITE(fileVotes);
+            }
             LogPrint("gobject", "CGovernanceObject::SerializationOp hash = %s, vote count = %d\n", GetHash().ToString(), fileVotes.GetVoteCount());
         }
 
@@ -344,7 +358,8 @@ private:
     bool ProcessVote(CNode* pfrom,
                      const CGovernanceVote& vote,
                      CGovernanceException& exception,
-                     CConnman& connman);
+                     CConnman& connman,
+                     bool fSignatureVerified = false);
 
     /// Called when MN's which have voted on this object have been removed
     void ClearMasternodeVotes();
@@ -353,5 +368,27 @@ private:
 
 };
 
+/** A governance object as stored in the cache database, without its votes */
+class CGovernanceObjectCacheRecord
+{
+private:
+    CGovernanceObject& govobj;
+
+public:
+    explicit CGovernanceObjectCacheRecord(const CGovernanceObject& govobjIn) : govobj(REF(govobjIn)) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        govobj.SerializationOp(s, ser_action, nType, nVersion, false);
+    }
+};
+
+inline CGovernanceObjectCacheRecord CacheDBRecord(const CGovernanceObject& govobj)
+{
+    return CGovernanceObjectCacheRecord(govobj);
+}
 
 #endif
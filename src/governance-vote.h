@@ -121,6 +121,10 @@ public:
 
     void SetSignature(const std::vector<unsigned char>& vchSigIn) { vchSig = vchSigIn; }
 
+    const std::vector<unsigned char>& GetSignature() const { return vchSig; }
+
+    /// The string this vote's signature is made over
+    std::string GetSignatureMessage() const;
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool IsValid(bool fSignatureCheck) const;
     void Relay(CConnman& connman) const;
@@ -7,13 +7,15 @@
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile()
     : nMemoryVotes(0),
       listVotes(),
-      mapVoteIndex()
+      mapVoteIndex(),
+      setDirtyVotes()
 {}
 
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other)
     : nMemoryVotes(other.nMemoryVotes),
       listVotes(other.listVotes),
-      mapVoteIndex()
+      mapVoteIndex(),
+      setDirtyVotes(other.setDirtyVotes)
 {
     RebuildIndex();
 }
@@ -23,6 +25,7 @@ void CGovernanceObjectVoteFile::AddVote(const CGovernanceVote& vote)
     listVotes.push_front(vote);
     mapVoteIndex[vote.GetHash()] = listVotes.begin();
     ++nMemoryVotes;
+    setDirtyVotes.insert(vote.GetHash());
 }
 
 bool CGovernanceObjectVoteFile::HasVote(const uint256& nHash) const
@@ -60,6 +63,7 @@ void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const COutPoint& outpo
         if(it->GetMasternodeOutpoint() == outpointMasternode) {
             --nMemoryVotes;
             mapVoteIndex.erase(it->GetHash());
+            setDirtyVotes.insert(it->GetHash());
             listVotes.erase(it++);
         }
         else {
@@ -72,6 +76,7 @@ CGovernanceObjectVoteFile& CGovernanceObjectVoteFile::operator=(const CGovernanc
 {
     nMemoryVotes = other.nMemoryVotes;
     listVotes = other.listVotes;
+    setDirtyVotes = other.setDirtyVotes;
     RebuildIndex();
     return *this;
 }
@@ -7,6 +7,7 @@
 
 #include <list>
 #include <map>
+#include <set>
 
 #include "governance-vote.h"
 #include "serialize.h"
@@ -44,6 +45,9 @@ private:
 
     vote_m_t mapVoteIndex;
 
+    /// Hashes of the votes added or removed since the file was last written to the cache database
+    std::set<uint256> setDirtyVotes;
+
 public:
     CGovernanceObjectVoteFile();
 
@@ -74,6 +78,10 @@ public:
 
     void RemoveVotesFromMasternode(const COutPoint& outpointMasternode);
 
+    std::set<uint256>& GetDirtyVotes() {
+        return setDirtyVotes;
+    }
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -6,6 +6,7 @@
 #include "governance-object.h"
 #include "governance-vote.h"
 #include "governance-classes.h"
+#include "cachedb.h"
 #include "net_processing.h"
 #include "masternode.h"
 #include "masternode-sync.h"
@@ -13,12 +14,13 @@
 #include "messagesigner.h"
 #include "netfulfilledman.h"
 #include "util.h"
+#include "votequeue.h"
 
 CGovernanceManager governance;
 
 int nSubmittedFinalBudget;
 
-const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-12";
+const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-13";
 const int CGovernanceManager::MAX_TIME_FUTURE_DEVIATION = 60*60;
 const int CGovernanceManager::RELIABLE_PROPAGATION_TIME = 60;
 
@@ -255,21 +257,26 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
             return;
         }
 
-        CGovernanceException exception;
-        if(ProcessVote(pfrom, vote, exception, connman)) {
-            LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- %s new\n", strHash);
-            masternodeSync.BumpAssetLastTime("MNGOVERNANCEOBJECTVOTE");
-            vote.Relay(connman);
-        }
-        else {
-            LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- Rejected vote, error = %s\n", exception.what());
-            if((exception.GetNodePenalty() != 0) && masternodeSync.IsSynced()) {
-                Misbehaving(pfrom->GetId(), exception.GetNodePenalty());
-            }
-            return;
-        }
+        // the signature is checked in parallel with other votes, see CVoteVerifyQueue
+        votequeue.AddGovernanceVote(pfrom->GetId(), vote);
+    }
+}
+
+int CGovernanceManager::ProcessVerifiedVote(CNode* pfrom, const CGovernanceVote& vote, bool fSignatureVerified, CConnman& connman)
+{
+    std::string strHash = vote.GetHash().ToString();
 
+    CGovernanceException exception;
+    if(ProcessVote(pfrom, vote, exception, connman, fSignatureVerified)) {
+        LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- %s new\n", strHash);
+        masternodeSync.BumpAssetLastTime("MNGOVERNANCEOBJECTVOTE");
+        vote.Relay(connman);
+        return 0;
     }
+
+    LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- Rejected vote, error = %s\n", exception.what());
+    if(!masternodeSync.IsSynced()) return 0;
+    return exception.GetNodePenalty();
 }
 
 void CGovernanceManager::CheckOrphanVotes(CGovernanceObject& govobj, CGovernanceException& exception, CConnman& connman)
@@ -294,7 +301,7 @@ void CGovernanceManager::CheckOrphanVotes(CGovernanceObject& govobj, CGovernance
             fRemove = true;
         }
         if(fRemove) {
-            mapOrphanVotes.Erase(nHash, pairVote);
+            EraseOrphanVote(nHash, pairVote);
         }
     }
 }
@@ -367,6 +374,7 @@ void CGovernanceManager::AddGovernanceObject(CGovernanceObject& govobj, CConnman
         break;
     case GOVERNANCE_OBJECT_WATCHDOG:
         mapWatchdogObjects[nHash] = govobj.GetCreationTime() + GOVERNANCE_WATCHDOG_EXPIRATION_TIME;
+        setDirtyWatchdogObjects.insert(nHash);
         LogPrint("gobject", "CGovernanceManager::AddGovernanceObject -- Added watchdog to map: hash = %s\n", nHash.ToString());
         break;
     default:
@@ -412,6 +420,7 @@ bool CGovernanceManager::UpdateCurrentWatchdog(CGovernanceObject& watchdogNew)
             if(it->second.nDeletionTime == 0) {
                 it->second.nDeletionTime = nNow;
             }
+            it->second.fDirtyDB = true;
         }
         nHashWatchdogCurrent = watchdogNew.GetHash();
         nTimeWatchdogCurrent = watchdogNew.GetCreationTime();
@@ -447,10 +456,12 @@ void CGovernanceManager::UpdateCachesAndClean()
                     if(it2->second.nDeletionTime == 0) {
                         it2->second.nDeletionTime = nNow;
                     }
+                    it2->second.fDirtyDB = true;
                 }
                 if(it->first == nHashWatchdogCurrent) {
                     nHashWatchdogCurrent = uint256();
                 }
+                setDirtyWatchdogObjects.insert(it->first);
                 mapWatchdogObjects.erase(it++);
             }
             else {
@@ -533,12 +544,22 @@ void CGovernanceManager::UpdateCachesAndClean()
 
             if(pObj->GetObjectType() == GOVERNANCE_OBJECT_WATCHDOG) {
                 mapWatchdogObjects.erase(nHash);
+                setDirtyWatchdogObjects.insert(nHash);
             } else if(pObj->GetObjectType() != GOVERNANCE_OBJECT_TRIGGER) {
                 // keep hashes of deleted proposals forever
                 nTimeExpired = std::numeric_limits<int64_t>::max();
             }
 
             mapErasedGovernanceObjects.insert(std::make_pair(nHash, nTimeExpired));
+            setDirtyErasedGovernanceObjects.insert(nHash);
+            setErasedObjectsDB.insert(nHash);
+            // the votes go with the object, including the ones removed since the last flush
+            CGovernanceObjectVoteFile& fileVotes = pObj->GetVoteFile();
+            setErasedObjectVotesDB.insert(fileVotes.GetDirtyVotes().begin(), fileVotes.GetDirtyVotes().end());
+            std::vector<CGovernanceVote> vecVotes = fileVotes.GetVotes();
+            for(size_t i = 0; i < vecVotes.size(); ++i) {
+                setErasedObjectVotesDB.insert(vecVotes[i].GetHash());
+            }
             mapObjects.erase(it++);
         } else {
             ++it;
@@ -548,9 +569,10 @@ void CGovernanceManager::UpdateCachesAndClean()
     // forget about expired deleted objects
     hash_time_m_it s_it = mapErasedGovernanceObjects.begin();
     while(s_it != mapErasedGovernanceObjects.end()) {
-        if(s_it->second < nNow)
+        if(s_it->second < nNow) {
+            setDirtyErasedGovernanceObjects.insert(s_it->first);
             mapErasedGovernanceObjects.erase(s_it++);
-        else
+        } else
             ++s_it;
     }
 
@@ -825,6 +847,7 @@ void CGovernanceManager::MasternodeRateUpdate(const CGovernanceObject& govobj)
 
     if(it == mapLastMasternodeObject.end())
         it = mapLastMasternodeObject.insert(txout_m_t::value_type(vin.prevout, last_object_rec(true))).first;
+    setDirtyLastMasternodeObject.insert(vin.prevout);
 
     int64_t nTimestamp = govobj.GetCreationTime();
     if (GOVERNANCE_OBJECT_TRIGGER == nObjectType)
@@ -920,14 +943,45 @@ bool CGovernanceManager::MasternodeRateCheck(const CGovernanceObject& govobj, bo
         LogPrintf("CGovernanceManager::MasternodeRateCheck -- Rate too high: object hash = %s, masternode vin = %s, object timestamp = %d, rate = %f, max rate = %f\n",
                   strHash, vin.prevout.ToStringShort(), nTimestamp, dRate, dMaxRate);
 
-        if (fUpdateFailStatus)
+        if (fUpdateFailStatus) {
             it->second.fStatusOK = false;
+            setDirtyLastMasternodeObject.insert(vin.prevout);
+        }
     }
 
     return fRateOK;
 }
 
-bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote, CGovernanceException& exception, CConnman& connman)
+void CGovernanceManager::AddInvalidVote(const CGovernanceVote& vote)
+{
+    uint256 nHash = vote.GetHash();
+    // a full cache makes room by dropping its oldest vote
+    if(!mapInvalidVotes.HasKey(nHash) && mapInvalidVotes.GetSize() > 0 && mapInvalidVotes.GetSize() == mapInvalidVotes.GetMaxSize()) {
+        setDirtyInvalidVotes.insert(mapInvalidVotes.GetItemList().back().key);
+    }
+    mapInvalidVotes.Insert(nHash, vote);
+    setDirtyInvalidVotes.insert(nHash);
+}
+
+bool CGovernanceManager::InsertOrphanVote(const uint256& nHash, const vote_time_pair_t& pairVote)
+{
+    // a full cache makes room by dropping its oldest vote
+    if(mapOrphanVotes.GetSize() > 0 && mapOrphanVotes.GetSize() == mapOrphanVotes.GetMaxSize()) {
+        const vote_mcache_t::item_t& item = mapOrphanVotes.GetItemList().back();
+        setDirtyOrphanVotes.insert(std::make_pair(item.key, item.value.first.GetHash()));
+    }
+    if(!mapOrphanVotes.Insert(nHash, pairVote)) return false;
+    setDirtyOrphanVotes.insert(std::make_pair(nHash, pairVote.first.GetHash()));
+    return true;
+}
+
+void CGovernanceManager::EraseOrphanVote(const uint256& nHash, const vote_time_pair_t& pairVote)
+{
+    setDirtyOrphanVotes.insert(std::make_pair(nHash, pairVote.first.GetHash()));
+    mapOrphanVotes.Erase(nHash, pairVote);
+}
+
+bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote, CGovernanceException& exception, CConnman& connman, bool fSignatureVerified)
 {
     ENTER_CRITICAL_SECTION(cs);
     uint256 nHashVote = vote.GetHash();
@@ -950,7 +1004,7 @@ bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote,
              << ", MN outpoint = " << vote.GetMasternodeOutpoint().ToStringShort()
              << ", governance object hash = " << vote.GetParentHash().ToString();
         exception = CGovernanceException(ostr.str(), GOVERNANCE_EXCEPTION_WARNING);
-        if(mapOrphanVotes.Insert(nHashGovobj, vote_time_pair_t(vote, GetAdjustedTime() + GOVERNANCE_ORPHAN_EXPIRATION_TIME))) {
+        if(InsertOrphanVote(nHashGovobj, vote_time_pair_t(vote, GetAdjustedTime() + GOVERNANCE_ORPHAN_EXPIRATION_TIME))) {
             LEAVE_CRITICAL_SECTION(cs);
             RequestGovernanceObject(pfrom, nHashGovobj, connman);
             LogPrintf("%s\n", ostr.str());
@@ -970,7 +1024,7 @@ bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote,
         return false;
     }
 
-    bool fOk = govobj.ProcessVote(pfrom, vote, exception, connman);
+    bool fOk = govobj.ProcessVote(pfrom, vote, exception, connman, fSignatureVerified);
     if(fOk) {
         mapVoteToObject.Insert(nHashVote, &govobj);
 
@@ -1294,6 +1348,195 @@ void CGovernanceManager::AddCachedTriggers()
     }
 }
 
+void CGovernanceManager::WriteCacheDB(CCacheDB& db, CDBBatch& batch, bool fAll)
+{
+    LOCK(cs);
+    db.WriteRecord(batch, "govversion", SERIALIZATION_VERSION_STRING);
+    db.WriteRecord(batch, "govwatchdoghash", nHashWatchdogCurrent);
+    db.WriteRecord(batch, "govwatchdogtime", nTimeWatchdogCurrent);
+
+    if(fAll) {
+        // these used to be single records
+        db.EraseRecord(batch, "goverased");
+        db.EraseRecord(batch, "govinvalidvotes");
+        db.EraseRecord(batch, "govorphanvotes");
+        db.EraseRecord(batch, "govwatchdogs");
+        db.EraseRecord(batch, "govlastmnobject");
+
+        std::map<uint256, CGovernanceVote> mapVotes;
+        for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+            std::vector<CGovernanceVote> vecVotes = it->second.GetVoteFile().GetVotes();
+            for(size_t i = 0; i < vecVotes.size(); ++i) {
+                mapVotes.insert(std::make_pair(vecVotes[i].GetHash(), vecVotes[i]));
+            }
+            it->second.GetVoteFile().GetDirtyVotes().clear();
+            it->second.SetDirtyDB(false);
+        }
+        std::map<uint256, CGovernanceVote> mapInvalidVotesDB;
+        const vote_cache_t::list_t& listInvalidVotes = mapInvalidVotes.GetItemList();
+        for(vote_cache_t::list_cit it = listInvalidVotes.begin(); it != listInvalidVotes.end(); ++it) {
+            mapInvalidVotesDB.insert(std::make_pair(it->key, it->value));
+        }
+        std::map<std::pair<uint256, uint256>, vote_time_pair_t> mapOrphanVotesDB;
+        const vote_mcache_t::list_t& listOrphanVotes = mapOrphanVotes.GetItemList();
+        for(vote_mcache_t::list_cit it = listOrphanVotes.begin(); it != listOrphanVotes.end(); ++it) {
+            mapOrphanVotesDB.insert(std::make_pair(std::make_pair(it->key, it->value.first.GetHash()), it->value));
+        }
+
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_OBJECT, mapObjects);
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_VOTE, mapVotes);
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_ERASED, mapErasedGovernanceObjects);
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_WATCHDOG, mapWatchdogObjects);
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_LAST_MN_OBJECT, mapLastMasternodeObject);
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_INVALID_VOTE, mapInvalidVotesDB);
+        db.RewriteMap(batch, DB_CACHE_GOVERNANCE_ORPHAN_VOTE, mapOrphanVotesDB);
+
+        setErasedObjectsDB.clear();
+        setErasedObjectVotesDB.clear();
+        setDirtyErasedGovernanceObjects.clear();
+        setDirtyWatchdogObjects.clear();
+        setDirtyLastMasternodeObject.clear();
+        setDirtyInvalidVotes.clear();
+        setDirtyOrphanVotes.clear();
+        return;
+    }
+
+    // new and updated objects carry fDirtyDB, erased ones are in setErasedObjectsDB.
+    // Their votes are records of their own, the vote files know which of them changed.
+    std::set<uint256> setDirty;
+    setDirty.swap(setErasedObjectsDB);
+    std::set<uint256> setDirtyVotes;
+    setDirtyVotes.swap(setErasedObjectVotesDB);
+    std::map<uint256, CGovernanceVote> mapDirtyVotes;
+    for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+        if(it->second.IsSetDirtyDB()) {
+            setDirty.insert(it->first);
+            it->second.SetDirtyDB(false);
+        }
+        CGovernanceObjectVoteFile& fileVotes = it->second.GetVoteFile();
+        std::set<uint256>& setDirtyFile = fileVotes.GetDirtyVotes();
+        for(std::set<uint256>::const_iterator vit = setDirtyFile.begin(); vit != setDirtyFile.end(); ++vit) {
+            CGovernanceVote vote;
+            if(fileVotes.GetVote(*vit, vote)) {
+                mapDirtyVotes.insert(std::make_pair(*vit, vote));
+            }
+            setDirtyVotes.insert(*vit);
+        }
+        setDirtyFile.clear();
+    }
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_OBJECT, mapObjects, setDirty);
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_VOTE, mapDirtyVotes, setDirtyVotes);
+
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_ERASED, mapErasedGovernanceObjects, setDirtyErasedGovernanceObjects);
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_WATCHDOG, mapWatchdogObjects, setDirtyWatchdogObjects);
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_LAST_MN_OBJECT, mapLastMasternodeObject, setDirtyLastMasternodeObject);
+
+    std::map<uint256, CGovernanceVote> mapDirtyInvalidVotes;
+    for(std::set<uint256>::const_iterator it = setDirtyInvalidVotes.begin(); it != setDirtyInvalidVotes.end(); ++it) {
+        CGovernanceVote vote;
+        if(mapInvalidVotes.Get(*it, vote)) {
+            mapDirtyInvalidVotes.insert(std::make_pair(*it, vote));
+        }
+    }
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_INVALID_VOTE, mapDirtyInvalidVotes, setDirtyInvalidVotes);
+
+    std::map<std::pair<uint256, uint256>, vote_time_pair_t> mapDirtyOrphanVotes;
+    for(std::set<std::pair<uint256, uint256> >::const_iterator it = setDirtyOrphanVotes.begin(); it != setDirtyOrphanVotes.end(); ++it) {
+        std::vector<vote_time_pair_t> vecVotePairs;
+        mapOrphanVotes.GetAll(it->first, vecVotePairs);
+        for(size_t i = 0; i < vecVotePairs.size(); ++i) {
+            if(vecVotePairs[i].first.GetHash() == it->second) {
+                mapDirtyOrphanVotes.insert(std::make_pair(*it, vecVotePairs[i]));
+                break;
+            }
+        }
+    }
+    db.WriteMap(batch, DB_CACHE_GOVERNANCE_ORPHAN_VOTE, mapDirtyOrphanVotes, setDirtyOrphanVotes);
+}
+
+/** The caches only keep the order of insertion in memory, restore it as far as the times tell */
+struct sortVotesByTime {
+    bool operator()(const CGovernanceVote& left, const CGovernanceVote& right) const
+    {
+        return left.GetTimestamp() < right.GetTimestamp();
+    }
+
+    bool operator()(const std::pair<uint256, vote_time_pair_t>& left, const std::pair<uint256, vote_time_pair_t>& right) const
+    {
+        return left.second.second < right.second.second;
+    }
+};
+
+bool CGovernanceManager::ReadCacheDB(CCacheDB& db)
+{
+    LOCK(cs);
+    std::string strVersion;
+    if(!db.ReadRecord("govversion", strVersion)) return false;
+
+    if(strVersion != SERIALIZATION_VERSION_STRING) {
+        // stale entries are replaced on the next flush
+        LogPrintf("CGovernanceManager::ReadCacheDB -- cache version %s does not match %s, clearing\n", strVersion, SERIALIZATION_VERSION_STRING);
+        Clear();
+        db.RequestRewrite();
+        return true;
+    }
+
+    std::map<uint256, CGovernanceVote> mapVotes;
+    std::map<uint256, CGovernanceVote> mapInvalidVotesDB;
+    std::map<std::pair<uint256, uint256>, vote_time_pair_t> mapOrphanVotesDB;
+    if(!db.ReadRecord("govwatchdoghash", nHashWatchdogCurrent) ||
+        !db.ReadRecord("govwatchdogtime", nTimeWatchdogCurrent) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_OBJECT, mapObjects) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_VOTE, mapVotes) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_ERASED, mapErasedGovernanceObjects) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_WATCHDOG, mapWatchdogObjects) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_LAST_MN_OBJECT, mapLastMasternodeObject) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_INVALID_VOTE, mapInvalidVotesDB) ||
+        !db.ReadMap(DB_CACHE_GOVERNANCE_ORPHAN_VOTE, mapOrphanVotesDB)) {
+        Clear();
+        return false;
+    }
+
+    std::vector<CGovernanceVote> vecVotes;
+    vecVotes.reserve(mapVotes.size());
+    for(std::map<uint256, CGovernanceVote>::const_iterator it = mapVotes.begin(); it != mapVotes.end(); ++it) {
+        vecVotes.push_back(it->second);
+    }
+    std::sort(vecVotes.begin(), vecVotes.end(), sortVotesByTime());
+    for(size_t i = 0; i < vecVotes.size(); ++i) {
+        object_m_it it = mapObjects.find(vecVotes[i].GetParentHash());
+        if(it == mapObjects.end()) {
+            // left over from an object which is gone
+            setErasedObjectVotesDB.insert(vecVotes[i].GetHash());
+            continue;
+        }
+        it->second.GetVoteFile().AddVote(vecVotes[i]);
+    }
+    for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+        it->second.GetVoteFile().GetDirtyVotes().clear();
+        it->second.SetDirtyDB(false);
+    }
+
+    vecVotes.clear();
+    for(std::map<uint256, CGovernanceVote>::const_iterator it = mapInvalidVotesDB.begin(); it != mapInvalidVotesDB.end(); ++it) {
+        vecVotes.push_back(it->second);
+    }
+    std::sort(vecVotes.begin(), vecVotes.end(), sortVotesByTime());
+    for(size_t i = 0; i < vecVotes.size(); ++i) {
+        mapInvalidVotes.Insert(vecVotes[i].GetHash(), vecVotes[i]);
+    }
+
+    std::vector<std::pair<uint256, vote_time_pair_t> > vecOrphanVotes;
+    for(std::map<std::pair<uint256, uint256>, vote_time_pair_t>::const_iterator it = mapOrphanVotesDB.begin(); it != mapOrphanVotesDB.end(); ++it) {
+        vecOrphanVotes.push_back(std::make_pair(it->first.first, it->second));
+    }
+    std::sort(vecOrphanVotes.begin(), vecOrphanVotes.end(), sortVotesByTime());
+    for(size_t i = 0; i < vecOrphanVotes.size(); ++i) {
+        mapOrphanVotes.Insert(vecOrphanVotes[i].first, vecOrphanVotes[i].second);
+    }
+    return true;
+}
+
 void CGovernanceManager::InitOnLoad()
 {
     LOCK(cs);
@@ -1402,7 +1645,7 @@ void CGovernanceManager::CleanOrphanObjects()
         ++it;
         const vote_time_pair_t& pairVote = prevIt->value;
         if(pairVote.second < nNow) {
-            mapOrphanVotes.Erase(prevIt->key, prevIt->value);
+            EraseOrphanVote(prevIt->key, prevIt->value);
         }
     }
 }
@@ -19,6 +19,8 @@
 #include "timedata.h"
 #include "util.h"
 
+class CCacheDB;
+class CDBBatch;
 class CGovernanceManager;
 class CGovernanceTriggerManager;
 class CGovernanceObject;
@@ -259,6 +261,18 @@ private:
 
     txout_m_t mapLastMasternodeObject;
 
+    // objects erased from mapObjects since the last cache flush
+    std::set<uint256> setErasedObjectsDB;
+    // votes of those objects, the votes of the other objects are tracked by their vote files
+    std::set<uint256> setErasedObjectVotesDB;
+
+    // keys changed since the last cache flush, written if still present and erased otherwise
+    std::set<uint256> setDirtyErasedGovernanceObjects;
+    std::set<uint256> setDirtyWatchdogObjects;
+    std::set<COutPoint> setDirtyLastMasternodeObject;
+    std::set<uint256> setDirtyInvalidVotes;
+    std::set<std::pair<uint256, uint256> > setDirtyOrphanVotes; // mapOrphanVotes key - vote hash
+
     hash_s_t setRequestedObjects;
 
     hash_s_t setRequestedVotes;
@@ -303,6 +317,11 @@ public:
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, CConnman& connman);
 
+    /// Second half of MNGOVERNANCEOBJECTVOTE processing, run by the vote verification queue
+    /// once the signature was checked in parallel. pfrom is NULL if the peer is gone.
+    /// Returns the misbehavior score the peer earned, the caller applies it under cs_main.
+    int ProcessVerifiedVote(CNode* pfrom, const CGovernanceVote& vote, bool fSignatureVerified, CConnman& connman);
+
     void DoMaintenance(CConnman& connman);
 
     CGovernanceObject *FindGovernanceObject(const uint256& nHash);
@@ -334,10 +353,22 @@ public:
         mapInvalidVotes.Clear();
         mapOrphanVotes.Clear();
         mapLastMasternodeObject.clear();
+        setErasedObjectsDB.clear();
+        setErasedObjectVotesDB.clear();
+        setDirtyErasedGovernanceObjects.clear();
+        setDirtyWatchdogObjects.clear();
+        setDirtyLastMasternodeObject.clear();
+        setDirtyInvalidVotes.clear();
+        setDirtyOrphanVotes.clear();
     }
 
     std::string ToString() const;
 
+    /// Stage changes since the last flush for the cache database, only entries marked dirty are serialized unless fAll is set
+    void WriteCacheDB(CCacheDB& db, CDBBatch& batch, bool fAll);
+    /// Load from the cache database, returns false if there was nothing stored or it could not be read
+    bool ReadCacheDB(CCacheDB& db);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -426,17 +457,18 @@ public:
 private:
     void RequestGovernanceObject(CNode* pfrom, const uint256& nHash, CConnman& connman, bool fUseFilter = false);
 
-    void AddInvalidVote(const CGovernanceVote& vote)
-    {
-        mapInvalidVotes.Insert(vote.GetHash(), vote);
-    }
+    void AddInvalidVote(const CGovernanceVote& vote);
 
     void AddOrphanVote(const CGovernanceVote& vote)
     {
-        mapOrphanVotes.Insert(vote.GetHash(), vote_time_pair_t(vote, GetAdjustedTime() + GOVERNANCE_ORPHAN_EXPIRATION_TIME));
+        InsertOrphanVote(vote.GetHash(), vote_time_pair_t(vote, GetAdjustedTime() + GOVERNANCE_ORPHAN_EXPIRATION_TIME));
     }
 
-    bool ProcessVote(CNode* pfrom, const CGovernanceVote& vote, CGovernanceException& exception, CConnman& connman);
+    // mapOrphanVotes changes which are tracked for the cache database
+    bool InsertOrphanVote(const uint256& nHash, const vote_time_pair_t& pairVote);
+    void EraseOrphanVote(const uint256& nHash, const vote_time_pair_t& pairVote);
+
+    bool ProcessVote(CNode* pfrom, const CGovernanceVote& vote, CGovernanceException& exception, CConnman& connman, bool fSignatureVerified = false);
 
     /// Called to indicate a requested object has been received
     bool AcceptObjectMessage(const uint256& nHash);
@@ -316,35 +316,52 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
 /* ----------- Skunk Hash ------------------------------------------------ */
-template<typename T1>
-inline uint256 SkunkHash(const T1 pbegin, const T1 pend)
-
+/** Run the Fugue-512 and GOST-512 stages of the Skunk chain on a CubeHash-512 digest. */
+inline uint256 SkunkHashTail(const uint512& hashCubehash)
 {
-    sph_skein512_context     ctx_skein;
-    sph_cubehash512_context  ctx_cubehash;
     sph_fugue512_context     ctx_fugue;
     sph_gost512_context      ctx_gost;
-    static unsigned char     pblank[1];
 
-    uint512 hash[17];
+    uint512 hash[2];
 
-    sph_skein512_init(&ctx_skein);
-    sph_skein512 (&ctx_skein, (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]));
-    sph_skein512_close(&ctx_skein, static_cast<void*>(&hash[0]));
+    sph_fugue512_init(&ctx_fugue);
+    sph_fugue512 (&ctx_fugue, static_cast<const void*>(&hashCubehash), 64);
+    sph_fugue512_close(&ctx_fugue, static_cast<void*>(&hash[0]));
+
+    sph_gost512_init(&ctx_gost);
+    sph_gost512 (&ctx_gost, static_cast<const void*>(&hash[0]), 64);
+    sph_gost512_close(&ctx_gost, static_cast<void*>(&hash[1]));
+
+    return hash[1].trim256();
+}
+
+/** Finish the Skunk chain from a Skein-512 context that has absorbed the whole input. */
+inline uint256 SkunkHashFinish(sph_skein512_context* ctx_skein)
+{
+    sph_cubehash512_context  ctx_cubehash;
+
+    uint512 hash[2];
+
+    sph_skein512_close(ctx_skein, static_cast<void*>(&hash[0]));
 
     sph_cubehash512_init(&ctx_cubehash);
     sph_cubehash512 (&ctx_cubehash, static_cast<const void*>(&hash[0]), 64);
     sph_cubehash512_close(&ctx_cubehash, static_cast<void*>(&hash[1]));
 
-    sph_fugue512_init(&ctx_fugue);
-    sph_fugue512 (&ctx_fugue, static_cast<const void*>(&hash[1]), 64);
-    sph_fugue512_close(&ctx_fugue, static_cast<void*>(&hash[2]));
+    return SkunkHashTail(hash[1]);
+}
 
-    sph_gost512_init(&ctx_gost);
-    sph_gost512 (&ctx_gost, static_cast<const void*>(&hash[2]), 64);
-    sph_gost512_close(&ctx_gost, static_cast<void*>(&hash[3]));
+template<typename T1>
+inline uint256 SkunkHash(const T1 pbegin, const T1 pend)
+
+{
+    sph_skein512_context     ctx_skein;
+    static unsigned char     pblank[1];
+
+    sph_skein512_init(&ctx_skein);
+    sph_skein512 (&ctx_skein, (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]));
 
-    return hash[3].trim256();
+    return SkunkHashFinish(&ctx_skein);
 }
 
 #endif // BITCOIN_HASH_H
@@ -75,8 +75,7 @@ void CInstantSend::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
 #endif
         LOCK(cs_instantsend);
 
-        if(mapTxLockVotes.count(nVoteHash)) return;
-        mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+        if(!AddTxLockVote(vote)) return;
 
         ProcessTxLockVote(pfrom, vote, connman);
 
@@ -266,7 +265,7 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate, CConnman& connman)
 
         // vote constructed sucessfully, let's store and relay it
         uint256 nVoteHash = vote.GetHash();
-        mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+        AddTxLockVote(vote);
         if(itOutpointLock->second.AddVote(vote)) {
             LogPrintf("CInstantSend::Vote -- Vote created successfully, relaying: txHash=%s, outpoint=%s, vote=%s\n",
                     txHash.ToString(), itOutpointLock->first.ToStringShort(), nVoteHash.ToString());
@@ -321,7 +320,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
         if(!mapTxLockVotesOrphan.count(vote.GetHash())) {
             // start timeout countdown after the very first vote
             CreateEmptyTxLockCandidate(txHash);
-            mapTxLockVotesOrphan[vote.GetHash()] = vote;
+            AddTxLockVoteOrphan(vote);
             LogPrint("instantsend", "CInstantSend::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s new\n",
                     txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
             bool fReprocess = true;
@@ -350,7 +349,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
 
         int nMasternodeOrphanExpireTime = GetTime() + 60*10; // keep time data for 10 minutes
         if(!mapMasternodeOrphanVotes.count(vote.GetMasternodeOutpoint())) {
-            mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
+            SetMasternodeOrphanVoteTime(vote.GetMasternodeOutpoint(), nMasternodeOrphanExpireTime);
         } else {
             int64_t nPrevOrphanVote = mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()];
             if(nPrevOrphanVote > GetTime() && nPrevOrphanVote > GetAverageMasternodeOrphanVoteTime()) {
@@ -360,7 +359,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
                 return false;
             }
             // not spamming, refresh
-            mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
+            SetMasternodeOrphanVoteTime(vote.GetMasternodeOutpoint(), nMasternodeOrphanExpireTime);
         }
 
         return true;
@@ -434,7 +433,7 @@ void CInstantSend::ProcessOrphanTxLockVotes(CConnman& connman)
     std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin();
     while(it != mapTxLockVotesOrphan.end()) {
         if(ProcessTxLockVote(NULL, it->second, connman)) {
-            mapTxLockVotesOrphan.erase(it++);
+            EraseTxLockVoteOrphan(it++);
         } else {
             ++it;
         }
@@ -458,16 +457,18 @@ bool CInstantSend::IsEnoughOrphanVotesForTxAndOutPoint(const uint256& txHash, co
 {
     // Scan orphan votes to check if this outpoint has enough orphan votes to be locked in some tx.
     LOCK2(cs_main, cs_instantsend);
+    std::map<uint256, std::set<uint256> >::iterator itHashes = mapTxLockVoteOrphanHashes.find(txHash);
+    if(itHashes == mapTxLockVoteOrphanHashes.end()) return false;
+
     int nCountVotes = 0;
-    std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin();
-    while(it != mapTxLockVotesOrphan.end()) {
-        if(it->second.GetTxHash() == txHash && it->second.GetOutpoint() == outpoint) {
+    BOOST_FOREACH(const uint256& nVoteHash, itHashes->second) {
+        std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.find(nVoteHash);
+        if(it != mapTxLockVotesOrphan.end() && it->second.GetOutpoint() == outpoint) {
             nCountVotes++;
             if(nCountVotes >= COutPointLock::SIGNATURES_REQUIRED) {
                 return true;
             }
         }
-        ++it;
     }
     return false;
 }
@@ -581,8 +582,8 @@ bool CInstantSend::ResolveConflicts(const CTxLockCandidate& txLockCandidate)
                     txHash.ToString(), hashConflicting.ToString());
             CTxLockRequest txLockRequest = itLockCandidate->second.txLockRequest;
             CTxLockRequest txLockRequestConflicting = itLockCandidateConflicting->second.txLockRequest;
-            itLockCandidate->second.SetConfirmedHeight(0); // expired
-            itLockCandidateConflicting->second.SetConfirmedHeight(0); // expired
+            SetTxLockCandidateConfirmedHeight(itLockCandidate, 0); // expired
+            SetTxLockCandidateConfirmedHeight(itLockCandidateConflicting, 0); // expired
             CheckAndRemove(); // clean up
             // AlreadyHave should still return "true" for both of them
             mapLockRequestRejected.insert(make_pair(txHash, txLockRequest));
@@ -651,79 +652,303 @@ void CInstantSend::CheckAndRemove()
 
     LOCK(cs_instantsend);
 
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.begin();
-
-    // remove expired candidates
-    while(itLockCandidate != mapTxLockCandidates.end()) {
-        CTxLockCandidate &txLockCandidate = itLockCandidate->second;
-        uint256 txHash = txLockCandidate.GetHash();
-        if(txLockCandidate.IsExpired(nCachedBlockHeight)) {
-            LogPrintf("CInstantSend::CheckAndRemove -- Removing expired Transaction Lock Candidate: txid=%s\n", txHash.ToString());
-            std::map<COutPoint, COutPointLock>::iterator itOutpointLock = txLockCandidate.mapOutPointLocks.begin();
-            while(itOutpointLock != txLockCandidate.mapOutPointLocks.end()) {
-                mapLockedOutpoints.erase(itOutpointLock->first);
-                mapVotedOutpoints.erase(itOutpointLock->first);
-                ++itOutpointLock;
+    // remove expired candidates, the queue is ordered by confirmed height so stop at the first one which isn't
+    while(!setTxLockCandidatesByHeight.empty()) {
+        uint256 txHash = setTxLockCandidatesByHeight.begin()->second;
+        std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+        if(itLockCandidate == mapTxLockCandidates.end()) {
+            // shouldn't happen
+            setTxLockCandidatesByHeight.erase(setTxLockCandidatesByHeight.begin());
+            continue;
+        }
+        if(!itLockCandidate->second.IsExpired(nCachedBlockHeight)) break;
+        LogPrintf("CInstantSend::CheckAndRemove -- Removing expired Transaction Lock Candidate: txid=%s\n", txHash.ToString());
+        EraseTxLockCandidate(itLockCandidate);
+
+        // the lock is gone, so older votes for it are votes for a failed lock attempt now
+        std::map<uint256, std::set<uint256> >::iterator itHashes = mapTxLockVoteHashes.find(txHash);
+        if(itHashes == mapTxLockVoteHashes.end()) continue;
+        std::set<uint256> setVoteHashes = itHashes->second;
+        BOOST_FOREACH(const uint256& nVoteHash, setVoteHashes) {
+            std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(nVoteHash);
+            if(itVote != mapTxLockVotes.end() && itVote->second.IsFailed()) {
+                LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing vote for failed lock attempt: txid=%s  masternode=%s\n",
+                        itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
+                EraseTxLockVote(itVote);
             }
-            mapLockRequestAccepted.erase(txHash);
-            mapLockRequestRejected.erase(txHash);
-            mapTxLockCandidates.erase(itLockCandidate++);
-        } else {
-            ++itLockCandidate;
         }
     }
 
     // remove expired votes
-    std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.begin();
-    while(itVote != mapTxLockVotes.end()) {
-        if(itVote->second.IsExpired(nCachedBlockHeight)) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired vote: txid=%s  masternode=%s\n",
-                    itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itVote++);
-        } else {
-            ++itVote;
+    while(!setTxLockVotesByHeight.empty()) {
+        std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(setTxLockVotesByHeight.begin()->second);
+        if(itVote == mapTxLockVotes.end()) {
+            // shouldn't happen
+            setTxLockVotesByHeight.erase(setTxLockVotesByHeight.begin());
+            continue;
         }
+        if(!itVote->second.IsExpired(nCachedBlockHeight)) break;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired vote: txid=%s  masternode=%s\n",
+                itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
+        EraseTxLockVote(itVote);
     }
 
     // remove timed out orphan votes
-    std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(itOrphanVote->second.IsTimedOut()) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing timed out orphan vote: txid=%s  masternode=%s\n",
-                    itOrphanVote->second.GetTxHash().ToString(), itOrphanVote->second.GetMasternodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itOrphanVote->first);
-            mapTxLockVotesOrphan.erase(itOrphanVote++);
-        } else {
-            ++itOrphanVote;
+    while(!setTxLockVotesOrphanByTime.empty()) {
+        std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.find(setTxLockVotesOrphanByTime.begin()->second);
+        if(itOrphanVote == mapTxLockVotesOrphan.end()) {
+            // shouldn't happen
+            setTxLockVotesOrphanByTime.erase(setTxLockVotesOrphanByTime.begin());
+            continue;
+        }
+        if(!itOrphanVote->second.IsTimedOut()) break;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing timed out orphan vote: txid=%s  masternode=%s\n",
+                itOrphanVote->second.GetTxHash().ToString(), itOrphanVote->second.GetMasternodeOutpoint().ToStringShort());
+        std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(itOrphanVote->first);
+        if(itVote != mapTxLockVotes.end()) {
+            EraseTxLockVote(itVote);
         }
+        EraseTxLockVoteOrphan(itOrphanVote);
     }
 
-    // remove invalid votes and votes for failed lock attempts
-    itVote = mapTxLockVotes.begin();
-    while(itVote != mapTxLockVotes.end()) {
-        if(itVote->second.IsFailed()) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing vote for failed lock attempt: txid=%s  masternode=%s\n",
-                    itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itVote++);
-        } else {
-            ++itVote;
-        }
+    // remove invalid votes and votes for failed lock attempts, each vote is looked at once it's old enough
+    // (votes of locks which are removed later are handled together with their candidate above)
+    while(!setTxLockVotesByTime.empty() && GetTime() - setTxLockVotesByTime.begin()->first > INSTANTSEND_FAILED_TIMEOUT_SECONDS) {
+        std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(setTxLockVotesByTime.begin()->second);
+        setTxLockVotesByTime.erase(setTxLockVotesByTime.begin());
+        if(itVote == mapTxLockVotes.end() || !itVote->second.IsFailed()) continue;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing vote for failed lock attempt: txid=%s  masternode=%s\n",
+                itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
+        EraseTxLockVote(itVote);
     }
 
     // remove timed out masternode orphan votes (DOS protection)
-    std::map<COutPoint, int64_t>::iterator itMasternodeOrphan = mapMasternodeOrphanVotes.begin();
-    while(itMasternodeOrphan != mapMasternodeOrphanVotes.end()) {
-        if(itMasternodeOrphan->second < GetTime()) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing timed out orphan masternode vote: masternode=%s\n",
-                    itMasternodeOrphan->first.ToStringShort());
-            mapMasternodeOrphanVotes.erase(itMasternodeOrphan++);
-        } else {
-            ++itMasternodeOrphan;
-        }
+    while(!setMasternodeOrphanVotesByTime.empty() && setMasternodeOrphanVotesByTime.begin()->first < GetTime()) {
+        COutPoint outpointMasternode = setMasternodeOrphanVotesByTime.begin()->second;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing timed out orphan masternode vote: masternode=%s\n",
+                outpointMasternode.ToStringShort());
+        setMasternodeOrphanVotesByTime.erase(setMasternodeOrphanVotesByTime.begin());
+        mapMasternodeOrphanVotes.erase(outpointMasternode);
     }
     LogPrintf("CInstantSend::CheckAndRemove -- %s\n", ToString());
 }
 
+bool CInstantSend::AddTxLockVote(const CTxLockVote& vote)
+{
+    AssertLockHeld(cs_instantsend);
+    uint256 nVoteHash = vote.GetHash();
+    std::pair<std::map<uint256, CTxLockVote>::iterator, bool> ret = mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+    if(!ret.second) return false;
+    const CTxLockVote& voteNew = ret.first->second;
+    mapTxLockVoteHashes[voteNew.GetTxHash()].insert(nVoteHash);
+    setTxLockVotesByTime.insert(std::make_pair(voteNew.GetTimeCreated(), nVoteHash));
+    if(voteNew.GetConfirmedHeight() != -1) {
+        setTxLockVotesByHeight.insert(std::make_pair(voteNew.GetConfirmedHeight(), nVoteHash));
+    }
+    return true;
+}
+
+void CInstantSend::EraseTxLockVote(std::map<uint256, CTxLockVote>::iterator it)
+{
+    AssertLockHeld(cs_instantsend);
+    const CTxLockVote& vote = it->second;
+    std::map<uint256, std::set<uint256> >::iterator itHashes = mapTxLockVoteHashes.find(vote.GetTxHash());
+    if(itHashes != mapTxLockVoteHashes.end()) {
+        itHashes->second.erase(it->first);
+        if(itHashes->second.empty()) mapTxLockVoteHashes.erase(itHashes);
+    }
+    setTxLockVotesByTime.erase(std::make_pair(vote.GetTimeCreated(), it->first));
+    setTxLockVotesByHeight.erase(std::make_pair(vote.GetConfirmedHeight(), it->first));
+    mapTxLockVotes.erase(it);
+}
+
+void CInstantSend::SetTxLockVoteConfirmedHeight(std::map<uint256, CTxLockVote>::iterator it, int nConfirmedHeight)
+{
+    AssertLockHeld(cs_instantsend);
+    setTxLockVotesByHeight.erase(std::make_pair(it->second.GetConfirmedHeight(), it->first));
+    it->second.SetConfirmedHeight(nConfirmedHeight);
+    if(nConfirmedHeight != -1) {
+        setTxLockVotesByHeight.insert(std::make_pair(nConfirmedHeight, it->first));
+    }
+}
+
+void CInstantSend::AddTxLockVoteOrphan(const CTxLockVote& vote)
+{
+    AssertLockHeld(cs_instantsend);
+    uint256 nVoteHash = vote.GetHash();
+    if(!mapTxLockVotesOrphan.insert(std::make_pair(nVoteHash, vote)).second) return;
+    mapTxLockVoteOrphanHashes[vote.GetTxHash()].insert(nVoteHash);
+    setTxLockVotesOrphanByTime.insert(std::make_pair(vote.GetTimeCreated(), nVoteHash));
+}
+
+void CInstantSend::EraseTxLockVoteOrphan(std::map<uint256, CTxLockVote>::iterator it)
+{
+    AssertLockHeld(cs_instantsend);
+    const CTxLockVote& vote = it->second;
+    std::map<uint256, std::set<uint256> >::iterator itHashes = mapTxLockVoteOrphanHashes.find(vote.GetTxHash());
+    if(itHashes != mapTxLockVoteOrphanHashes.end()) {
+        itHashes->second.erase(it->first);
+        if(itHashes->second.empty()) mapTxLockVoteOrphanHashes.erase(itHashes);
+    }
+    setTxLockVotesOrphanByTime.erase(std::make_pair(vote.GetTimeCreated(), it->first));
+    mapTxLockVotesOrphan.erase(it);
+}
+
+void CInstantSend::EraseTxLockCandidate(std::map<uint256, CTxLockCandidate>::iterator it)
+{
+    AssertLockHeld(cs_instantsend);
+    const uint256& txHash = it->first;
+    std::map<COutPoint, COutPointLock>::iterator itOutpointLock = it->second.mapOutPointLocks.begin();
+    while(itOutpointLock != it->second.mapOutPointLocks.end()) {
+        mapLockedOutpoints.erase(itOutpointLock->first);
+        mapVotedOutpoints.erase(itOutpointLock->first);
+        ++itOutpointLock;
+    }
+    mapLockRequestAccepted.erase(txHash);
+    mapLockRequestRejected.erase(txHash);
+    setTxLockCandidatesByHeight.erase(std::make_pair(it->second.GetConfirmedHeight(), txHash));
+    mapTxLockCandidates.erase(it);
+}
+
+void CInstantSend::SetTxLockCandidateConfirmedHeight(std::map<uint256, CTxLockCandidate>::iterator it, int nConfirmedHeight)
+{
+    AssertLockHeld(cs_instantsend);
+    setTxLockCandidatesByHeight.erase(std::make_pair(it->second.GetConfirmedHeight(), it->first));
+    it->second.SetConfirmedHeight(nConfirmedHeight);
+    if(nConfirmedHeight != -1) {
+        setTxLockCandidatesByHeight.insert(std::make_pair(nConfirmedHeight, it->first));
+    }
+}
+
+void CInstantSend::SetMasternodeOrphanVoteTime(const COutPoint& outpointMasternode, int64_t nTime)
+{
+    AssertLockHeld(cs_instantsend);
+    std::map<COutPoint, int64_t>::iterator it = mapMasternodeOrphanVotes.find(outpointMasternode);
+    if(it != mapMasternodeOrphanVotes.end()) {
+        setMasternodeOrphanVotesByTime.erase(std::make_pair(it->second, outpointMasternode));
+        it->second = nTime;
+    } else {
+        mapMasternodeOrphanVotes.insert(std::make_pair(outpointMasternode, nTime));
+    }
+    setMasternodeOrphanVotesByTime.insert(std::make_pair(nTime, outpointMasternode));
+}
+
+void CInstantSend::RebuildIndexes()
+{
+    AssertLockHeld(cs_instantsend);
+
+    mapTxLockVoteHashes.clear();
+    mapTxLockVoteOrphanHashes.clear();
+    setTxLockCandidatesByHeight.clear();
+    setTxLockVotesByHeight.clear();
+    setTxLockVotesByTime.clear();
+    setTxLockVotesOrphanByTime.clear();
+    setMasternodeOrphanVotesByTime.clear();
+
+    for(std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotes.begin(); it != mapTxLockVotes.end(); ++it) {
+        mapTxLockVoteHashes[it->second.GetTxHash()].insert(it->first);
+        setTxLockVotesByTime.insert(std::make_pair(it->second.GetTimeCreated(), it->first));
+        if(it->second.GetConfirmedHeight() != -1) {
+            setTxLockVotesByHeight.insert(std::make_pair(it->second.GetConfirmedHeight(), it->first));
+        }
+    }
+    for(std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin(); it != mapTxLockVotesOrphan.end(); ++it) {
+        mapTxLockVoteOrphanHashes[it->second.GetTxHash()].insert(it->first);
+        setTxLockVotesOrphanByTime.insert(std::make_pair(it->second.GetTimeCreated(), it->first));
+    }
+    for(std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.begin(); it != mapTxLockCandidates.end(); ++it) {
+        if(it->second.GetConfirmedHeight() != -1) {
+            setTxLockCandidatesByHeight.insert(std::make_pair(it->second.GetConfirmedHeight(), it->first));
+        }
+    }
+    for(std::map<COutPoint, int64_t>::iterator it = mapMasternodeOrphanVotes.begin(); it != mapMasternodeOrphanVotes.end(); ++it) {
+        setMasternodeOrphanVotesByTime.insert(std::make_pair(it->second, it->first));
+    }
+}
+
+void CInstantSend::Merge(CInstantSend& instantsendIn)
+{
+    LOCK2(cs_instantsend, instantsendIn.cs_instantsend);
+
+    // std::map::insert keeps entries which are already present, those are at least as recent
+    mapLockRequestAccepted.insert(instantsendIn.mapLockRequestAccepted.begin(), instantsendIn.mapLockRequestAccepted.end());
+    mapLockRequestRejected.insert(instantsendIn.mapLockRequestRejected.begin(), instantsendIn.mapLockRequestRejected.end());
+    mapTxLockVotes.insert(instantsendIn.mapTxLockVotes.begin(), instantsendIn.mapTxLockVotes.end());
+    mapTxLockVotesOrphan.insert(instantsendIn.mapTxLockVotesOrphan.begin(), instantsendIn.mapTxLockVotesOrphan.end());
+    mapTxLockCandidates.insert(instantsendIn.mapTxLockCandidates.begin(), instantsendIn.mapTxLockCandidates.end());
+    for(std::map<COutPoint, std::set<uint256> >::const_iterator it = instantsendIn.mapVotedOutpoints.begin(); it != instantsendIn.mapVotedOutpoints.end(); ++it) {
+        mapVotedOutpoints[it->first].insert(it->second.begin(), it->second.end());
+    }
+    mapLockedOutpoints.insert(instantsendIn.mapLockedOutpoints.begin(), instantsendIn.mapLockedOutpoints.end());
+    mapMasternodeOrphanVotes.insert(instantsendIn.mapMasternodeOrphanVotes.begin(), instantsendIn.mapMasternodeOrphanVotes.end());
+
+    RebuildIndexes();
+}
+
+void CInstantSend::UpdateConfirmedHeights()
+{
+    LOCK2(cs_main, cs_instantsend);
+
+    // tx hash - inputs we know of, for every lock candidate and vote still waiting for its tx
+    std::map<uint256, std::vector<COutPoint> > mapUnconfirmed;
+    for(std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.begin(); it != mapTxLockCandidates.end(); ++it) {
+        if(it->second.GetConfirmedHeight() != -1) continue;
+        std::vector<COutPoint>& vecInputs = mapUnconfirmed[it->first];
+        BOOST_FOREACH(const CTxIn& txin, it->second.txLockRequest.vin) {
+            vecInputs.push_back(txin.prevout);
+        }
+    }
+    for(std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotes.begin(); it != mapTxLockVotes.end(); ++it) {
+        if(it->second.GetConfirmedHeight() != -1) continue;
+        mapUnconfirmed[it->second.GetTxHash()].push_back(it->second.GetOutpoint());
+    }
+
+    for(std::map<uint256, std::vector<COutPoint> >::iterator it = mapUnconfirmed.begin(); it != mapUnconfirmed.end(); ++it) {
+        const uint256& txHash = it->first;
+
+        // As long as its inputs are unspent the tx is neither mined nor conflicted
+        bool fInputSpent = false;
+        BOOST_FOREACH(const COutPoint& outpoint, it->second) {
+            if(!pcoinsTip->HaveCoin(outpoint)) {
+                fInputSpent = true;
+                break;
+            }
+        }
+        if(!fInputSpent) continue;
+
+        // Use the height of the block when we can find it, otherwise keep the entry from now on
+        int nHeightNew = chainActive.Height();
+        const Coin& coin = AccessByTxid(*pcoinsTip, txHash);
+        if(!coin.IsSpent()) {
+            nHeightNew = coin.nHeight;
+        } else if(fTxIndex) {
+            CTransaction tx;
+            uint256 hashBlock;
+            if(GetTransaction(txHash, tx, Params().GetConsensus(), hashBlock) && !hashBlock.IsNull()) {
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+                if(mi != mapBlockIndex.end() && mi->second && chainActive.Contains(mi->second)) {
+                    nHeightNew = mi->second->nHeight;
+                }
+            }
+        }
+
+        LogPrint("instantsend", "CInstantSend::UpdateConfirmedHeights -- txid=%s nHeightNew=%d\n", txHash.ToString(), nHeightNew);
+
+        std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+        if(itLockCandidate != mapTxLockCandidates.end() && itLockCandidate->second.GetConfirmedHeight() == -1) {
+            SetTxLockCandidateConfirmedHeight(itLockCandidate, nHeightNew);
+        }
+
+        std::map<uint256, std::set<uint256> >::iterator itHashes = mapTxLockVoteHashes.find(txHash);
+        if(itHashes == mapTxLockVoteHashes.end()) continue;
+        BOOST_FOREACH(const uint256& nVoteHash, itHashes->second) {
+            std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(nVoteHash);
+            if(itVote == mapTxLockVotes.end() || itVote->second.GetConfirmedHeight() != -1) continue;
+            SetTxLockVoteConfirmedHeight(itVote, nHeightNew);
+        }
+    }
+}
+
 bool CInstantSend::AlreadyHave(const uint256& hash)
 {
     LOCK(cs_instantsend);
@@ -892,37 +1117,18 @@ void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     if(itLockCandidate != mapTxLockCandidates.end()) {
         LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d lock candidate updated\n",
                 txHash.ToString(), nHeightNew);
-        itLockCandidate->second.SetConfirmedHeight(nHeightNew);
-        // Loop through outpoint locks
-        std::map<COutPoint, COutPointLock>::iterator itOutpointLock = itLockCandidate->second.mapOutPointLocks.begin();
-        while(itOutpointLock != itLockCandidate->second.mapOutPointLocks.end()) {
-            // Check corresponding lock votes
-            std::vector<CTxLockVote> vVotes = itOutpointLock->second.GetVotes();
-            std::vector<CTxLockVote>::iterator itVote = vVotes.begin();
-            std::map<uint256, CTxLockVote>::iterator it;
-            while(itVote != vVotes.end()) {
-                uint256 nVoteHash = itVote->GetHash();
-                LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
-                        txHash.ToString(), nHeightNew, nVoteHash.ToString());
-                it = mapTxLockVotes.find(nVoteHash);
-                if(it != mapTxLockVotes.end()) {
-                    it->second.SetConfirmedHeight(nHeightNew);
-                }
-                ++itVote;
-            }
-            ++itOutpointLock;
-        }
+        SetTxLockCandidateConfirmedHeight(itLockCandidate, nHeightNew);
     }
 
-    // check orphan votes
-    std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(itOrphanVote->second.GetTxHash() == txHash) {
-            LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
-                    txHash.ToString(), nHeightNew, itOrphanVote->first.ToString());
-            mapTxLockVotes[itOrphanVote->first].SetConfirmedHeight(nHeightNew);
-        }
-        ++itOrphanVote;
+    // Check lock votes for this tx, the ones of the candidate as well as orphan votes
+    std::map<uint256, std::set<uint256> >::iterator itHashes = mapTxLockVoteHashes.find(txHash);
+    if(itHashes == mapTxLockVoteHashes.end()) return;
+    BOOST_FOREACH(const uint256& nVoteHash, itHashes->second) {
+        std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(nVoteHash);
+        if(itVote == mapTxLockVotes.end()) continue;
+        LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
+                txHash.ToString(), nHeightNew, nVoteHash.ToString());
+        SetTxLockVoteConfirmedHeight(itVote, nHeightNew);
     }
 }
 
@@ -61,6 +61,29 @@ private:
     //track masternodes who voted with no txreq (for DOS protection)
     std::map<COutPoint, int64_t> mapMasternodeOrphanVotes; // mn outpoint - time
 
+    // secondary indexes of mapTxLockVotes and mapTxLockVotesOrphan
+    std::map<uint256, std::set<uint256> > mapTxLockVoteHashes; // tx hash - vote hash set
+    std::map<uint256, std::set<uint256> > mapTxLockVoteOrphanHashes; // tx hash - orphan vote hash set
+
+    // expiry queues, so CheckAndRemove only looks at entries which are due
+    std::set<std::pair<int, uint256> > setTxLockCandidatesByHeight; // confirmed height - tx hash
+    std::set<std::pair<int, uint256> > setTxLockVotesByHeight; // confirmed height - vote hash
+    std::set<std::pair<int64_t, uint256> > setTxLockVotesByTime; // creation time - vote hash, checked for failed lock attempts
+    std::set<std::pair<int64_t, uint256> > setTxLockVotesOrphanByTime; // creation time - orphan vote hash
+    std::set<std::pair<int64_t, COutPoint> > setMasternodeOrphanVotesByTime; // time - mn outpoint
+
+    // keep the maps above and their indexes/queues in sync
+    bool AddTxLockVote(const CTxLockVote& vote);
+    void EraseTxLockVote(std::map<uint256, CTxLockVote>::iterator it);
+    void SetTxLockVoteConfirmedHeight(std::map<uint256, CTxLockVote>::iterator it, int nConfirmedHeight);
+    void AddTxLockVoteOrphan(const CTxLockVote& vote);
+    void EraseTxLockVoteOrphan(std::map<uint256, CTxLockVote>::iterator it);
+    void EraseTxLockCandidate(std::map<uint256, CTxLockCandidate>::iterator it);
+    void SetTxLockCandidateConfirmedHeight(std::map<uint256, CTxLockCandidate>::iterator it, int nConfirmedHeight);
+    void SetMasternodeOrphanVoteTime(const COutPoint& outpointMasternode, int64_t nTime);
+    // indexes and queues aren't stored, recreate them from the maps after loading
+    void RebuildIndexes();
+
     bool CreateTxLockCandidate(const CTxLockRequest& txLockRequest);
     void CreateEmptyTxLockCandidate(const uint256& txHash);
     void Vote(CTxLockCandidate& txLockCandidate, CConnman& connman);
@@ -83,6 +106,29 @@ private:
 public:
     CCriticalSection cs_instantsend;
 
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        LOCK(cs_instantsend);
+        READWRITE(mapLockRequestAccepted);
+        READWRITE(mapLockRequestRejected);
+        READWRITE(mapTxLockVotes);
+        READWRITE(mapTxLockVotesOrphan);
+        READWRITE(mapTxLockCandidates);
+        READWRITE(mapVotedOutpoints);
+        READWRITE(mapLockedOutpoints);
+        READWRITE(mapMasternodeOrphanVotes);
+        if(ser_action.ForRead()) {
+            RebuildIndexes();
+        }
+    }
+
+    // add what instantsendIn knows and this doesn't, for data loaded from disk after the network started
+    void Merge(CInstantSend& instantsendIn);
+    // entries loaded from disk missed SyncTransaction for blocks connected meanwhile, look their txes up in the chain
+    void UpdateConfirmedHeights();
+
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, CConnman& connman);
 
     bool ProcessTxLockRequest(const CTxLockRequest& txLockRequest, CConnman& connman);
@@ -148,7 +194,7 @@ private:
     COutPoint outpoint;
     COutPoint outpointMasternode;
     std::vector<unsigned char> vchMasternodeSignature;
-    // local memory only
+    // not relayed, only kept in memory and in the mempool dump
     int nConfirmedHeight; // when corresponding tx is 0-confirmed or conflicted, nConfirmedHeight is -1
     int64_t nTimeCreated;
 
@@ -179,6 +225,10 @@ public:
         READWRITE(outpoint);
         READWRITE(outpointMasternode);
         READWRITE(vchMasternodeSignature);
+        if(nType & SER_DISK) {
+            READWRITE(nConfirmedHeight);
+            READWRITE(nTimeCreated);
+        }
     }
 
     uint256 GetHash() const;
@@ -189,6 +239,8 @@ public:
 
     bool IsValid(CNode* pnode, CConnman& connman) const;
     void SetConfirmedHeight(int nConfirmedHeightIn) { nConfirmedHeight = nConfirmedHeightIn; }
+    int GetConfirmedHeight() const { return nConfirmedHeight; }
+    int64_t GetTimeCreated() const { return nTimeCreated; }
     bool IsExpired(int nHeight) const;
     bool IsTimedOut() const;
     bool IsFailed() const;
@@ -210,11 +262,22 @@ public:
     static const int SIGNATURES_REQUIRED        = 6;
     static const int SIGNATURES_TOTAL           = 10;
 
+    COutPointLock() {}
+
     COutPointLock(const COutPoint& outpointIn) :
         outpoint(outpointIn),
         mapMasternodeVotes()
         {}
 
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(outpoint);
+        READWRITE(mapMasternodeVotes);
+        READWRITE(fAttacked);
+    }
+
     COutPoint GetOutpoint() const { return outpoint; }
 
     bool AddVote(const CTxLockVote& vote);
@@ -234,6 +297,11 @@ private:
     int64_t nTimeCreated;
 
 public:
+    CTxLockCandidate() :
+        nConfirmedHeight(-1),
+        nTimeCreated(GetTime())
+        {}
+
     CTxLockCandidate(const CTxLockRequest& txLockRequestIn) :
         nConfirmedHeight(-1),
         nTimeCreated(GetTime()),
@@ -244,6 +312,16 @@ public:
     CTxLockRequest txLockRequest;
     std::map<COutPoint, COutPointLock> mapOutPointLocks;
 
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txLockRequest);
+        READWRITE(mapOutPointLocks);
+        READWRITE(nTimeCreated);
+        READWRITE(nConfirmedHeight);
+    }
+
     uint256 GetHash() const { return txLockRequest.GetHash(); }
 
     void AddOutPointLock(const COutPoint& outpoint);
@@ -255,6 +333,7 @@ public:
     int CountVotes() const;
 
     void SetConfirmedHeight(int nConfirmedHeightIn) { nConfirmedHeight = nConfirmedHeightIn; }
+    int GetConfirmedHeight() const { return nConfirmedHeight; }
     bool IsExpired(int nHeight) const;
     bool IsTimedOut() const;
 
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "activemasternode.h"
+#include "cachedb.h"
 #include "governance-classes.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
@@ -11,6 +12,7 @@
 #include "netfulfilledman.h"
 #include "spork.h"
 #include "util.h"
+#include "votequeue.h"
 
 #include <boost/lexical_cast.hpp>
 
@@ -36,8 +38,8 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
 {
     strErrorRet = "";
 
-    bool isBlockRewardValueMet = (block.vtx[0].GetValueOut() <= blockReward);
-    if(fDebug) LogPrintf("block.vtx[0].GetValueOut() %lld <= blockReward %lld\n", block.vtx[0].GetValueOut(), blockReward);
+    bool isBlockRewardValueMet = (block.vtx[0]->GetValueOut() <= blockReward);
+    if(fDebug) LogPrintf("block.vtx[0].GetValueOut() %lld <= blockReward %lld\n", block.vtx[0]->GetValueOut(), blockReward);
 
     // we are still using budgets, but we have no data about them anymore,
     // all we know is predefined budget cycle and window
@@ -54,7 +56,7 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
                 LogPrint("gobject", "IsBlockValueValid -- Client synced but budget spork is disabled, checking block value against block reward\n");
                 if(!isBlockRewardValueMet) {
                     strErrorRet = strprintf("coinbase pays too much at height %d (actual=%d vs limit=%d), exceeded block reward, budgets are disabled",
-                                            nBlockHeight, block.vtx[0].GetValueOut(), blockReward);
+                                            nBlockHeight, block.vtx[0]->GetValueOut(), blockReward);
                 }
                 return isBlockRewardValueMet;
             }
@@ -65,7 +67,7 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
         // LogPrint("gobject", "IsBlockValueValid -- Block is not in budget cycle window, checking block value against block reward\n");
         if(!isBlockRewardValueMet) {
             strErrorRet = strprintf("coinbase pays too much at height %d (actual=%d vs limit=%d), exceeded block reward, block is not in budget cycle window",
-                                    nBlockHeight, block.vtx[0].GetValueOut(), blockReward);
+                                    nBlockHeight, block.vtx[0]->GetValueOut(), blockReward);
         }
         return isBlockRewardValueMet;
     }
@@ -73,9 +75,9 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
     // superblocks started
 
     CAmount nSuperblockMaxValue =  blockReward + CSuperblock::GetPaymentsLimit(nBlockHeight);
-    bool isSuperblockMaxValueMet = (block.vtx[0].GetValueOut() <= nSuperblockMaxValue);
+    bool isSuperblockMaxValueMet = (block.vtx[0]->GetValueOut() <= nSuperblockMaxValue);
 
-    LogPrint("gobject", "block.vtx[0].GetValueOut() %lld <= nSuperblockMaxValue %lld\n", block.vtx[0].GetValueOut(), nSuperblockMaxValue);
+    LogPrint("gobject", "block.vtx[0].GetValueOut() %lld <= nSuperblockMaxValue %lld\n", block.vtx[0]->GetValueOut(), nSuperblockMaxValue);
 
     if(!masternodeSync.IsSynced()) {
         // not enough data but at least it must NOT exceed superblock max value
@@ -83,13 +85,13 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
             if(fDebug) LogPrintf("IsBlockPayeeValid -- WARNING: Client not synced, checking superblock max bounds only\n");
             if(!isSuperblockMaxValueMet) {
                 strErrorRet = strprintf("coinbase pays too much at height %d (actual=%d vs limit=%d), exceeded superblock max value",
-                                        nBlockHeight, block.vtx[0].GetValueOut(), nSuperblockMaxValue);
+                                        nBlockHeight, block.vtx[0]->GetValueOut(), nSuperblockMaxValue);
             }
             return isSuperblockMaxValueMet;
         }
         if(!isBlockRewardValueMet) {
             strErrorRet = strprintf("coinbase pays too much at height %d (actual=%d vs limit=%d), exceeded block reward, only regular blocks are allowed at this height",
-                                    nBlockHeight, block.vtx[0].GetValueOut(), blockReward);
+                                    nBlockHeight, block.vtx[0]->GetValueOut(), blockReward);
         }
         // it MUST be a regular block otherwise
         return isBlockRewardValueMet;
@@ -99,14 +101,14 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
 
     if(sporkManager.IsSporkActive(SPORK_9_SUPERBLOCKS_ENABLED)) {
         if(CSuperblockManager::IsSuperblockTriggered(nBlockHeight)) {
-            if(CSuperblockManager::IsValid(block.vtx[0], nBlockHeight, blockReward)) {
-                LogPrint("gobject", "IsBlockValueValid -- Valid superblock at height %d: %s", nBlockHeight, block.vtx[0].ToString());
+            if(CSuperblockManager::IsValid(*block.vtx[0], nBlockHeight, blockReward)) {
+                LogPrint("gobject", "IsBlockValueValid -- Valid superblock at height %d: %s", nBlockHeight, block.vtx[0]->ToString());
                 // all checks are done in CSuperblock::IsValid, nothing to do here
                 return true;
             }
 
             // triggered but invalid? that's weird
-            LogPrintf("IsBlockValueValid -- ERROR: Invalid superblock detected at height %d: %s", nBlockHeight, block.vtx[0].ToString());
+            LogPrintf("IsBlockValueValid -- ERROR: Invalid superblock detected at height %d: %s", nBlockHeight, block.vtx[0]->ToString());
             // should NOT allow invalid superblocks, when superblocks are enabled
             strErrorRet = strprintf("invalid superblock detected at height %d", nBlockHeight);
             return false;
@@ -114,14 +116,14 @@ bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockRewar
         LogPrint("gobject", "IsBlockValueValid -- No triggered superblock detected at height %d\n", nBlockHeight);
         if(!isBlockRewardValueMet) {
             strErrorRet = strprintf("coinbase pays too much at height %d (actual=%d vs limit=%d), exceeded block reward, no triggered superblock detected",
-                                    nBlockHeight, block.vtx[0].GetValueOut(), blockReward);
+                                    nBlockHeight, block.vtx[0]->GetValueOut(), blockReward);
         }
     } else {
         // should NOT allow superblocks at all, when superblocks are disabled
         LogPrint("gobject", "IsBlockValueValid -- Superblocks are disabled, no superblocks allowed\n");
         if(!isBlockRewardValueMet) {
             strErrorRet = strprintf("coinbase pays too much at height %d (actual=%d vs limit=%d), exceeded block reward, superblocks are disabled",
-                                    nBlockHeight, block.vtx[0].GetValueOut(), blockReward);
+                                    nBlockHeight, block.vtx[0]->GetValueOut(), blockReward);
         }
     }
 
@@ -240,6 +242,37 @@ void CMasternodePayments::Clear()
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
     mapMasternodeBlocks.clear();
     mapMasternodePaymentVotes.clear();
+    setDirtyPaymentBlocks.clear();
+    setDirtyPaymentVotes.clear();
+}
+
+void CMasternodePayments::WriteCacheDB(CCacheDB& db, CDBBatch& batch, bool fAll)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
+    db.WriteRecord(batch, "mnpayments", true);
+    if(fAll) {
+        db.RewriteMap(batch, DB_CACHE_PAYMENT_VOTE, mapMasternodePaymentVotes);
+        db.RewriteMap(batch, DB_CACHE_PAYMENT_BLOCK, mapMasternodeBlocks);
+        setDirtyPaymentVotes.clear();
+        setDirtyPaymentBlocks.clear();
+        return;
+    }
+    db.WriteMap(batch, DB_CACHE_PAYMENT_VOTE, mapMasternodePaymentVotes, setDirtyPaymentVotes);
+    db.WriteMap(batch, DB_CACHE_PAYMENT_BLOCK, mapMasternodeBlocks, setDirtyPaymentBlocks);
+}
+
+bool CMasternodePayments::ReadCacheDB(CCacheDB& db)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
+    bool fStored;
+    if(!db.ReadRecord("mnpayments", fStored)) return false;
+
+    if(!db.ReadMap(DB_CACHE_PAYMENT_VOTE, mapMasternodePaymentVotes) ||
+        !db.ReadMap(DB_CACHE_PAYMENT_BLOCK, mapMasternodeBlocks)) {
+        Clear();
+        return false;
+    }
+    return true;
 }
 
 bool CMasternodePayments::CanVote(COutPoint outMasternode, int nBlockHeight)
@@ -356,6 +389,7 @@ void CMasternodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand,
             // but first mark vote as non-verified,
             // AddPaymentVote() below should take care of it if vote is actually ok
             mapMasternodePaymentVotes[nHash].MarkAsNotVerified();
+            setDirtyPaymentVotes.insert(nHash);
         }
 
         int nFirstBlock = nCachedBlockHeight - GetStorageLimit();
@@ -383,44 +417,57 @@ void CMasternodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand,
             return;
         }
 
-        int nDos = 0;
-        if(!vote.CheckSignature(mnInfo.pubKeyMasternode, nCachedBlockHeight, nDos)) {
-            if(nDos) {
-                LogPrintf("MASTERNODEPAYMENTVOTE -- ERROR: invalid signature\n");
-                Misbehaving(pfrom->GetId(), nDos);
-            } else {
-                // only warn about anything non-critical (i.e. nDos == 0) in debug mode
-                LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- WARNING: invalid signature\n");
-            }
-            // Either our info or vote info could be outdated.
-            // In case our info is outdated, ask for an update,
-            mnodeman.AskForMN(pfrom, vote.vinMasternode.prevout, connman);
-            // but there is nothing we can do if vote info itself is outdated
-            // (i.e. it was signed by a mn which changed its key),
-            // so just quit here.
-            return;
+        // the signature is checked in parallel with other votes, see CVoteVerifyQueue
+        votequeue.AddPaymentVote(pfrom->GetId(), vote, mnInfo.pubKeyMasternode);
+    }
+}
+
+int CMasternodePayments::ProcessVerifiedVote(CNode* pfrom, CMasternodePaymentVote& vote, bool fSignatureValid, CConnman& connman)
+{
+    uint256 nHash = vote.GetHash();
+
+    if(!fSignatureValid) {
+        int nDos = vote.GetBadSignatureDoS(nCachedBlockHeight);
+        if(nDos) {
+            LogPrintf("MASTERNODEPAYMENTVOTE -- ERROR: invalid signature\n");
+        } else {
+            // only warn about anything non-critical (i.e. nDos == 0) in debug mode
+            LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- WARNING: invalid signature\n");
         }
+        // Either our info or vote info could be outdated.
+        // In case our info is outdated, ask for an update,
+        mnodeman.AskForMN(pfrom, vote.vinMasternode.prevout, connman);
+        // but there is nothing we can do if vote info itself is outdated
+        // (i.e. it was signed by a mn which changed its key),
+        // so just quit here.
+        return nDos;
+    }
 
-        CTxDestination address1;
-        ExtractDestination(vote.payee, address1);
-        CBitcoinAddress address2(address1);
+    CTxDestination address1;
+    ExtractDestination(vote.payee, address1);
+    CBitcoinAddress address2(address1);
 
-        LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- vote: address=%s, nBlockHeight=%d, nHeight=%d, prevout=%s, hash=%s new\n",
-                    address2.ToString(), vote.nBlockHeight, nCachedBlockHeight, vote.vinMasternode.prevout.ToStringShort(), nHash.ToString());
+    LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- vote: address=%s, nBlockHeight=%d, nHeight=%d, prevout=%s, hash=%s new\n",
+                address2.ToString(), vote.nBlockHeight, nCachedBlockHeight, vote.vinMasternode.prevout.ToStringShort(), nHash.ToString());
 
-        if(AddPaymentVote(vote)){
-            vote.Relay(connman);
-            masternodeSync.BumpAssetLastTime("MASTERNODEPAYMENTVOTE");
-        }
+    if(AddPaymentVote(vote)){
+        vote.Relay(connman);
+        masternodeSync.BumpAssetLastTime("MASTERNODEPAYMENTVOTE");
     }
+    return 0;
 }
 
-bool CMasternodePaymentVote::Sign()
+std::string CMasternodePaymentVote::GetSignatureMessage() const
 {
-    std::string strError;
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
+    return vinMasternode.prevout.ToStringShort() +
                 boost::lexical_cast<std::string>(nBlockHeight) +
                 ScriptToAsmStr(payee);
+}
+
+bool CMasternodePaymentVote::Sign()
+{
+    std::string strError;
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::SignMessage(strMessage, vchSig, activeMasternode.keyMasternode)) {
         LogPrintf("CMasternodePaymentVote::Sign -- SignMessage() failed\n");
@@ -466,6 +513,23 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
     return false;
 }
 
+void CMasternodePayments::GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayeesRet)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    setPayeesRet.clear();
+
+    if(!masternodeSync.IsMasternodeListSynced()) return;
+
+    CScript payee;
+    for(int64_t h = nCachedBlockHeight; h <= nCachedBlockHeight + 8; h++){
+        if(h == nNotBlockHeight) continue;
+        if(mapMasternodeBlocks.count(h) && mapMasternodeBlocks[h].GetBestPayee(payee)) {
+            setPayeesRet.insert(payee);
+        }
+    }
+}
+
 bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
 {
     uint256 blockHash = uint256();
@@ -476,6 +540,7 @@ bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
 
     mapMasternodePaymentVotes[vote.GetHash()] = vote;
+    setDirtyPaymentVotes.insert(vote.GetHash());
 
     if(!mapMasternodeBlocks.count(vote.nBlockHeight)) {
        CMasternodeBlockPayees blockPayees(vote.nBlockHeight);
@@ -483,6 +548,7 @@ bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
     }
 
     mapMasternodeBlocks[vote.nBlockHeight].AddPayee(vote);
+    setDirtyPaymentBlocks.insert(vote.nBlockHeight);
 
     return true;
 }
@@ -645,6 +711,8 @@ void CMasternodePayments::CheckAndRemove()
 
         if(nCachedBlockHeight - vote.nBlockHeight > nLimit) {
             LogPrint("mnpayments", "CMasternodePayments::CheckAndRemove -- Removing old Masternode payment: nBlockHeight=%d\n", vote.nBlockHeight);
+            setDirtyPaymentVotes.insert(it->first);
+            setDirtyPaymentBlocks.insert(vote.nBlockHeight);
             mapMasternodePaymentVotes.erase(it++);
             mapMasternodeBlocks.erase(vote.nBlockHeight);
         } else {
@@ -855,24 +923,28 @@ bool CMasternodePaymentVote::CheckSignature(const CPubKey& pubKeyMasternode, int
     // do not ban by default
     nDos = 0;
 
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                boost::lexical_cast<std::string>(nBlockHeight) +
-                ScriptToAsmStr(payee);
+    std::string strMessage = GetSignatureMessage();
 
     std::string strError = "";
     if (!CMessageSigner::VerifyMessage(pubKeyMasternode, vchSig, strMessage, strError)) {
-        // Only ban for future block vote when we are already synced.
-        // Otherwise it could be the case when MN which signed this vote is using another key now
-        // and we have no idea about the old one.
-        if(masternodeSync.IsMasternodeListSynced() && nBlockHeight > nValidationHeight) {
-            nDos = 20;
-        }
+        nDos = GetBadSignatureDoS(nValidationHeight);
         return error("CMasternodePaymentVote::CheckSignature -- Got bad Masternode payment signature, masternode=%s, error: %s", vinMasternode.prevout.ToStringShort().c_str(), strError);
     }
 
     return true;
 }
 
+int CMasternodePaymentVote::GetBadSignatureDoS(int nValidationHeight) const
+{
+    // Only ban for future block vote when we are already synced.
+    // Otherwise it could be the case when MN which signed this vote is using another key now
+    // and we have no idea about the old one.
+    if(masternodeSync.IsMasternodeListSynced() && nBlockHeight > nValidationHeight) {
+        return 20;
+    }
+    return 0;
+}
+
 std::string CMasternodePaymentVote::ToString() const
 {
     std::ostringstream info;
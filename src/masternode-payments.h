@@ -12,6 +12,8 @@
 #include "net_processing.h"
 #include "utilstrencodings.h"
 
+class CCacheDB;
+class CDBBatch;
 class CMasternodePayments;
 class CMasternodePaymentVote;
 class CMasternodeBlockPayees;
@@ -148,8 +150,12 @@ public:
         return ss.GetHash();
     }
 
+    /// The string this vote's signature is made over
+    std::string GetSignatureMessage() const;
     bool Sign();
     bool CheckSignature(const CPubKey& pubKeyMasternode, int nValidationHeight, int &nDos);
+    /// Misbehavior score for a bad signature on this vote
+    int GetBadSignatureDoS(int nValidationHeight) const;
 
     bool IsValid(CNode* pnode, int nValidationHeight, std::string& strError, CConnman& connman);
     void Relay(CConnman& connman);
@@ -176,6 +182,10 @@ private:
     // Keep track of current block height
     int nCachedBlockHeight;
 
+    // Votes and blocks changed since the last cache flush
+    std::set<uint256> setDirtyPaymentVotes;
+    std::set<int> setDirtyPaymentBlocks;
+
 public:
     std::map<uint256, CMasternodePaymentVote> mapMasternodePaymentVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -194,6 +204,11 @@ public:
 
     void Clear();
 
+    /// Stage changes since the last flush for the cache database, or everything if fAll is set
+    void WriteCacheDB(CCacheDB& db, CDBBatch& batch, bool fAll);
+    /// Load from the cache database, returns false if there was nothing stored or it could not be read
+    bool ReadCacheDB(CCacheDB& db);
+
     bool AddPaymentVote(const CMasternodePaymentVote& vote);
     bool HasVerifiedPaymentVote(uint256 hashIn);
     bool ProcessBlock(int nBlockHeight, CConnman& connman);
@@ -206,11 +221,17 @@ public:
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
+    /// Collect the best payees of the blocks IsScheduled looks at, to test many masternodes at once
+    void GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayeesRet);
 
     bool CanVote(COutPoint outMasternode, int nBlockHeight);
 
     int GetMinMasternodePaymentsProto();
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, CConnman& connman);
+    /// Second half of MASTERNODEPAYMENTVOTE processing, run by the vote verification queue
+    /// once the signature was checked in parallel. pfrom is NULL if the peer is gone.
+    /// Returns the misbehavior score the peer earned, the caller applies it under cs_main.
+    int ProcessVerifiedVote(CNode* pfrom, CMasternodePaymentVote& vote, bool fSignatureValid, CConnman& connman);
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, int nBlockHeight, CAmount blockReward, CTxOut& txoutMasternodeRet);
     std::string ToString() const;
@@ -71,6 +71,7 @@ bool CMasternode::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb, CConnman& co
     if(mnb.lastPing == CMasternodePing() || (mnb.lastPing != CMasternodePing() && mnb.lastPing.CheckAndUpdate(this, true, nDos, connman))) {
         lastPing = mnb.lastPing;
         mnodeman.mapSeenMasternodePing.insert(std::make_pair(lastPing.GetHash(), lastPing));
+        mnodeman.SetSeenPingDirtyDB(lastPing.GetHash());
     }
     // if it matches our Masternode privkey...
     if(fMasterNode && pubKeyMasternode == activeMasternode.pubKeyMasternode) {
@@ -136,21 +137,12 @@ void CMasternode::Check(bool fForce)
     LogPrint("masternode", "CMasternode::Check -- Masternode %s is in %s state\n", vin.prevout.ToStringShort(), GetStateString());
 
     //once spent, stop doing the checks
+    // (spends are reported by CMasternodeMan::SyncTransaction, no UTXO lookup needed here)
     if(IsOutpointSpent()) return;
 
     int nHeight = 0;
     if(!fUnitTest) {
-        TRY_LOCK(cs_main, lockMain);
-        if(!lockMain) return;
-
-        CollateralStatus err = CheckCollateral(vin.prevout);
-        if (err == COLLATERAL_UTXO_NOT_FOUND) {
-            nActiveState = MASTERNODE_OUTPOINT_SPENT;
-            LogPrint("masternode", "CMasternode::Check -- Failed to find Masternode UTXO, masternode=%s\n", vin.prevout.ToStringShort());
-            return;
-        }
-
-        nHeight = chainActive.Height();
+        nHeight = mnodeman.GetCachedBlockHeight();
     }
 
     if(IsPoSeBanned()) {
@@ -246,6 +238,35 @@ void CMasternode::Check(bool fForce)
     }
 }
 
+int64_t CMasternode::GetNextCheckTime()
+{
+    LOCK(cs);
+
+    int64_t nNow = GetAdjustedTime();
+    int64_t nNextCheck = nNow + MASTERNODE_CHECK_MAX_SECONDS;
+
+    // the ping and watchdog timeouts Check() looks at
+    const int64_t arrDeadlines[] = {
+        lastPing.sigTime + MASTERNODE_MIN_MNP_SECONDS,
+        lastPing.sigTime + MASTERNODE_EXPIRATION_SECONDS,
+        lastPing.sigTime + MASTERNODE_NEW_START_REQUIRED_SECONDS,
+        nTimeLastWatchdogVote + MASTERNODE_WATCHDOG_MAX_SECONDS
+    };
+    for (int64_t nDeadline : arrDeadlines) {
+        if(nDeadline > nNow && nDeadline < nNextCheck) {
+            nNextCheck = nDeadline;
+        }
+    }
+    return nNextCheck;
+}
+
+void CMasternode::SetOutpointSpent()
+{
+    LOCK(cs);
+    nActiveState = MASTERNODE_OUTPOINT_SPENT;
+    LogPrint("masternode", "CMasternode::SetOutpointSpent -- Masternode UTXO spent, masternode=%s\n", vin.prevout.ToStringShort());
+}
+
 bool CMasternode::IsInputAssociatedWithPubkey()
 {
     CScript payee;
@@ -327,9 +348,9 @@ void CMasternode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScan
             if(!ReadBlockFromDisk(block, BlockReading, Params().GetConsensus())) // shouldn't really happen
                 continue;
 
-            CAmount nMasternodePayment = GetMasternodePayment(BlockReading->nHeight, block.vtx[0].GetValueOut());
+            CAmount nMasternodePayment = GetMasternodePayment(BlockReading->nHeight, block.vtx[0]->GetValueOut());
 
-            BOOST_FOREACH(CTxOut txout, block.vtx[0].vout)
+            BOOST_FOREACH(CTxOut txout, block.vtx[0]->vout)
                 if(mnpayee == txout.scriptPubKey && nMasternodePayment == txout.nValue) {
                     nBlockLastPaid = BlockReading->nHeight;
                     nTimeLastPaid = BlockReading->nTime;
@@ -552,6 +573,7 @@ bool CMasternodeBroadcast::CheckOutpoint(int& nDos)
             // not mnb fault, let it to be checked again later
             LogPrint("masternode", "CMasternodeBroadcast::CheckOutpoint -- Failed to aquire lock, addr=%s", addr.ToString());
             mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
+            mnodeman.SetSeenBroadcastDirtyDB(GetHash());
             return false;
         }
 
@@ -572,6 +594,7 @@ bool CMasternodeBroadcast::CheckOutpoint(int& nDos)
                     Params().GetConsensus().nMasternodeMinimumConfirmations, vin.prevout.ToStringShort());
             // maybe we miss few blocks, let this mnb to be checked again later
             mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
+            mnodeman.SetSeenBroadcastDirtyDB(GetHash());
             return false;
         }
         // remember the hash of the block where masternode collateral had minimum required confirmations
@@ -663,6 +686,9 @@ void CMasternodeBroadcast::Relay(CConnman& connman)
         return;
     }
 
+    // Not kept framed in mapRelay: the lastPing of the copy in
+    // mapSeenMasternodeBroadcast is replaced by every new ping, and getdata
+    // has to serve the current one rather than the ping it was relayed with
     CInv inv(MSG_MASTERNODE_ANNOUNCE, GetHash());
     connman.RelayInv(inv);
 }
@@ -801,12 +827,14 @@ bool CMasternodePing::CheckAndUpdate(CMasternode* pmn, bool fFromNewBroadcast, i
     // let's store this ping as the last one
     LogPrint("masternode", "CMasternodePing::CheckAndUpdate -- Masternode ping accepted, masternode=%s\n", vin.prevout.ToStringShort());
     pmn->lastPing = *this;
+    mnodeman.SetMasternodeDirtyDB(vin.prevout);
 
     // and update mnodeman.mapSeenMasternodeBroadcast.lastPing which is probably outdated
     CMasternodeBroadcast mnb(*pmn);
     uint256 hash = mnb.GetHash();
     if (mnodeman.mapSeenMasternodeBroadcast.count(hash)) {
         mnodeman.mapSeenMasternodeBroadcast[hash].second.lastPing = *this;
+        mnodeman.SetSeenBroadcastDirtyDB(hash);
     }
 
     // force update, ignoring cache
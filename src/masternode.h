@@ -19,6 +19,8 @@ static const int MASTERNODE_MIN_MNP_SECONDS             =  10 * 60;
 static const int MASTERNODE_EXPIRATION_SECONDS          =  65 * 60;
 static const int MASTERNODE_WATCHDOG_MAX_SECONDS        = 120 * 60;
 static const int MASTERNODE_NEW_START_REQUIRED_SECONDS  = 300 * 60;
+// recheck at least this often for changes which are not tracked by events (sync status, sporks, watchdogs, PoSe)
+static const int MASTERNODE_CHECK_MAX_SECONDS           =   1 * 60;
 
 static const int MASTERNODE_POSE_BAN_MAX_SCORE          = 5;
 
@@ -206,6 +208,10 @@ public:
     static CollateralStatus CheckCollateral(const COutPoint& outpoint);
     static CollateralStatus CheckCollateral(const COutPoint& outpoint, int& nHeightRet);
     void Check(bool fForce = false);
+    /// Earliest time Check() could change the state on its own, i.e. without a new ping, vote or block
+    int64_t GetNextCheckTime();
+    /// Collateral was spent in a connected block
+    void SetOutpointSpent();
 
     bool IsBroadcastedWithin(int nSeconds) { return GetAdjustedTime() - sigTime < nSeconds; }
 
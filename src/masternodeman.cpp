@@ -4,6 +4,7 @@
 
 #include "activemasternode.h"
 #include "addrman.h"
+#include "cachedb.h"
 #include "governance.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
@@ -21,15 +22,6 @@ CMasternodeMan mnodeman;
 
 const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-7";
 
-struct CompareLastPaidBlock
-{
-    bool operator()(const std::pair<int, CMasternode*>& t1,
-                    const std::pair<int, CMasternode*>& t2) const
-    {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
-    }
-};
-
 struct CompareScoreMN
 {
     bool operator()(const std::pair<arith_uint256, CMasternode*>& t1,
@@ -52,6 +44,13 @@ struct CompareByAddr
 CMasternodeMan::CMasternodeMan()
 : cs(),
   mapMasternodes(),
+  setLastPaidQueue(),
+  mapCollateralHeights(),
+  mapCollateralPayees(),
+  mapIndexPubKey(),
+  mapIndexPayee(),
+  mapIndexAddr(),
+  hashCollateralHeightsTip(),
   mAskedUsForMasternodeList(),
   mWeAskedForMasternodeList(),
   mWeAskedForMasternodeListEntry(),
@@ -76,10 +75,75 @@ bool CMasternodeMan::Add(CMasternode &mn)
 
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     mapMasternodes[mn.vin.prevout] = mn;
+    SetMasternodeDirtyDB(mn.vin.prevout);
+    setLastPaidQueue.insert(std::make_pair(mn.GetLastPaidBlock(), mn.vin.prevout));
+    AddToIndexes(mn);
+    ScheduleCheck(mn.vin.prevout, GetAdjustedTime());
     fMasternodesAdded = true;
     return true;
 }
 
+void CMasternodeMan::Erase(std::map<COutPoint, CMasternode>::iterator it)
+{
+    setLastPaidQueue.erase(std::make_pair(it->second.GetLastPaidBlock(), it->first));
+    RemoveFromIndexes(it->second);
+    mapCollateralHeights.erase(it->first);
+    mapCollateralPayees.erase(it->first);
+    mapNextCheck.erase(it->first);
+    SetMasternodeDirtyDB(it->first);
+    mapMasternodes.erase(it);
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    setLastPaidQueue.clear();
+    mapCollateralHeights.clear();
+    mapCollateralPayees.clear();
+    mapIndexPubKey.clear();
+    mapIndexPayee.clear();
+    mapIndexAddr.clear();
+    mapNextCheck.clear();
+    queueCheck = check_queue_t();
+    int64_t nNow = GetAdjustedTime();
+    for (auto& mnpair : mapMasternodes) {
+        setLastPaidQueue.insert(std::make_pair(mnpair.second.GetLastPaidBlock(), mnpair.first));
+        AddToIndexes(mnpair.second);
+        ScheduleCheck(mnpair.first, nNow);
+    }
+}
+
+void CMasternodeMan::ScheduleCheck(const COutPoint& outpoint, int64_t nTime)
+{
+    AssertLockHeld(cs);
+    mapNextCheck[outpoint] = nTime;
+    queueCheck.push(std::make_pair(nTime, outpoint));
+}
+
+template<typename K>
+static void EraseFromIndex(std::map<K, std::set<COutPoint> >& mapIndex, const K& key, const COutPoint& outpoint)
+{
+    typename std::map<K, std::set<COutPoint> >::iterator it = mapIndex.find(key);
+    if (it == mapIndex.end()) return;
+    it->second.erase(outpoint);
+    if (it->second.empty()) mapIndex.erase(it);
+}
+
+void CMasternodeMan::AddToIndexes(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+    mapIndexPubKey[mn.pubKeyMasternode].insert(mn.vin.prevout);
+    mapIndexPayee[GetCollateralPayee(mn)].insert(mn.vin.prevout);
+    mapIndexAddr[mn.addr].insert(mn.vin.prevout);
+}
+
+void CMasternodeMan::RemoveFromIndexes(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+    EraseFromIndex(mapIndexPubKey, mn.pubKeyMasternode, mn.vin.prevout);
+    EraseFromIndex(mapIndexPayee, GetCollateralPayee(mn), mn.vin.prevout);
+    EraseFromIndex(mapIndexAddr, mn.addr, mn.vin.prevout);
+}
+
 void CMasternodeMan::AskForMN(CNode* pnode, const COutPoint& outpoint, CConnman& connman)
 {
     if(!pnode) return;
@@ -119,6 +183,7 @@ bool CMasternodeMan::AllowMixing(const COutPoint &outpoint)
     nDsqCount++;
     pmn->nLastDsq = nDsqCount;
     pmn->fAllowMixingTx = true;
+    SetMasternodeDirtyDB(outpoint);
 
     return true;
 }
@@ -131,6 +196,7 @@ bool CMasternodeMan::DisallowMixing(const COutPoint &outpoint)
         return false;
     }
     pmn->fAllowMixingTx = false;
+    SetMasternodeDirtyDB(outpoint);
 
     return true;
 }
@@ -143,18 +209,78 @@ bool CMasternodeMan::PoSeBan(const COutPoint &outpoint)
         return false;
     }
     pmn->PoSeBan();
+    SetMasternodeDirtyDB(outpoint);
+    ScheduleCheck(outpoint, GetAdjustedTime());
 
     return true;
 }
 
-void CMasternodeMan::Check()
+int CMasternodeMan::Check()
 {
     LOCK(cs);
 
     LogPrint("masternode", "CMasternodeMan::Check -- nLastWatchdogVoteTime=%d, IsWatchdogActive()=%d\n", nLastWatchdogVoteTime, IsWatchdogActive());
 
+    // only touch the ones which are due instead of sweeping the whole list
+    int64_t nNow = GetAdjustedTime();
+    int nChecked = 0;
+    while (!queueCheck.empty() && queueCheck.top().first <= nNow) {
+        check_pair_t check = queueCheck.top();
+        queueCheck.pop();
+
+        std::map<COutPoint, int64_t>::iterator itNext = mapNextCheck.find(check.second);
+        // removed or rescheduled in the meantime
+        if (itNext == mapNextCheck.end() || itNext->second != check.first) continue;
+
+        CMasternode* pmn = Find(check.second);
+        if (!pmn) {
+            mapNextCheck.erase(itNext);
+            continue;
+        }
+        int nActiveStatePrev = pmn->nActiveState;
+        pmn->Check(true);
+        nChecked++;
+        if (pmn->nActiveState != nActiveStatePrev) {
+            SetMasternodeDirtyDB(check.second);
+        }
+        if (pmn->IsOutpointSpent()) {
+            // nothing left to wait for, CheckAndRemove drops it
+            mapNextCheck.erase(itNext);
+            continue;
+        }
+        ScheduleCheck(check.second, pmn->GetNextCheckTime());
+    }
+    return nChecked;
+}
+
+void CMasternodeMan::CheckCollaterals()
+{
+    LOCK2(cs_main, cs);
+
     for (auto& mnpair : mapMasternodes) {
-        mnpair.second.Check();
+        if (mnpair.second.IsOutpointSpent()) continue;
+        if (CMasternode::CheckCollateral(mnpair.first) == CMasternode::COLLATERAL_UTXO_NOT_FOUND) {
+            mnpair.second.SetOutpointSpent();
+            mapNextCheck.erase(mnpair.first);
+            mapCollateralHeights.erase(mnpair.first);
+        }
+    }
+}
+
+void CMasternodeMan::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    // like the UTXO lookup this replaces, only spends in connected blocks count
+    if (!pblock || tx.IsCoinBase()) return;
+
+    LOCK(cs);
+    if (mapMasternodes.empty()) return;
+
+    for (const auto& txin : tx.vin) {
+        std::map<COutPoint, CMasternode>::iterator it = mapMasternodes.find(txin.prevout);
+        if (it == mapMasternodes.end() || it->second.IsOutpointSpent()) continue;
+        it->second.SetOutpointSpent();
+        mapNextCheck.erase(it->first);
+        mapCollateralHeights.erase(it->first);
     }
 }
 
@@ -185,11 +311,12 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
 
                 // erase all of the broadcasts we've seen from this txin, ...
                 mapSeenMasternodeBroadcast.erase(hash);
+                SetSeenBroadcastDirtyDB(hash);
                 mWeAskedForMasternodeListEntry.erase(it->first);
 
                 // and finally remove it from the list
                 it->second.FlagGovernanceItemsAsDirty();
-                mapMasternodes.erase(it++);
+                Erase(it++);
                 fMasternodesRemoved = true;
             } else {
                 bool fAsk = (nAskForMnbRecovery > 0) &&
@@ -316,6 +443,7 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
         while(it4 != mapSeenMasternodePing.end()){
             if((*it4).second.IsExpired()) {
                 LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode ping: hash=%s\n", (*it4).second.GetHash().ToString());
+                SetSeenPingDirtyDB(it4->first);
                 mapSeenMasternodePing.erase(it4++);
             } else {
                 ++it4;
@@ -345,13 +473,81 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     mapMasternodes.clear();
+    setLastPaidQueue.clear();
+    mapCollateralHeights.clear();
+    mapCollateralPayees.clear();
+    mapIndexPubKey.clear();
+    mapIndexPayee.clear();
+    mapIndexAddr.clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
+    mapNextCheck.clear();
+    queueCheck = check_queue_t();
     nDsqCount = 0;
     nLastWatchdogVoteTime = 0;
+    setDirtyMasternodes.clear();
+    setDirtySeenMasternodeBroadcast.clear();
+    setDirtySeenMasternodePing.clear();
+}
+
+void CMasternodeMan::WriteCacheDB(CCacheDB& db, CDBBatch& batch, bool fAll)
+{
+    LOCK(cs);
+    db.WriteRecord(batch, "mnversion", SERIALIZATION_VERSION_STRING);
+    db.WriteRecord(batch, "mnaskedus", mAskedUsForMasternodeList);
+    db.WriteRecord(batch, "mnweasked", mWeAskedForMasternodeList);
+    db.WriteRecord(batch, "mnweaskedentry", mWeAskedForMasternodeListEntry);
+    db.WriteRecord(batch, "mnbrecoveryrequests", mMnbRecoveryRequests);
+    db.WriteRecord(batch, "mnbrecoveryreplies", mMnbRecoveryGoodReplies);
+    db.WriteRecord(batch, "mnwatchdogvotetime", nLastWatchdogVoteTime);
+    db.WriteRecord(batch, "mndsqcount", nDsqCount);
+    if(fAll) {
+        db.RewriteMap(batch, DB_CACHE_MASTERNODE, mapMasternodes);
+        db.RewriteMap(batch, DB_CACHE_SEEN_MNB, mapSeenMasternodeBroadcast);
+        db.RewriteMap(batch, DB_CACHE_SEEN_MNP, mapSeenMasternodePing);
+        setDirtyMasternodes.clear();
+        setDirtySeenMasternodeBroadcast.clear();
+        setDirtySeenMasternodePing.clear();
+        return;
+    }
+    db.WriteMap(batch, DB_CACHE_MASTERNODE, mapMasternodes, setDirtyMasternodes);
+    db.WriteMap(batch, DB_CACHE_SEEN_MNB, mapSeenMasternodeBroadcast, setDirtySeenMasternodeBroadcast);
+    db.WriteMap(batch, DB_CACHE_SEEN_MNP, mapSeenMasternodePing, setDirtySeenMasternodePing);
+}
+
+bool CMasternodeMan::ReadCacheDB(CCacheDB& db)
+{
+    LOCK(cs);
+    std::string strVersion;
+    if(!db.ReadRecord("mnversion", strVersion)) return false;
+
+    if(strVersion != SERIALIZATION_VERSION_STRING) {
+        // stale entries are replaced on the next flush
+        LogPrintf("CMasternodeMan::ReadCacheDB -- cache version %s does not match %s, clearing\n", strVersion, SERIALIZATION_VERSION_STRING);
+        Clear();
+        db.RequestRewrite();
+        return true;
+    }
+
+    if(!db.ReadRecord("mnaskedus", mAskedUsForMasternodeList) ||
+        !db.ReadRecord("mnweasked", mWeAskedForMasternodeList) ||
+        !db.ReadRecord("mnweaskedentry", mWeAskedForMasternodeListEntry) ||
+        !db.ReadRecord("mnbrecoveryrequests", mMnbRecoveryRequests) ||
+        !db.ReadRecord("mnbrecoveryreplies", mMnbRecoveryGoodReplies) ||
+        !db.ReadRecord("mnwatchdogvotetime", nLastWatchdogVoteTime) ||
+        !db.ReadRecord("mndsqcount", nDsqCount) ||
+        !db.ReadMap(DB_CACHE_MASTERNODE, mapMasternodes) ||
+        !db.ReadMap(DB_CACHE_SEEN_MNB, mapSeenMasternodeBroadcast) ||
+        !db.ReadMap(DB_CACHE_SEEN_MNP, mapSeenMasternodePing)) {
+        Clear();
+        return false;
+    }
+
+    RebuildIndexes();
+    return true;
 }
 
 int CMasternodeMan::CountMasternodes(int nProtocolVersion)
@@ -427,6 +623,20 @@ CMasternode* CMasternodeMan::Find(const COutPoint &outpoint)
     return it == mapMasternodes.end() ? NULL : &(it->second);
 }
 
+CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
+{
+    LOCK(cs);
+    auto it = mapIndexPubKey.find(pubKeyMasternode);
+    return it == mapIndexPubKey.end() ? NULL : Find(*it->second.begin());
+}
+
+CMasternode* CMasternodeMan::Find(const CScript& payee)
+{
+    LOCK(cs);
+    auto it = mapIndexPayee.find(payee);
+    return it == mapIndexPayee.end() ? NULL : Find(*it->second.begin());
+}
+
 bool CMasternodeMan::Get(const COutPoint& outpoint, CMasternode& masternodeRet)
 {
     // Theses mutexes are recursive so double locking by the same thread is safe.
@@ -454,26 +664,23 @@ bool CMasternodeMan::GetMasternodeInfo(const COutPoint& outpoint, masternode_inf
 bool CMasternodeMan::GetMasternodeInfo(const CPubKey& pubKeyMasternode, masternode_info_t& mnInfoRet)
 {
     LOCK(cs);
-    for (auto& mnpair : mapMasternodes) {
-        if (mnpair.second.pubKeyMasternode == pubKeyMasternode) {
-            mnInfoRet = mnpair.second.GetInfo();
-            return true;
-        }
+    CMasternode* pmn = Find(pubKeyMasternode);
+    if (!pmn) {
+        return false;
     }
-    return false;
+    mnInfoRet = pmn->GetInfo();
+    return true;
 }
 
 bool CMasternodeMan::GetMasternodeInfo(const CScript& payee, masternode_info_t& mnInfoRet)
 {
     LOCK(cs);
-    for (auto& mnpair : mapMasternodes) {
-        CScript scriptCollateralAddress = GetScriptForDestination(mnpair.second.pubKeyCollateralAddress.GetID());
-        if (scriptCollateralAddress == payee) {
-            mnInfoRet = mnpair.second.GetInfo();
-            return true;
-        }
+    CMasternode* pmn = Find(payee);
+    if (!pmn) {
+        return false;
     }
-    return false;
+    mnInfoRet = pmn->GetInfo();
+    return true;
 }
 
 bool CMasternodeMan::Has(const COutPoint& outpoint)
@@ -482,6 +689,14 @@ bool CMasternodeMan::Has(const COutPoint& outpoint)
     return mapMasternodes.find(outpoint) != mapMasternodes.end();
 }
 
+bool CMasternodeMan::Has(const CNetAddr& addr)
+{
+    LOCK(cs);
+    // mapIndexAddr is ordered by address first, port second
+    std::map<CService, std::set<COutPoint> >::iterator it = mapIndexAddr.lower_bound(CService(addr, 0));
+    return it != mapIndexAddr.end() && (CNetAddr)it->first == addr;
+}
+
 //
 // Deterministically select the oldest/best masternode to pay on the network
 //
@@ -503,30 +718,35 @@ bool CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool f
     // Need LOCK2 here to ensure consistent locking order because the GetBlockHash call below locks cs_main
     LOCK2(cs_main,cs);
 
-    std::vector<std::pair<int, CMasternode*> > vecMasternodeLastPaid;
+    std::vector<CMasternode*> vecMasternodeLastPaid;
 
     /*
-        Make a vector with all of the last paid times
+        Make a vector with the eligible masternodes, ordered by last paid block
     */
 
     int nMnCount = CountMasternodes();
 
-    for (auto& mnpair : mapMasternodes) {
-        if(!mnpair.second.IsValidForPayment()) continue;
-
-        //check protocol version
-        if(mnpair.second.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
-
-        //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if(mnpayments.IsScheduled(mnpair.second, nBlockHeight)) continue;
+    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
+    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
+    //  -- (chance per block * chances before IsScheduled will fire)
+    int nTenthNetwork = nMnCount/10;
+    // When filtering by sigTime we also need to know whether at least a third qualifies (see below),
+    // nothing after that many entries can change the outcome
+    int nCountNeeded = fFilterSigTime ? std::max(nTenthNetwork, nMnCount/3) : nTenthNetwork;
 
-        //it's too new, wait for a cycle
-        if(fFilterSigTime && mnpair.second.sigTime + (nMnCount*2.6*60) > GetAdjustedTime()) continue;
+    // payees which are in the list (up to 8 entries ahead of current block to allow propagation)
+    std::set<CScript> setScheduledPayees;
+    mnpayments.GetScheduledPayees(nBlockHeight, setScheduledPayees);
 
-        //make sure it has at least as many confirmations as there are masternodes
-        if(GetUTXOConfirmations(mnpair.first) < nMnCount) continue;
+    // setLastPaidQueue is already sorted low to high
+    for (const auto& queuepair : setLastPaidQueue) {
+        std::map<COutPoint, CMasternode>::iterator it = mapMasternodes.find(queuepair.second);
+        if(it == mapMasternodes.end()) continue;
+        if(!IsQualifiedForPayment(it->second, nMnCount, fFilterSigTime, setScheduledPayees)) continue;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mnpair.second.GetLastPaidBlock(), &mnpair.second));
+        vecMasternodeLastPaid.push_back(&it->second);
+        if((int)vecMasternodeLastPaid.size() >= nCountNeeded) break;
     }
 
     nCountRet = (int)vecMasternodeLastPaid.size();
@@ -535,27 +755,19 @@ bool CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool f
     if(fFilterSigTime && nCountRet < nMnCount/3)
         return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCountRet, mnInfoRet);
 
-    // Sort them low to high
-    sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), CompareLastPaidBlock());
-
     uint256 blockHash;
     if(!GetBlockHash(blockHash, nBlockHeight - 101)) {
         LogPrintf("CMasternode::GetNextMasternodeInQueueForPayment -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", nBlockHeight - 101);
         return false;
     }
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
-    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
-    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
-    //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = nMnCount/10;
     int nCountTenth = 0;
     arith_uint256 nHighest = 0;
     CMasternode *pBestMasternode = NULL;
-    BOOST_FOREACH (PAIRTYPE(int, CMasternode*)& s, vecMasternodeLastPaid){
-        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+    BOOST_FOREACH (CMasternode* pmn, vecMasternodeLastPaid){
+        arith_uint256 nScore = pmn->CalculateScore(blockHash);
         if(nScore > nHighest){
             nHighest = nScore;
-            pBestMasternode = s.second;
+            pBestMasternode = pmn;
         }
         nCountTenth++;
         if(nCountTenth >= nTenthNetwork) break;
@@ -566,6 +778,82 @@ bool CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool f
     return mnInfoRet.fInfoValid;
 }
 
+int CMasternodeMan::CountQualifiedForPayment(bool fFilterSigTime)
+{
+    return CountQualifiedForPayment(nCachedBlockHeight, fFilterSigTime);
+}
+
+int CMasternodeMan::CountQualifiedForPayment(int nBlockHeight, bool fFilterSigTime)
+{
+    if (!masternodeSync.IsWinnersListSynced()) return 0;
+
+    LOCK2(cs_main,cs);
+
+    int nMnCount = CountMasternodes();
+    std::set<CScript> setScheduledPayees;
+    mnpayments.GetScheduledPayees(nBlockHeight, setScheduledPayees);
+
+    int nCount = 0;
+    for (auto& mnpair : mapMasternodes) {
+        if(IsQualifiedForPayment(mnpair.second, nMnCount, fFilterSigTime, setScheduledPayees)) nCount++;
+    }
+
+    // same fallback as GetNextMasternodeInQueueForPayment
+    if(fFilterSigTime && nCount < nMnCount/3)
+        return CountQualifiedForPayment(nBlockHeight, false);
+
+    return nCount;
+}
+
+bool CMasternodeMan::IsQualifiedForPayment(CMasternode& mn, int nMnCount, bool fFilterSigTime, const std::set<CScript>& setScheduledPayees)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    if(!mn.IsValidForPayment()) return false;
+
+    //check protocol version
+    if(mn.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto()) return false;
+
+    //it's in the list -- so let's skip it
+    if(!setScheduledPayees.empty() && setScheduledPayees.count(GetCollateralPayee(mn))) return false;
+
+    //it's too new, wait for a cycle
+    if(fFilterSigTime && mn.sigTime + (nMnCount*2.6*60) > GetAdjustedTime()) return false;
+
+    //make sure it has at least as many confirmations as there are masternodes,
+    //a spent collateral was caught by IsValidForPayment already, see SyncTransaction
+    return GetCollateralConfirmations(mn.vin.prevout) >= nMnCount;
+}
+
+int CMasternodeMan::GetCollateralConfirmations(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    if (!chainActive.Tip()) return -1;
+
+    std::map<COutPoint, int>::iterator it = mapCollateralHeights.find(outpoint);
+    if (it == mapCollateralHeights.end()) {
+        // -1 means UTXO is yet unknown or already spent, don't remember that
+        int nHeight = GetUTXOHeight(outpoint);
+        if (nHeight < 0) return -1;
+        it = mapCollateralHeights.insert(std::make_pair(outpoint, nHeight)).first;
+    }
+    return chainActive.Height() - it->second + 1;
+}
+
+const CScript& CMasternodeMan::GetCollateralPayee(const CMasternode& mn)
+{
+    AssertLockHeld(cs);
+
+    std::map<COutPoint, CScript>::iterator it = mapCollateralPayees.find(mn.vin.prevout);
+    if (it == mapCollateralPayees.end()) {
+        it = mapCollateralPayees.insert(std::make_pair(mn.vin.prevout, GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()))).first;
+    }
+    return it->second;
+}
+
 masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<COutPoint> &vecToExclude, int nProtocolVersion)
 {
     LOCK(cs);
@@ -783,6 +1071,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         if(mapSeenMasternodePing.count(nHash)) return; //seen
         mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
+        SetSeenPingDirtyDB(nHash);
 
         LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s new\n", mnp.vin.prevout.ToStringShort());
 
@@ -860,6 +1149,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
             mapSeenMasternodeBroadcast.insert(std::make_pair(hashMNB, std::make_pair(GetTime(), mnb)));
             mapSeenMasternodePing.insert(std::make_pair(hashMNP, mnp));
+            SetSeenBroadcastDirtyDB(hashMNB);
+            SetSeenPingDirtyDB(hashMNP);
 
             if (vin.prevout == mnpair.first) {
                 LogPrintf("DSEG -- Sent 1 Masternode inv to peer %d\n", pfrom->id);
@@ -988,31 +1279,28 @@ void CMasternodeMan::CheckSameAddr()
     if(!masternodeSync.IsSynced() || mapMasternodes.empty()) return;
 
     std::vector<CMasternode*> vBan;
-    std::vector<CMasternode*> vSortedByAddr;
 
     {
         LOCK(cs);
 
-        CMasternode* pprevMasternode = NULL;
-        CMasternode* pverifiedMasternode = NULL;
-
-        for (auto& mnpair : mapMasternodes) {
-            vSortedByAddr.push_back(&mnpair.second);
-        }
-
-        sort(vSortedByAddr.begin(), vSortedByAddr.end(), CompareByAddr());
-
-        BOOST_FOREACH(CMasternode* pmn, vSortedByAddr) {
-            // check only (pre)enabled masternodes
-            if(!pmn->IsEnabled() && !pmn->IsPreEnabled()) continue;
-            // initial step
-            if(!pprevMasternode) {
-                pprevMasternode = pmn;
-                pverifiedMasternode = pmn->IsPoSeVerified() ? pmn : NULL;
-                continue;
-            }
-            // second+ step
-            if(pmn->addr == pprevMasternode->addr) {
+        for (const auto& addrpair : mapIndexAddr) {
+            // only addresses shared by several masternodes are interesting
+            if(addrpair.second.size() < 2) continue;
+
+            CMasternode* pprevMasternode = NULL;
+            CMasternode* pverifiedMasternode = NULL;
+
+            BOOST_FOREACH(const COutPoint& outpoint, addrpair.second) {
+                CMasternode* pmn = Find(outpoint);
+                // check only (pre)enabled masternodes
+                if(!pmn || (!pmn->IsEnabled() && !pmn->IsPreEnabled())) continue;
+                // initial step
+                if(!pprevMasternode) {
+                    pprevMasternode = pmn;
+                    pverifiedMasternode = pmn->IsPoSeVerified() ? pmn : NULL;
+                    continue;
+                }
+                // second+ step
                 if(pverifiedMasternode) {
                     // another masternode with the same ip is verified, ban this one
                     vBan.push_back(pmn);
@@ -1022,10 +1310,8 @@ void CMasternodeMan::CheckSameAddr()
                     // and keep a reference to be able to ban following masternodes with the same ip
                     pverifiedMasternode = pmn;
                 }
-            } else {
-                pverifiedMasternode = pmn->IsPoSeVerified() ? pmn : NULL;
+                pprevMasternode = pmn;
             }
-            pprevMasternode = pmn;
         }
     }
 
@@ -1033,6 +1319,7 @@ void CMasternodeMan::CheckSameAddr()
     BOOST_FOREACH(CMasternode* pmn, vBan) {
         LogPrintf("CMasternodeMan::CheckSameAddr -- increasing PoSe ban score for masternode %s\n", pmn->vin.prevout.ToStringShort());
         pmn->IncreasePoSeBanScore();
+        SetMasternodeDirtyDB(pmn->vin.prevout);
     }
 }
 
@@ -1147,13 +1434,16 @@ void CMasternodeMan::ProcessVerifyReply(CNode* pnode, CMasternodeVerification& m
         CMasternode* prealMasternode = NULL;
         std::vector<CMasternode*> vpMasternodesToBan;
         std::string strMessage1 = strprintf("%s%d%s", pnode->addr.ToString(false), mnv.nonce, blockHash.ToString());
-        for (auto& mnpair : mapMasternodes) {
-            if(CAddress(mnpair.second.addr, NODE_NETWORK) == pnode->addr) {
+        auto itAddr = mapIndexAddr.find(pnode->addr);
+        if(itAddr != mapIndexAddr.end()) {
+            for (const auto& outpoint : itAddr->second) {
+                auto& mnpair = *mapMasternodes.find(outpoint);
                 if(CMessageSigner::VerifyMessage(mnpair.second.pubKeyMasternode, mnv.vchSig1, strMessage1, strError)) {
                     // found it!
                     prealMasternode = &mnpair.second;
                     if(!mnpair.second.IsPoSeVerified()) {
                         mnpair.second.DecreasePoSeBanScore();
+                        SetMasternodeDirtyDB(mnpair.first);
                     }
                     netfulfilledman.AddFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-done");
 
@@ -1200,6 +1490,7 @@ void CMasternodeMan::ProcessVerifyReply(CNode* pnode, CMasternodeVerification& m
         // increase ban score for everyone else
         BOOST_FOREACH(CMasternode* pmn, vpMasternodesToBan) {
             pmn->IncreasePoSeBanScore();
+            SetMasternodeDirtyDB(pmn->vin.prevout);
             LogPrint("masternode", "CMasternodeMan::ProcessVerifyReply -- increased PoSe ban score for %s addr %s, new score %d\n",
                         prealMasternode->vin.prevout.ToStringShort(), pnode->addr.ToString(), pmn->nPoSeBanScore);
         }
@@ -1292,6 +1583,7 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
 
         if(!pmn1->IsPoSeVerified()) {
             pmn1->DecreasePoSeBanScore();
+            SetMasternodeDirtyDB(pmn1->vin.prevout);
         }
         mnv.Relay();
 
@@ -1300,12 +1592,17 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
 
         // increase ban score for everyone else with the same addr
         int nCount = 0;
-        for (auto& mnpair : mapMasternodes) {
-            if(mnpair.second.addr != mnv.addr || mnpair.first == mnv.vin1.prevout) continue;
-            mnpair.second.IncreasePoSeBanScore();
-            nCount++;
-            LogPrint("masternode", "CMasternodeMan::ProcessVerifyBroadcast -- increased PoSe ban score for %s addr %s, new score %d\n",
-                        mnpair.first.ToStringShort(), mnpair.second.addr.ToString(), mnpair.second.nPoSeBanScore);
+        auto itAddr = mapIndexAddr.find(mnv.addr);
+        if(itAddr != mapIndexAddr.end()) {
+            for (const auto& outpoint : itAddr->second) {
+                if(outpoint == mnv.vin1.prevout) continue;
+                CMasternode& mn = mapMasternodes.find(outpoint)->second;
+                mn.IncreasePoSeBanScore();
+                SetMasternodeDirtyDB(outpoint);
+                nCount++;
+                LogPrint("masternode", "CMasternodeMan::ProcessVerifyBroadcast -- increased PoSe ban score for %s addr %s, new score %d\n",
+                            outpoint.ToStringShort(), mn.addr.ToString(), mn.nPoSeBanScore);
+            }
         }
         if(nCount)
             LogPrintf("CMasternodeMan::ProcessVerifyBroadcast -- PoSe score increased for %d fake masternodes, addr %s\n",
@@ -1331,6 +1628,8 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb, CConnman& co
     LOCK2(cs_main, cs);
     mapSeenMasternodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
     mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), std::make_pair(GetTime(), mnb)));
+    SetSeenPingDirtyDB(mnb.lastPing.GetHash());
+    SetSeenBroadcastDirtyDB(mnb.GetHash());
 
     LogPrintf("CMasternodeMan::UpdateMasternodeList -- masternode=%s  addr=%s\n", mnb.vin.prevout.ToStringShort(), mnb.addr.ToString());
 
@@ -1341,9 +1640,14 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb, CConnman& co
         }
     } else {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-        if(pmn->UpdateFromNewBroadcast(mnb, connman)) {
+        RemoveFromIndexes(*pmn);
+        bool fUpdated = pmn->UpdateFromNewBroadcast(mnb, connman);
+        AddToIndexes(*pmn);
+        if(fUpdated) {
             masternodeSync.BumpAssetLastTime("CMasternodeMan::UpdateMasternodeList - seen");
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
+            SetSeenBroadcastDirtyDB(mnbOld.GetHash());
+            SetMasternodeDirtyDB(mnb.vin.prevout);
         }
     }
 }
@@ -1365,6 +1669,7 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
             if(GetTime() - mapSeenMasternodeBroadcast[hash].first > MASTERNODE_NEW_START_REQUIRED_SECONDS - MASTERNODE_MIN_MNP_SECONDS * 2) {
                 LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- masternode=%s seen update\n", mnb.vin.prevout.ToStringShort());
                 mapSeenMasternodeBroadcast[hash].first = GetTime();
+                SetSeenBroadcastDirtyDB(hash);
                 masternodeSync.BumpAssetLastTime("CMasternodeMan::CheckMnbAndUpdateMasternodeList - seen");
             }
             // did we ask this node for it?
@@ -1391,6 +1696,7 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
             return true;
         }
         mapSeenMasternodeBroadcast.insert(std::make_pair(hash, std::make_pair(GetTime(), mnb)));
+        SetSeenBroadcastDirtyDB(hash);
 
         LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- masternode=%s new\n", mnb.vin.prevout.ToStringShort());
 
@@ -1403,12 +1709,17 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
         CMasternode* pmn = Find(mnb.vin.prevout);
         if(pmn) {
             CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-            if(!mnb.Update(pmn, nDos, connman)) {
+            RemoveFromIndexes(*pmn);
+            bool fUpdated = mnb.Update(pmn, nDos, connman);
+            AddToIndexes(*pmn);
+            SetMasternodeDirtyDB(mnb.vin.prevout);
+            if(!fUpdated) {
                 LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- Update() failed, masternode=%s\n", mnb.vin.prevout.ToStringShort());
                 return false;
             }
             if(hash != mnbOld.GetHash()) {
                 mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
+                SetSeenBroadcastDirtyDB(mnbOld.GetHash());
             }
             return true;
         }
@@ -1456,7 +1767,14 @@ void CMasternodeMan::UpdateLastPaid(const CBlockIndex* pindex)
     //                         nCachedBlockHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
 
     for (auto& mnpair: mapMasternodes) {
+        int nBlockLastPaidOld = mnpair.second.GetLastPaidBlock();
         mnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+        if (mnpair.second.GetLastPaidBlock() != nBlockLastPaidOld) {
+            // keep payment queue order in sync
+            setLastPaidQueue.erase(std::make_pair(nBlockLastPaidOld, mnpair.first));
+            setLastPaidQueue.insert(std::make_pair(mnpair.second.GetLastPaidBlock(), mnpair.first));
+            SetMasternodeDirtyDB(mnpair.first);
+        }
     }
 
     IsFirstRun = false;
@@ -1470,6 +1788,7 @@ void CMasternodeMan::UpdateWatchdogVoteTime(const COutPoint& outpoint, uint64_t
         return;
     }
     pmn->UpdateWatchdogVoteTime(nVoteTime);
+    SetMasternodeDirtyDB(outpoint);
     nLastWatchdogVoteTime = GetTime();
 }
 
@@ -1488,6 +1807,7 @@ bool CMasternodeMan::AddGovernanceVote(const COutPoint& outpoint, uint256 nGover
         return false;
     }
     pmn->AddGovernanceVote(nGovernanceObjectHash);
+    SetMasternodeDirtyDB(outpoint);
     return true;
 }
 
@@ -1495,17 +1815,21 @@ void CMasternodeMan::RemoveGovernanceObject(uint256 nGovernanceObjectHash)
 {
     LOCK(cs);
     for(auto& mnpair : mapMasternodes) {
+        if(!mnpair.second.mapGovernanceObjectsVotedOn.count(nGovernanceObjectHash)) continue;
         mnpair.second.RemoveGovernanceObject(nGovernanceObjectHash);
+        SetMasternodeDirtyDB(mnpair.first);
     }
 }
 
 void CMasternodeMan::CheckMasternode(const CPubKey& pubKeyMasternode, bool fForce)
 {
     LOCK(cs);
-    for (auto& mnpair : mapMasternodes) {
-        if (mnpair.second.pubKeyMasternode == pubKeyMasternode) {
-            mnpair.second.Check(fForce);
-            return;
+    CMasternode* pmn = Find(pubKeyMasternode);
+    if (pmn) {
+        int nActiveStatePrev = pmn->nActiveState;
+        pmn->Check(fForce);
+        if (pmn->nActiveState != nActiveStatePrev) {
+            SetMasternodeDirtyDB(pmn->vin.prevout);
         }
     }
 }
@@ -1525,6 +1849,9 @@ void CMasternodeMan::SetMasternodeLastPing(const COutPoint& outpoint, const CMas
         return;
     }
     pmn->lastPing = mnp;
+    SetMasternodeDirtyDB(outpoint);
+    // a new ping may move the masternode to another state
+    ScheduleCheck(outpoint, GetAdjustedTime());
     // if masternode uses sentinel ping instead of watchdog
     // we shoud update nTimeLastWatchdogVote here if sentinel
     // ping flag is actual
@@ -1532,11 +1859,13 @@ void CMasternodeMan::SetMasternodeLastPing(const COutPoint& outpoint, const CMas
         UpdateWatchdogVoteTime(mnp.vin.prevout, mnp.sigTime);
     }
     mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
+    SetSeenPingDirtyDB(mnp.GetHash());
 
     CMasternodeBroadcast mnb(*pmn);
     uint256 hash = mnb.GetHash();
     if(mapSeenMasternodeBroadcast.count(hash)) {
         mapSeenMasternodeBroadcast[hash].second.lastPing = mnp;
+        SetSeenBroadcastDirtyDB(hash);
     }
 }
 
@@ -1545,6 +1874,15 @@ void CMasternodeMan::UpdatedBlockTip(const CBlockIndex *pindex)
     nCachedBlockHeight = pindex->nHeight;
     LogPrint("masternode", "CMasternodeMan::UpdatedBlockTip -- nCachedBlockHeight=%d\n", nCachedBlockHeight);
 
+    {
+        LOCK(cs);
+        // collateral heights may differ on the new branch after a reorg
+        if (!pindex->pprev || pindex->pprev->GetBlockHash() != hashCollateralHeightsTip) {
+            mapCollateralHeights.clear();
+        }
+        hashCollateralHeightsTip = pindex->GetBlockHash();
+    }
+
     CheckSameAddr();
 
     if(fMasterNode) {
@@ -8,10 +8,14 @@
 #include "masternode.h"
 #include "sync.h"
 
+#include <queue>
+
 using namespace std;
 
 class CMasternodeMan;
+class CCacheDB;
 class CConnman;
+class CDBBatch;
 
 extern CMasternodeMan mnodeman;
 
@@ -22,6 +26,8 @@ public:
     typedef std::vector<score_pair_t> score_pair_vec_t;
     typedef std::pair<int, CMasternode> rank_pair_t;
     typedef std::vector<rank_pair_t> rank_pair_vec_t;
+    typedef std::pair<int64_t, COutPoint> check_pair_t;
+    typedef std::priority_queue<check_pair_t, std::vector<check_pair_t>, std::greater<check_pair_t> > check_queue_t;
 
 private:
     static const std::string SERIALIZATION_VERSION_STRING;
@@ -50,6 +56,23 @@ private:
 
     // map to hold all MNs
     std::map<COutPoint, CMasternode> mapMasternodes;
+    // all MNs ordered by last paid block and then collateral outpoint, i.e. payment queue order
+    std::set<std::pair<int, COutPoint> > setLastPaidQueue;
+    // collateral height per MN, so payment queue checks don't need a UTXO lookup (reset on reorg).
+    // Entries don't need to be checked against the UTXO set: a collateral spent in a connected block
+    // gets its MN marked as spent by SyncTransaction, which drops the entry as well.
+    std::map<COutPoint, int> mapCollateralHeights;
+    // collateral payee script per MN, so payment queue checks don't rebuild it
+    std::map<COutPoint, CScript> mapCollateralPayees;
+    // secondary indexes: MNs by masternode key, collateral payee script and network address
+    std::map<CPubKey, std::set<COutPoint> > mapIndexPubKey;
+    std::map<CScript, std::set<COutPoint> > mapIndexPayee;
+    std::map<CService, std::set<COutPoint> > mapIndexAddr;
+    // tip the cached collateral heights are valid for
+    uint256 hashCollateralHeightsTip;
+    // when each MN is due for its next Check() and the same ordered by time (entries not matching mapNextCheck are outdated)
+    std::map<COutPoint, int64_t> mapNextCheck;
+    check_queue_t queueCheck;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -74,12 +97,38 @@ private:
 
     int64_t nLastWatchdogVoteTime;
 
+    // entries of mapMasternodes, mapSeenMasternodeBroadcast and mapSeenMasternodePing
+    // added, changed or erased since the last cache database flush
+    std::set<COutPoint> setDirtyMasternodes;
+    std::set<uint256> setDirtySeenMasternodeBroadcast;
+    std::set<uint256> setDirtySeenMasternodePing;
+
     friend class CMasternodeSync;
     /// Find an entry
     CMasternode* Find(const COutPoint& outpoint);
+    /// Find the entry with the lowest collateral outpoint for a masternode key / payee script
+    CMasternode* Find(const CPubKey& pubKeyMasternode);
+    CMasternode* Find(const CScript& payee);
 
     bool GetMasternodeScores(const uint256& nBlockHash, score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol = 0);
 
+    /// Rebuild lookup structures derived from mapMasternodes (after loading it from disk)
+    void RebuildIndexes();
+    /// Drop an entry from mapMasternodes together with its lookup structures
+    void Erase(std::map<COutPoint, CMasternode>::iterator it);
+    /// Add/remove an entry to/from the secondary indexes under its current pubKeyMasternode, payee and addr.
+    /// Anything that changes those fields must remove the entry first and add it back afterwards.
+    void AddToIndexes(const CMasternode& mn);
+    void RemoveFromIndexes(const CMasternode& mn);
+    /// (Re)schedule the next Check() of an entry
+    void ScheduleCheck(const COutPoint& outpoint, int64_t nTime);
+    /// Same as GetUTXOConfirmations but remembers the collateral height
+    int GetCollateralConfirmations(const COutPoint& outpoint);
+    /// Payee script of a masternode's collateral address, built once per entry
+    const CScript& GetCollateralPayee(const CMasternode& mn);
+    /// Whether a masternode can be picked from the payment queue, see GetNextMasternodeInQueueForPayment
+    bool IsQualifiedForPayment(CMasternode& mn, int nMnCount, bool fFilterSigTime, const std::set<CScript>& setScheduledPayees);
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, std::pair<int64_t, CMasternodeBroadcast> > mapSeenMasternodeBroadcast;
@@ -119,6 +168,9 @@ public:
         if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
             Clear();
         }
+        if(ser_action.ForRead()) {
+            RebuildIndexes();
+        }
     }
 
     CMasternodeMan();
@@ -134,8 +186,10 @@ public:
     bool AllowMixing(const COutPoint &outpoint);
     bool DisallowMixing(const COutPoint &outpoint);
 
-    /// Check all Masternodes
-    void Check();
+    /// Check the Masternodes which are due, see CMasternode::GetNextCheckTime. Returns how many were checked.
+    int Check();
+    /// Look up the collaterals of all Masternodes in the UTXO set, later spends are reported by SyncTransaction
+    void CheckCollaterals();
 
     /// Check all Masternodes and remove inactive
     void CheckAndRemove(CConnman& connman);
@@ -145,6 +199,16 @@ public:
     /// Clear Masternode vector
     void Clear();
 
+    /// Remember an entry which was added, changed or erased for the next cache database flush, cs must be held
+    void SetMasternodeDirtyDB(const COutPoint& outpoint) { setDirtyMasternodes.insert(outpoint); }
+    void SetSeenBroadcastDirtyDB(const uint256& hash) { setDirtySeenMasternodeBroadcast.insert(hash); }
+    void SetSeenPingDirtyDB(const uint256& hash) { setDirtySeenMasternodePing.insert(hash); }
+
+    /// Stage changes since the last flush (or everything if fAll) for the cache database
+    void WriteCacheDB(CCacheDB& db, CDBBatch& batch, bool fAll);
+    /// Load from the cache database, returns false if there was nothing stored or it could not be read
+    bool ReadCacheDB(CCacheDB& db);
+
     /// Count Masternodes filtered by nProtocolVersion.
     /// Masternode nProtocolVersion should match or be above the one specified in param here.
     int CountMasternodes(int nProtocolVersion = -1);
@@ -160,15 +224,22 @@ public:
     /// Versions of Find that are safe to use from outside the class
     bool Get(const COutPoint& outpoint, CMasternode& masternodeRet);
     bool Has(const COutPoint& outpoint);
+    /// Whether any known masternode is reachable at this IP, regardless of port
+    bool Has(const CNetAddr& addr);
 
     bool GetMasternodeInfo(const COutPoint& outpoint, masternode_info_t& mnInfoRet);
     bool GetMasternodeInfo(const CPubKey& pubKeyMasternode, masternode_info_t& mnInfoRet);
     bool GetMasternodeInfo(const CScript& payee, masternode_info_t& mnInfoRet);
 
-    /// Find an entry in the masternode list that is next to be paid
+    /// Find an entry in the masternode list that is next to be paid,
+    /// nCountRet is set to the number of qualified entries it had to look at
     bool GetNextMasternodeInQueueForPayment(int nBlockHeight, bool fFilterSigTime, int& nCountRet, masternode_info_t& mnInfoRet);
     /// Same as above but use current block height
     bool GetNextMasternodeInQueueForPayment(bool fFilterSigTime, int& nCountRet, masternode_info_t& mnInfoRet);
+    /// Count all entries the payee is picked from, this has to go through the whole list
+    int CountQualifiedForPayment(int nBlockHeight, bool fFilterSigTime);
+    /// Same as above but use current block height
+    int CountQualifiedForPayment(bool fFilterSigTime);
 
     /// Find a random entry
     masternode_info_t FindRandomNotInVec(const std::vector<COutPoint> &vecToExclude, int nProtocolVersion = -1);
@@ -228,6 +299,10 @@ public:
     void SetMasternodeLastPing(const COutPoint& outpoint, const CMasternodePing& mnp);
 
     void UpdatedBlockTip(const CBlockIndex *pindex);
+    /// Flag Masternodes whose collateral is spent by a transaction of a connected block
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+    int GetCachedBlockHeight() { return nCachedBlockHeight; }
 
     /**
      * Called to notify CGovernanceManager that the masternode index has been updated.
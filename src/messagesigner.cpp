@@ -4,11 +4,95 @@
 
 #include "base58.h"
 #include "hash.h"
+#include "memusage.h"
+#include "random.h"
+#include "util.h"
 #include "validation.h" // For strMessageMagic
 #include "messagesigner.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
+
+namespace {
+
+/**
+ * Entries are already salted with a nonce, no extra blinding is needed in the set hash.
+ */
+class CMessageSignatureCacheHasher
+{
+public:
+    size_t operator()(const uint256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Cache of compact signatures that were verified successfully, so masternode,
+ * governance and InstantSend messages seen again (relays, governance sync,
+ * payment vote checks) don't go through public key recovery every time.
+ * Works the same way as CSignatureCache in script/sigcache.cpp.
+ */
+class CMessageSignatureCache
+{
+private:
+    //! Entries are SHA256(nonce || hash || public key || signature):
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CMessageSignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_msgsigcache;
+    std::atomic<uint64_t> nHits;
+
+public:
+    CMessageSignatureCache() : nHits(0)
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_msgsigcache);
+        if(!setValid.count(entry)) return false;
+        ++nHits;
+        return true;
+    }
+
+    uint64_t GetHits() const
+    {
+        return nHits;
+    }
+
+    void Set(const uint256& entry)
+    {
+        size_t nMaxCacheSize = GetArg("-maxmsgsigcachesize", DEFAULT_MAX_MSG_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_msgsigcache);
+        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
+        {
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s)) {
+                setValid.erase(*it);
+            }
+        }
+
+        setValid.insert(entry);
+    }
+};
+
+CMessageSignatureCache messageSignatureCache;
+
+}
+
 bool CMessageSigner::GetKeysFromSecret(const std::string strSecret, CKey& keyRet, CPubKey& pubkeyRet)
 {
     CBitcoinSecret vchSecret;
@@ -46,6 +130,12 @@ bool CHashSigner::SignHash(const uint256& hash, const CKey key, std::vector<unsi
 
 bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
+    uint256 entry;
+    messageSignatureCache.ComputeEntry(entry, hash, vchSig, pubkey);
+    if(messageSignatureCache.Get(entry)) {
+        return true;
+    }
+
     CPubKey pubkeyFromSig;
     if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
         strErrorRet = "Error recovering public key.";
@@ -59,5 +149,11 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey pubkey, const st
         return false;
     }
 
+    messageSignatureCache.Set(entry);
     return true;
 }
+
+uint64_t CHashSigner::GetCacheHits()
+{
+    return messageSignatureCache.GetHits();
+}
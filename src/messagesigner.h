@@ -7,6 +7,9 @@
 
 #include "key.h"
 
+// Limit the verified message signature cache to 8MB (about 100000 entries on 64-bit systems).
+static const unsigned int DEFAULT_MAX_MSG_SIG_CACHE_SIZE = 8;
+
 /** Helper class for signing messages and checking their signatures
  */
 class CMessageSigner
@@ -27,8 +30,11 @@ class CHashSigner
 public:
     /// Sign the hash, returns true if successful
     static bool SignHash(const uint256& hash, const CKey key, std::vector<unsigned char>& vchSigRet);
-    /// Verify the hash signature, returns true if succcessful
+    /// Verify the hash signature, returns true if succcessful.
+    /// Successful verifications are cached, so checking the same (hash, pubkey, signature) again is cheap.
     static bool VerifyHash(const uint256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
+    /// Number of verifications answered from the cache so far
+    static uint64_t GetCacheHits();
 };
 
 #endif
@@ -30,7 +30,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
-#include <queue>
+#include <algorithm>
 
 using namespace std;
 
@@ -42,23 +42,12 @@ using namespace std;
 //
 // Unconfirmed transactions in the memory pool often depend on other
 // transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
+// pool, we select packages of a transaction and its unconfirmed ancestors
+// by their combined fee rate, so children can pay for their parents.
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-class ScoreCompare
-{
-public:
-    ScoreCompare() {}
-
-    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
-    {
-        return CompareTxMemPoolEntryByScore()(*b,*a); // Convert to less than
-    }
-};
-
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -74,13 +63,116 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+/**
+ * The transaction selection of the last block template, so the next template
+ * on the same tip only has to look at what entered the mempool since, as long
+ * as no entries were removed or had their fees changed and no package had to
+ * be left out for lack of space. Protected by cs_main.
+ */
+struct CBlockTemplateCache
+{
+    bool fValid;
+
+    // What the selection depended on besides the mempool
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockMinSize;
+
+    // The mempool the selection was made from
+    unsigned int nTransactionsChanged;
+    uint64_t nPoolSize;
+    // Time of the newest entry and the number of entries with that time or later
+    int64_t nTimeNewest;
+    uint64_t nCountNewest;
+
+    // The selected transactions, without the coinbase
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    CTxMemPool::setEntries inBlock;
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+
+    CBlockTemplateCache() : fValid(false) {}
+};
+
+static CBlockTemplateCache blockTemplateCache;
+
+struct CompareTxIterByAncestorFee {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    }
+};
+
+/** Count the mempool entries which entered at nTime or later, collecting them in pvEntries if given */
+static uint64_t GetMempoolEntriesSince(int64_t nTime, std::vector<CTxMemPool::txiter>* pvEntries)
+{
+    AssertLockHeld(mempool.cs);
+    uint64_t nCount = 0;
+    CTxMemPool::indexed_transaction_set::nth_index<2>::type::iterator it = mempool.mapTx.get<2>().end();
+    while (it != mempool.mapTx.get<2>().begin()) {
+        --it;
+        if (it->GetTime() < nTime)
+            break;
+        ++nCount;
+        if (pvEntries)
+            pvEntries->push_back(mempool.mapTx.project<0>(it));
+    }
+    return nCount;
+}
+
+BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
+    : fIncremental(false), chainparams(_chainparams)
+{
+    // Largest block you're willing to create:
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to between 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MaxBlockSize(fDIP0001ActiveAtTip)-1000), nBlockMaxSize));
+
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+}
+
+void BlockAssembler::resetBlock()
+{
+    inBlock.clear();
+
+    // Keep only the dummy coinbase tx
+    pblock->vtx.resize(1);
+    pblocktemplate->vTxFees.resize(1);
+    pblocktemplate->vTxSigOps.resize(1);
+
+    // Reserve space for coinbase tx
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+
+    // These counters do not include coinbase tx
+    nBlockTx = 0;
+    nFees = 0;
+
+    fBlockFull = false;
+}
+
+CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
 {
     // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    pblocktemplate.reset(new CBlockTemplate());
     if(!pblocktemplate.get())
         return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+    pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Add dummy coinbase tx as first transaction, filled in once the fees are known
+    pblock->vtx.emplace_back();
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+    resetBlock();
 
     // Create coinbase tx
     CMutableTransaction txNew;
@@ -89,234 +181,432 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
     txNew.vout.resize(1);
     txNew.vout[0].scriptPubKey = scriptPubKeyIn;
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to between 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MaxBlockSize(fDIP0001ActiveAtTip)-1000), nBlockMaxSize));
+    LOCK(cs_main);
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    nHeight = pindexPrev->nHeight + 1;
+    pblock->nTime = GetAdjustedTime();
+    const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+    pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (chainparams.MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                    ? nMedianTimePast
+                    : pblock->GetBlockTime();
+
+    CBlockTemplateCache& cache = blockTemplateCache;
+    unsigned int nTransactionsChanged;
+    uint64_t nPoolSize;
+    int64_t nTimeNewest = 0;
+    uint64_t nCountNewest = 0;
+    int64_t nTimeStart = GetTimeMicros();
+    {
+        LOCK(mempool.cs);
+
+        fIncremental = ResumeFromCache(cache);
+        // Only stored again once the new template passed TestBlockValidity
+        cache.fValid = false;
+
+        if (!fIncremental) {
+            resetBlock();
+            std::vector<CTxMemPool::txiter> vCandidates;
+            vCandidates.reserve(mempool.mapTx.size());
+            CTxMemPool::indexed_transaction_set::nth_index<4>::type::iterator mi = mempool.mapTx.get<4>().begin();
+            for (; mi != mempool.mapTx.get<4>().end(); ++mi)
+                vCandidates.push_back(mempool.mapTx.project<0>(mi));
+            addPackageTxs(vCandidates, false);
+        }
 
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+        nTransactionsChanged = mempool.GetTransactionsChanged();
+        nPoolSize = mempool.mapTx.size();
+        if (nPoolSize > 0) {
+            nTimeNewest = mempool.mapTx.get<2>().rbegin()->GetTime();
+            nCountNewest = GetMempoolEntriesSince(nTimeNewest, NULL);
+        }
+    }
+    int64_t nTimeSelected = GetTimeMicros();
+
+    // NOTE: unlike in bitcoin, we need to pass PREVIOUS block height here
+    CAmount blockReward = nFees + GetBlockSubsidy(pindexPrev->nBits, pindexPrev->nHeight, Params().GetConsensus());
+
+    // Compute regular coinbase transaction.
+    txNew.vout[0].nValue = blockReward;
+    txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
+
+    // Update coinbase transaction with additional info about masternode and governance payments,
+    // get some info back to pass to getblocktemplate
+    FillBlockPayments(txNew, nHeight, blockReward, pblock->txoutMasternode, pblock->voutSuperblock);
+    // LogPrintf("CreateNewBlock -- nBlockHeight %d blockReward %lld txoutMasternode %s txNew %s",
+    //             nHeight, blockReward, pblock->txoutMasternode.ToString(), txNew.ToString());
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
+    LogPrint("bench", "CreateNewBlock(): %s transaction selection: %.2fms\n", fIncremental ? "incremental" : "full", 0.001 * (nTimeSelected - nTimeStart));
+
+    // Update block coinbase
+    pblock->vtx[0] = MakeTransactionRef(std::move(txNew));
+    pblocktemplate->vTxFees[0] = -nFees;
+
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nNonce         = 0;
+    pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
 
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+    if (!fBlockFull) {
+        cache.hashPrevBlock = pblock->hashPrevBlock;
+        cache.nHeight = nHeight;
+        cache.nLockTimeCutoff = nLockTimeCutoff;
+        cache.nBlockMaxSize = nBlockMaxSize;
+        cache.nBlockMinSize = nBlockMinSize;
+        cache.nTransactionsChanged = nTransactionsChanged;
+        cache.nPoolSize = nPoolSize;
+        cache.nTimeNewest = nTimeNewest;
+        cache.nCountNewest = nCountNewest;
+        cache.vtx.assign(pblock->vtx.begin() + 1, pblock->vtx.end());
+        cache.vTxFees.assign(pblocktemplate->vTxFees.begin() + 1, pblocktemplate->vTxFees.end());
+        cache.vTxSigOps.assign(pblocktemplate->vTxSigOps.begin() + 1, pblocktemplate->vTxSigOps.end());
+        cache.inBlock = inBlock;
+        cache.nBlockSize = nBlockSize;
+        cache.nBlockTx = nBlockTx;
+        cache.nBlockSigOps = nBlockSigOps;
+        cache.nFees = nFees;
+        cache.fValid = true;
+    }
 
-    // Collect memory pool transactions into the block
-    CTxMemPool::setEntries inBlock;
-    CTxMemPool::setEntries waitSet;
+    return pblocktemplate.release();
+}
 
-    // This vector will be sorted into a priority queue:
-    vector<TxCoinAgePriority> vecPriority;
-    TxCoinAgePriorityCompare pricomparer;
-    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
-    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
-    double actualPriority = -1;
+bool BlockAssembler::ResumeFromCache(CBlockTemplateCache& cache)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    if (!cache.fValid ||
+        cache.hashPrevBlock != chainActive.Tip()->GetBlockHash() ||
+        cache.nHeight != nHeight ||
+        cache.nLockTimeCutoff != nLockTimeCutoff ||
+        cache.nBlockMaxSize != nBlockMaxSize ||
+        cache.nBlockMinSize != nBlockMinSize ||
+        cache.nTransactionsChanged != mempool.GetTransactionsChanged() ||
+        cache.nPoolSize > mempool.mapTx.size())
+        return false;
+
+    // With nothing removed, every entry the last selection didn't see is one
+    // of the entries from nTimeNewest on which weren't there yet. Anything
+    // accepted with an older time (e.g. loaded from mempool.dat) is caught by
+    // the count and needs a full selection.
+    std::vector<CTxMemPool::txiter> vNewest;
+    uint64_t nCountNewest = GetMempoolEntriesSince(cache.nTimeNewest, &vNewest);
+    if (nCountNewest != cache.nCountNewest + (mempool.mapTx.size() - cache.nPoolSize))
+        return false;
+
+    // Entries already looked at last time are considered again, which gives
+    // the same result as before for them.
+    std::vector<CTxMemPool::txiter> vCandidates;
+    BOOST_FOREACH(CTxMemPool::txiter it, vNewest) {
+        if (!cache.inBlock.count(it))
+            vCandidates.push_back(it);
+    }
+    std::sort(vCandidates.begin(), vCandidates.end(), CompareTxIterByAncestorFee());
+
+    pblock->vtx.insert(pblock->vtx.end(), cache.vtx.begin(), cache.vtx.end());
+    pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), cache.vTxFees.begin(), cache.vTxFees.end());
+    pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), cache.vTxSigOps.begin(), cache.vTxSigOps.end());
+    inBlock = cache.inBlock;
+    nBlockSize = cache.nBlockSize;
+    nBlockTx = cache.nBlockTx;
+    nBlockSigOps = cache.nBlockSigOps;
+    nFees = cache.nFees;
+
+    return addPackageTxs(vCandidates, true);
+}
 
-    std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
-    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-    uint64_t nBlockSize = 1000;
-    uint64_t nBlockTx = 0;
-    unsigned int nBlockSigOps = 100;
-    int lastFewTxs = 0;
-    CAmount nFees = 0;
+void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+{
+    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
+        // Only test txs not already in the block
+        if (inBlock.count(*iit)) {
+            testSet.erase(iit++);
+        }
+        else {
+            iit++;
+        }
+    }
+}
 
-    {
-        LOCK(cs_main);
+bool BlockAssembler::TestPackage(uint64_t packageSize, unsigned int packageSigOps)
+{
+    if (nBlockSize + packageSize >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + packageSigOps >= MaxBlockSigOps(fDIP0001ActiveAtTip))
+        return false;
+    return true;
+}
 
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        pblock->nTime = GetAdjustedTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-
-        // Add our coinbase tx as first transaction
-        pblock->vtx.push_back(txNew);
-        pblocktemplate->vTxFees.push_back(-1); // updated at end
-        pblocktemplate->vTxSigOps.push_back(-1); // updated at end
-        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
-        // -regtest only: allow overriding block.nVersion with
-        // -blockversion=N to test forking scenarios
-        if (chainparams.MineBlocksOnDemand())
-            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
-
-        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                ? nMedianTimePast
-                                : pblock->GetBlockTime();
-
-        {
-            LOCK(mempool.cs);
-
-            bool fPriorityBlock = nBlockPrioritySize > 0;
-            if (fPriorityBlock) {
-                vecPriority.reserve(mempool.mapTx.size());
-                for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                     mi != mempool.mapTx.end(); ++mi)
-                {
-                    double dPriority = mi->GetPriority(nHeight);
-                    CAmount dummy;
-                    mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-                    vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-                }
-                std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-            }
+bool BlockAssembler::TestPackageFinality(const CTxMemPool::setEntries& package)
+{
+    BOOST_FOREACH (const CTxMemPool::txiter it, package) {
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+    }
+    return true;
+}
 
-            CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
-            CTxMemPool::txiter iter;
+void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
+{
+    // Added; the block shares the mempool's allocation of tx
+    pblock->vtx.push_back(iter->GetSharedTx());
+    pblocktemplate->vTxFees.push_back(iter->GetFee());
+    pblocktemplate->vTxSigOps.push_back(iter->GetSigOpCount());
+    nBlockSize += iter->GetTxSize();
+    ++nBlockTx;
+    nBlockSigOps += iter->GetSigOpCount();
+    nFees += iter->GetFee();
+    inBlock.insert(iter);
 
-            while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
-            {
-                bool priorityTx = false;
-                if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
-                    priorityTx = true;
-                    iter = vecPriority.front().second;
-                    actualPriority = vecPriority.front().first;
-                    std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                    vecPriority.pop_back();
-                }
-                else if (clearedTxs.empty()) { // add tx with next highest score
-                    iter = mempool.mapTx.project<0>(mi);
-                    mi++;
-                }
-                else {  // try to add a previously postponed child tx
-                    iter = clearedTxs.top();
-                    clearedTxs.pop();
-                }
+    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+    if (fPrintPriority) {
+        double dPriority = iter->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority,
+                  CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
+                  iter->GetTx().GetHash().ToString());
+    }
+}
 
-                if (inBlock.count(iter))
-                    continue; // could have been added to the priorityBlock
+void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+        indexed_modified_transaction_set &mapModifiedTx)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
 
-                const CTransaction& tx = iter->GetTx();
+void BlockAssembler::UpdatePackagesForCandidates(const std::vector<CTxMemPool::txiter>& vCandidates,
+        indexed_modified_transaction_set &mapModifiedTx)
+{
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    BOOST_FOREACH(const CTxMemPool::txiter it, vCandidates) {
+        CTxMemPool::setEntries ancestors;
+        mempool.CalculateMemPoolAncestors(*it, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        BOOST_FOREACH(const CTxMemPool::txiter ancestor, ancestors) {
+            if (!inBlock.count(ancestor))
+                continue;
+            modtxiter mit = mapModifiedTx.find(it);
+            if (mit == mapModifiedTx.end())
+                mit = mapModifiedTx.insert(CTxMemPoolModifiedEntry(it)).first;
+            mapModifiedTx.modify(mit, update_for_parent_inclusion(ancestor));
+        }
+    }
+}
 
-                bool fOrphan = false;
-                BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
-                {
-                    if (!inBlock.count(parent)) {
-                        fOrphan = true;
-                        break;
-                    }
-                }
-                if (fOrphan) {
-                    if (priorityTx)
-                        waitPriMap.insert(std::make_pair(iter,actualPriority));
-                    else
-                        waitSet.insert(iter);
-                    continue;
-                }
+// Skip entries in mapTx that are already in a block or are present
+// in mapModifiedTx (which implies that the mapTx ancestor state is
+// stale due to ancestor inclusion in the block)
+// Also skip transactions that we've already failed to add. This can happen if
+// we consider a transaction in mapModifiedTx and it fails: we can then
+// potentially consider it again while walking mapTx.  It's currently
+// guaranteed to fail again, but as a belt-and-suspenders check we put it in
+// failedTx and avoid re-evaluation, since the re-evaluation would be using
+// cached size/sigops/fee values that are not actually correct.
+bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
+{
+    assert (it != mempool.mapTx.end());
+    if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
+        return true;
+    return false;
+}
 
-                unsigned int nTxSize = iter->GetTxSize();
-                if (fPriorityBlock &&
-                    (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
-                    fPriorityBlock = false;
-                    waitPriMap.clear();
-                }
-                if (!priorityTx &&
-                    (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
-                    break;
-                }
-                if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                    if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-                        break;
-                    }
-                    // Once we're within 1000 bytes of a full block, only look at 50 more txs
-                    // to try to fill the remaining space.
-                    if (nBlockSize > nBlockMaxSize - 1000) {
-                        lastFewTxs++;
-                    }
-                    continue;
-                }
+void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
+{
+    // Sort package by ancestor count
+    // If a transaction A depends on transaction B, then A's ancestor count
+    // must be greater than B's.  So this is sufficient to validly order the
+    // transactions for block inclusion.
+    sortedEntries.clear();
+    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+}
 
-                if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
-                    continue;
+// This transaction selection algorithm orders the mempool based
+// on feerate of a transaction including all unconfirmed ancestors.
+// Since we don't remove transactions from the mempool as we select them
+// for block inclusion, we need an alternate method of updating the feerate
+// of a transaction with its not-yet-selected ancestors as we go.
+// This is accomplished by walking the candidates in ancestor feerate order,
+// and storing a set of "modified" entries for transactions whose ancestors
+// have been included in the block, sorted the same way. Each time through
+// the loop we compare the best transaction in mapModifiedTx with the next
+// candidate to see which one should be considered next.
+bool BlockAssembler::addPackageTxs(const std::vector<CTxMemPool::txiter>& vCandidates, bool fIncremental)
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+    // Keep track of entries that failed inclusion, to avoid duplicate work
+    CTxMemPool::setEntries failedTx;
+
+    // When extending a previous selection, account for the candidates'
+    // ancestors which are already in the block
+    if (fIncremental)
+        UpdatePackagesForCandidates(vCandidates, mapModifiedTx);
+
+    std::vector<CTxMemPool::txiter>::const_iterator mi = vCandidates.begin();
+    CTxMemPool::txiter iter;
+
+    // Limit the number of attempts to add transactions to the block when it is
+    // close to full; this is just a simple heuristic to finish quickly if the
+    // mempool has a lot of entries.
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    while (mi != vCandidates.end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != vCandidates.end() &&
+                SkipMapTxEntry(*mi, mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
 
-                unsigned int nTxSigOps = iter->GetSigOpCount();
-                unsigned int nMaxBlockSigOps = MaxBlockSigOps(fDIP0001ActiveAtTip);
-                if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps) {
-                    if (nBlockSigOps > nMaxBlockSigOps - 2) {
-                        break;
-                    }
-                    continue;
-                }
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<1>().begin();
+        if (mi == vCandidates.end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = *mi;
+            if (modit != mapModifiedTx.get<1>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
+            }
+        }
 
-                CAmount nTxFees = iter->GetFee();
-                // Added
-                pblock->vtx.push_back(tx);
-                pblocktemplate->vTxFees.push_back(nTxFees);
-                pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-                nBlockSize += nTxSize;
-                ++nBlockTx;
-                nBlockSigOps += nTxSigOps;
-                nFees += nTxFees;
-
-                if (fPrintPriority)
-                {
-                    double dPriority = iter->GetPriority(nHeight);
-                    CAmount dummy;
-                    mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-                    LogPrintf("priority %.1f fee %s txid %s\n",
-                              dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-                }
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOps = modit->nSigOpCountWithAncestors;
+        }
 
-                inBlock.insert(iter);
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize) {
+            // Everything else we might consider has a lower fee rate
+            return true;
+        }
 
-                // Add transactions that depend on this one to the priority queue
-                BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
-                {
-                    if (fPriorityBlock) {
-                        waitPriIter wpiter = waitPriMap.find(child);
-                        if (wpiter != waitPriMap.end()) {
-                            vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                            waitPriMap.erase(wpiter);
-                        }
-                    }
-                    else {
-                        if (waitSet.count(child)) {
-                            clearedTxs.push(child);
-                            waitSet.erase(child);
-                        }
-                    }
-                }
+        if (!TestPackage(packageSize, packageSigOps)) {
+            // From here on the selection depends on the order the packages
+            // were considered in, which only a full selection reproduces
+            fBlockFull = true;
+            if (fIncremental)
+                return false;
+
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
             }
 
+            ++nConsecutiveFailed;
+
+            if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize > nBlockMaxSize - 1000) {
+                // Give up if we're close to full and haven't succeeded in a while
+                break;
+            }
+            continue;
         }
 
-        // NOTE: unlike in bitcoin, we need to pass PREVIOUS block height here
-        CAmount blockReward = nFees + GetBlockSubsidy(pindexPrev->nBits, pindexPrev->nHeight, Params().GetConsensus());
-
-        // Compute regular coinbase transaction.
-        txNew.vout[0].nValue = blockReward;
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
-
-        // Update coinbase transaction with additional info about masternode and governance payments,
-        // get some info back to pass to getblocktemplate
-        FillBlockPayments(txNew, nHeight, blockReward, pblock->txoutMasternode, pblock->voutSuperblock);
-        // LogPrintf("CreateNewBlock -- nBlockHeight %d blockReward %lld txoutMasternode %s txNew %s",
-        //             nHeight, blockReward, pblock->txoutMasternode.ToString(), txNew.ToString());
-
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
-
-        // Update block coinbase
-        pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -nFees;
-
-        // Fill in header
-        pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-        UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-        pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-        pblock->nNonce         = 0;
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
-
-        CValidationState state;
-        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        // Test if all tx's are Final
+        if (!TestPackageFinality(ancestors)) {
+            if (fUsingModified) {
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
         }
+
+        // This transaction will make it in; reset the failed counter.
+        nConsecutiveFailed = 0;
+
+        // Package can be added. Sort the entries in a valid order.
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, sortedEntries);
+
+        for (size_t i = 0; i < sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+            // Erase from the modified set, if present
+            mapModifiedTx.erase(sortedEntries[i]);
+        }
+
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
+    return true;
+}
 
-    return pblocktemplate.release();
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    return BlockAssembler(chainparams).CreateNewBlock(scriptPubKeyIn);
 }
 
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
@@ -330,11 +620,11 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
+    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
 
@@ -380,7 +670,7 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams)
 {
     LogPrintf("%s\n", pblock->ToString());
-    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue));
+    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0]->vout[0].nValue));
 
     // Found a solution
     {
@@ -455,6 +745,8 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
             //
             int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+            // Only nTime, nBits and nNonce change below, so the Skein prefix state can be reused
+            const CSkunkHeaderHasher hasher(*pblock);
             while (true)
             {
                 unsigned int nHashesDone = 0;
@@ -462,7 +754,7 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
                 uint256 hash;
                 while (true)
                 {
-                    hash = pblock->GetHash();
+                    hash = hasher.GetHash(*pblock);
                     if (UintToArith256(hash) <= hashTarget)
                     {
                         // Found a solution
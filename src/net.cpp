@@ -33,6 +33,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -49,6 +53,12 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// How long the socket handler waits for socket events before doing its housekeeping (ms)
+#define SOCKET_WAIT_TIMEOUT 50
+
+// Maximum number of events fetched by one epoll_wait() call
+#define MAX_SOCKET_EVENTS 256
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -81,7 +91,7 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 std::string strSubVersion;
 
-std::map<CInv, CDataStream> mapRelay;
+std::map<CInv, CSerializedNetMsgRef> mapRelay;
 std::deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -425,8 +435,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         }
 
         GetNodeSignals().InitializeNode(pnode, *this);
-        LOCK(cs_vNodes);
-        vNodes.push_back(pnode);
+        RegisterNode(pnode);
 
         return pnode;
     } else if (!proxyConnectionFailed) {
@@ -809,11 +818,11 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializedNetMsgRef>::iterator it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSerializeData &data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -850,6 +859,7 @@ size_t CConnman::SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    UpdateSendEvents(pnode);
     return nSentSize;
 }
 
@@ -1099,50 +1109,69 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint("net", "connection from %s accepted\n", addr.ToString());
 
+    RegisterNode(pnode);
+}
+
+void CConnman::RegisterNode(CNode* pnode)
+{
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    // Registered only once the node is in vNodes: a failure disconnects it, and the sweep has to find it there
+    AddSocketEvents(pnode);
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet)
+    // Nodes marked after the flag is cleared raise it again for the next round
+    if (!CNodeDisconnectFlag::fPending.exchange(false))
+        return;
+
+    LOCK(cs_vNodes);
+    // Disconnect unused nodes
+    std::vector<CNode*> vNodesCopy = vNodes;
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
     {
-        //
-        // Disconnect nodes
-        //
+        if (pnode->fDisconnect)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-            {
-                if (pnode->fDisconnect)
-                {
-                    LogPrintf("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fNetworkNode=%d fInbound=%d fMasternode=%d\n",
-                              pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fNetworkNode, pnode->fInbound, pnode->fMasternode);
+            LogPrintf("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fNetworkNode=%d fInbound=%d fMasternode=%d\n",
+                      pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fNetworkNode, pnode->fInbound, pnode->fMasternode);
 
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+            // remove from vNodes
+            vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
-                    pnode->grantMasternodeOutbound.Release();
+            // release outbound grant (if any)
+            pnode->grantOutbound.Release();
+            pnode->grantMasternodeOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+            // close socket and cleanup
+            pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    if (pnode->fMasternode)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
-            }
+            // hold in disconnected pool until all refs are released
+            if (pnode->fNetworkNode || pnode->fInbound)
+                pnode->Release();
+            if (pnode->fMasternode)
+                pnode->Release();
+            vNodesDisconnected.push_back(pnode);
         }
+    }
+}
+
+std::atomic_bool CNodeDisconnectFlag::fPending(false);
+
+void CConnman::ThreadSocketHandler()
+{
+    unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    int64_t nLastInactivityCheck = 0;
+#endif
+    while (!interruptNet)
+    {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes();
         {
             // Delete disconnected nodes
             std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
@@ -1180,12 +1209,27 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
+#ifdef USE_EPOLL
+        SocketEvents();
+        if (interruptNet)
+            return;
+
+        // Nothing else needs a sweep over all peers, do timeouts once a second
+        int64_t nTime = GetSystemTimeInSeconds();
+        if (nTime != nLastInactivityCheck) {
+            nLastInactivityCheck = nTime;
+            std::vector<CNode*> vNodesCopy = CopyNodeVector();
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                InactivityCheck(pnode);
+            ReleaseNodeVector(vNodesCopy);
+        }
+#else
         //
         // Find which sockets have data to receive
         //
         struct timeval timeout;
         timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+        timeout.tv_usec = SOCKET_WAIT_TIMEOUT * 1000; // frequency to poll pnode->vSend
 
         fd_set fdsetRecv;
         fd_set fdsetSend;
@@ -1284,56 +1328,7 @@ void CConnman::ThreadSocketHandler()
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
-            {
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                                pnode->CloseSocketDisconnect();
-                            RecordBytesRecv(nBytes);
-                            if (notify) {
-                                size_t nSizeAdded = 0;
-                                auto it(pnode->vRecvMsg.begin());
-                                for (; it != pnode->vRecvMsg.end(); ++it) {
-                                    if (!it->complete())
-                                        break;
-                                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                                }
-                                {
-                                    LOCK(pnode->cs_vProcessMsg);
-                                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                                    pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                                }
-                                WakeMessageHandler();
-                            }
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+                SocketRecvData(pnode);
 
             //
             // Send
@@ -1354,35 +1349,273 @@ void CConnman::ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
+            InactivityCheck(pnode);
+        }
+        ReleaseNodeVector(vNodesCopy);
+#endif // USE_EPOLL
+    }
+}
+
+bool CConnman::SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
+        }
+        return true;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+bool CConnman::InitSocketEvents(std::string& strError)
+{
+#ifdef USE_EPOLL
+    hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpoll == -1) {
+        strError = strprintf("Failed to create epoll instance: %s", NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    if (pipe2(hWakePipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        strError = strprintf("Failed to create wakeup pipe: %s", NetworkErrorString(WSAGetLastError()));
+        CloseSocketEvents();
+        return false;
+    }
+
+    // The wakeup pipe and the listening sockets stay level-triggered,
+    // they are told apart from peers by their data pointer
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hWakePipe[0], &event) != 0) {
+        strError = strprintf("Failed to register wakeup pipe: %s", NetworkErrorString(WSAGetLastError()));
+        CloseSocketEvents();
+        return false;
+    }
+    BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+        event.events = EPOLLIN;
+        event.data.ptr = &hListenSocket;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+            strError = strprintf("Failed to register listening socket: %s", NetworkErrorString(WSAGetLastError()));
+            CloseSocketEvents();
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void CConnman::CloseSocketEvents()
+{
+#ifdef USE_EPOLL
+    BOOST_FOREACH(CNode* pnode, vNodesRecvReady) {
+        pnode->fRecvReady = false;
+        pnode->Release();
+    }
+    vNodesRecvReady.clear();
+    if (hEpoll != -1)
+        close(hEpoll);
+    if (hWakePipe[0] != -1)
+        close(hWakePipe[0]);
+    if (hWakePipe[1] != -1)
+        close(hWakePipe[1]);
+#endif
+    hEpoll = -1;
+    hWakePipe[0] = hWakePipe[1] = -1;
+}
+
+void CConnman::AddSocketEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    // Edge-triggered: we are told once when data arrives and have to read until EWOULDBLOCK.
+    // EPOLLOUT is only added while the send queue is not empty, see UpdateSendEvents.
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("AddSocketEvents -- failed to register socket of peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+        pnode->CloseSocketDisconnect();
+    }
+#endif
+}
+
+// requires LOCK(cs_vSend)
+void CConnman::UpdateSendEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    bool fWantSend = !pnode->vSendMsg.empty();
+    if (fWantSend == pnode->fSendEvents || pnode->hSocket == INVALID_SOCKET)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (fWantSend ? (uint32_t)EPOLLOUT : 0u);
+    event.data.ptr = pnode;
+    // The change applies to a concurrent epoll_wait() right away, no wakeup needed
+    if (epoll_ctl(hEpoll, EPOLL_CTL_MOD, pnode->hSocket, &event) == 0)
+        pnode->fSendEvents = fWantSend;
+#endif
+}
+
+void CConnman::WakeSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (hWakePipe[1] == -1)
+        return;
+    char buf = 0;
+    // a full pipe means a wakeup is pending already
+    if (write(hWakePipe[1], &buf, 1) != 1) {}
+#endif
+}
+
+void CConnman::SocketEvents()
+{
+#ifdef USE_EPOLL
+    // Peers which still have data buffered will not be reported again, don't wait if any can be read from
+    bool fRecvPending = false;
+    BOOST_FOREACH(CNode* pnode, vNodesRecvReady) {
+        if (!pnode->fPauseRecv) {
+            fRecvPending = true;
+            break;
+        }
+    }
+
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(hEpoll, events, MAX_SOCKET_EVENTS, fRecvPending ? 0 : SOCKET_WAIT_TIMEOUT);
+    if (interruptNet)
+        return;
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_WAIT_TIMEOUT));
+        }
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        void* ptr = events[i].data.ptr;
+        if (ptr == NULL) {
+            char buf[128];
+            while (read(hWakePipe[0], buf, sizeof(buf)) > 0) {}
+            continue;
+        }
+
+        bool fListenSocket = false;
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            if (&hListenSocket == ptr) {
+                AcceptConnection(hListenSocket);
+                fListenSocket = true;
+                break;
+            }
+        }
+        if (fListenSocket)
+            continue;
+
+        // Nodes are only deleted by this thread and only after their socket was closed,
+        // which removes it from the epoll set, so the pointer is still valid here
+        CNode* pnode = static_cast<CNode*>(ptr);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            if (!pnode->fRecvReady) {
+                pnode->fRecvReady = true;
+                pnode->AddRef();
+                vNodesRecvReady.push_back(pnode);
+            }
+        }
+        if (events[i].events & EPOLLOUT) {
+            // no TRY_LOCK: the edge is not reported again if we miss it
+            LOCK(pnode->cs_vSend);
+            if (pnode->hSocket != INVALID_SOCKET) {
+                size_t nBytes = SocketSendData(pnode);
+                if (nBytes) {
+                    RecordBytesSent(nBytes);
                 }
             }
         }
-        ReleaseNodeVector(vNodesCopy);
     }
+
+    // Read one chunk from every peer with buffered data, peers stay in the list until they would block.
+    // Paused peers keep their place and are read from again once the message handler caught up.
+    std::vector<CNode*> vNodesStillReady;
+    vNodesStillReady.reserve(vNodesRecvReady.size());
+    BOOST_FOREACH(CNode* pnode, vNodesRecvReady) {
+        if (!interruptNet && pnode->hSocket != INVALID_SOCKET && (pnode->fPauseRecv || SocketRecvData(pnode))) {
+            vNodesStillReady.push_back(pnode);
+        } else {
+            pnode->fRecvReady = false;
+            pnode->Release();
+        }
+    }
+    vNodesRecvReady.swap(vNodesStillReady);
+#endif
 }
 
+
 void CConnman::WakeMessageHandler()
 {
     {
@@ -2145,6 +2378,8 @@ CConnman::CConnman()
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    hEpoll = -1;
+    hWakePipe[0] = hWakePipe[1] = -1;
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2237,6 +2472,9 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         fMsgProcWake = false;
     }
 
+    if (!InitSocketEvents(strNodeError))
+        return false;
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2295,6 +2533,7 @@ void CConnman::Interrupt()
     condMsgProc.notify_all();
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound)
@@ -2316,6 +2555,7 @@ void CConnman::Stop()
         threadDNSAddressSeed.join();
     if (threadSocketHandler.joinable())
         threadSocketHandler.join();
+    CloseSocketEvents();
 
     if (semMasternodeOutbound)
         for (int i=0; i<MAX_OUTBOUND_MASTERNODE_CONNECTIONS; i++)
@@ -2496,19 +2736,7 @@ void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss)
     int nInv = static_cast<bool>(CPrivateSend::GetDSTX(hash)) ? MSG_DSTX :
                 (instantsend.HasTxLockRequest(hash) ? MSG_TXLOCK_REQUEST : MSG_TX);
     CInv inv(nInv, hash);
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
-
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
+    SaveRelayMessage(inv, ss);
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
@@ -2531,6 +2759,29 @@ void CConnman::RelayInv(CInv &inv, const int minProtoVersion) {
             pnode->PushInventory(inv);
 }
 
+void CConnman::RelayInv(CInv &inv, const CDataStream& ssPayload, const int minProtoVersion) {
+    SaveRelayMessage(inv, ssPayload);
+    RelayInv(inv, minProtoVersion);
+}
+
+void CConnman::SaveRelayMessage(const CInv& inv, const CDataStream& ssPayload)
+{
+    // Frame the message once, every getdata for it shares this buffer
+    CSerializedNetMsgRef msg = MakeSharedMessage(inv.GetCommand(), ssPayload);
+
+    LOCK(cs_mapRelay);
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
+    {
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    // Save original serialized message so newer versions are preserved
+    mapRelay.insert(std::make_pair(inv, msg));
+    vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+}
+
 void CConnman::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -2727,6 +2978,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nLocalServices = nLocalServicesIn;
     fPauseRecv = false;
     fPauseSend = false;
+    fSendEvents = false;
+    fRecvReady = false;
     nProcessQueueSize = 0;
 
     GetRandBytes((unsigned char*)&nLocalHostNonce, sizeof(nLocalHostNonce));
@@ -2847,7 +3100,24 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
     if(strm.empty())
         return;
 
-    unsigned int nSize = strm.size() - CMessageHeader::HEADER_SIZE;
+    PushSharedMessage(pnode, std::make_shared<const CSerializeData>(strm.begin(), strm.end()), sCommand);
+}
+
+CSerializedNetMsgRef CConnman::MakeSharedMessage(const std::string& sCommand, const CDataStream& ssPayload)
+{
+    CDataStream strm(SER_NETWORK, PROTOCOL_VERSION, CMessageHeader(Params().MessageStart(), sCommand.c_str(), 0));
+    strm.reserve(CMessageHeader::HEADER_SIZE + ssPayload.size());
+    strm += ssPayload;
+    EndMessage(strm);
+    return std::make_shared<const CSerializeData>(strm.begin(), strm.end());
+}
+
+void CConnman::PushSharedMessage(CNode* pnode, const CSerializedNetMsgRef& msg, const std::string& sCommand)
+{
+    if(!msg || msg->empty())
+        return;
+
+    unsigned int nSize = msg->size() - CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(sCommand.c_str()), nSize, pnode->id);
 
     size_t nBytesSent = 0;
@@ -2857,11 +3127,11 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
             return;
         }
         bool optimisticSend(pnode->vSendMsg.empty());
-        pnode->vSendMsg.emplace_back(strm.begin(), strm.end());
+        pnode->vSendMsg.push_back(msg);
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[sCommand] += strm.size();
-        pnode->nSendSize += strm.size();
+        pnode->mapSendBytesPerMsgCmd[sCommand] += msg->size();
+        pnode->nSendSize += msg->size();
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
@@ -93,6 +93,9 @@ static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 10;  // Default 10
 
 typedef int NodeId;
 
+/** A complete serialized message (header and payload). Immutable, so one copy can sit in several send queues. */
+typedef std::shared_ptr<const CSerializeData> CSerializedNetMsgRef;
+
 struct AddedNodeInfo
 {
     std::string strAddedNode;
@@ -107,6 +110,7 @@ class CClientUIInterface;
 
 class CConnman
 {
+    friend struct CConnmanTest;
 public:
 
     enum NumConnections {
@@ -307,6 +311,12 @@ public:
     void RelayTransaction(const CTransaction& tx);
     void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
     void RelayInv(CInv &inv, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
+    /** Announce inv and keep ssPayload framed in mapRelay, so every getdata for it shares one buffer */
+    void RelayInv(CInv &inv, const CDataStream& ssPayload, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
+
+    /** Frame a payload as a complete message which can be pushed to any number of peers without copying */
+    CSerializedNetMsgRef MakeSharedMessage(const std::string& sCommand, const CDataStream& ssPayload);
+    void PushSharedMessage(CNode* pnode, const CSerializedNetMsgRef& msg, const std::string& sCommand);
 
     // Addrman functions
     size_t GetAddressCount() const;
@@ -388,6 +398,9 @@ public:
 
 
     unsigned int GetReceiveFloodSize() const;
+
+    /** Interrupt the socket handler's wait, e.g. when a peer may be read from again */
+    void WakeSocketHandler();
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -401,11 +414,24 @@ private:
     void ThreadOpenConnections();
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
+    /** Add a new node to vNodes and register its socket */
+    void RegisterNode(CNode* pnode);
+    /** Remove the nodes marked for disconnection from vNodes, if any are */
+    void DisconnectNodes();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
     void ThreadMnbRequestConnections();
 
     void WakeMessageHandler();
+    void SaveRelayMessage(const CInv& inv, const CDataStream& ssPayload);
+
+    bool InitSocketEvents(std::string& strError);
+    void CloseSocketEvents();
+    void AddSocketEvents(CNode* pnode);
+    void UpdateSendEvents(CNode* pnode);
+    void SocketEvents();
+    bool SocketRecvData(CNode* pnode);
+    void InactivityCheck(CNode* pnode);
 
     CNode* FindNode(const CNetAddr& ip);
     CNode* FindNode(const CSubNet& subNet);
@@ -502,6 +528,12 @@ private:
 
     CThreadInterrupt interruptNet;
 
+    /** epoll instance and the pipe used to wake up the socket handler, -1 when not in use */
+    int hEpoll;
+    int hWakePipe[2];
+    /** Peers with unread data, edge-triggered epoll won't report them again. Socket handler only. */
+    std::vector<CNode*> vNodesRecvReady;
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
@@ -574,7 +606,7 @@ extern bool fDiscover;
 extern bool fListen;
 extern bool fRelayTxes;
 
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSerializedNetMsgRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
@@ -660,6 +692,31 @@ public:
 };
 
 
+/** Disconnect flag of a peer. Setting it also raises fPending, so the socket
+ * handler only walks the node list when some node is waiting to be removed.
+ */
+class CNodeDisconnectFlag
+{
+private:
+    std::atomic_bool fValue;
+
+public:
+    static std::atomic_bool fPending;
+
+    CNodeDisconnectFlag() : fValue(false) {}
+
+    CNodeDisconnectFlag& operator=(bool fValueIn)
+    {
+        fValue = fValueIn;
+        if (fValueIn)
+            fPending = true;
+        return *this;
+    }
+
+    operator bool() const { return fValue; }
+};
+
+
 /** Information about a peer */
 class CNode
 {
@@ -672,7 +729,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializedNetMsgRef> vSendMsg;
     CCriticalSection cs_vSend;
 
     CCriticalSection cs_vProcessMsg;
@@ -706,7 +763,7 @@ public:
     bool fInbound;
     bool fNetworkNode;
     std::atomic_bool fSuccessfullyConnected;
-    bool fDisconnect;
+    CNodeDisconnectFlag fDisconnect;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in its version message that we should not relay tx invs
@@ -723,6 +780,9 @@ public:
 
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // epoll: EPOLLOUT is armed (guarded by cs_vSend) / node is in vNodesRecvReady (socket handler only)
+    bool fSendEvents;
+    bool fRecvReady;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -13,6 +13,12 @@
  *  Timeout = base + per_header * (expected number of headers) */
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER = 1000; // 1ms/header
+/** Compact block encoding version we provide and request in sendcmpct */
+static constexpr uint64_t CMPCTBLOCK_VERSION = 1;
+/** Number of peers asked to announce new blocks to us with cmpctblock messages (BIP152) */
+static constexpr size_t MAX_CMPCT_ANNOUNCING_PEERS = 3;
+/** Rejected transactions at least this big are not kept for compact block reconstruction */
+static constexpr unsigned int MAX_EXTRA_TXN_SIZE = 100000;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "cachedb.h"
 #include "chainparams.h"
 #include "netfulfilledman.h"
 #include "util.h"
@@ -64,6 +65,22 @@ void CNetFulfilledRequestManager::Clear()
     mapFulfilledRequests.clear();
 }
 
+void CNetFulfilledRequestManager::WriteCacheDB(CCacheDB& db, CDBBatch& batch)
+{
+    LOCK(cs_mapFulfilledRequests);
+    db.WriteRecord(batch, "netfulfilled", mapFulfilledRequests);
+}
+
+bool CNetFulfilledRequestManager::ReadCacheDB(CCacheDB& db)
+{
+    LOCK(cs_mapFulfilledRequests);
+    if(!db.ReadRecord("netfulfilled", mapFulfilledRequests)) {
+        mapFulfilledRequests.clear();
+        return false;
+    }
+    return true;
+}
+
 std::string CNetFulfilledRequestManager::ToString() const
 {
     std::ostringstream info;
@@ -10,6 +10,8 @@
 #include "serialize.h"
 #include "sync.h"
 
+class CCacheDB;
+class CDBBatch;
 class CNetFulfilledRequestManager;
 extern CNetFulfilledRequestManager netfulfilledman;
 
@@ -43,6 +45,11 @@ public:
     void CheckAndRemove();
     void Clear();
 
+    /// Stage the fulfilled requests for the cache database
+    void WriteCacheDB(CCacheDB& db, CDBBatch& batch);
+    /// Load from the cache database, returns false if there was nothing stored or it could not be read
+    bool ReadCacheDB(CCacheDB& db);
+
     std::string ToString() const;
 };
 
@@ -0,0 +1,2 @@
+#define BUILD_SUFFIX afc96aa-dirty
+#define BUILD_DATE "2026-10-17 01:11:57 +0000"
@@ -9,12 +9,50 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/skunk_multi.h"
 
 uint256 CBlockHeader::GetHash() const
 {
+    if (fHashMemo)
+        return hashMemo;
     return SkunkHash(BEGIN(nVersion), END(nNonce));
 }
 
+CSkunkHeaderHasher::CSkunkHeaderHasher(const CBlockHeader& header)
+{
+    // The first 64-byte Skein block is compressed as soon as the 65th byte arrives,
+    // so the cached context already holds it and only the tail is left per nonce.
+    sph_skein512_init(&ctxPrefix);
+    sph_skein512(&ctxPrefix, BEGIN(header.nVersion), END(header.hashMerkleRoot) - BEGIN(header.nVersion));
+}
+
+uint256 CSkunkHeaderHasher::GetHash(const CBlockHeader& header) const
+{
+    sph_skein512_context ctx = ctxPrefix;
+    sph_skein512(&ctx, BEGIN(header.nTime), END(header.nNonce) - BEGIN(header.nTime));
+    return SkunkHashFinish(&ctx);
+}
+
+void SkunkHashBatch(const CBlockHeader* headers, size_t n, uint256* out)
+{
+    const size_t nLanes = skunk_multi::Lanes();
+    size_t i = 0;
+    if (nLanes > 0) {
+        std::vector<const unsigned char*> vIn(nLanes);
+        std::vector<uint512> vCubehash(nLanes);
+        for (; i + nLanes <= n; i += nLanes) {
+            for (size_t l = 0; l < nLanes; l++)
+                vIn[l] = (const unsigned char*)BEGIN(headers[i + l].nVersion);
+            skunk_multi::SkeinCubehash80(&vIn[0], vCubehash[0].begin());
+            for (size_t l = 0; l < nLanes; l++)
+                out[i + l] = SkunkHashTail(vCubehash[l]);
+        }
+    }
+    // Remainder, or everything when no vector kernel is available
+    for (; i < n; i++)
+        out[i] = headers[i].GetHash();
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -27,7 +65,7 @@ std::string CBlock::ToString() const
         vtx.size());
     for (unsigned int i = 0; i < vtx.size(); i++)
     {
-        s << "  " << vtx[i].ToString() << "\n";
+        s << "  " << vtx[i]->ToString() << "\n";
     }
     return s.str();
 }
@@ -9,6 +9,7 @@
 #include "primitives/transaction.h"
 #include "serialize.h"
 #include "uint256.h"
+#include "crypto/sph_skein.h"
 
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
@@ -33,6 +34,22 @@ public:
         SetNull();
     }
 
+    // Copies leave the hash memo behind: a miner or RPC caller that copies a
+    // header into a template and changes nNonce, nTime or hashMerkleRoot must
+    // not keep reading the hash of the original.
+    CBlockHeader(const CBlockHeader& other)
+    {
+        CopyFields(other);
+        fHashMemo = false;
+    }
+
+    CBlockHeader& operator=(const CBlockHeader& other)
+    {
+        CopyFields(other);
+        fHashMemo = false;
+        return *this;
+    }
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -44,6 +61,8 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+        if (ser_action.ForRead())
+            fHashMemo = false;
     }
 
     void SetNull()
@@ -54,6 +73,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        fHashMemo = false;
     }
 
     bool IsNull() const
@@ -63,18 +83,69 @@ public:
 
     uint256 GetHash() const;
 
+    /** Record hash as the Skunk hash of the current header fields without computing it.
+     * Only for callers that own this header, have just hashed it or matched its fields
+     * against a verified hash (e.g. the block index) and do not change them afterwards.
+     * The header must not be shared with other threads yet. Copies do not inherit it.
+     */
+    void SetCachedHash(const uint256& hash)
+    {
+        hashMemo = hash;
+        fHashMemo = true;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
+
+private:
+    void CopyFields(const CBlockHeader& other)
+    {
+        nVersion = other.nVersion;
+        hashPrevBlock = other.hashPrevBlock;
+        hashMerkleRoot = other.hashMerkleRoot;
+        nTime = other.nTime;
+        nBits = other.nBits;
+        nNonce = other.nNonce;
+    }
+
+    // memory only: hash set by SetCachedHash, never written by GetHash() so
+    // headers shared between threads are only ever read
+    bool fHashMemo;
+    uint256 hashMemo;
 };
 
 
+/** Skunk PoW hasher for scanning the nonce space of a single header.
+ * The Skein-512 state after nVersion, hashPrevBlock and hashMerkleRoot is
+ * computed once, so each GetHash() only absorbs nTime, nBits and nNonce
+ * before running the rest of the Skunk chain.
+ */
+class CSkunkHeaderHasher
+{
+private:
+    sph_skein512_context ctxPrefix;
+
+public:
+    explicit CSkunkHeaderHasher(const CBlockHeader& header);
+
+    /** Same result as header.GetHash(); header must share the prefix this hasher was built from */
+    uint256 GetHash(const CBlockHeader& header) const;
+};
+
+/** Compute the Skunk PoW hash of n headers into out[0..n-1]. Full groups of
+ * headers go through the multi-lane Skein/CubeHash kernel picked at runtime;
+ * results are identical to calling GetHash() on each header.
+ */
+void SkunkHashBatch(const CBlockHeader* headers, size_t n, uint256* out);
+
+
 class CBlock : public CBlockHeader
 {
 public:
     // network and disk
-    std::vector<CTransaction> vtx;
+    std::vector<CTransactionRef> vtx;
 
     // memory only
     mutable CTxOut txoutMasternode; // masternode payment
@@ -4,6 +4,7 @@
 #include "privatesend.h"
 
 #include "activemasternode.h"
+#include "cachedb.h"
 #include "consensus/validation.h"
 #include "governance.h"
 #include "init.h"
@@ -77,7 +78,7 @@ bool CDarksendBroadcastTx::Sign()
 {
     if(!fMasterNode) return false;
 
-    std::string strMessage = tx.GetHash().ToString() + boost::lexical_cast<std::string>(sigTime);
+    std::string strMessage = tx->GetHash().ToString() + boost::lexical_cast<std::string>(sigTime);
 
     if(!CMessageSigner::SignMessage(strMessage, vchSig, activeMasternode.keyMasternode)) {
         LogPrintf("CDarksendBroadcastTx::Sign -- SignMessage() failed\n");
@@ -89,7 +90,7 @@ bool CDarksendBroadcastTx::Sign()
 
 bool CDarksendBroadcastTx::CheckSignature(const CPubKey& pubKeyMasternode)
 {
-    std::string strMessage = tx.GetHash().ToString() + boost::lexical_cast<std::string>(sigTime);
+    std::string strMessage = tx->GetHash().ToString() + boost::lexical_cast<std::string>(sigTime);
     std::string strError = "";
 
     if(!CMessageSigner::VerifyMessage(pubKeyMasternode, vchSig, strMessage, strError)) {
@@ -213,7 +214,7 @@ bool CPrivateSend::IsCollateralValid(const CTransaction& txCollateral)
     {
         LOCK(cs_main);
         CValidationState validationState;
-        if(!AcceptToMemoryPool(mempool, validationState, txCollateral, false, NULL, false, true, true)) {
+        if(!AcceptToMemoryPool(mempool, validationState, MakeTransactionRef(txCollateral), false, NULL, false, true, true)) {
             LogPrint("privatesend", "CPrivateSend::IsCollateralValid -- didn't pass AcceptToMemoryPool()\n");
             return false;
         }
@@ -379,7 +380,7 @@ std::string CPrivateSend::GetMessageByID(PoolMessage nMessageID)
 void CPrivateSend::AddDSTX(const CDarksendBroadcastTx& dstx)
 {
     LOCK(cs_mapdstx);
-    mapDSTX.insert(std::make_pair(dstx.tx.GetHash(), dstx));
+    mapDSTX.insert(std::make_pair(dstx.tx->GetHash(), dstx));
 }
 
 CDarksendBroadcastTx CPrivateSend::GetDSTX(const uint256& hash)
@@ -389,6 +390,18 @@ CDarksendBroadcastTx CPrivateSend::GetDSTX(const uint256& hash)
     return (it == mapDSTX.end()) ? CDarksendBroadcastTx() : it->second;
 }
 
+void CPrivateSend::GetUnconfirmedDSTXes(std::vector<CDarksendBroadcastTx>& vecDSTXRet)
+{
+    LOCK(cs_mapdstx);
+    vecDSTXRet.clear();
+    vecDSTXRet.reserve(mapDSTX.size());
+    for(std::map<uint256, CDarksendBroadcastTx>::const_iterator it = mapDSTX.begin(); it != mapDSTX.end(); ++it) {
+        if(it->second.GetConfirmedHeight() == -1) {
+            vecDSTXRet.push_back(it->second);
+        }
+    }
+}
+
 void CPrivateSend::CheckDSTXes(int nHeight)
 {
     LOCK(cs_mapdstx);
@@ -481,6 +494,12 @@ void ThreadCheckPrivateSend(CConnman& connman)
             if(nTick % (60 * 5) == 0) {
                 governance.DoMaintenance(connman);
             }
+
+            if(nTick % 60 == 30) {
+                // write out what changed in masternode, payment and governance caches,
+                // only entries changed since the last flush are serialized so this is cheap
+                FlushCacheDB();
+            }
         }
     }
 }
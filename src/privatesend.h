@@ -216,20 +216,20 @@ private:
     int nConfirmedHeight;
 
 public:
-    CTransaction tx;
+    CTransactionRef tx;
     CTxIn vin;
     std::vector<unsigned char> vchSig;
     int64_t sigTime;
 
     CDarksendBroadcastTx() :
         nConfirmedHeight(-1),
-        tx(),
+        tx(MakeTransactionRef()),
         vin(),
         vchSig(),
         sigTime(0)
         {}
 
-    CDarksendBroadcastTx(CTransaction tx, COutPoint outpoint, int64_t sigTime) :
+    CDarksendBroadcastTx(const CTransactionRef& tx, COutPoint outpoint, int64_t sigTime) :
         nConfirmedHeight(-1),
         tx(tx),
         vin(CTxIn(outpoint)),
@@ -249,7 +249,7 @@ public:
 
     friend bool operator==(const CDarksendBroadcastTx& a, const CDarksendBroadcastTx& b)
     {
-        return a.tx == b.tx;
+        return *a.tx == *b.tx;
     }
     friend bool operator!=(const CDarksendBroadcastTx& a, const CDarksendBroadcastTx& b)
     {
@@ -264,6 +264,7 @@ public:
     bool CheckSignature(const CPubKey& pubKeyMasternode);
 
     void SetConfirmedHeight(int nConfirmedHeightIn) { nConfirmedHeight = nConfirmedHeightIn; }
+    int GetConfirmedHeight() const { return nConfirmedHeight; }
     bool IsExpired(int nHeight);
 };
 
@@ -351,6 +352,8 @@ public:
 
     static void AddDSTX(const CDarksendBroadcastTx& dstx);
     static CDarksendBroadcastTx GetDSTX(const uint256& hash);
+    /// Copy the mixing broadcasts whose transactions are still unconfirmed, e.g. to store them with the mempool
+    static void GetUnconfirmedDSTXes(std::vector<CDarksendBroadcastTx>& vecDSTXRet);
 
     static void UpdatedBlockTip(const CBlockIndex *pindex);
     static void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
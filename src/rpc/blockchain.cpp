@@ -9,6 +9,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinstatsindex.h"
 #include "consensus/validation.h"
 #include "validation.h"
 #include "policy/policy.h"
@@ -30,7 +31,8 @@
 
 using namespace std;
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CSpentIndexMap& mapSpentInfo);
+extern void GetSpentInfo(const std::vector<CTransactionRef>& vtx, CSpentIndexMap& mapSpentInfo);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
 double GetDifficulty(const CBlockIndex* blockindex)
@@ -105,12 +107,17 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
     UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    // Look up the spent index of the whole block at once
+    CSpentIndexMap mapSpentInfo;
+    if (txDetails)
+        GetSpentInfo(block.vtx, mapSpentInfo);
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
+        const CTransaction& tx = *ptx;
         if(txDetails)
         {
             UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
+            TxToJSON(tx, uint256(), objTx, mapSpentInfo);
             txs.push_back(objTx);
         }
         else
@@ -623,28 +630,81 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time unless served from -coinstatsindex.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"     (string, optional) Which UTXO set hash to return: \"hash_serialized_2\" (computed by\n"
+            "                   reading the whole set) or \"muhash\" (requires -coinstatsindex, answered at once).\n"
+            "                   Defaults to \"hash_serialized_2\", also with -coinstatsindex.\n"
+            "2. height          (numeric, optional) Return the statistics as of this block height of the active chain\n"
+            "                   instead of the tip (\"muhash\" only)\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (hash_serialized_2 only)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size (muhash only)\n"
+            "  \"hash_serialized_2\": \"hash\",   (string) The serialized hash (hash_serialized_2 only)\n"
+            "  \"muhash\": \"hash\",      (string) The rolling hash of the set (muhash only)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (tip only)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    // The index only ever answers when asked for it by name, so callers that
+    // compare hash_serialized_2 across nodes see the same fields everywhere
+    std::string strHashType = "hash_serialized_2";
+    if (params.size() > 0 && !params[0].isNull())
+        strHashType = params[0].get_str();
+
+    if (strHashType == "muhash") {
+        if (!fCoinStatsIndex)
+            throw JSONRPCError(RPC_MISC_ERROR, "The muhash of the UTXO set requires -coinstatsindex");
+
+        CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+            if (params.size() > 1) {
+                int nHeight = params[1].get_int();
+                if (nHeight < 0 || nHeight > chainActive.Height())
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+                pindex = chainActive[nHeight];
+            }
+        }
+
+        CCoinStatsIndexValue stats;
+        if (!GetCoinStatsIndex(pindex->GetBlockHash(), stats))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the coin stats index");
+        unsigned char hash[MuHash3072::OUTPUT_SIZE];
+        stats.muhash.Finalize(hash);
+
+        ret.push_back(Pair("height", (int64_t)pindex->nHeight));
+        ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        ret.push_back(Pair("muhash", uint256(std::vector<unsigned char>(hash, hash + sizeof(hash))).GetHex()));
+        if (params.size() < 2)
+            ret.push_back(Pair("disk_size", pcoinsdbview->EstimateSize()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+
+    if (strHashType != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+    if (params.size() > 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Statistics of past blocks are only available for hash_type muhash");
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview, stats)) {
@@ -101,6 +101,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendrawtransaction", 1 },
     { "sendrawtransaction", 2 },    
     { "fundrawtransaction", 1 },
+    { "gettxoutsetinfo", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
@@ -18,6 +18,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
+#include "votequeue.h"
 
 #include <boost/foreach.hpp>
 
@@ -423,6 +424,15 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
             "  }\n"
             "  ,...\n"
             "  ]\n"
+            "  \"votequeue\": {                        (json object) masternode payment and governance vote verification\n"
+            "    \"batches\": xxx,                     (numeric) batches verified since startup\n"
+            "    \"votes\": xxx,                       (numeric) votes verified since startup\n"
+            "    \"badsignatures\": xxx,               (numeric) votes whose signature did not verify\n"
+            "    \"pending\": xxx,                     (numeric) votes waiting for the next batch\n"
+            "    \"lastbatchsize\": xxx,               (numeric) votes in the last batch\n"
+            "    \"lastbatchverifytime\": xxx,         (numeric) time spent verifying signatures of the last batch, in microseconds\n"
+            "    \"lastbatchtime\": xxx                (numeric) time spent on the last batch in total, in microseconds\n"
+            "  }\n"
             "  \"warnings\": \"...\"                    (string) any network warnings (such as alert messages) \n"
             "}\n"
             "\nExamples:\n"
@@ -458,6 +468,16 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
         }
     }
     obj.push_back(Pair("localaddresses", localAddresses));
+    CVoteQueueStats voteStats = votequeue.GetStats();
+    UniValue voteQueue(UniValue::VOBJ);
+    voteQueue.push_back(Pair("batches", voteStats.nBatches));
+    voteQueue.push_back(Pair("votes", voteStats.nVotes));
+    voteQueue.push_back(Pair("badsignatures", voteStats.nBadSignatures));
+    voteQueue.push_back(Pair("pending", (uint64_t)voteStats.nPending));
+    voteQueue.push_back(Pair("lastbatchsize", (uint64_t)voteStats.nLastBatchSize));
+    voteQueue.push_back(Pair("lastbatchverifytime", voteStats.nLastBatchVerifyMicros));
+    voteQueue.push_back(Pair("lastbatchtime", voteStats.nLastBatchTotalMicros));
+    obj.push_back(Pair("votequeue",      voteQueue));
     obj.push_back(Pair("warnings",       GetWarnings("statusbar")));
     return obj;
 }
@@ -61,7 +61,39 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fInclud
     out.push_back(Pair("addresses", a));
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+/** Collect the spent index keys of the inputs and outputs of a transaction */
+static void AddSpentIndexKeys(const CTransaction& tx, std::vector<CSpentIndexKey>& keys)
+{
+    if (!tx.IsCoinBase()) {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            keys.push_back(CSpentIndexKey(txin.prevout.hash, txin.prevout.n));
+    }
+    uint256 txid = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        keys.push_back(CSpentIndexKey(txid, i));
+}
+
+static void LookupSpentInfo(const std::vector<CSpentIndexKey>& keys, CSpentIndexMap& mapSpentInfo)
+{
+    std::vector<CSpentIndexValue> values;
+    if (keys.empty() || !GetSpentIndexMulti(keys, values))
+        return;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!values[i].IsNull())
+            mapSpentInfo.insert(std::make_pair(keys[i], values[i]));
+    }
+}
+
+/** Look up the spent index of all inputs and outputs of many transactions, such as a block, in one batch */
+void GetSpentInfo(const std::vector<CTransactionRef>& vtx, CSpentIndexMap& mapSpentInfo)
+{
+    std::vector<CSpentIndexKey> keys;
+    BOOST_FOREACH(const CTransactionRef& ptx, vtx)
+        AddSpentIndexKeys(*ptx, keys);
+    LookupSpentInfo(keys, mapSpentInfo);
+}
+
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CSpentIndexMap& mapSpentInfo)
 {
     uint256 txid = tx.GetHash();
     entry.push_back(Pair("txid", txid.GetHex()));
@@ -82,9 +114,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             in.push_back(Pair("scriptSig", o));
 
             // Add address and value info if spentindex enabled
-            CSpentIndexValue spentInfo;
-            CSpentIndexKey spentKey(txin.prevout.hash, txin.prevout.n);
-            if (GetSpentIndex(spentKey, spentInfo)) {
+            CSpentIndexMap::const_iterator itSpent = mapSpentInfo.find(CSpentIndexKey(txin.prevout.hash, txin.prevout.n));
+            if (itSpent != mapSpentInfo.end()) {
+                const CSpentIndexValue& spentInfo = itSpent->second;
                 in.push_back(Pair("value", ValueFromAmount(spentInfo.satoshis)));
                 in.push_back(Pair("valueSat", spentInfo.satoshis));
                 if (spentInfo.addressType == 1) {
@@ -111,9 +143,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         out.push_back(Pair("scriptPubKey", o));
 
         // Add spent information if spentindex is enabled
-        CSpentIndexValue spentInfo;
-        CSpentIndexKey spentKey(txid, i);
-        if (GetSpentIndex(spentKey, spentInfo)) {
+        CSpentIndexMap::const_iterator itSpent = mapSpentInfo.find(CSpentIndexKey(txid, i));
+        if (itSpent != mapSpentInfo.end()) {
+            const CSpentIndexValue& spentInfo = itSpent->second;
             out.push_back(Pair("spentTxId", spentInfo.txid.GetHex()));
             out.push_back(Pair("spentIndex", (int)spentInfo.inputIndex));
             out.push_back(Pair("spentHeight", spentInfo.blockHeight));
@@ -141,6 +173,15 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
 }
 
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+{
+    CSpentIndexMap mapSpentInfo;
+    std::vector<CSpentIndexKey> keys;
+    AddSpentIndexKeys(tx, keys);
+    LookupSpentInfo(keys, mapSpentInfo);
+    TxToJSON(tx, hashBlock, entry, mapSpentInfo);
+}
+
 UniValue getrawtransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -306,8 +347,8 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     unsigned int ntxFound = 0;
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        if (setTxids.count(tx.GetHash()))
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx)
+        if (setTxids.count(tx->GetHash()))
             ntxFound++;
     if (ntxFound != setTxids.size())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
@@ -883,7 +924,7 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
         }
         CValidationState state;
         bool fMissingInputs;
-        if (!AcceptToMemoryPool(mempool, state, tx, false, &fMissingInputs, false, !fOverrideFees)) {
+        if (!AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), false, &fMissingInputs, false, !fOverrideFees)) {
             if (state.IsInvalid()) {
                 throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
             } else {
@@ -5,88 +5,237 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "crypto/common.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
+#include <atomic>
+#include <memory>
+#include <new>
 
-namespace {
+uint8_t CSignatureCache::GetSlotGeneration(uint64_t header, int slot)
+{
+    return (header >> (32 + 8 * slot)) & 0xff;
+}
+
+uint64_t CSignatureCache::SetSlotGeneration(uint64_t header, int slot, uint8_t generation)
+{
+    header &= ~((uint64_t)0xff << (32 + 8 * slot));
+    return header | ((uint64_t)generation << (32 + 8 * slot));
+}
+
+uint8_t CSignatureCache::NextGeneration(uint8_t generation)
+{
+    return generation == 255 ? 1 : generation + 1;
+}
+
+bool CSignatureCache::IsExpired(uint8_t slotGeneration, uint8_t generation) const
+{
+    return slotGeneration == 0 || (slotGeneration != generation && NextGeneration(slotGeneration) != generation);
+}
+
+void CSignatureCache::GetBuckets(const uint64_t* key, size_t& b1, size_t& b2) const
+{
+    b1 = key[0] % nBuckets;
+    b2 = key[1] % nBuckets;
+    if (b1 == b2)
+        b2 = (b1 + 1) % nBuckets;
+}
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
+bool CSignatureCache::SlotMatches(const Bucket& bucket, int slot, const uint64_t* key)
 {
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
+    bool fMatch = true;
+    for (int w = 0; w < ENTRY_WORDS; w++)
+        fMatch &= bucket.words[slot][w].load(std::memory_order_relaxed) == key[w];
+    return fMatch;
+}
+
+int CSignatureCache::FindSlot(const Bucket& bucket, uint64_t header, const uint64_t* key)
+{
+    for (int s = 0; s < SLOTS_PER_BUCKET; s++) {
+        if (GetSlotGeneration(header, s) != 0 && SlotMatches(bucket, s, key))
+            return s;
     }
-};
-
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
-{
-private:
-     //! Entries are SHA256(nonce || signature hash || public key || signature):
-    uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
-
-public:
-    CSignatureCache()
-    {
-        GetRandBytes(nonce.begin(), 32);
+    return -1;
+}
+
+bool CSignatureCache::Contains(const Bucket& bucket, const uint64_t* key) const
+{
+    uint64_t header = bucket.header.load(std::memory_order_acquire);
+    if (header & 1)
+        return false;
+    bool fFound = FindSlot(bucket, header, key) >= 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return fFound && bucket.header.load(std::memory_order_relaxed) == header;
+}
+
+bool CSignatureCache::LockBucket(Bucket& bucket, uint64_t& header)
+{
+    header = bucket.header.load(std::memory_order_relaxed);
+    if ((header & 1) || !bucket.header.compare_exchange_strong(header, header + 1, std::memory_order_acquire, std::memory_order_relaxed))
+        return false;
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+}
+
+void CSignatureCache::UnlockBucket(Bucket& bucket, uint64_t header)
+{
+    header = (header & ~SEQUENCE_MASK) | ((header + 2) & SEQUENCE_MASK);
+    bucket.header.store(header, std::memory_order_release);
+}
+
+void CSignatureCache::WriteSlot(Bucket& bucket, int slot, const uint64_t* key)
+{
+    for (int w = 0; w < ENTRY_WORDS; w++)
+        bucket.words[slot][w].store(key[w], std::memory_order_relaxed);
+}
+
+bool CSignatureCache::TryInsert(Bucket& bucket, const uint64_t* key, uint8_t entryGeneration, uint8_t generation)
+{
+    uint64_t header;
+    if (!LockBucket(bucket, header))
+        return false;
+    int slot = FindSlot(bucket, header, key);
+    if (slot < 0) {
+        for (int s = 0; s < SLOTS_PER_BUCKET && slot < 0; s++) {
+            if (IsExpired(GetSlotGeneration(header, s), generation))
+                slot = s;
+        }
+        if (slot >= 0)
+            WriteSlot(bucket, slot, key);
     }
+    if (slot >= 0)
+        header = SetSlotGeneration(header, slot, entryGeneration);
+    UnlockBucket(bucket, header);
+    return slot >= 0;
+}
 
-    void
-    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
-    {
-        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+bool CSignatureCache::Displace(Bucket& bucket, uint64_t* key, uint8_t& entryGeneration)
+{
+    uint64_t header;
+    if (!LockBucket(bucket, header))
+        return false;
+    int slot = 0;
+    for (int s = 1; s < SLOTS_PER_BUCKET; s++) {
+        if (GetSlotGeneration(header, s) != nGeneration.load(std::memory_order_relaxed))
+            slot = s;
     }
+    uint64_t victim[ENTRY_WORDS];
+    for (int w = 0; w < ENTRY_WORDS; w++)
+        victim[w] = bucket.words[slot][w].load(std::memory_order_relaxed);
+    uint8_t victimGeneration = GetSlotGeneration(header, slot);
+    WriteSlot(bucket, slot, key);
+    UnlockBucket(bucket, SetSlotGeneration(header, slot, entryGeneration));
+
+    for (int w = 0; w < ENTRY_WORDS; w++)
+        key[w] = victim[w];
+    entryGeneration = victimGeneration;
+    return true;
+}
+
+void CSignatureCache::ToKey(const uint256& entry, uint64_t* key)
+{
+    for (int w = 0; w < ENTRY_WORDS; w++)
+        key[w] = ReadLE64(entry.begin() + 8 * w);
+}
+
+CSignatureCache::CSignatureCache() : buckets(NULL), nBuckets(0), nGeneration(1), nInsertedThisGeneration(0)
+{
+    Init(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
+}
+
+CSignatureCache::CSignatureCache(int64_t nMaxCacheSize) : buckets(NULL), nBuckets(0), nGeneration(1), nInsertedThisGeneration(0)
+{
+    Init(nMaxCacheSize);
+}
 
-    bool
-    Get(const uint256& entry)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+void CSignatureCache::Init(int64_t nMaxCacheSize)
+{
+    GetRandBytes(nonce.begin(), 32);
+
+    if (nMaxCacheSize <= 0) return;
+    nBuckets = (size_t)nMaxCacheSize * ((size_t) 1 << 20) / sizeof(Bucket);
+
+    storage.reset(new unsigned char[nBuckets * sizeof(Bucket) + sizeof(Bucket)]);
+    uintptr_t p = (uintptr_t)storage.get();
+    buckets = (Bucket*)((p + sizeof(Bucket) - 1) & ~(uintptr_t)(sizeof(Bucket) - 1));
+    for (size_t i = 0; i < nBuckets; i++) {
+        Bucket* bucket = new (&buckets[i]) Bucket;
+        bucket->header.store(0, std::memory_order_relaxed);
+        for (int s = 0; s < SLOTS_PER_BUCKET; s++)
+            for (int w = 0; w < ENTRY_WORDS; w++)
+                bucket->words[s][w].store(0, std::memory_order_relaxed);
     }
+    std::atomic_thread_fence(std::memory_order_release);
+    LogPrintf("Using %u MiB for signature cache, able to store %u elements\n",
+              (unsigned int)nMaxCacheSize, (unsigned int)(nBuckets * SLOTS_PER_BUCKET));
+}
+
+void CSignatureCache::ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+}
+
+bool CSignatureCache::Get(const uint256& entry)
+{
+    if (nBuckets == 0) return false;
 
-    void Erase(const uint256& entry)
-    {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+    uint64_t key[ENTRY_WORDS];
+    ToKey(entry, key);
+    size_t b1, b2;
+    GetBuckets(key, b1, b2);
+    return Contains(buckets[b1], key) || Contains(buckets[b2], key);
+}
+
+void CSignatureCache::Erase(const uint256& entry)
+{
+    if (nBuckets == 0) return;
+
+    uint64_t key[ENTRY_WORDS];
+    ToKey(entry, key);
+    size_t b[2];
+    GetBuckets(key, b[0], b[1]);
+    for (int i = 0; i < 2; i++) {
+        uint64_t header;
+        if (!Contains(buckets[b[i]], key) || !LockBucket(buckets[b[i]], header))
+            continue;
+        int slot = FindSlot(buckets[b[i]], header, key);
+        if (slot >= 0)
+            header = SetSlotGeneration(header, slot, 0);
+        UnlockBucket(buckets[b[i]], header);
     }
+}
 
-    void Set(const uint256& entry)
-    {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
+void CSignatureCache::Set(const uint256& entry)
+{
+    if (nBuckets == 0) return;
 
-        setValid.insert(entry);
+    uint64_t key[ENTRY_WORDS];
+    ToKey(entry, key);
+    uint8_t generation = nGeneration.load(std::memory_order_relaxed);
+    uint8_t entryGeneration = generation;
+    size_t bFrom = nBuckets;
+    for (int n = 0; n <= MAX_DISPLACEMENTS; n++) {
+        size_t b1, b2;
+        GetBuckets(key, b1, b2);
+        if (TryInsert(buckets[b1], key, entryGeneration, generation) ||
+            TryInsert(buckets[b2], key, entryGeneration, generation))
+            break;
+        // Both buckets hold live entries: take the place of one and move
+        // it to its other bucket, never back to where it was just pushed from
+        size_t b = b1 == bFrom ? b2 : b1;
+        if (n == MAX_DISPLACEMENTS || !Displace(buckets[b], key, entryGeneration))
+            break;
+        bFrom = b;
     }
-};
 
+    // Start a new generation once half the slots were written in this one
+    if (nInsertedThisGeneration.fetch_add(1, std::memory_order_relaxed) + 1 == nBuckets * SLOTS_PER_BUCKET / 2) {
+        nInsertedThisGeneration.fetch_sub(nBuckets * SLOTS_PER_BUCKET / 2, std::memory_order_relaxed);
+        nGeneration.store(NextGeneration(generation), std::memory_order_relaxed);
+    }
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
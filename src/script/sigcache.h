@@ -7,7 +7,10 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
 // DoS prevention: limit cache size to less than 40MB (over 500000
@@ -16,6 +19,92 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 
 class CPubKey;
 
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ *
+ * It is a fixed size cuckoo hash table shared by all script check threads
+ * without a lock. Every entry has two candidate buckets of two slots, each
+ * bucket filling one cache line. Lookups never wait: a bucket which is being
+ * written to or changes while it is read counts as a miss, which only costs
+ * a signature check. Writers claim one bucket at a time and give up instead
+ * of waiting when another writer holds it, a cache may drop entries.
+ *
+ * Entries are tagged with the generation they were inserted in. A new
+ * generation starts whenever half the slots have been filled, and slots of
+ * entries older than the previous generation are free to be reused, so the
+ * table always holds the most recent entries without a separate eviction
+ * pass.
+ */
+class CSignatureCache
+{
+private:
+    static const int SLOTS_PER_BUCKET = 2;
+    //! Entries are SHA256(nonce || signature hash || public key || signature),
+    //! of which 192 bits are kept: plenty to rule out collisions, and it lets
+    //! two entries and the bucket header share a cache line
+    static const int ENTRY_WORDS = 3;
+    //! Number of live entries moved to their other bucket to make room before one is dropped
+    static const int MAX_DISPLACEMENTS = 8;
+    static const uint64_t SEQUENCE_MASK = 0xffffffff;
+
+    /**
+     * The header holds a sequence number in its low 32 bits, odd while a
+     * writer is changing the bucket, and above it the generation each slot
+     * was written in, 0 for an empty slot.
+     */
+    struct alignas(64) Bucket
+    {
+        std::atomic<uint64_t> header;
+        std::atomic<uint64_t> words[SLOTS_PER_BUCKET][ENTRY_WORDS];
+    };
+
+    uint256 nonce;
+    std::unique_ptr<unsigned char[]> storage;
+    Bucket* buckets;
+    size_t nBuckets;
+
+    //! Current generation, 1 to 255
+    std::atomic<uint8_t> nGeneration;
+    std::atomic<uint64_t> nInsertedThisGeneration;
+
+    static uint8_t GetSlotGeneration(uint64_t header, int slot);
+    static uint64_t SetSlotGeneration(uint64_t header, int slot, uint8_t generation);
+    static uint8_t NextGeneration(uint8_t generation);
+    bool IsExpired(uint8_t slotGeneration, uint8_t generation) const;
+    void GetBuckets(const uint64_t* key, size_t& b1, size_t& b2) const;
+    static bool SlotMatches(const Bucket& bucket, int slot, const uint64_t* key);
+    static int FindSlot(const Bucket& bucket, uint64_t header, const uint64_t* key);
+    bool Contains(const Bucket& bucket, const uint64_t* key) const;
+    /** Claim a bucket for writing, failing if another writer has it */
+    static bool LockBucket(Bucket& bucket, uint64_t& header);
+    /** Publish the changes to a bucket locked with the given header */
+    static void UnlockBucket(Bucket& bucket, uint64_t header);
+    static void WriteSlot(Bucket& bucket, int slot, const uint64_t* key);
+    /** Store the entry in a free or expired slot of the bucket, if it has one */
+    bool TryInsert(Bucket& bucket, const uint64_t* key, uint8_t entryGeneration, uint8_t generation);
+    /** Store the entry in place of the bucket's oldest one, which is returned to be moved */
+    bool Displace(Bucket& bucket, uint64_t* key, uint8_t& entryGeneration);
+    static void ToKey(const uint256& entry, uint64_t* key);
+
+    void Init(int64_t nMaxCacheSize);
+
+public:
+    /** Sized by -maxsigcachesize */
+    CSignatureCache();
+    /** Sized to nMaxCacheSize MiB, a cache of size 0 stores nothing */
+    explicit CSignatureCache(int64_t nMaxCacheSize);
+
+    /** Number of entries the table has room for */
+    size_t GetCapacity() const { return nBuckets * SLOTS_PER_BUCKET; }
+
+    void ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+    bool Get(const uint256& entry);
+    void Erase(const uint256& entry);
+    void Set(const uint256& entry);
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
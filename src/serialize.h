@@ -14,6 +14,7 @@
 #include <limits>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -576,6 +577,13 @@ template<typename K, typename Pred, typename A> unsigned int GetSerializeSize(co
 template<typename Stream, typename K, typename Pred, typename A> void Serialize(Stream& os, const std::set<K, Pred, A>& m, int nType, int nVersion);
 template<typename Stream, typename K, typename Pred, typename A> void Unserialize(Stream& is, std::set<K, Pred, A>& m, int nType, int nVersion);
 
+/**
+ * shared_ptr
+ */
+template<typename T> unsigned int GetSerializeSize(const std::shared_ptr<const T>& p, int nType, int nVersion);
+template<typename Stream, typename T> void Serialize(Stream& os, const std::shared_ptr<const T>& p, int nType, int nVersion);
+template<typename Stream, typename T> void Unserialize(Stream& is, std::shared_ptr<const T>& p, int nType, int nVersion);
+
 
 
 
@@ -944,6 +952,29 @@ void Unserialize(Stream& is, std::list<T, A>& l, int nType, int nVersion)
     }
 }
 
+/**
+ * shared_ptr
+ */
+template<typename T>
+unsigned int GetSerializeSize(const std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    return GetSerializeSize(*p, nType, nVersion);
+}
+
+template<typename Stream, typename T>
+void Serialize(Stream& os, const std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    Serialize(os, *p, nType, nVersion);
+}
+
+template<typename Stream, typename T>
+void Unserialize(Stream& is, std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    std::shared_ptr<T> obj = std::make_shared<T>();
+    Unserialize(is, *obj, nType, nVersion);
+    p = obj;
+}
+
 
 
 /**
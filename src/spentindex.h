@@ -10,6 +10,8 @@
 #include "amount.h"
 #include "script/script.h"
 
+#include <map>
+
 struct CSpentIndexKey {
     uint256 txid;
     unsigned int outputIndex;
@@ -36,6 +38,18 @@ struct CSpentIndexKey {
         outputIndex = 0;
     }
 
+    friend bool operator==(const CSpentIndexKey& a, const CSpentIndexKey& b) {
+        return a.txid == b.txid && a.outputIndex == b.outputIndex;
+    }
+
+    friend bool operator<(const CSpentIndexKey& a, const CSpentIndexKey& b) {
+        if (a.txid == b.txid) {
+            return a.outputIndex < b.outputIndex;
+        } else {
+            return a.txid < b.txid;
+        }
+    }
+
 };
 
 struct CSpentIndexValue {
@@ -96,6 +110,8 @@ struct CSpentIndexKeyCompare
     }
 };
 
+typedef std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> CSpentIndexMap;
+
 struct CTimestampIndexIteratorKey {
     unsigned int timestamp;
 
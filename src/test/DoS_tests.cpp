@@ -5,6 +5,7 @@
 // Unit tests for denial-of-service detection/prevention code
 
 #include "chainparams.h"
+#include "governance-object.h"
 #include "keystore.h"
 #include "net.h"
 #include "net_processing.h"
@@ -23,11 +24,11 @@
 #include <boost/test/unit_test.hpp>
 
 // Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
+extern bool AddOrphanTx(const CTransactionRef& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
 extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
@@ -131,7 +132,7 @@ CTransaction RandomOrphan()
     it = mapOrphanTransactions.lower_bound(GetRandHash());
     if (it == mapOrphanTransactions.end())
         it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return *it->second.tx;
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -153,7 +154,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(MakeTransactionRef(tx), i);
     }
 
     // ... and 50 that depend on other orphans:
@@ -170,7 +171,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0);
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(MakeTransactionRef(tx), i);
     }
 
     // This really-big orphan should be ignored:
@@ -194,7 +195,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!AddOrphanTx(MakeTransactionRef(tx), i));
     }
 
     // Test EraseOrphansFor:
@@ -215,4 +216,60 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
 }
 
+BOOST_AUTO_TEST_CASE(relay_shared_message)
+{
+    std::atomic<bool> interruptDummy(false);
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1*CENT;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx(mtx);
+    connman->RelayTransaction(tx);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CGovernanceObject();
+    CInv invGovobj(MSG_GOVERNANCE_OBJECT, GetRandHash());
+    connman->RelayInv(invGovobj, ss);
+
+    std::vector<CInv> vInv;
+    vInv.push_back(CInv(MSG_TX, tx.GetHash()));
+    vInv.push_back(invGovobj);
+    std::vector<CSerializedNetMsgRef> vMsgRelay;
+    {
+        LOCK(cs_mapRelay);
+        BOOST_FOREACH(const CInv& inv, vInv) {
+            BOOST_CHECK(mapRelay.count(inv));
+            vMsgRelay.push_back(mapRelay[inv]);
+        }
+    }
+    BOOST_CHECK(vMsgRelay[0] && vMsgRelay[1]);
+
+    for (int i = 0; i < 2; i++) {
+        CAddress addr(ip(0xa0b0c010 + i), NODE_NONE);
+        CNode dummyNode(id++, NODE_NETWORK, 0, socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), addr, "", true);
+        dummyNode.SetSendVersion(PROTOCOL_VERSION);
+        // Keep an earlier message queued so nothing is written to the unconnected socket
+        CSerializedNetMsgRef msgQueued = connman->MakeSharedMessage(NetMsgType::PING, CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+        dummyNode.vSendMsg.push_back(msgQueued);
+        dummyNode.nSendSize += msgQueued->size();
+
+        dummyNode.vRecvGetData.insert(dummyNode.vRecvGetData.end(), vInv.begin(), vInv.end());
+        ProcessMessages(&dummyNode, *connman, interruptDummy);
+        BOOST_CHECK(dummyNode.vRecvGetData.empty());
+
+        // Both peers are answered with the very buffer kept in mapRelay
+        BOOST_CHECK_EQUAL(dummyNode.vSendMsg.size(), 3U);
+        BOOST_CHECK(dummyNode.vSendMsg[1] == vMsgRelay[0]);
+        BOOST_CHECK(dummyNode.vSendMsg[2] == vMsgRelay[1]);
+        BOOST_CHECK_EQUAL(dummyNode.nSendSize, msgQueued->size() + vMsgRelay[0]->size() + vMsgRelay[1]->size());
+    }
+
+    LOCK(cs_mapRelay);
+    BOOST_FOREACH(const CInv& inv, vInv)
+        mapRelay.erase(inv);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
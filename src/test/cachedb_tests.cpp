@@ -0,0 +1,127 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cachedb.h"
+#include "governance-object.h"
+#include "test/test_mobitglobal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cachedb_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(cachedb_incremental_flush)
+{
+    CCacheDB db(1 << 20, true);
+
+    std::map<int, std::string> mapIn;
+    std::set<int> setDirty;
+    mapIn[1] = "one";
+    mapIn[2] = "two";
+    mapIn[3] = "three";
+    setDirty.insert(1);
+    setDirty.insert(2);
+    setDirty.insert(3);
+
+    size_t nEmptySize = CDBBatch(db).SizeEstimate();
+
+    CDBBatch batch1(db);
+    db.WriteMap(batch1, 'x', mapIn, setDirty);
+    BOOST_CHECK(batch1.SizeEstimate() > nEmptySize);
+    BOOST_CHECK(setDirty.empty());
+    BOOST_CHECK(db.WriteCache(batch1));
+
+    // nothing changed, nothing to write
+    CDBBatch batch2(db);
+    db.WriteMap(batch2, 'x', mapIn, setDirty);
+    BOOST_CHECK_EQUAL(batch2.SizeEstimate(), nEmptySize);
+
+    // one entry changed and one removed
+    mapIn.erase(2);
+    mapIn[3] = "drei";
+    setDirty.insert(2);
+    setDirty.insert(3);
+    CDBBatch batch3(db);
+    db.WriteMap(batch3, 'x', mapIn, setDirty);
+    BOOST_CHECK(batch3.SizeEstimate() > nEmptySize);
+    BOOST_CHECK(db.WriteCache(batch3));
+
+    std::map<int, std::string> mapOut;
+    BOOST_CHECK(db.ReadMap('x', mapOut));
+    BOOST_CHECK(mapOut == mapIn);
+
+    // entries of other prefixes are not picked up
+    std::map<int, std::string> mapOther;
+    BOOST_CHECK(db.ReadMap('y', mapOther));
+    BOOST_CHECK(mapOther.empty());
+}
+
+BOOST_AUTO_TEST_CASE(cachedb_rewrite)
+{
+    CCacheDB db(1 << 20, true);
+
+    std::map<int, std::string> mapIn;
+    mapIn[1] = "one";
+    mapIn[2] = "two";
+    mapIn[3] = "three";
+
+    CDBBatch batch1(db);
+    db.RewriteMap(batch1, 'x', mapIn);
+    BOOST_CHECK(db.WriteCache(batch1));
+
+    // entries gone from the map without being marked dirty are erased by a rewrite
+    BOOST_CHECK(!db.IsRewriteRequested());
+    db.RequestRewrite();
+    BOOST_CHECK(db.IsRewriteRequested());
+    mapIn.erase(1);
+    mapIn[4] = "four";
+    CDBBatch batch2(db);
+    db.RewriteMap(batch2, 'x', mapIn);
+    BOOST_CHECK(db.WriteCache(batch2));
+    BOOST_CHECK(!db.IsRewriteRequested());
+
+    std::map<int, std::string> mapOut;
+    BOOST_CHECK(db.ReadMap('x', mapOut));
+    BOOST_CHECK(mapOut == mapIn);
+}
+
+BOOST_AUTO_TEST_CASE(cachedb_governance_votes)
+{
+    CCacheDB db(1 << 20, true);
+
+    std::map<uint256, CGovernanceObject> mapObjects;
+    CGovernanceObject govobj(uint256(), 1, 1500000000, uint256S("01"), "7b7d");
+    uint256 nHash = govobj.GetHash();
+    COutPoint outpoint1(uint256S("02"), 0);
+    COutPoint outpoint2(uint256S("03"), 1);
+    CGovernanceVote vote1(outpoint1, nHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES);
+    CGovernanceVote vote2(outpoint2, nHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_NO);
+    CGovernanceObjectVoteFile& fileVotes = mapObjects.insert(std::make_pair(nHash, govobj)).first->second.GetVoteFile();
+
+    // the vote file remembers which votes changed
+    fileVotes.AddVote(vote1);
+    fileVotes.AddVote(vote2);
+    BOOST_CHECK_EQUAL(fileVotes.GetDirtyVotes().size(), 2);
+    fileVotes.GetDirtyVotes().clear();
+    fileVotes.RemoveVotesFromMasternode(outpoint1);
+    BOOST_CHECK_EQUAL(fileVotes.GetDirtyVotes().size(), 1);
+    BOOST_CHECK(fileVotes.GetDirtyVotes().count(vote1.GetHash()));
+
+    // objects are stored without their votes, those are records of their own
+    CDBBatch batch(db);
+    db.RewriteMap(batch, DB_CACHE_GOVERNANCE_OBJECT, mapObjects);
+    BOOST_CHECK(db.WriteCache(batch));
+
+    std::map<uint256, CGovernanceObject> mapOut;
+    BOOST_CHECK(db.ReadMap(DB_CACHE_GOVERNANCE_OBJECT, mapOut));
+    BOOST_CHECK_EQUAL(mapOut.size(), 1);
+    BOOST_CHECK(mapOut.begin()->first == nHash);
+    BOOST_CHECK(mapOut.begin()->second.GetHash() == nHash);
+    BOOST_CHECK_EQUAL(mapOut.begin()->second.GetVoteFile().GetVoteCount(), 0);
+
+    std::map<uint256, CGovernanceVote> mapVotesOut;
+    BOOST_CHECK(db.ReadMap(DB_CACHE_GOVERNANCE_VOTE, mapVotesOut));
+    BOOST_CHECK(mapVotesOut.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
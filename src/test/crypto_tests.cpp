@@ -8,6 +8,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_mobitglobal.h"
@@ -273,4 +274,98 @@ BOOST_AUTO_TEST_CASE(pbkdf2_hmac_sha512_test) {
     BOOST_CHECK(HexStr(k, k + 64) == "8c0511f4c6e597c6ac6315d8f0362e225f3c501495ba23b868c005174dc4ee71115b59f9e60cd9532fa33e0f75aefe30225c583a186cd82bd4daea9724a3d3b8");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    unsigned char in[64 * 32];
+    for (size_t j = 0; j < sizeof(in); ++j) {
+        in[j] = insecure_rand();
+    }
+
+    // Expected results from the portable implementation
+    SHA256AutoDetect(sha256_implementation::STANDARD);
+    unsigned char expected[32 * 32], expectedAll[CSHA256::OUTPUT_SIZE];
+    for (int j = 0; j < 32; ++j) {
+        unsigned char tmp[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(in + 64 * j, 64).Finalize(tmp);
+        CSHA256().Write(tmp, sizeof(tmp)).Finalize(expected + 32 * j);
+    }
+    CSHA256().Write(in, sizeof(in)).Finalize(expectedAll);
+
+    // Force each accelerated implementation in turn, those the CPU lacks fall back to the portable one
+    const sha256_implementation::UseImplementation uses[] = {
+        sha256_implementation::STANDARD,
+        sha256_implementation::USE_SSE4,
+        sha256_implementation::USE_AVX2,
+        sha256_implementation::USE_SHANI,
+        sha256_implementation::USE_ALL,
+    };
+    for (sha256_implementation::UseImplementation use : uses) {
+        BOOST_TEST_MESSAGE("sha256d64: testing " << SHA256AutoDetect(use));
+        unsigned char out[32 * 32], outAll[CSHA256::OUTPUT_SIZE];
+        // Many blocks in one call to Transform
+        CSHA256().Write(in, sizeof(in)).Finalize(outAll);
+        BOOST_CHECK(memcmp(outAll, expectedAll, sizeof(outAll)) == 0);
+        // Every batch size up to 32 exercises the 8-way, 4-way and single hash paths
+        for (int i = 0; i <= 32; ++i) {
+            SHA256D64(out, in, i);
+            BOOST_CHECK(memcmp(out, expected, 32 * i) == 0);
+        }
+    }
+
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests) {
+    unsigned char hash[MuHash3072::OUTPUT_SIZE];
+    unsigned char hashOther[MuHash3072::OUTPUT_SIZE];
+    std::vector<std::vector<unsigned char> > elements;
+    for (int i = 0; i < 4; i++) {
+        std::vector<unsigned char> element(36 + i);
+        for (size_t j = 0; j < element.size(); j++)
+            element[j] = insecure_rand();
+        elements.push_back(element);
+    }
+
+    // The hash only depends on the contents of the set
+    MuHash3072 acc;
+    acc.Insert(&elements[0][0], elements[0].size()).Insert(&elements[1][0], elements[1].size());
+    acc.Finalize(hash);
+    MuHash3072 accOther;
+    accOther.Insert(&elements[2][0], elements[2].size()).Insert(&elements[1][0], elements[1].size());
+    accOther.Insert(&elements[0][0], elements[0].size()).Remove(&elements[2][0], elements[2].size());
+    accOther.Finalize(hashOther);
+    BOOST_CHECK(memcmp(hash, hashOther, sizeof(hash)) == 0);
+
+    // Removing what was added gives the empty set, union and difference of sets
+    MuHash3072 accEmpty;
+    accEmpty.Finalize(hash);
+    MuHash3072 accA, accB;
+    accA.Insert(&elements[3][0], elements[3].size());
+    accB.Insert(&elements[3][0], elements[3].size());
+    accA /= accB;
+    accA.Finalize(hashOther);
+    BOOST_CHECK(memcmp(hash, hashOther, sizeof(hash)) == 0);
+    accA *= accB;
+    accA.Finalize(hashOther);
+    accB.Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashOther, sizeof(hash)) == 0);
+
+    // Different sets hash differently
+    accOther.Insert(&elements[3][0], elements[3].size());
+    accOther.Finalize(hashOther);
+    acc.Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashOther, sizeof(hash)) != 0);
+
+    // The state survives serialization, including pending removals
+    MuHash3072 accSer;
+    accSer.Insert(&elements[0][0], elements[0].size()).Insert(&elements[2][0], elements[2].size());
+    accSer.Insert(&elements[1][0], elements[1].size()).Remove(&elements[2][0], elements[2].size());
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << accSer;
+    MuHash3072 accDeser;
+    ss >> accDeser;
+    accDeser.Finalize(hashOther);
+    BOOST_CHECK(memcmp(hash, hashOther, sizeof(hash)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
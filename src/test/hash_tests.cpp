@@ -2,7 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/skunk_multi.h"
 #include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_mobitglobal.h"
 
@@ -85,4 +88,121 @@ BOOST_AUTO_TEST_CASE(siphash)
     }*/
 }
 
+BOOST_AUTO_TEST_CASE(skunk_header_hasher)
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = uint256S("00000000a5c3d0e0b2f1f8ab6f0c1e7d3f6b2b4e7d8c9a0b1c2d3e4f5a6b7c8d");
+    header.hashMerkleRoot = uint256S("4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    header.nTime = 1510000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 0;
+
+    const CSkunkHeaderHasher hasher(header);
+    for (int i = 0; i < 300; i++) {
+        BOOST_CHECK(hasher.GetHash(header) == header.GetHash());
+        BOOST_CHECK(hasher.GetHash(header) == SkunkHash(BEGIN(header.nVersion), END(header.nNonce)));
+        header.nNonce += 0x01010101;
+        if (i % 100 == 0) {
+            // the tail fields may change without rebuilding the hasher
+            header.nTime += 1;
+            header.nBits ^= 1;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(block_header_hash_memo)
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1510000000;
+    header.nBits = 0x1e0ffff0;
+
+    // without a memo every call hashes the current fields
+    const uint256 hash = header.GetHash();
+    BOOST_CHECK(hash == SkunkHash(BEGIN(header.nVersion), END(header.nNonce)));
+    header.nNonce++;
+    BOOST_CHECK(header.GetHash() != hash);
+    BOOST_CHECK(header.GetHash() == SkunkHash(BEGIN(header.nVersion), END(header.nNonce)));
+
+    // a hash vouched for by the owner is served, but not by copies which
+    // may be turned into templates with a different nonce
+    const uint256 hashIndex = GetRandHash();
+    header.SetCachedHash(hashIndex);
+    BOOST_CHECK(header.GetHash() == hashIndex);
+    CBlockHeader copy = header;
+    BOOST_CHECK(copy.GetHash() == SkunkHash(BEGIN(header.nVersion), END(header.nNonce)));
+    copy.nNonce++;
+    BOOST_CHECK(copy.GetHash() == SkunkHash(BEGIN(copy.nVersion), END(copy.nNonce)));
+    CBlock block(header);
+    BOOST_CHECK(block.GetHash() == SkunkHash(BEGIN(header.nVersion), END(header.nNonce)));
+    CBlockHeader assigned;
+    assigned = header;
+    assigned.hashMerkleRoot = GetRandHash();
+    BOOST_CHECK(assigned.GetHash() == SkunkHash(BEGIN(assigned.nVersion), END(assigned.nNonce)));
+    BOOST_CHECK(header.GetHash() == hashIndex);
+    copy.SetCachedHash(hashIndex);
+
+    // reading new fields into the header drops it
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CBlockHeader other;
+    other.nVersion = 0x20000000;
+    other.nBits = 0x1e0ffff0;
+    ss << other;
+    ss >> header;
+    BOOST_CHECK(header.GetHash() == SkunkHash(BEGIN(other.nVersion), END(other.nNonce)));
+
+    // as does clearing it
+    copy.SetNull();
+    BOOST_CHECK(copy.GetHash() == SkunkHash(BEGIN(copy.nVersion), END(copy.nNonce)));
+}
+
+BOOST_AUTO_TEST_CASE(skunk_hash_batch)
+{
+    // Enough headers for several full vector groups plus a scalar remainder
+    std::vector<CBlockHeader> vHeaders(37);
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].nVersion = 0x20000000 + i;
+        vHeaders[i].hashPrevBlock = GetRandHash();
+        vHeaders[i].hashMerkleRoot = GetRandHash();
+        vHeaders[i].nTime = 1510000000 + i * 150;
+        vHeaders[i].nBits = 0x1e0ffff0;
+        vHeaders[i].nNonce = GetRand(0xffffffff);
+    }
+
+    std::vector<uint256> vExpected;
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        vExpected.push_back(SkunkHash(BEGIN(vHeaders[i].nVersion), END(vHeaders[i].nNonce)));
+
+    // Force each kernel in turn, those the CPU lacks fall back to the next narrower one
+    const skunk_multi::UseKernel uses[] = {
+        skunk_multi::STANDARD,
+        skunk_multi::USE_SSE41,
+        skunk_multi::USE_AVX2,
+        skunk_multi::USE_ALL,
+    };
+    for (skunk_multi::UseKernel use : uses) {
+        std::string strKernel = skunk_multi::AutoDetect(use);
+        BOOST_TEST_MESSAGE("skunk_hash_batch: testing " << strKernel);
+        if (use == skunk_multi::STANDARD)
+            BOOST_CHECK_EQUAL(strKernel, "scalar");
+        if (use == skunk_multi::USE_SSE41)
+            BOOST_CHECK(strKernel == "sse4.1" || strKernel == "scalar");
+        BOOST_CHECK_EQUAL(skunk_multi::Lanes(), strKernel == "avx2" ? 8U : strKernel == "sse4.1" ? 4U : 0U);
+
+        for (size_t n = 0; n <= vHeaders.size(); n++) {
+            std::vector<uint256> vHashes(n + 1);
+            SkunkHashBatch(vHeaders.empty() ? NULL : &vHeaders[0], n, &vHashes[0]);
+            for (size_t i = 0; i < n; i++)
+                BOOST_CHECK(vHashes[i] == vExpected[i]);
+            // nothing written past the end
+            BOOST_CHECK(vHashes[n].IsNull());
+        }
+    }
+
+    skunk_multi::AutoDetect();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
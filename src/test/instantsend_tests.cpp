@@ -0,0 +1,239 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "instantx.h"
+#include "masternode-sync.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include "test/test_mobitglobal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(instantsend_tests, TestingSetup)
+
+/** The maps CInstantSend stores, in the same order, to load and inspect its state */
+struct CInstantSendMaps
+{
+    std::map<uint256, CTxLockRequest> mapLockRequestAccepted;
+    std::map<uint256, CTxLockRequest> mapLockRequestRejected;
+    std::map<uint256, CTxLockVote> mapTxLockVotes;
+    std::map<uint256, CTxLockVote> mapTxLockVotesOrphan;
+    std::map<uint256, CTxLockCandidate> mapTxLockCandidates;
+    std::map<COutPoint, std::set<uint256> > mapVotedOutpoints;
+    std::map<COutPoint, uint256> mapLockedOutpoints;
+    std::map<COutPoint, int64_t> mapMasternodeOrphanVotes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(mapLockRequestAccepted);
+        READWRITE(mapLockRequestRejected);
+        READWRITE(mapTxLockVotes);
+        READWRITE(mapTxLockVotesOrphan);
+        READWRITE(mapTxLockCandidates);
+        READWRITE(mapVotedOutpoints);
+        READWRITE(mapLockedOutpoints);
+        READWRITE(mapMasternodeOrphanVotes);
+    }
+};
+
+static void LoadInstantSend(const CInstantSendMaps& maps)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << maps;
+    ss >> instantsend;
+}
+
+static CInstantSendMaps SaveInstantSend()
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << instantsend;
+    CInstantSendMaps maps;
+    ss >> maps;
+    return maps;
+}
+
+static bool IsLockedByScan(const CInstantSendMaps& maps, const uint256& txHash)
+{
+    std::map<uint256, CTxLockCandidate>::const_iterator itLockCandidate = maps.mapTxLockCandidates.find(txHash);
+    if(itLockCandidate == maps.mapTxLockCandidates.end() || itLockCandidate->second.mapOutPointLocks.empty()) return false;
+    for(const auto& pair : itLockCandidate->second.mapOutPointLocks) {
+        std::map<COutPoint, uint256>::const_iterator it = maps.mapLockedOutpoints.find(pair.first);
+        if(it == maps.mapLockedOutpoints.end() || it->second != txHash) return false;
+    }
+    return true;
+}
+
+/** CInstantSend::CheckAndRemove as it was before the expiry queues: a full scan of every map */
+static void CheckAndRemoveByScan(CInstantSendMaps& maps, int nHeight)
+{
+    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = maps.mapTxLockCandidates.begin();
+    while(itLockCandidate != maps.mapTxLockCandidates.end()) {
+        if(itLockCandidate->second.IsExpired(nHeight)) {
+            for(const auto& pair : itLockCandidate->second.mapOutPointLocks) {
+                maps.mapLockedOutpoints.erase(pair.first);
+                maps.mapVotedOutpoints.erase(pair.first);
+            }
+            maps.mapLockRequestAccepted.erase(itLockCandidate->first);
+            maps.mapLockRequestRejected.erase(itLockCandidate->first);
+            maps.mapTxLockCandidates.erase(itLockCandidate++);
+        } else {
+            ++itLockCandidate;
+        }
+    }
+
+    std::map<uint256, CTxLockVote>::iterator itVote = maps.mapTxLockVotes.begin();
+    while(itVote != maps.mapTxLockVotes.end()) {
+        if(itVote->second.IsExpired(nHeight)) {
+            maps.mapTxLockVotes.erase(itVote++);
+        } else {
+            ++itVote;
+        }
+    }
+
+    std::map<uint256, CTxLockVote>::iterator itOrphanVote = maps.mapTxLockVotesOrphan.begin();
+    while(itOrphanVote != maps.mapTxLockVotesOrphan.end()) {
+        if(itOrphanVote->second.IsTimedOut()) {
+            maps.mapTxLockVotes.erase(itOrphanVote->first);
+            maps.mapTxLockVotesOrphan.erase(itOrphanVote++);
+        } else {
+            ++itOrphanVote;
+        }
+    }
+
+    itVote = maps.mapTxLockVotes.begin();
+    while(itVote != maps.mapTxLockVotes.end()) {
+        if(GetTime() - itVote->second.GetTimeCreated() > INSTANTSEND_FAILED_TIMEOUT_SECONDS && !IsLockedByScan(maps, itVote->second.GetTxHash())) {
+            maps.mapTxLockVotes.erase(itVote++);
+        } else {
+            ++itVote;
+        }
+    }
+
+    std::map<COutPoint, int64_t>::iterator itMasternodeOrphan = maps.mapMasternodeOrphanVotes.begin();
+    while(itMasternodeOrphan != maps.mapMasternodeOrphanVotes.end()) {
+        if(itMasternodeOrphan->second < GetTime()) {
+            maps.mapMasternodeOrphanVotes.erase(itMasternodeOrphan++);
+        } else {
+            ++itMasternodeOrphan;
+        }
+    }
+}
+
+template <typename K, typename V>
+static void CheckSameKeys(const std::map<K, V>& mapA, const std::map<K, V>& mapB)
+{
+    BOOST_CHECK_EQUAL(mapA.size(), mapB.size());
+    typename std::map<K, V>::const_iterator itA = mapA.begin(), itB = mapB.begin();
+    for(; itA != mapA.end() && itB != mapB.end(); ++itA, ++itB) {
+        BOOST_CHECK(itA->first == itB->first);
+    }
+}
+
+static void CheckSameSurvivors(const CInstantSendMaps& mapsA, const CInstantSendMaps& mapsB)
+{
+    CheckSameKeys(mapsA.mapLockRequestAccepted, mapsB.mapLockRequestAccepted);
+    CheckSameKeys(mapsA.mapLockRequestRejected, mapsB.mapLockRequestRejected);
+    CheckSameKeys(mapsA.mapTxLockVotes, mapsB.mapTxLockVotes);
+    CheckSameKeys(mapsA.mapTxLockVotesOrphan, mapsB.mapTxLockVotesOrphan);
+    CheckSameKeys(mapsA.mapTxLockCandidates, mapsB.mapTxLockCandidates);
+    CheckSameKeys(mapsA.mapVotedOutpoints, mapsB.mapVotedOutpoints);
+    CheckSameKeys(mapsA.mapLockedOutpoints, mapsB.mapLockedOutpoints);
+    CheckSameKeys(mapsA.mapMasternodeOrphanVotes, mapsB.mapMasternodeOrphanVotes);
+}
+
+static int RandomConfirmedHeight(int nHeight)
+{
+    // a third of them isn't confirmed, the others are spread over the last 40 blocks
+    return insecure_rand() % 3 == 0 ? -1 : nHeight - (int)(insecure_rand() % 40);
+}
+
+BOOST_AUTO_TEST_CASE(instantsend_checkandremove)
+{
+    // CheckAndRemove only runs once the masternode list is synced
+    masternodeSync.Reset();
+    while (!masternodeSync.IsMasternodeListSynced())
+        masternodeSync.SwitchToNextAsset(*connman);
+
+    const int nKeepLock = Params().GetConsensus().nInstantSendKeepLock;
+    const int64_t nTimeStart = GetTime();
+    int nHeight = 1000;
+    CInstantSendMaps maps;
+
+    // Lock candidates created over the last 200 seconds, some of them locked,
+    // some accepted or rejected
+    std::vector<uint256> vTxHashes;
+    for(int i = 0; i < 100; i++) {
+        SetMockTime(nTimeStart - insecure_rand() % 200);
+        CMutableTransaction mtx;
+        mtx.vin.resize(1 + insecure_rand() % 3);
+        for(size_t j = 0; j < mtx.vin.size(); j++)
+            mtx.vin[j].prevout = COutPoint(GetRandHash(), j);
+        CTxLockCandidate txLockCandidate((CTxLockRequest(mtx)));
+        uint256 txHash = txLockCandidate.GetHash();
+        bool fLocked = insecure_rand() % 2 == 0;
+        for(size_t j = 0; j < mtx.vin.size(); j++) {
+            txLockCandidate.AddOutPointLock(mtx.vin[j].prevout);
+            maps.mapVotedOutpoints[mtx.vin[j].prevout].insert(txHash);
+            if(fLocked)
+                maps.mapLockedOutpoints[mtx.vin[j].prevout] = txHash;
+        }
+        txLockCandidate.SetConfirmedHeight(RandomConfirmedHeight(nHeight));
+        if(insecure_rand() % 4 == 0)
+            maps.mapLockRequestAccepted[txHash] = txLockCandidate.txLockRequest;
+        if(insecure_rand() % 4 == 0)
+            maps.mapLockRequestRejected[txHash] = txLockCandidate.txLockRequest;
+        maps.mapTxLockCandidates.insert(std::make_pair(txHash, txLockCandidate));
+        vTxHashes.push_back(txHash);
+    }
+
+    // Votes for these candidates and for txes without one, some of them orphans
+    for(int i = 0; i < 500; i++) {
+        SetMockTime(nTimeStart - insecure_rand() % 200);
+        uint256 txHash = insecure_rand() % 5 == 0 ? GetRandHash() : vTxHashes[insecure_rand() % vTxHashes.size()];
+        CTxLockVote vote(txHash, COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0));
+        vote.SetConfirmedHeight(RandomConfirmedHeight(nHeight));
+        maps.mapTxLockVotes.insert(std::make_pair(vote.GetHash(), vote));
+        if(insecure_rand() % 4 == 0)
+            maps.mapTxLockVotesOrphan.insert(std::make_pair(vote.GetHash(), vote));
+    }
+
+    // Masternodes which sent orphan votes, some of them long ago
+    for(int i = 0; i < 50; i++) {
+        maps.mapMasternodeOrphanVotes[COutPoint(GetRandHash(), 0)] = nTimeStart - 300 + insecure_rand() % 900;
+    }
+
+    SetMockTime(nTimeStart);
+    LoadInstantSend(maps);
+
+    // Move on in steps, so entries expire over several runs and some of them
+    // are already gone when their candidate does
+    CBlockIndex index;
+    for(int nStep = 0; nStep <= 8; nStep++) {
+        index.nHeight = nHeight + nStep * 5;
+        SetMockTime(nTimeStart + nStep * 20);
+        instantsend.UpdatedBlockTip(&index);
+        instantsend.CheckAndRemove();
+        CheckAndRemoveByScan(maps, index.nHeight);
+        CheckSameSurvivors(SaveInstantSend(), maps);
+    }
+    // by now every confirmed candidate has expired
+    BOOST_CHECK(index.nHeight - nHeight > nKeepLock);
+    for(const auto& pair : maps.mapTxLockCandidates) {
+        BOOST_CHECK_EQUAL(pair.second.GetConfirmedHeight(), -1);
+    }
+
+    // Nothing expires twice, a run at the same height and time changes nothing
+    instantsend.CheckAndRemove();
+    CheckSameSurvivors(SaveInstantSend(), maps);
+
+    LoadInstantSend(CInstantSendMaps());
+    SetMockTime(0);
+    masternodeSync.Reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
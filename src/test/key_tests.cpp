@@ -5,6 +5,7 @@
 #include "key.h"
 
 #include "base58.h"
+#include "messagesigner.h"
 #include "script/script.h"
 #include "uint256.h"
 #include "util.h"
@@ -188,4 +189,40 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(hash_signer_cache)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    std::string strError;
+
+    uint256 hash = Hash(strSecret1.begin(), strSecret1.end());
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(CHashSigner::SignHash(hash, key1, vchSig));
+
+    // the first check recovers the public key, the second one is served from the cache
+    uint64_t nHits = CHashSigner::GetCacheHits();
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key1.GetPubKey(), vchSig, strError));
+    BOOST_CHECK_EQUAL(CHashSigner::GetCacheHits(), nHits);
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key1.GetPubKey(), vchSig, strError));
+    BOOST_CHECK_EQUAL(CHashSigner::GetCacheHits(), nHits + 1);
+
+    // a cached signature must not validate anything else, and none of these hit the cache
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, key2.GetPubKey(), vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(uint256(), key1.GetPubKey(), vchSig, strError));
+    std::vector<unsigned char> vchSigBad(vchSig);
+    vchSigBad[10] ^= 1;
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, key1.GetPubKey(), vchSigBad, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, key1.GetPubKey(), std::vector<unsigned char>(), strError));
+    BOOST_CHECK_EQUAL(CHashSigner::GetCacheHits(), nHits + 1);
+
+    std::string strMessage = "masternode ping";
+    BOOST_CHECK(CMessageSigner::SignMessage(strMessage, vchSig, key2));
+    BOOST_CHECK(CMessageSigner::VerifyMessage(key2.GetPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK(CMessageSigner::VerifyMessage(key2.GetPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK_EQUAL(CHashSigner::GetCacheHits(), nHits + 2);
+    BOOST_CHECK(!CMessageSigner::VerifyMessage(key2.GetPubKey(), vchSig, strMessage + "x", strError));
+    BOOST_CHECK_EQUAL(CHashSigner::GetCacheHits(), nHits + 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
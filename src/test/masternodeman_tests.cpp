@@ -0,0 +1,254 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-payments.h"
+#include "masternode-sync.h"
+#include "masternodeman.h"
+#include "script/interpreter.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include "test/test_mobitglobal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, TestChain100Setup)
+
+struct CompareLastPaidBlock
+{
+    bool operator()(const std::pair<int, CMasternode*>& t1,
+                    const std::pair<int, CMasternode*>& t2) const
+    {
+        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
+    }
+};
+
+/**
+ * The payee selection as it was before the payment queue was kept ordered:
+ * collect every qualified masternode, sort them by last paid block and pick
+ * the best scoring of the oldest tenth.
+ */
+static bool GetNextMasternodeInQueueBySort(int nBlockHeight, bool fFilterSigTime, int& nCountRet, COutPoint& outpointRet)
+{
+    LOCK(cs_main);
+
+    std::map<COutPoint, CMasternode> mapMasternodes = mnodeman.GetFullMasternodeMap();
+    std::vector<std::pair<int, CMasternode*> > vecMasternodeLastPaid;
+    int nMnCount = mnodeman.CountMasternodes();
+
+    for (auto& mnpair : mapMasternodes) {
+        if(!mnpair.second.IsValidForPayment()) continue;
+        if(mnpair.second.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
+        if(mnpayments.IsScheduled(mnpair.second, nBlockHeight)) continue;
+        if(fFilterSigTime && mnpair.second.sigTime + (nMnCount*2.6*60) > GetAdjustedTime()) continue;
+        if(GetUTXOConfirmations(mnpair.first) < nMnCount) continue;
+        vecMasternodeLastPaid.push_back(std::make_pair(mnpair.second.GetLastPaidBlock(), &mnpair.second));
+    }
+
+    nCountRet = (int)vecMasternodeLastPaid.size();
+    if(fFilterSigTime && nCountRet < nMnCount/3)
+        return GetNextMasternodeInQueueBySort(nBlockHeight, false, nCountRet, outpointRet);
+
+    sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), CompareLastPaidBlock());
+
+    uint256 blockHash;
+    if(!GetBlockHash(blockHash, nBlockHeight - 101)) return false;
+
+    int nTenthNetwork = nMnCount/10;
+    int nCountTenth = 0;
+    arith_uint256 nHighest = 0;
+    CMasternode *pBestMasternode = NULL;
+    BOOST_FOREACH (PAIRTYPE(int, CMasternode*)& s, vecMasternodeLastPaid){
+        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+        if(nScore > nHighest){
+            nHighest = nScore;
+            pBestMasternode = s.second;
+        }
+        nCountTenth++;
+        if(nCountTenth >= nTenthNetwork) break;
+    }
+    if(!pBestMasternode) return false;
+    outpointRet = pBestMasternode->vin.prevout;
+    return true;
+}
+
+/** Compare the payment queue against the old selection for every height there is a block hash to score with */
+static void CheckSameWinners(bool fFilterSigTime)
+{
+    for (int nBlockHeight = 101; nBlockHeight <= chainActive.Height() + 101; nBlockHeight++) {
+        int nCount, nCountBySort;
+        masternode_info_t mnInfo;
+        COutPoint outpointBySort;
+        bool fFound = mnodeman.GetNextMasternodeInQueueForPayment(nBlockHeight, fFilterSigTime, nCount, mnInfo);
+        BOOST_CHECK_EQUAL(fFound, GetNextMasternodeInQueueBySort(nBlockHeight, fFilterSigTime, nCountBySort, outpointBySort));
+        BOOST_CHECK_EQUAL(mnodeman.CountQualifiedForPayment(nBlockHeight, fFilterSigTime), nCountBySort);
+        BOOST_CHECK(nCount <= nCountBySort);
+        if (fFound)
+            BOOST_CHECK(mnInfo.vin.prevout == outpointBySort);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(masternode_payment_queue)
+{
+    // GetNextMasternodeInQueueForPayment needs the winners list
+    masternodeSync.Reset();
+    while (!masternodeSync.IsWinnersListSynced())
+        masternodeSync.SwitchToNextAsset(*connman);
+
+    // 60 masternodes with coinbase collaterals of 100 down to 41 confirmations,
+    // so a third of them doesn't have as many as there are masternodes.
+    // Last paid blocks repeat, so ties are decided by the collateral.
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<COutPoint> vecOutpoints;
+    for (int i = 0; i < 60; i++) {
+        COutPoint outpoint(coinbaseTxns[i].GetHash(), 0);
+        CMasternode mn(CService(), outpoint, key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+        mn.sigTime = GetAdjustedTime() - 7 * 24 * 60 * 60;
+        mn.nBlockLastPaid = (i % 4 == 0) ? 0 : (i % 7) * 10;
+        BOOST_CHECK(mnodeman.Add(mn));
+        vecOutpoints.push_back(outpoint);
+    }
+    BOOST_CHECK_EQUAL(mnodeman.CountQualifiedForPayment(101, true), 41);
+    CheckSameWinners(true);
+    CheckSameWinners(false);
+
+    // Masternodes which were just announced are left out while there are
+    // enough others, otherwise the sigTime filter is dropped altogether
+    mnodeman.Clear();
+    for (int i = 0; i < 60; i++) {
+        CMasternode mn(CService(), vecOutpoints[i], key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+        mn.sigTime = (i % 3 == 0) ? GetAdjustedTime() : GetAdjustedTime() - 7 * 24 * 60 * 60;
+        mn.nBlockLastPaid = (i % 5) * 10;
+        BOOST_CHECK(mnodeman.Add(mn));
+    }
+    BOOST_CHECK(mnodeman.CountQualifiedForPayment(101, true) < mnodeman.CountQualifiedForPayment(101, false));
+    CheckSameWinners(true);
+
+    mnodeman.Clear();
+    for (int i = 0; i < 60; i++) {
+        CMasternode mn(CService(), vecOutpoints[i], key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+        mn.sigTime = (i % 3 == 0) ? GetAdjustedTime() - 7 * 24 * 60 * 60 : GetAdjustedTime();
+        mn.nBlockLastPaid = (i % 5) * 10;
+        BOOST_CHECK(mnodeman.Add(mn));
+    }
+    BOOST_CHECK_EQUAL(mnodeman.CountQualifiedForPayment(101, true), mnodeman.CountQualifiedForPayment(101, false));
+    CheckSameWinners(true);
+
+    mnodeman.Clear();
+    masternodeSync.Reset();
+}
+
+/** A transaction spending the first output of a coinbase of the test chain */
+static CMutableTransaction SpendCoinbase(const CTransaction& txFrom, const CKey& key)
+{
+    CScript scriptCoinbase = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = txFrom.vout[0].nValue - 10000;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, mtx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    mtx.vin[0].scriptSig << vchSig;
+    return mtx;
+}
+
+static bool IsOutpointSpent(const COutPoint& outpoint)
+{
+    CMasternode mn;
+    BOOST_CHECK(mnodeman.Get(outpoint, mn));
+    return mn.IsOutpointSpent();
+}
+
+BOOST_AUTO_TEST_CASE(masternode_collateral_spent)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<COutPoint> vecOutpoints;
+    for (int i = 0; i < 3; i++) {
+        COutPoint outpoint(coinbaseTxns[i].GetHash(), 0);
+        CMasternode mn(CService(), outpoint, key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+        BOOST_CHECK(mnodeman.Add(mn));
+        vecOutpoints.push_back(outpoint);
+    }
+
+    // Spends which didn't make it into a block don't count
+    CMutableTransaction mtxSpend = SpendCoinbase(coinbaseTxns[0], coinbaseKey);
+    mnodeman.SyncTransaction(mtxSpend, NULL);
+    BOOST_CHECK(!IsOutpointSpent(vecOutpoints[0]));
+
+    // Spends in a connected block are caught without a UTXO lookup
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, mtxSpend), scriptCoinbase);
+    BOOST_CHECK_EQUAL(block.vtx.size(), 2U);
+    for (const auto& tx : block.vtx)
+        mnodeman.SyncTransaction(*tx, &block);
+    BOOST_CHECK(IsOutpointSpent(vecOutpoints[0]));
+    BOOST_CHECK(!IsOutpointSpent(vecOutpoints[1]));
+    BOOST_CHECK(!IsOutpointSpent(vecOutpoints[2]));
+
+    // Spent masternodes aren't checked anymore
+    SetMockTime(GetTime() + MASTERNODE_CHECK_MAX_SECONDS);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 2);
+
+    // Spends no SyncTransaction was called for, like the ones while the node
+    // was offline, are found by looking up all collaterals
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, SpendCoinbase(coinbaseTxns[1], coinbaseKey)), scriptCoinbase);
+    BOOST_CHECK(!IsOutpointSpent(vecOutpoints[1]));
+    mnodeman.CheckCollaterals();
+    BOOST_CHECK(IsOutpointSpent(vecOutpoints[1]));
+    BOOST_CHECK(!IsOutpointSpent(vecOutpoints[2]));
+
+    SetMockTime(GetTime() + MASTERNODE_CHECK_MAX_SECONDS);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 1);
+
+    SetMockTime(0);
+    mnodeman.Clear();
+}
+
+BOOST_AUTO_TEST_CASE(masternode_check_schedule)
+{
+    const int64_t nTimeStart = GetTime();
+    SetMockTime(nTimeStart);
+
+    CKey key;
+    key.MakeNewKey(true);
+    COutPoint outpoint(coinbaseTxns[0].GetHash(), 0);
+    CMasternode mn(CService(), outpoint, key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+    mn.sigTime = nTimeStart - 7 * 24 * 60 * 60;
+    BOOST_CHECK(mnodeman.Add(mn));
+
+    // A ping right after the masternode was added schedules it again for the
+    // same time, it's still checked only once
+    CMasternodePing mnp;
+    mnp.vin = CTxIn(outpoint);
+    mnp.sigTime = nTimeStart - MASTERNODE_MIN_MNP_SECONDS + 30;
+    mnodeman.SetMasternodeLastPing(outpoint, mnp);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 1);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 0);
+
+    // The next check is when the ping gets too old, 30 seconds later,
+    // and only once again
+    SetMockTime(nTimeStart + 29);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 0);
+    SetMockTime(nTimeStart + 30);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 1);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 0);
+
+    // Without another deadline ahead it's rechecked after a minute
+    SetMockTime(nTimeStart + 30 + MASTERNODE_CHECK_MAX_SECONDS - 1);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 0);
+    SetMockTime(nTimeStart + 30 + MASTERNODE_CHECK_MAX_SECONDS);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 1);
+    BOOST_CHECK_EQUAL(mnodeman.Check(), 0);
+
+    SetMockTime(0);
+    mnodeman.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -54,7 +54,7 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
 
 
     CTxMemPool testPool(CFeeRate(0));
-    std::list<CTransaction> removed;
+    std::list<CTransactionRef> removed;
 
     // Nothing in pool, remove should do nothing:
     testPool.remove(txParent, removed, true);
@@ -280,7 +280,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK_EQUAL(pool.size(), 10);
 
     // Now try removing tx10 and verify the sort order returns to normal
-    std::list<CTransaction> removed;
+    std::list<CTransactionRef> removed;
     pool.remove(pool.mapTx.find(tx10.GetHash())->GetTx(), removed, true);
     CheckSort<1>(pool, snapshotOrder);
 
@@ -318,6 +318,116 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).Priority(10.0).FromTx(tx1));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).Priority(9.0).FromTx(tx2));
+    uint64_t tx2Size = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(0LL).Priority(100.0).FromTx(tx3));
+
+    /* 2nd highest fee */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 6 * COIN;
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(15000LL).Priority(1.0).FromTx(tx4));
+
+    /* equal fee rate to tx1, but newer */
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx5.vout[0].nValue = 11 * COIN;
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(10000LL).FromTx(tx5));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.resize(5);
+    sortedOrder[0] = tx2.GetHash().ToString(); // 20000
+    sortedOrder[1] = tx4.GetHash().ToString(); // 15000
+    // tx1 and tx5 are both 10000
+    // Ties are broken by hash, not timestamp, so determine which
+    // hash comes first.
+    if (tx1.GetHash() < tx5.GetHash()) {
+        sortedOrder[2] = tx1.GetHash().ToString();
+        sortedOrder[3] = tx5.GetHash().ToString();
+    } else {
+        sortedOrder[2] = tx5.GetHash().ToString();
+        sortedOrder[3] = tx1.GetHash().ToString();
+    }
+    sortedOrder[4] = tx3.GetHash().ToString(); // 0
+    CheckSort<4>(pool, sortedOrder);
+
+    /* low fee parent with high fee child */
+    /* tx6 (0) -> tx7 (high) */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    uint64_t tx6Size = ::GetSerializeSize(tx6, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(0LL).FromTx(tx6));
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    else
+        sortedOrder.insert(sortedOrder.end()-1, tx6.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    uint64_t tx7Size = ::GetSerializeSize(tx7, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* set the fee to just below tx2's feerate when including ancestor */
+    CAmount fee = (20000/tx2Size)*(tx7Size + tx6Size) - 1;
+
+    pool.addUnchecked(tx7.GetHash(), entry.Fee(fee).FromTx(tx7));
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    /* after tx6 is mined, tx7 should move up in the sort */
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(tx6));
+    std::list<CTransactionRef> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+
+    sortedOrder.erase(sortedOrder.begin()+1);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.pop_back();
+    else
+        sortedOrder.erase(sortedOrder.end()-2);
+    sortedOrder.insert(sortedOrder.begin(), tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
     CTxMemPool pool(CFeeRate(1000));
@@ -443,8 +553,8 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    std::vector<CTransaction> vtx;
-    std::list<CTransaction> conflicts;
+    std::vector<CTransactionRef> vtx;
+    std::list<CTransactionRef> conflicts;
     SetMockTime(42);
     SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
     BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), maxFeeRateRemoved.GetFeePerK() + 1000);
@@ -473,4 +583,97 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+
+    uint160 hashA, hashB;
+    memset(hashA.begin(), 0x01, 20);
+    memset(hashB.begin(), 0x02, 20);
+    CScript scriptA = CScript() << OP_DUP << OP_HASH160 << ToByteVector(hashA) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptB = CScript() << OP_HASH160 << ToByteVector(hashB) << OP_EQUAL;
+
+    // Confirmed coin paying to B
+    COutPoint prevout(uint256S("0x01"), 0);
+    view.AddCoin(prevout, Coin(CTxOut(50000, scriptB), 1, false), false);
+
+    // tx1 spends B, pays A twice and B once
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = prevout;
+    tx1.vout.resize(3);
+    tx1.vout[0] = CTxOut(10000, scriptA);
+    tx1.vout[1] = CTxOut(20000, scriptA);
+    tx1.vout[2] = CTxOut(15000, scriptB);
+
+    // tx2 spends tx1 and pays A
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 2);
+    tx2.vout.resize(1);
+    tx2.vout[0] = CTxOut(14000, scriptA);
+
+    std::vector<std::pair<uint160, int> > addressA(1, std::make_pair(hashA, 1));
+    std::vector<std::pair<uint160, int> > addressB(1, std::make_pair(hashB, 2));
+    std::vector<std::pair<uint160, int> > addressBoth;
+    addressBoth.push_back(addressA[0]);
+    addressBoth.push_back(addressB[0]);
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+
+    pool.addAddressIndex(entry.FromTx(tx1), view);
+    view.AddCoin(COutPoint(tx1.GetHash(), 2), Coin(tx1.vout[2], MEMPOOL_HEIGHT, false), false);
+    pool.addAddressIndex(entry.FromTx(tx2), view);
+
+    pool.getAddressIndex(addressA, results);
+    BOOST_CHECK_EQUAL(results.size(), 3);
+    results.clear();
+    pool.getAddressIndex(addressB, results);
+    BOOST_CHECK_EQUAL(results.size(), 3);
+    CAmount nSpent = 0, nReceived = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        BOOST_CHECK(results[i].first.addressBytes == hashB && results[i].first.type == 2);
+        if (results[i].second.amount < 0) {
+            BOOST_CHECK_EQUAL(results[i].first.spending, 1);
+            nSpent -= results[i].second.amount;
+        } else {
+            nReceived += results[i].second.amount;
+        }
+    }
+    BOOST_CHECK_EQUAL(nSpent, 65000);
+    BOOST_CHECK_EQUAL(nReceived, 15000);
+    results.clear();
+    pool.getAddressIndex(addressBoth, results);
+    BOOST_CHECK_EQUAL(results.size(), 6);
+    results.clear();
+
+    // Removing tx1 leaves only the deltas of tx2
+    pool.removeAddressIndex(tx1.GetHash());
+    pool.getAddressIndex(addressA, results);
+    BOOST_CHECK_EQUAL(results.size(), 1);
+    BOOST_CHECK(results[0].first.txhash == tx2.GetHash());
+    BOOST_CHECK_EQUAL(results[0].second.amount, 14000);
+    results.clear();
+    pool.getAddressIndex(addressB, results);
+    BOOST_CHECK_EQUAL(results.size(), 1);
+    BOOST_CHECK(results[0].first.txhash == tx2.GetHash());
+    BOOST_CHECK_EQUAL(results[0].second.amount, -15000);
+    BOOST_CHECK(results[0].second.prevhash == tx1.GetHash());
+    BOOST_CHECK_EQUAL(results[0].second.prevout, 2);
+    results.clear();
+
+    // Adding it back reuses the freed slots
+    pool.addAddressIndex(entry.FromTx(tx1), view);
+    pool.getAddressIndex(addressBoth, results);
+    BOOST_CHECK_EQUAL(results.size(), 6);
+    results.clear();
+
+    pool.removeAddressIndex(tx2.GetHash());
+    pool.removeAddressIndex(tx1.GetHash());
+    pool.getAddressIndex(addressBoth, results);
+    BOOST_CHECK(results.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "key.h"
 #include "validation.h"
 #include "masternode-payments.h"
 #include "miner.h"
@@ -104,17 +105,17 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         CBlock *pblock = &pblocktemplate->block; // pointer for convenience
         pblock->nVersion = 1;
         pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
-        CMutableTransaction txCoinbase(pblock->vtx[0]);
+        CMutableTransaction txCoinbase(*pblock->vtx[0]);
         txCoinbase.nVersion = 1;
         txCoinbase.vin[0].scriptSig = CScript();
         txCoinbase.vin[0].scriptSig.push_back(blockinfo[i].extranonce);
         txCoinbase.vin[0].scriptSig.push_back(chainActive.Height());
         txCoinbase.vout[0].scriptPubKey = CScript();
-        pblock->vtx[0] = CTransaction(txCoinbase);
+        pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
         if (txFirst.size() == 0)
             baseheight = chainActive.Height();
         if (txFirst.size() < 4)
-            txFirst.push_back(new CTransaction(pblock->vtx[0]));
+            txFirst.push_back(new CTransaction(*pblock->vtx[0]));
         pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
         pblock->nNonce = blockinfo[i].nonce;
         BOOST_CHECK(ProcessNewBlock(chainparams, pblock, true, NULL, NULL));
@@ -388,4 +389,141 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+/** Sign the only input of tx, which spends an output to scriptPubKey of key */
+static void SignSpend(const CKey& key, const CScript& scriptPubKey, CMutableTransaction& tx)
+{
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig = CScript() << vchSig;
+}
+
+/** Spend prevout to nOutputs outputs of nValue each, paying back to scriptPubKey */
+static CMutableTransaction CreateSpend(const CKey& key, const CScript& scriptPubKey, const COutPoint& prevout, CAmount nValue, int nOutputs = 1)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = nValue;
+        tx.vout[i].scriptPubKey = scriptPubKey;
+    }
+    SignSpend(key, scriptPubKey, tx);
+    return tx;
+}
+
+/** Create a template with a fresh assembler and tell whether it continued the last selection */
+static CBlockTemplate* CreateTemplate(const CChainParams& chainparams, const CScript& scriptPubKey, bool& fIncremental)
+{
+    BlockAssembler assembler(chainparams);
+    CBlockTemplate* pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    fIncremental = assembler.IsIncremental();
+    return pblocktemplate;
+}
+
+static std::set<uint256> GetTemplateTxids(const CBlockTemplate& blocktemplate)
+{
+    std::set<uint256> setTxids;
+    for (size_t i = 1; i < blocktemplate.block.vtx.size(); i++)
+        setTxids.insert(blocktemplate.block.vtx[i]->GetHash());
+    return setTxids;
+}
+
+BOOST_FIXTURE_TEST_CASE(CreateNewBlock_incremental, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::unique_ptr<CBlockTemplate> pblocktemplate, pblocktemplateFull;
+    bool fIncremental;
+
+    // Split the mature coinbase into outputs for the mempool transactions to spend
+    const int nOutputs = 20;
+    const CAmount nOutputValue = coinbaseTxns[0].vout[0].nValue / (nOutputs + 1);
+    CMutableTransaction txSplit = CreateSpend(coinbaseKey, scriptPubKey, COutPoint(coinbaseTxns[0].GetHash(), 0), nOutputValue, nOutputs);
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, txSplit), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    LOCK(cs_main);
+    TestMemPoolEntryHelper entry;
+    entry.nHeight = chainActive.Height();
+    int64_t nTime = GetTime();
+    std::vector<CMutableTransaction> vtx;
+    for (int i = 0; i < nOutputs; i++)
+        vtx.push_back(CreateSpend(coinbaseKey, scriptPubKey, COutPoint(txSplit.GetHash(), i), nOutputValue - 10000 - 1000 * i));
+
+    // The first template on a new tip makes a full selection
+    for (int i = 0; i < 5; i++)
+        mempool.addUnchecked(vtx[i].GetHash(), entry.Fee(nOutputValue - vtx[i].vout[0].nValue).Time(nTime++).FromTx(vtx[i]));
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 6);
+
+    // Transactions added since, including a child of one already selected,
+    // are added to the last selection
+    for (int i = 5; i < 10; i++)
+        mempool.addUnchecked(vtx[i].GetHash(), entry.Fee(nOutputValue - vtx[i].vout[0].nValue).Time(nTime++).FromTx(vtx[i]));
+    CMutableTransaction txChild = CreateSpend(coinbaseKey, scriptPubKey, COutPoint(vtx[0].GetHash(), 0), vtx[0].vout[0].nValue - 50000);
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(50000).Time(nTime++).FromTx(txChild));
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(fIncremental);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 12);
+
+    // A zero fee delta changes nothing but forces a full selection, which
+    // must pick the same transactions (only their order may differ)
+    mempool.PrioritiseTransaction(vtx[0].GetHash(), vtx[0].GetHash().ToString(), 0, 0);
+    pblocktemplateFull.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    BOOST_CHECK(GetTemplateTxids(*pblocktemplate) == GetTemplateTxids(*pblocktemplateFull));
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], pblocktemplateFull->vTxFees[0]);
+    BOOST_CHECK(pblocktemplate->block.vtx[0]->vout == pblocktemplateFull->block.vtx[0]->vout);
+
+    // Nothing changed, so the next template reuses the selection unchanged
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(fIncremental);
+    BOOST_CHECK(GetTemplateTxids(*pblocktemplate) == GetTemplateTxids(*pblocktemplateFull));
+
+    // Changing the fee of an entry forces a full selection
+    mempool.PrioritiseTransaction(vtx[3].GetHash(), vtx[3].GetHash().ToString(), 0, 100000);
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 12);
+
+    // So does removing an entry, which takes its descendants along
+    std::list<CTransactionRef> removed;
+    mempool.remove(vtx[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 10);
+    BOOST_CHECK(!GetTemplateTxids(*pblocktemplate).count(vtx[0].GetHash()));
+    BOOST_CHECK(!GetTemplateTxids(*pblocktemplate).count(txChild.GetHash()));
+
+    // Additions after that are incremental again and still match a full selection
+    for (int i = 10; i < 15; i++)
+        mempool.addUnchecked(vtx[i].GetHash(), entry.Fee(nOutputValue - vtx[i].vout[0].nValue).Time(nTime++).FromTx(vtx[i]));
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(fIncremental);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 15);
+    mempool.PrioritiseTransaction(vtx[1].GetHash(), vtx[1].GetHash().ToString(), 0, 0);
+    pblocktemplateFull.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    BOOST_CHECK(GetTemplateTxids(*pblocktemplate) == GetTemplateTxids(*pblocktemplateFull));
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], pblocktemplateFull->vTxFees[0]);
+
+    // Once a package didn't fit, the selection isn't kept and the next
+    // template starts over even without any change to the mempool
+    mapArgs["-blockmaxsize"] = "1500";
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    BOOST_CHECK(pblocktemplate->block.vtx.size() > 1);
+    BOOST_CHECK(pblocktemplate->block.vtx.size() < 15);
+    pblocktemplate.reset(CreateTemplate(chainparams, scriptPubKey, fIncremental));
+    BOOST_CHECK(!fIncremental);
+    mapArgs.erase("-blockmaxsize");
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
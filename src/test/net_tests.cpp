@@ -12,6 +12,11 @@
 #include "netbase.h"
 #include "chainparams.h"
 
+#ifdef USE_EPOLL
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 
 class CAddrManSerializationMock : public CAddrMan
@@ -174,4 +179,89 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+#ifdef USE_EPOLL
+struct CConnmanTest
+{
+    static bool InitSocketEvents(CConnman& connman)
+    {
+        std::string strError;
+        return connman.InitSocketEvents(strError);
+    }
+    static void RegisterNode(CConnman& connman, CNode* pnode) { connman.RegisterNode(pnode); }
+    static void DisconnectNodes(CConnman& connman) { connman.DisconnectNodes(); }
+    static void SocketEvents(CConnman& connman) { connman.SocketEvents(); }
+    static size_t CountDisconnected(CConnman& connman) { return connman.vNodesDisconnected.size(); }
+    static int GetWakeFd(CConnman& connman) { return connman.hWakePipe[0]; }
+};
+
+static CNode* CreatePairedNode(NodeId id, int& hPeerSocketRet)
+{
+    int sv[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    hPeerSocketRet = sv[1];
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001 + id;
+    return new CNode(id, NODE_NETWORK, 0, sv[0], CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), "", true);
+}
+
+BOOST_AUTO_TEST_CASE(socket_events_disconnect)
+{
+    CConnman connmanTest;
+    int hPeerSockets[3];
+    CNodeDisconnectFlag::fPending = false;
+
+    // Before epoll is set up registering fails. The node is in vNodes by
+    // then, so the sweep that its disconnection asks for removes it.
+    CNode* pnode0 = CreatePairedNode(0, hPeerSockets[0]);
+    CConnmanTest::RegisterNode(connmanTest, pnode0);
+    BOOST_CHECK(pnode0->fDisconnect);
+    BOOST_CHECK(CNodeDisconnectFlag::fPending);
+    CConnmanTest::DisconnectNodes(connmanTest);
+    BOOST_CHECK(!CNodeDisconnectFlag::fPending);
+    BOOST_CHECK_EQUAL(connmanTest.GetNodeCount(CConnman::CONNECTIONS_ALL), 0U);
+    BOOST_CHECK_EQUAL(CConnmanTest::CountDisconnected(connmanTest), 1U);
+
+    BOOST_REQUIRE(CConnmanTest::InitSocketEvents(connmanTest));
+    CNode* pnode1 = CreatePairedNode(1, hPeerSockets[1]);
+    CNode* pnode2 = CreatePairedNode(2, hPeerSockets[2]);
+    CConnmanTest::RegisterNode(connmanTest, pnode1);
+    CConnmanTest::RegisterNode(connmanTest, pnode2);
+    BOOST_CHECK(!pnode1->fDisconnect);
+    BOOST_CHECK(!pnode2->fDisconnect);
+    BOOST_CHECK(!CNodeDisconnectFlag::fPending);
+
+    // Only marking a node raises the flag, only a raised flag sweeps
+    pnode1->fDisconnect = false;
+    BOOST_CHECK(!CNodeDisconnectFlag::fPending);
+    CConnmanTest::DisconnectNodes(connmanTest);
+    BOOST_CHECK_EQUAL(connmanTest.GetNodeCount(CConnman::CONNECTIONS_ALL), 2U);
+    pnode1->fDisconnect = true;
+    BOOST_CHECK(CNodeDisconnectFlag::fPending);
+    CConnmanTest::DisconnectNodes(connmanTest);
+    BOOST_CHECK(!CNodeDisconnectFlag::fPending);
+    BOOST_CHECK_EQUAL(connmanTest.GetNodeCount(CConnman::CONNECTIONS_ALL), 1U);
+    BOOST_CHECK_EQUAL(CConnmanTest::CountDisconnected(connmanTest), 2U);
+    BOOST_CHECK(pnode1->hSocket == INVALID_SOCKET);
+    BOOST_CHECK(pnode2->hSocket != INVALID_SOCKET);
+
+    // A wakeup interrupts the wait and is drained by it, even when so many
+    // came in that the pipe is full
+    char buf;
+    int hWakeFd = CConnmanTest::GetWakeFd(connmanTest);
+    BOOST_CHECK(read(hWakeFd, &buf, 1) == -1);
+    for (int i = 0; i < 100000; i++)
+        connmanTest.WakeSocketHandler();
+    CConnmanTest::SocketEvents(connmanTest);
+    BOOST_CHECK(read(hWakeFd, &buf, 1) == -1);
+
+    connmanTest.WakeSocketHandler();
+    CConnmanTest::SocketEvents(connmanTest);
+    BOOST_CHECK(read(hWakeFd, &buf, 1) == -1);
+    BOOST_CHECK(!pnode2->fDisconnect);
+
+    for (int i = 0; i < 3; i++)
+        close(hPeerSockets[i]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
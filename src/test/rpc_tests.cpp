@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "validation.h"
 
 #include "test/test_mobitglobal.h"
 
@@ -329,6 +330,25 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_gettxoutsetinfo_default)
+{
+    // -coinstatsindex must not change what a plain call returns
+    bool fCoinStatsIndexOld = fCoinStatsIndex;
+    for (int i = 0; i < 2; i++) {
+        fCoinStatsIndex = (i == 1);
+        UniValue r;
+        BOOST_CHECK_NO_THROW(r = CallRPC("gettxoutsetinfo"));
+        BOOST_CHECK(find_value(r.get_obj(), "hash_serialized_2").isStr());
+        BOOST_CHECK(find_value(r.get_obj(), "transactions").isNum());
+        BOOST_CHECK(find_value(r.get_obj(), "muhash").isNull());
+        BOOST_CHECK_NO_THROW(CallRPC("gettxoutsetinfo hash_serialized_2"));
+        BOOST_CHECK_THROW(CallRPC("gettxoutsetinfo hash_serialized_2 0"), runtime_error);
+    }
+    fCoinStatsIndex = false;
+    BOOST_CHECK_THROW(CallRPC("gettxoutsetinfo muhash"), runtime_error);
+    fCoinStatsIndex = fCoinStatsIndexOld;
+}
+
 BOOST_AUTO_TEST_CASE(rpc_sentinel_ping)
 {
     BOOST_CHECK_NO_THROW(CallRPC("sentinelping 1.0.2"));
@@ -0,0 +1,134 @@
+// Copyright (c) 2018 The MobitGlobal Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hash.h"
+#include "script/sigcache.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "test/test_mobitglobal.h"
+
+#include <atomic>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+/** Distinct cache entries, entry n stands for the n-th checked signature */
+static uint256 TestEntry(uint32_t n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_insert_lookup_erase)
+{
+    CSignatureCache cache(1);
+
+    for (uint32_t i = 0; i < 1000; i++)
+        cache.Set(TestEntry(i));
+    for (uint32_t i = 0; i < 1000; i++)
+        BOOST_CHECK(cache.Get(TestEntry(i)));
+    for (uint32_t i = 1000; i < 2000; i++)
+        BOOST_CHECK(!cache.Get(TestEntry(i)));
+
+    // erasing one entry leaves the others alone
+    for (uint32_t i = 0; i < 1000; i += 2)
+        cache.Erase(TestEntry(i));
+    for (uint32_t i = 0; i < 1000; i++)
+        BOOST_CHECK_EQUAL(cache.Get(TestEntry(i)), i % 2 == 1);
+
+    // erased entries can be stored again, inserting twice keeps one copy
+    cache.Set(TestEntry(0));
+    cache.Set(TestEntry(0));
+    BOOST_CHECK(cache.Get(TestEntry(0)));
+    cache.Erase(TestEntry(0));
+    BOOST_CHECK(!cache.Get(TestEntry(0)));
+
+    // erasing what isn't there is harmless
+    cache.Erase(TestEntry(5000));
+    BOOST_CHECK(cache.Get(TestEntry(1)));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_size_arg)
+{
+    // 64 byte buckets of two entries each
+    mapArgs["-maxsigcachesize"] = "2";
+    CSignatureCache cache;
+    BOOST_CHECK_EQUAL(cache.GetCapacity(), (size_t)2 * (1 << 20) / 64 * 2);
+
+    mapArgs["-maxsigcachesize"] = "0";
+    CSignatureCache cacheDisabled;
+    BOOST_CHECK_EQUAL(cacheDisabled.GetCapacity(), 0U);
+    cacheDisabled.Set(TestEntry(0));
+    BOOST_CHECK(!cacheDisabled.Get(TestEntry(0)));
+    cacheDisabled.Erase(TestEntry(0));
+
+    mapArgs.erase("-maxsigcachesize");
+    CSignatureCache cacheDefault;
+    BOOST_CHECK_EQUAL(cacheDefault.GetCapacity(), (size_t)DEFAULT_MAX_SIG_CACHE_SIZE * (1 << 20) / 64 * 2);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_generation_eviction)
+{
+    CSignatureCache cache(1);
+    const uint32_t nCapacity = cache.GetCapacity();
+
+    // up to half the slots form a single generation, nothing is dropped yet
+    for (uint32_t i = 0; i < nCapacity / 2; i++)
+        cache.Set(TestEntry(i));
+    size_t nHits = 0;
+    for (uint32_t i = 0; i < nCapacity / 2; i++)
+        nHits += cache.Get(TestEntry(i));
+    BOOST_CHECK(nHits >= nCapacity / 2 * 99 / 100);
+
+    // keep inserting far beyond the capacity: old generations make room for new entries
+    for (uint32_t i = nCapacity / 2; i < 4 * nCapacity; i++)
+        cache.Set(TestEntry(i));
+
+    size_t nRecentHits = 0;
+    for (uint32_t i = 4 * nCapacity - nCapacity / 4; i < 4 * nCapacity; i++)
+        nRecentHits += cache.Get(TestEntry(i));
+    BOOST_CHECK(nRecentHits >= nCapacity / 4 * 90 / 100);
+
+    size_t nOldHits = 0;
+    for (uint32_t i = 0; i < nCapacity; i++)
+        nOldHits += cache.Get(TestEntry(i));
+    BOOST_CHECK(nOldHits <= nCapacity / 100);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_concurrent)
+{
+    CSignatureCache cache(1);
+    const int nThreads = 4;
+    // together the threads fill one generation
+    const uint32_t nPerThread = cache.GetCapacity() / 8;
+    std::atomic<unsigned int> nFalsePositives(0);
+
+    boost::thread_group threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.create_thread([&cache, &nFalsePositives, t, nThreads, nPerThread]() {
+            for (uint32_t i = 0; i < nPerThread; i++) {
+                cache.Set(TestEntry(t * nPerThread + i));
+                // entries above 0x80000000 are never stored
+                if (cache.Get(TestEntry(0x80000000 + t * nPerThread + i)))
+                    nFalsePositives++;
+                // read what the other threads are writing right now
+                cache.Get(TestEntry(((t + 1) % nThreads) * nPerThread + i));
+            }
+        });
+    }
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(nFalsePositives, 0U);
+
+    // writers only give up a bucket another writer holds, so nearly everything was stored
+    size_t nHits = 0;
+    for (uint32_t i = 0; i < nThreads * nPerThread; i++)
+        nHits += cache.Get(TestEntry(i));
+    BOOST_CHECK(nHits >= nThreads * nPerThread * 95 / 100);
+    for (uint32_t i = 0; i < nThreads * nPerThread; i++)
+        BOOST_CHECK(!cache.Get(TestEntry(0x80000000 + i)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
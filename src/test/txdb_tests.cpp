@@ -0,0 +1,136 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "random.h"
+#include "spentindex.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include "test/test_mobitglobal.h"
+
+#include <boost/test/unit_test.hpp>
+
+extern bool fSpentIndex;
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, TestingSetup)
+
+static void CheckSpentIndexValue(const CSpentIndexValue& value, const CSpentIndexValue& expected)
+{
+    BOOST_CHECK(value.txid == expected.txid);
+    BOOST_CHECK_EQUAL(value.inputIndex, expected.inputIndex);
+    BOOST_CHECK_EQUAL(value.blockHeight, expected.blockHeight);
+    BOOST_CHECK_EQUAL(value.satoshis, expected.satoshis);
+}
+
+/** Look up every key on its own and compare with the batched result */
+static void CheckSameAsSingleReads(const std::vector<CSpentIndexKey>& keys, const std::vector<CSpentIndexValue>& values)
+{
+    BOOST_CHECK_EQUAL(values.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        CSpentIndexKey key = keys[i];
+        CSpentIndexValue value;
+        BOOST_CHECK_EQUAL(pblocktree->ReadSpentIndex(key, value), !values[i].IsNull());
+        if (!values[i].IsNull())
+            CheckSpentIndexValue(values[i], value);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(spentindex_multi)
+{
+    // Outputs of two transactions, so some keys sit next to each other in the DB
+    uint256 txid1 = GetRandHash(), txid2 = GetRandHash();
+    std::vector<CSpentIndexKey> vKeys;
+    for (unsigned int n = 0; n < 4; n++) {
+        vKeys.push_back(CSpentIndexKey(txid1, n));
+        vKeys.push_back(CSpentIndexKey(txid2, n));
+    }
+    std::vector<CSpentIndexValue> vValues;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vUpdate;
+    for (size_t i = 0; i < vKeys.size(); i++) {
+        vValues.push_back(CSpentIndexValue(GetRandHash(), i, 100 + i, 1000 * i, 1, uint160()));
+        // every third output is unspent
+        if (i % 3 != 0)
+            vUpdate.push_back(std::make_pair(vKeys[i], vValues[i]));
+    }
+    BOOST_CHECK(pblocktree->UpdateSpentIndex(vUpdate));
+
+    // Out of order, duplicated and missing keys; the second round is served from the cache
+    std::vector<CSpentIndexKey> vQuery;
+    std::vector<size_t> vQueryIndex;
+    const size_t order[] = {7, 0, 3, 3, 5, 1, 6, 2, 7, 4};
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        vQuery.push_back(vKeys[order[i]]);
+        vQueryIndex.push_back(order[i]);
+    }
+    vQuery.push_back(CSpentIndexKey(GetRandHash(), 0));
+    vQueryIndex.push_back(vKeys.size());
+    for (int nRound = 0; nRound < 2; nRound++) {
+        std::vector<CSpentIndexValue> vResult;
+        BOOST_CHECK(pblocktree->ReadSpentIndexMulti(vQuery, vResult));
+        BOOST_CHECK_EQUAL(vResult.size(), vQuery.size());
+        for (size_t i = 0; i < vQuery.size(); i++) {
+            size_t nKey = vQueryIndex[i];
+            if (nKey == vKeys.size() || nKey % 3 == 0)
+                BOOST_CHECK(vResult[i].IsNull());
+            else
+                CheckSpentIndexValue(vResult[i], vValues[nKey]);
+        }
+        CheckSameAsSingleReads(vQuery, vResult);
+    }
+
+    // Outputs cached as unspent (or spent) pick up later updates
+    vUpdate.clear();
+    vUpdate.push_back(std::make_pair(vKeys[0], vValues[0]));
+    vUpdate.push_back(std::make_pair(vKeys[1], CSpentIndexValue()));
+    BOOST_CHECK(pblocktree->UpdateSpentIndex(vUpdate));
+    std::vector<CSpentIndexKey> vUpdated(1, vKeys[0]);
+    vUpdated.push_back(vKeys[1]);
+    std::vector<CSpentIndexValue> vResult;
+    BOOST_CHECK(pblocktree->ReadSpentIndexMulti(vUpdated, vResult));
+    CheckSpentIndexValue(vResult[0], vValues[0]);
+    BOOST_CHECK(vResult[1].IsNull());
+
+    // GetSpentIndexMulti lays the mempool over the index
+    bool fSpentIndexOld = fSpentIndex;
+    fSpentIndex = true;
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(vKeys[3].txid, vKeys[3].outputIndex);
+    mtx.vin[1].prevout = COutPoint(vKeys[5].txid, vKeys[5].outputIndex);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    CTransaction tx(mtx);
+    TestMemPoolEntryHelper entry;
+    CCoinsViewCache view(pcoinsTip);
+    mempool.addSpentIndex(entry.FromTx(tx), view);
+
+    std::vector<CSpentIndexKey> vOverlay;
+    vOverlay.push_back(vKeys[5]);
+    vOverlay.push_back(vKeys[2]);
+    vOverlay.push_back(vKeys[3]);
+    vOverlay.push_back(vKeys[6]);
+    vOverlay.push_back(vKeys[5]);
+    BOOST_CHECK(GetSpentIndexMulti(vOverlay, vResult));
+    BOOST_CHECK_EQUAL(vResult.size(), vOverlay.size());
+    CheckSpentIndexValue(vResult[0], CSpentIndexValue(tx.GetHash(), 1, -1, vResult[0].satoshis, 0, uint160()));
+    CheckSpentIndexValue(vResult[1], vValues[2]);
+    CheckSpentIndexValue(vResult[2], CSpentIndexValue(tx.GetHash(), 0, -1, vResult[2].satoshis, 0, uint160()));
+    BOOST_CHECK(vResult[3].IsNull());
+    CheckSpentIndexValue(vResult[4], vResult[0]);
+    for (size_t i = 0; i < vOverlay.size(); i++) {
+        CSpentIndexValue value;
+        BOOST_CHECK_EQUAL(GetSpentIndex(vOverlay[i], value), !vResult[i].IsNull());
+        if (!vResult[i].IsNull())
+            CheckSpentIndexValue(vResult[i], value);
+    }
+
+    mempool.removeSpentIndex(tx.GetHash());
+    BOOST_CHECK(GetSpentIndexMulti(vOverlay, vResult));
+    BOOST_CHECK(vResult[0].IsNull());
+    CheckSpentIndexValue(vResult[1], vValues[2]);
+    fSpentIndex = fSpentIndexOld;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
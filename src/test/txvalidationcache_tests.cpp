@@ -3,9 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "consensus/validation.h"
+#include "instantx.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
+#include "privatesend.h"
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
@@ -23,7 +25,7 @@ ToMemPool(CMutableTransaction& tx)
     LOCK(cs_main);
 
     CValidationState state;
-    return AcceptToMemoryPool(mempool, state, tx, false, NULL, true, false);
+    return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), false, NULL, true, false);
 }
 
 BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
@@ -83,4 +85,147 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+/** What CInstantSend serializes, to set up and inspect its state */
+struct InstantSendState
+{
+    std::map<uint256, CTxLockRequest> mapLockRequestAccepted;
+    std::map<uint256, CTxLockRequest> mapLockRequestRejected;
+    std::map<uint256, CTxLockVote> mapTxLockVotes;
+    std::map<uint256, CTxLockVote> mapTxLockVotesOrphan;
+    std::map<uint256, CTxLockCandidate> mapTxLockCandidates;
+    std::map<COutPoint, std::set<uint256> > mapVotedOutpoints;
+    std::map<COutPoint, uint256> mapLockedOutpoints;
+    std::map<COutPoint, int64_t> mapMasternodeOrphanVotes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(mapLockRequestAccepted);
+        READWRITE(mapLockRequestRejected);
+        READWRITE(mapTxLockVotes);
+        READWRITE(mapTxLockVotesOrphan);
+        READWRITE(mapTxLockCandidates);
+        READWRITE(mapVotedOutpoints);
+        READWRITE(mapLockedOutpoints);
+        READWRITE(mapMasternodeOrphanVotes);
+    }
+};
+
+static void SetInstantSendState(const InstantSendState& state)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << state;
+    ss >> instantsend;
+}
+
+static InstantSendState GetInstantSendState()
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << instantsend;
+    InstantSendState state;
+    ss >> state;
+    return state;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_dump_load, TestChain100Setup)
+{
+    // Transactions come back from a mempool dump with their entry time and
+    // fee deltas, children after their parents. InstantSend and mixing state
+    // is merged with what was received since startup.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector<CMutableTransaction> chain;
+    chain.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        chain[i].vin.resize(1);
+        chain[i].vin[0].prevout.hash = i == 0 ? coinbaseTxns[0].GetHash() : chain[i-1].GetHash();
+        chain[i].vin[0].prevout.n = 0;
+        chain[i].vout.resize(1);
+        chain[i].vout[0].nValue = (11 - i)*CENT;
+        chain[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, chain[i], 0, SIGHASH_ALL);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        chain[i].vin[0].scriptSig << vchSig;
+        BOOST_CHECK(ToMemPool(chain[i]));
+    }
+
+    uint256 hashChild = chain[1].GetHash();
+    mempool.PrioritiseTransaction(hashChild, hashChild.ToString(), 0, 5*CENT);
+    int64_t nTimeChild;
+    {
+        LOCK(mempool.cs);
+        nTimeChild = mempool.mapTx.find(hashChild)->GetTime();
+    }
+
+    // A lock for a transaction which gets mined while the node is down, the
+    // second coinbase is mature in the next block
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    CMutableTransaction txLocked;
+    txLocked.vin.resize(1);
+    txLocked.vin[0].prevout = COutPoint(coinbaseTxns[1].GetHash(), 0);
+    txLocked.vout.resize(1);
+    txLocked.vout[0].nValue = 11*CENT;
+    txLocked.vout[0].scriptPubKey = scriptPubKey;
+    {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txLocked, 0, SIGHASH_ALL);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txLocked.vin[0].scriptSig << vchSig;
+    }
+    uint256 hashLocked = txLocked.GetHash();
+    COutPoint outpointMasternode(GetRandHash(), 0);
+    CTxLockVote voteLocked(hashLocked, txLocked.vin[0].prevout, outpointMasternode);
+    CTxLockVote voteParent(chain[0].GetHash(), chain[0].vin[0].prevout, outpointMasternode);
+
+    InstantSendState stateDump;
+    stateDump.mapLockRequestAccepted.insert(std::make_pair(hashLocked, CTxLockRequest(txLocked)));
+    stateDump.mapTxLockCandidates.insert(std::make_pair(hashLocked, CTxLockCandidate(CTxLockRequest(txLocked))));
+    stateDump.mapTxLockVotes.insert(std::make_pair(voteLocked.GetHash(), voteLocked));
+    stateDump.mapTxLockVotes.insert(std::make_pair(voteParent.GetHash(), voteParent));
+    SetInstantSendState(stateDump);
+    CPrivateSend::AddDSTX(CDarksendBroadcastTx(MakeTransactionRef(chain[0]), outpointMasternode, GetAdjustedTime()));
+
+    DumpMempool();
+    mempool.clear();
+    mempool.ClearPrioritisation(hashChild);
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    SetInstantSendState(InstantSendState());
+    instantsend.AcceptLockRequest(CTxLockRequest(chain[1]));
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, txLocked), scriptPubKey);
+
+    BOOST_CHECK(LoadMempool());
+
+    InstantSendState stateLoaded = GetInstantSendState();
+    BOOST_CHECK(instantsend.AlreadyHave(hashLocked));
+    BOOST_CHECK(instantsend.AlreadyHave(hashChild));
+    BOOST_CHECK(instantsend.HasTxLockRequest(hashLocked));
+    BOOST_CHECK_EQUAL(stateLoaded.mapLockRequestAccepted.size(), 2);
+    BOOST_CHECK_EQUAL(stateLoaded.mapTxLockVotes.size(), 2);
+    // Entries of the mined transaction expire, the ones of the unconfirmed one don't yet
+    BOOST_CHECK_EQUAL(stateLoaded.mapTxLockCandidates[hashLocked].GetConfirmedHeight(), chainActive.Height());
+    BOOST_CHECK_EQUAL(stateLoaded.mapTxLockVotes[voteLocked.GetHash()].GetConfirmedHeight(), chainActive.Height());
+    BOOST_CHECK_EQUAL(stateLoaded.mapTxLockVotes[voteParent.GetHash()].GetConfirmedHeight(), -1);
+    BOOST_CHECK(CPrivateSend::GetDSTX(chain[0].GetHash()));
+
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(mempool.exists(chain[0].GetHash()));
+    BOOST_CHECK(mempool.exists(hashChild));
+    {
+        LOCK(mempool.cs);
+        CTxMemPool::txiter it = mempool.mapTx.find(hashChild);
+        BOOST_CHECK_EQUAL(it->GetTime(), nTimeChild);
+        BOOST_CHECK_EQUAL(it->GetModifiedFee(), it->GetFee() + 5*CENT);
+    }
+    mempool.clear();
+    SetInstantSendState(InstantSendState());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
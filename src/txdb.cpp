@@ -6,14 +6,17 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "pow.h"
 #include "uint256.h"
 #include "ui_interface.h"
 #include "init.h"
 
+#include <algorithm>
 #include <stdint.h>
 
+#include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -26,6 +29,7 @@ static const char DB_ADDRESSINDEX = 'a';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_COINSTATSINDEX = 'S';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -106,7 +110,7 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe), spentIndexCache(SPENT_INDEX_CACHE_SIZE), nSpentIndexGeneration(0) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -207,7 +211,74 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
 }
 
 bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(make_pair(DB_SPENTINDEX, key), value);
+    std::vector<CSpentIndexKey> keys(1, key);
+    std::vector<CSpentIndexValue> values;
+    if (!ReadSpentIndexMulti(keys, values) || values[0].IsNull())
+        return false;
+    value = values[0];
+    return true;
+}
+
+namespace {
+/** Orders spent index keys the way LevelDB orders their serialization */
+struct CSpentIndexKeyDBCompare
+{
+    const std::vector<CSpentIndexKey>& keys;
+
+    CSpentIndexKeyDBCompare(const std::vector<CSpentIndexKey>& keysIn) : keys(keysIn) {}
+
+    bool operator()(size_t a, size_t b) const {
+        int cmp = memcmp(keys[a].txid.begin(), keys[b].txid.begin(), 32);
+        if (cmp != 0)
+            return cmp < 0;
+        unsigned char na[4], nb[4];
+        WriteLE32(na, keys[a].outputIndex);
+        WriteLE32(nb, keys[b].outputIndex);
+        return memcmp(na, nb, 4) < 0;
+    }
+};
+}
+
+bool CBlockTreeDB::ReadSpentIndexMulti(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values) {
+    values.assign(keys.size(), CSpentIndexValue());
+
+    std::vector<size_t> vMissing;
+    uint64_t nGeneration;
+    {
+        LOCK(cs_spentIndexCache);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (!spentIndexCache.GetAndTouch(keys[i], values[i]))
+                vMissing.push_back(i);
+        }
+        nGeneration = nSpentIndexGeneration;
+    }
+    if (vMissing.empty())
+        return true;
+
+    // Seeking forward through sorted keys keeps the iterator in the same
+    // blocks, and outputs of one transaction are usually next to each other
+    std::sort(vMissing.begin(), vMissing.end(), CSpentIndexKeyDBCompare(keys));
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    std::pair<char, CSpentIndexKey> key;
+    BOOST_FOREACH(size_t i, vMissing) {
+        bool fAtKey = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_SPENTINDEX && key.second == keys[i];
+        if (!fAtKey) {
+            pcursor->Seek(make_pair(DB_SPENTINDEX, keys[i]));
+            fAtKey = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_SPENTINDEX && key.second == keys[i];
+        }
+        if (fAtKey) {
+            if (!pcursor->GetValue(values[i]))
+                return error("failed to get spent index value");
+            pcursor->Next();
+        }
+    }
+
+    LOCK(cs_spentIndexCache);
+    if (nGeneration == nSpentIndexGeneration) {
+        BOOST_FOREACH(size_t i, vMissing)
+            spentIndexCache.Insert(keys[i], values[i]);
+    }
+    return true;
 }
 
 bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
@@ -219,7 +290,13 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
+    bool ret = WriteBatch(batch);
+
+    LOCK(cs_spentIndexCache);
+    nSpentIndexGeneration++;
+    for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        spentIndexCache.Erase(it->first);
+    return ret;
 }
 
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
@@ -334,6 +411,14 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
+bool CBlockTreeDB::WriteCoinStatsIndex(const uint256 &hashBlock, const CCoinStatsIndexValue &value) {
+    return Write(make_pair(DB_COINSTATSINDEX, hashBlock), value);
+}
+
+bool CBlockTreeDB::ReadCoinStatsIndex(const uint256 &hashBlock, CCoinStatsIndexValue &value) {
+    return Read(make_pair(DB_COINSTATSINDEX, hashBlock), value);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -6,10 +6,13 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "cachemap.h"
 #include "coins.h"
+#include "coinstatsindex.h"
 #include "dbwrapper.h"
 #include "chain.h"
 #include "spentindex.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
@@ -107,6 +110,9 @@ private:
     friend class CCoinsViewDB;
 };
 
+/** Number of recent spent index lookups, including misses, kept in memory */
+static const unsigned int SPENT_INDEX_CACHE_SIZE = 50000;
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -115,6 +121,12 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    CCriticalSection cs_spentIndexCache;
+    /** Recently read spent index entries, a null value for outputs that are not spent */
+    CacheMap<CSpentIndexKey, CSpentIndexValue> spentIndexCache;
+    /** Bumped on every spent index update, so lookups racing with it don't cache stale entries */
+    uint64_t nSpentIndexGeneration;
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
@@ -124,6 +136,8 @@ public:
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+    /** Look up many spent index entries with a single iterator walked in key order. Keys that are not found get a null value. */
+    bool ReadSpentIndexMulti(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values);
     bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
@@ -135,6 +149,8 @@ public:
                           int start = 0, int end = 0);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
+    bool WriteCoinStatsIndex(const uint256 &hashBlock, const CCoinStatsIndexValue &value);
+    bool ReadCoinStatsIndex(const uint256 &hashBlock, CCoinStatsIndexValue &value);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
@@ -39,6 +39,7 @@
 #include "instantx.h"
 #include "masternodeman.h"
 #include "masternode-payments.h"
+#include "privatesend.h"
 
 #include <sstream>
 
@@ -73,12 +74,14 @@ bool fTxIndex = true;
 bool fAddressIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
+bool fCoinStatsIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fCheckBlockIndex = false;
+bool fCheckBlockReads = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -551,10 +554,11 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
+bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
                               std::vector<COutPoint>& coins_to_uncache, bool fDryRun)
 {
+    const CTransaction& tx = *ptx;
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
         *pfMissingInputs = false;
@@ -742,7 +746,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
+        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -843,20 +847,6 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                 // Save these to avoid repeated lookups
                 setIterConflicting.insert(mi);
 
-                // If this entry is "dirty", then we don't have descendant
-                // state for this transaction, which means we probably have
-                // lots of in-mempool descendants.
-                // Don't allow replacements of dirty transactions, to ensure
-                // that we don't spend too much time walking descendants.
-                // This should be rare.
-                if (mi->IsDirty()) {
-                    return state.DoS(0,
-                            error("AcceptToMemoryPool: rejecting replacement %s; cannot replace tx %s with untracked descendants",
-                                hash.ToString(),
-                                mi->GetTx().GetHash().ToString()),
-                            REJECT_NONSTANDARD, "too many potential replacements");
-                }
-
                 // Don't allow the replacement to reduce the feerate of the
                 // mempool.
                 //
@@ -987,7 +977,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                     FormatMoney(nModifiedFees - nConflictingFees),
                     (int)nSize - (int)nConflictingSize);
         }
-        pool.RemoveStaged(allConflicting);
+        pool.RemoveStaged(allConflicting, false);
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
@@ -1016,13 +1006,14 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fDryRun)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit,
+                                bool fRejectAbsurdFee, bool fDryRun)
 {
     std::vector<COutPoint> coins_to_uncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, coins_to_uncache, fDryRun);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, fRejectAbsurdFee, coins_to_uncache, fDryRun);
     if (!res || fDryRun) {
-        if(!res) LogPrint("mempool", "%s: %s %s\n", __func__, tx.GetHash().ToString(), state.GetRejectReason());
+        if(!res) LogPrint("mempool", "%s: %s %s\n", __func__, tx->GetHash().ToString(), state.GetRejectReason());
         BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
@@ -1032,6 +1023,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fDryRun)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, fRejectAbsurdFee, fDryRun);
+}
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes)
 {
     if (!fTimestampIndex)
@@ -1057,6 +1054,42 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     return true;
 }
 
+bool GetSpentIndexMulti(const std::vector<CSpentIndexKey> &keys, std::vector<CSpentIndexValue> &values)
+{
+    if (!fSpentIndex)
+        return false;
+
+    values.assign(keys.size(), CSpentIndexValue());
+    mempool.getSpentIndexMulti(keys, values);
+
+    std::vector<size_t> vMissing;
+    std::vector<CSpentIndexKey> missingKeys;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (values[i].IsNull()) {
+            vMissing.push_back(i);
+            missingKeys.push_back(keys[i]);
+        }
+    }
+    if (missingKeys.empty())
+        return true;
+
+    std::vector<CSpentIndexValue> missingValues;
+    if (!pblocktree->ReadSpentIndexMulti(missingKeys, missingValues))
+        return false;
+    for (size_t i = 0; i < vMissing.size(); i++)
+        values[vMissing[i]] = missingValues[i];
+
+    return true;
+}
+
+bool GetCoinStatsIndex(const uint256 &hashBlock, CCoinStatsIndexValue &value)
+{
+    if (!fCoinStatsIndex)
+        return false;
+
+    return pblocktree->ReadCoinStatsIndex(hashBlock, value);
+}
+
 bool GetAddressIndex(uint160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
 {
@@ -1088,8 +1121,10 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 
     LOCK(cs_main);
 
-    if (mempool.lookup(hash, txOut))
+    CTransactionRef ptx = mempool.get(hash);
+    if (ptx)
     {
+        txOut = *ptx;
         return true;
     }
 
@@ -1125,9 +1160,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-                if (tx.GetHash() == hash) {
-                    txOut = tx;
+            BOOST_FOREACH(const CTransactionRef &tx, block.vtx) {
+                if (tx->GetHash() == hash) {
+                    txOut = *tx;
                     hashBlock = pindexSlow->GetBlockHash();
                     return true;
                 }
@@ -1169,7 +1204,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockFromDiskUnchecked(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
@@ -1186,6 +1221,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockFromDiskUnchecked(block, pos))
+        return false;
+
     // Check the header
     if (!CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
@@ -1195,11 +1238,26 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (fCheckBlockReads) {
+        if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+            return false;
+        if (block.GetHash() != pindex->GetBlockHash())
+            return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                    pindex->ToString(), pindex->GetBlockPos().ToString());
+        return true;
+    }
+
+    // The index entry was PoW-checked when it was accepted, so if the header
+    // read from disk carries exactly the same fields it has the same hash.
+    if (!ReadBlockFromDiskUnchecked(block, pindex->GetBlockPos()))
         return false;
-    if (block.GetHash() != pindex->GetBlockHash())
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+    const uint256 hashPrev = pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+    if (block.nVersion != pindex->nVersion || block.hashPrevBlock != hashPrev ||
+        block.hashMerkleRoot != pindex->hashMerkleRoot || block.nTime != pindex->nTime ||
+        block.nBits != pindex->nBits || block.nNonce != pindex->nNonce)
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): header doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    block.SetCachedHash(pindex->GetBlockHash());
     return true;
 }
 
@@ -1676,7 +1734,7 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
         uint256 hash = tx.GetHash();
         bool is_coinbase = tx.IsCoinBase();
 
@@ -1900,6 +1958,29 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+/** Add an unspent output to the coin stats, or remove it with fSpend */
+static void ApplyCoinStats(CCoinStatsIndexValue& stats, const COutPoint& outpoint, const Coin& coin, bool fSpend)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    const unsigned char* data = (const unsigned char*)&ss[0];
+    // Rough size of the output in the UTXO set: outpoint, height and coinbase flag, amount, script
+    uint64_t nBogoSize = 32 + 4 + 4 + 8 + 2 + coin.out.scriptPubKey.size();
+    if (fSpend) {
+        stats.muhash.Remove(data, ss.size());
+        stats.nTransactionOutputs--;
+        stats.nBogoSize -= nBogoSize;
+        stats.nTotalAmount -= coin.out.nValue;
+    } else {
+        stats.muhash.Insert(data, ss.size());
+        stats.nTransactionOutputs++;
+        stats.nBogoSize += nBogoSize;
+        stats.nTotalAmount += coin.out.nValue;
+    }
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
@@ -1929,8 +2010,11 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
+        if (!fJustCheck) {
+            if (fCoinStatsIndex && !pblocktree->WriteCoinStatsIndex(pindex->GetBlockHash(), CCoinStatsIndexValue()))
+                return AbortNode(state, "Failed to write coin stats index");
             view.SetBestBlock(pindex->GetBlockHash());
+        }
         return true;
     }
 
@@ -1990,7 +2074,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     fEnforceBIP30 = fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
 
     if (fEnforceBIP30) {
-        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            const CTransaction &tx = *ptx;
             for (size_t o = 0; o < tx.vout.size(); o++) {
                 if (view.HaveCoin(COutPoint(tx.GetHash(), o))) {
                     return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
@@ -2043,12 +2128,18 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    // Only rolled forward when the parent's statistics are there, i.e. not
+    // for TestBlockValidity which never writes them.
+    CCoinStatsIndexValue coinStats;
+    bool fCoinStats = fCoinStatsIndex && !fJustCheck;
+    if (fCoinStats && !pblocktree->ReadCoinStatsIndex(pindex->pprev->GetBlockHash(), coinStats))
+        return AbortNode(state, "Coin stats index is missing the parent block, restart with -reindex-chainstate to rebuild it");
 
     bool fDIP0001Active_context = (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_DIP0001, versionbitscache) == THRESHOLD_ACTIVE);
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
         const uint256 txhash = tx.GetHash();
 
         nInputs += tx.vin.size();
@@ -2169,6 +2260,18 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
+        if (fCoinStats) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                if (!tx.vout[k].scriptPubKey.IsUnspendable())
+                    ApplyCoinStats(coinStats, COutPoint(txhash, k), Coin(tx.vout[k], pindex->nHeight, i == 0), false);
+            }
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo.back();
+                for (size_t j = 0; j < tx.vin.size(); j++)
+                    ApplyCoinStats(coinStats, tx.vin[j].prevout, txundo.vprevout[j], true);
+            }
+        }
+
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
@@ -2189,7 +2292,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         return state.DoS(0, error("ConnectBlock(MBGL): %s", strError), REJECT_INVALID, "bad-cb-amount");
     }
 
-    if (!IsBlockPayeeValid(block.vtx[0], pindex->nHeight, blockReward)) {
+    if (!IsBlockPayeeValid(*block.vtx[0], pindex->nHeight, blockReward)) {
         mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
         return state.DoS(0, error("ConnectBlock(MBGL): couldn't find masternode or superblock payments"),
                                 REJECT_INVALID, "bad-cb-payee");
@@ -2245,6 +2348,10 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
             return AbortNode(state, "Failed to write timestamp index");
 
+    if (fCoinStats)
+        if (!pblocktree->WriteCoinStatsIndex(pindex->GetBlockHash(), coinStats))
+            return AbortNode(state, "Failed to write coin stats index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2254,7 +2361,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
     GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
-    hashPrevBestCoinBase = block.vtx[0].GetHash();
+    hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
@@ -2459,11 +2566,12 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
         return false;
     // Resurrect mempool transactions from the disconnected block.
     std::vector<uint256> vHashUpdate;
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction &tx = *ptx;
         // ignore validation errors in resurrected transactions
-        list<CTransaction> removed;
+        list<CTransactionRef> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, true)) {
+        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, ptx, false, NULL, true)) {
             mempool.remove(tx, removed, true);
         } else if (mempool.exists(tx.GetHash())) {
             vHashUpdate.push_back(tx.GetHash());
@@ -2479,8 +2587,8 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        GetMainSignals().SyncTransaction(tx, NULL);
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        GetMainSignals().SyncTransaction(*ptx, NULL);
     }
     return true;
 }
@@ -2531,18 +2639,18 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.
-    list<CTransaction> txConflicted;
+    list<CTransactionRef> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
-    BOOST_FOREACH(const CTransaction &tx, txConflicted) {
-        GetMainSignals().SyncTransaction(tx, NULL);
+    BOOST_FOREACH(const CTransactionRef &ptx, txConflicted) {
+        GetMainSignals().SyncTransaction(*ptx, NULL);
     }
     // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        GetMainSignals().SyncTransaction(tx, pblock);
+    BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx) {
+        GetMainSignals().SyncTransaction(*ptx, pblock);
     }
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
@@ -3116,11 +3224,11 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
                          REJECT_INVALID, "bad-blk-length");
 
     // First transaction must be coinbase, the rest must not be
-    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+    if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
         return state.DoS(100, error("CheckBlock(): first tx is not coinbase"),
                          REJECT_INVALID, "bad-cb-missing");
     for (unsigned int i = 1; i < block.vtx.size(); i++)
-        if (block.vtx[i].IsCoinBase())
+        if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, error("CheckBlock(): more than one coinbase"),
                              REJECT_INVALID, "bad-cb-multiple");
 
@@ -3131,7 +3239,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         // We should never accept block which conflicts with completed transaction lock,
         // that's why this is in CheckBlock unlike coinbase payee/amount.
         // Require other nodes to comply, send them some data in case they are missing it.
-        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            const CTransaction &tx = *ptx;
             // skip coinbase, it has no inputs
             if (tx.IsCoinBase()) continue;
             // LOOK FOR TRANSACTION LOCK IN OUR MAP OF OUTPOINTS
@@ -3155,16 +3264,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // END MBGL
 
     // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state))
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+        if (!CheckTransaction(*ptx, state))
             return error("CheckBlock(): CheckTransaction of %s failed with %s",
-                tx.GetHash().ToString(),
+                ptx->GetHash().ToString(),
                 FormatStateMessage(state));
 
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
-        nSigOps += GetLegacySigOpCount(tx);
+        nSigOps += GetLegacySigOpCount(*ptx);
     }
     // sigops limits (relaxed)
     if (nSigOps > MaxBlockSigOps(true))
@@ -3182,7 +3291,7 @@ bool CheckNetFilter51Hash(const CBlock& block)
     CTxDestination address;
     int coinbaseKey = 0;
 
-    CTransaction coinbasetxn = block.vtx[coinbaseKey]; // coinbase is always first txn
+    const CTransaction& coinbasetxn = *block.vtx[coinbaseKey]; // coinbase is always first txn
     int addrKey = coinbasetxn.vout.size()-1; //minerReward is last coinbasepayment
     CTxOut minerReward = coinbasetxn.vout[addrKey];
     if (ExtractDestination(minerReward.scriptPubKey, address)) {
@@ -3205,7 +3314,7 @@ bool CheckNetFilter51Hash(const CBlock& block)
             while (!chkBlock.IsNull() && count <= nMaxMatch)
             {
                 CTxDestination chkAddress;
-                CTransaction coinbasetxn = chkBlock.vtx[coinbaseKey]; // coinbase is always first txn
+                const CTransaction& coinbasetxn = *chkBlock.vtx[coinbaseKey]; // coinbase is always first txn
                 int addrKey = coinbasetxn.vout.size() - 1; //minerReward is last coinbasepayment
                 CTxOut minerReward = coinbasetxn.vout[addrKey];
                 ExtractDestination(minerReward.scriptPubKey, chkAddress);
@@ -3317,7 +3426,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     // Check that all transactions are finalized and not over-sized
     // Also count sigops
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction &tx = *ptx;
         if (!IsFinalTx(tx, nHeight, nLockTimeCutoff)) {
             return state.DoS(10, error("%s: contains a non-final transaction", __func__), REJECT_INVALID, "bad-txns-nonfinal");
         }
@@ -3337,8 +3447,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     if (block.nVersion >= 2 && IsSuperMajority(2, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams))
     {
         CScript expect = CScript() << nHeight;
-        if (block.vtx[0].vin[0].scriptSig.size() < expect.size() ||
-            !std::equal(expect.begin(), expect.end(), block.vtx[0].vin[0].scriptSig.begin())) {
+        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
             return state.DoS(100, error("%s: block height mismatch in coinbase", __func__), REJECT_INVALID, "bad-cb-height");
         }
     }
@@ -3424,6 +3534,25 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
     return true;
 }
 
+size_t HashBlockHeaders(std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams)
+{
+    // Hash in groups so that a batch with bad proof of work is abandoned after
+    // at most one group instead of after hashing every header in it.
+    static const size_t nGroupSize = 64;
+    std::vector<uint256> vHashes(nGroupSize);
+    for (size_t nStart = 0; nStart < headers.size(); nStart += nGroupSize) {
+        const size_t nCount = std::min(nGroupSize, headers.size() - nStart);
+        SkunkHashBatch(&headers[nStart], nCount, &vHashes[0]);
+        for (size_t i = 0; i < nCount; i++) {
+            CBlockHeader& header = headers[nStart + i];
+            header.SetCachedHash(vHashes[i]);
+            if (!CheckProofOfWork(vHashes[i], header.nBits, consensusParams))
+                return nStart + i;
+        }
+    }
+    return headers.size();
+}
+
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
 static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
 {
@@ -3840,6 +3969,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    // Check whether we have a coin stats index
+    pblocktree->ReadFlag("coinstatsindex", fCoinStatsIndex);
+    LogPrintf("%s: coin stats index %s\n", __func__, fCoinStatsIndex ? "enabled" : "disabled");
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4006,6 +4139,10 @@ bool InitBlockIndex(const CChainParams& chainparams)
     fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
     pblocktree->WriteFlag("spentindex", fSpentIndex);
 
+    // Use the provided setting for -coinstatsindex in the new database
+    fCoinStatsIndex = GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX);
+    pblocktree->WriteFlag("coinstatsindex", fCoinStatsIndex);
+
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4408,6 +4545,217 @@ ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::D
     return VersionBitsState(chainActive.Tip(), params, pos, versionbitscache);
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Number of loaded transactions whose scripts are checked together before they are accepted */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 200;
+
+typedef std::vector<std::pair<CTransactionRef, int64_t> > mempool_dump_v_t; // tx - time it entered the mempool
+
+/** Append an entry after all of its in-mempool parents, so the dump can be accepted front to back */
+static void AddMempoolDumpEntry(CTxMemPool::txiter it, CTxMemPool::setEntries& setDone, mempool_dump_v_t& vDump)
+{
+    AssertLockHeld(mempool.cs);
+    if (!setDone.insert(it).second) return;
+    BOOST_FOREACH(CTxMemPool::txiter itParent, mempool.GetMemPoolParents(it))
+        AddMempoolDumpEntry(itParent, setDone, vDump);
+    vDump.push_back(std::make_pair(it->GetSharedTx(), it->GetTime()));
+}
+
+static bool GetMempoolLoadPrevout(const COutPoint& prevout, const std::map<uint256, CTransactionRef>& mapBatch, CTxOut& txoutRet)
+{
+    AssertLockHeld(cs_main);
+    CTransactionRef ptxPrev = mempool.get(prevout.hash);
+    if (!ptxPrev) {
+        std::map<uint256, CTransactionRef>::const_iterator it = mapBatch.find(prevout.hash);
+        if (it != mapBatch.end())
+            ptxPrev = it->second;
+    }
+    if (ptxPrev) {
+        if (prevout.n >= ptxPrev->vout.size())
+            return false;
+        txoutRet = ptxPrev->vout[prevout.n];
+        return true;
+    }
+    const Coin& coin = pcoinsTip->AccessCoin(prevout);
+    if (coin.IsSpent())
+        return false;
+    txoutRet = coin.out;
+    return true;
+}
+
+/**
+ * Verify the scripts of a batch of loaded transactions on the script check
+ * threads, storing the results in the signature cache. Accepting them to the
+ * mempool one by one afterwards then finds their signatures already checked.
+ */
+static void CacheMempoolLoadSignatures(const mempool_dump_v_t& vBatch)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads)
+        return;
+
+    std::map<uint256, CTransactionRef> mapBatch;
+    BOOST_FOREACH(const mempool_dump_v_t::value_type& entry, vBatch)
+        mapBatch.insert(std::make_pair(entry.first->GetHash(), entry.first));
+
+    std::vector<CScriptCheck> vChecks;
+    BOOST_FOREACH(const mempool_dump_v_t::value_type& entry, vBatch) {
+        const CTransaction& tx = *entry.first;
+        if (tx.IsCoinBase())
+            continue;
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            CTxOut txout;
+            if (!GetMempoolLoadPrevout(tx.vin[i].prevout, mapBatch, txout))
+                continue;
+            vChecks.push_back(CScriptCheck());
+            CScriptCheck check(txout.scriptPubKey, txout.nValue, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, true);
+            check.swap(vChecks.back());
+        }
+    }
+
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    // Only the cache matters here, failures are reported when the transaction itself is accepted
+    control.Wait();
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+
+        // Restore the locks first, so locked inputs are protected while the transactions are accepted.
+        // The network is already running, keep whatever was received since startup.
+        {
+            CInstantSend instantsendDump;
+            file >> instantsendDump;
+            instantsend.Merge(instantsendDump);
+        }
+        instantsend.UpdateConfirmedHeights();
+
+        std::vector<CDarksendBroadcastTx> vecDSTX;
+        file >> vecDSTX;
+
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it) {
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+        }
+
+        uint64_t num;
+        file >> num;
+        mempool_dump_v_t vBatch;
+        vBatch.reserve(std::min<uint64_t>(num, MEMPOOL_LOAD_BATCH_SIZE));
+        while (num--) {
+            CTransactionRef tx;
+            int64_t nTime;
+            file >> tx;
+            file >> nTime;
+
+            if (nTime + nExpiryTimeout > nNow) {
+                vBatch.push_back(std::make_pair(tx, nTime));
+            } else {
+                ++skipped;
+            }
+            if (vBatch.size() < MEMPOOL_LOAD_BATCH_SIZE && num)
+                continue;
+
+            LOCK(cs_main);
+            CacheMempoolLoadSignatures(vBatch);
+            BOOST_FOREACH(const mempool_dump_v_t::value_type& entry, vBatch) {
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, entry.first, true, NULL, entry.second)) {
+                    ++count;
+                } else {
+                    ++failed;
+                }
+            }
+            vBatch.clear();
+
+            if (ShutdownRequested())
+                return false;
+        }
+
+        BOOST_FOREACH(const CDarksendBroadcastTx& dstx, vecDSTX) {
+            if (mempool.exists(dstx.tx->GetHash()))
+                CPrivateSend::AddDSTX(dstx);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired, %s\n", count, failed, skipped, instantsend.ToString());
+    LogPrint("mempool", "LoadMempool -- loaded in %dms\n", GetTimeMillis() - nStart);
+    return true;
+}
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+
+    mempool_dump_v_t vDump;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vDump.reserve(mempool.mapTx.size());
+        CTxMemPool::setEntries setDone;
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            AddMempoolDumpEntry(it, setDone, vDump);
+    }
+
+    std::vector<CDarksendBroadcastTx> vecDSTX;
+    CPrivateSend::GetUnconfirmedDSTXes(vecDSTX);
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << instantsend;
+        file << vecDSTX;
+        file << mapDeltas;
+
+        file << (uint64_t)vDump.size();
+        BOOST_FOREACH(const mempool_dump_v_t::value_type& entry, vDump) {
+            file << entry.first;
+            file << entry.second;
+        }
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        LogPrintf("Dumped mempool: %u transactions, %u mixing transactions in %dms\n", vDump.size(), vecDSTX.size(), GetTimeMillis() - nStart);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
 class CMainCleanup
 {
 public:
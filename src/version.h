@@ -44,4 +44,8 @@ static const int SENDHEADERS_VERSION = 70201;
 //! DIP0001 was activated in this version
 static const int DIP0001_PROTOCOL_VERSION = 70208;
 
+//! short-id-based block download starts with this version; peers of this version
+//! that don't know "sendcmpct" ignore it and are never sent compact blocks
+static const int SHORT_IDS_BLOCKS_VERSION = 70211;
+
 #endif // BITCOIN_VERSION_H
@@ -0,0 +1,172 @@
+// Copyright (c) 2018 The MobitGlobal Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "votequeue.h"
+
+#include "checkqueue.h"
+#include "governance.h"
+#include "masternodeman.h"
+#include "messagesigner.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h" // For cs_main and nScriptCheckThreads
+
+CVoteVerifyQueue votequeue;
+
+static CCheckQueue<CVoteSignatureCheck> votecheckqueue(128);
+
+bool CVoteSignatureCheck::operator()()
+{
+    std::string strError;
+    *pfValid = CMessageSigner::VerifyMessage(pubKeyMasternode, vchSig, strMessage, strError);
+    // never fail the batch, every vote gets its own verdict when it is applied
+    return true;
+}
+
+void CVoteSignatureCheck::swap(CVoteSignatureCheck& check)
+{
+    std::swap(pubKeyMasternode, check.pubKeyMasternode);
+    vchSig.swap(check.vchSig);
+    strMessage.swap(check.strMessage);
+    std::swap(pfValid, check.pfValid);
+}
+
+void CVoteVerifyQueue::AddPaymentVote(NodeId nodeId, const CMasternodePaymentVote& vote, const CPubKey& pubKeyMasternode)
+{
+    LOCK(cs);
+    vecPending.push_back(CQueuedVote());
+    CQueuedVote& queued = vecPending.back();
+    queued.nodeId = nodeId;
+    queued.fGovernance = false;
+    queued.paymentVote = vote;
+    queued.pubKeyMasternode = pubKeyMasternode;
+    queued.fSignatureValid = false;
+}
+
+void CVoteVerifyQueue::AddGovernanceVote(NodeId nodeId, const CGovernanceVote& vote)
+{
+    // an unknown masternode is dealt with by CGovernanceManager::ProcessVote, nothing to pre-verify then
+    masternode_info_t infoMn;
+    mnodeman.GetMasternodeInfo(vote.GetMasternodeOutpoint(), infoMn);
+
+    LOCK(cs);
+    vecPending.push_back(CQueuedVote());
+    CQueuedVote& queued = vecPending.back();
+    queued.nodeId = nodeId;
+    queued.fGovernance = true;
+    queued.governanceVote = vote;
+    queued.pubKeyMasternode = infoMn.pubKeyMasternode;
+    queued.fSignatureValid = false;
+}
+
+void CVoteVerifyQueue::ProcessQueue(CConnman& connman)
+{
+    std::vector<CQueuedVote> vecVotes;
+    {
+        LOCK(cs);
+        vecVotes.swap(vecPending);
+    }
+    if (vecVotes.empty()) return;
+
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::vector<CVoteSignatureCheck> vChecks;
+    vChecks.reserve(vecVotes.size());
+    for (auto& queued : vecVotes) {
+        if (!queued.pubKeyMasternode.IsValid()) continue;
+        if (queued.fGovernance) {
+            vChecks.push_back(CVoteSignatureCheck(queued.pubKeyMasternode, queued.governanceVote.GetSignature(), queued.governanceVote.GetSignatureMessage(), &queued.fSignatureValid));
+        } else {
+            vChecks.push_back(CVoteSignatureCheck(queued.pubKeyMasternode, queued.paymentVote.vchSig, queued.paymentVote.GetSignatureMessage(), &queued.fSignatureValid));
+        }
+    }
+    size_t nChecks = vChecks.size();
+
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CVoteSignatureCheck> control(&votecheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (auto& check : vChecks) {
+            check();
+        }
+    }
+
+    int64_t nTimeVerified = GetTimeMicros();
+
+    unsigned int nBadSignatures = 0;
+    std::vector<std::pair<NodeId, int> > vecMisbehaving;
+    for (auto& queued : vecVotes) {
+        if (queued.pubKeyMasternode.IsValid() && !queued.fSignatureValid) {
+            nBadSignatures++;
+        }
+        CNode* pfrom = NULL;
+        connman.ForNode(queued.nodeId, [&pfrom](CNode* pnode) {
+            pnode->AddRef();
+            pfrom = pnode;
+            return true;
+        });
+        int nDos;
+        if (queued.fGovernance) {
+            // a vote not verified against the key known at arrival is checked again against the current key
+            nDos = governance.ProcessVerifiedVote(pfrom, queued.governanceVote, queued.fSignatureValid, connman);
+        } else {
+            nDos = mnpayments.ProcessVerifiedVote(pfrom, queued.paymentVote, queued.fSignatureValid, connman);
+        }
+        if (nDos) {
+            vecMisbehaving.push_back(std::make_pair(queued.nodeId, nDos));
+        }
+        if (pfrom) {
+            pfrom->Release();
+        }
+    }
+
+    // node states are guarded by cs_main, which is not held while the managers apply the votes
+    if (!vecMisbehaving.empty()) {
+        LOCK(cs_main);
+        for (const auto& pairMisbehaving : vecMisbehaving) {
+            Misbehaving(pairMisbehaving.first, pairMisbehaving.second);
+        }
+    }
+
+    int64_t nTimeApplied = GetTimeMicros();
+    LogPrint("bench", "CVoteVerifyQueue::ProcessQueue -- %u votes, %u checked, %u bad signatures: verify %.2fms, apply %.2fms\n",
+                vecVotes.size(), nChecks, nBadSignatures, 0.001 * (nTimeVerified - nTimeStart), 0.001 * (nTimeApplied - nTimeVerified));
+
+    LOCK(cs);
+    stats.nBatches++;
+    stats.nVotes += vecVotes.size();
+    stats.nBadSignatures += nBadSignatures;
+    stats.nLastBatchSize = vecVotes.size();
+    stats.nLastBatchVerifyMicros = nTimeVerified - nTimeStart;
+    stats.nLastBatchTotalMicros = nTimeApplied - nTimeStart;
+}
+
+CVoteQueueStats CVoteVerifyQueue::GetStats() const
+{
+    LOCK(cs);
+    CVoteQueueStats statsRet = stats;
+    statsRet.nPending = vecPending.size();
+    return statsRet;
+}
+
+void ThreadVoteCheck()
+{
+    RenameThread("mobitglobal-votech");
+    votecheckqueue.Thread();
+}
+
+void ThreadVoteVerify(CConnman& connman)
+{
+    if(fLiteMode) return; // disable all Mobit Global specific functionality
+
+    RenameThread("mobitglobal-votes");
+
+    while (true)
+    {
+        // short enough to not delay relay noticeably, long enough to collect votes from many peers
+        MilliSleep(100);
+        votequeue.ProcessQueue(connman);
+    }
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The MobitGlobal Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef VOTEQUEUE_H
+#define VOTEQUEUE_H
+
+#include "governance-vote.h"
+#include "masternode-payments.h"
+#include "net.h"
+#include "pubkey.h"
+#include "sync.h"
+
+class CVoteVerifyQueue;
+
+extern CVoteVerifyQueue votequeue;
+
+/** Checks one queued vote signature on a verification worker. The result is
+ * stored in the queued vote, which is judged later by the normal processing
+ * code without verifying the signature again.
+ */
+class CVoteSignatureCheck
+{
+private:
+    CPubKey pubKeyMasternode;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+    bool* pfValid;
+
+public:
+    CVoteSignatureCheck() : pfValid(NULL) {}
+    CVoteSignatureCheck(const CPubKey& pubKeyMasternodeIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn, bool* pfValidIn) :
+        pubKeyMasternode(pubKeyMasternodeIn), vchSig(vchSigIn), strMessage(strMessageIn), pfValid(pfValidIn) {}
+
+    bool operator()();
+
+    void swap(CVoteSignatureCheck& check);
+};
+
+struct CVoteQueueStats
+{
+    uint64_t nBatches;
+    uint64_t nVotes;
+    uint64_t nBadSignatures;
+    size_t nPending;
+    size_t nLastBatchSize;
+    int64_t nLastBatchVerifyMicros;
+    int64_t nLastBatchTotalMicros;
+
+    CVoteQueueStats() : nBatches(0), nVotes(0), nBadSignatures(0), nPending(0), nLastBatchSize(0), nLastBatchVerifyMicros(0), nLastBatchTotalMicros(0) {}
+};
+
+/** Collects masternode payment votes and governance votes from all peers after
+ * their cheap checks passed. Each batch has its signatures verified in parallel
+ * on the verification workers, then the votes are applied one by one in arrival
+ * order by the managers, which are handed the result of each check. Peers which
+ * sent bad votes are punished under cs_main once the batch is applied.
+ */
+class CVoteVerifyQueue
+{
+private:
+    struct CQueuedVote
+    {
+        NodeId nodeId;
+        bool fGovernance;
+        CMasternodePaymentVote paymentVote;
+        CGovernanceVote governanceVote;
+        // key of the voting masternode when the vote arrived, invalid if unknown
+        CPubKey pubKeyMasternode;
+        // set by CVoteSignatureCheck if the signature matches pubKeyMasternode
+        bool fSignatureValid;
+    };
+
+    mutable CCriticalSection cs;
+    std::vector<CQueuedVote> vecPending;
+    CVoteQueueStats stats;
+
+public:
+    void AddPaymentVote(NodeId nodeId, const CMasternodePaymentVote& vote, const CPubKey& pubKeyMasternode);
+    void AddGovernanceVote(NodeId nodeId, const CGovernanceVote& vote);
+
+    /// Verify and apply everything queued so far
+    void ProcessQueue(CConnman& connman);
+
+    CVoteQueueStats GetStats() const;
+};
+
+/** Run a vote signature verification worker */
+void ThreadVoteCheck();
+/** Periodically hand queued votes to the workers and apply the results */
+void ThreadVoteVerify(CConnman& connman);
+
+#endif
@@ -128,7 +128,6 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
     {
-        pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
         // Don't throw error in case a key is already there
@@ -139,6 +138,8 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
         if (!pwalletMain->AddKeyPubKey(key, pubkey))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+        // Also picks up outputs of known transactions when not rescanning
+        pwalletMain->MarkDirty();
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
@@ -157,8 +158,6 @@ void ImportScript(const CScript& script, const string& strLabel, bool isRedeemSc
     if (!isRedeemScript && ::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
         throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
-    pwalletMain->MarkDirty();
-
     if (!pwalletMain->HaveWatchOnly(script) && !pwalletMain->AddWatchOnly(script))
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
 
@@ -167,6 +166,9 @@ void ImportScript(const CScript& script, const string& strLabel, bool isRedeemSc
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding p2sh redeemScript to wallet");
         ImportAddress(CBitcoinAddress(CScriptID(script)), strLabel);
     }
+
+    // After adding, so outputs of known transactions are picked up without a rescan
+    pwalletMain->MarkDirty();
 }
 
 void ImportAddress(const CBitcoinAddress& address, const string& strLabel)
@@ -536,6 +538,7 @@ UniValue importelectrumwallet(const UniValue& params, bool fHelp)
 
     LogPrintf("Rescanning %i blocks\n", chainActive.Height() - nStartHeight + 1);
     pwalletMain->ScanForWalletTransactions(chainActive[nStartHeight], true);
+    pwalletMain->MarkDirty();
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
@@ -4,6 +4,12 @@
 
 #include "wallet/wallet.h"
 
+#include "privatesend.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "validation.h"
+
+#include <algorithm>
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -361,4 +367,318 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 101);
 }
 
+BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
+{
+    // every coinbase of the test chain pays to coinbaseKey
+    CWallet walletScan;
+    {
+        LOCK(walletScan.cs_wallet);
+        walletScan.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    BOOST_CHECK_EQUAL(walletScan.ScanForWalletTransactions(chainActive.Genesis()), 100);
+    BOOST_CHECK_EQUAL(walletScan.mapWallet.size(), 100U);
+
+    // transactions already in the wallet are only picked up again when updating
+    BOOST_CHECK_EQUAL(walletScan.ScanForWalletTransactions(chainActive.Genesis()), 0);
+    BOOST_CHECK_EQUAL(walletScan.ScanForWalletTransactions(chainActive.Genesis(), true), 100);
+    BOOST_CHECK_EQUAL(walletScan.mapWallet.size(), 100U);
+}
+
+static bool HaveAvailableCoin(const CWallet& wallet, const COutPoint& outpoint)
+{
+    std::vector<COutput> vAvailable;
+    wallet.AvailableCoins(vAvailable);
+    BOOST_FOREACH(const COutput& out, vAvailable) {
+        if (out.tx->GetHash() == outpoint.hash && out.i == (int)outpoint.n)
+            return true;
+    }
+    return false;
+}
+
+static CMutableTransaction SpendCoinbases(const std::vector<CTransaction>& vFrom, const CKey& key, const CScript& scriptTo)
+{
+    CScript scriptCoinbase = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction mtx;
+    mtx.vin.resize(vFrom.size());
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = scriptTo;
+    for (size_t i = 0; i < vFrom.size(); i++) {
+        mtx.vin[i].prevout = COutPoint(vFrom[i].GetHash(), 0);
+        mtx.vout[0].nValue += vFrom[i].vout[0].nValue;
+    }
+    mtx.vout[0].nValue -= 10000;
+    for (size_t i = 0; i < vFrom.size(); i++) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptCoinbase, mtx, i, SIGHASH_ALL);
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        mtx.vin[i].scriptSig << vchSig;
+    }
+    return mtx;
+}
+
+BOOST_FIXTURE_TEST_CASE(wallet_utxo_refill, TestChain100Setup)
+{
+    // Balances and coin selection only see transactions in setWalletUTXO, so
+    // every way an output of ours becomes unspent again has to put it back
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    CWallet walletUTXO;
+    {
+        LOCK(walletUTXO.cs_wallet);
+        walletUTXO.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    walletUTXO.ScanForWalletTransactions(chainActive.Genesis(), true);
+    RegisterValidationInterface(&walletUTXO);
+    // the wallet wants one confirmation more than consensus before spending coinbases
+    for (int i = 0; i < 2; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptCoinbase);
+
+    COutPoint outpoint0(coinbaseTxns[0].GetHash(), 0), outpoint1(coinbaseTxns[1].GetHash(), 0);
+    BOOST_CHECK(HaveAvailableCoin(walletUTXO, outpoint0));
+    BOOST_CHECK(HaveAvailableCoin(walletUTXO, outpoint1));
+
+    // Abandoning a spend that never made it into the mempool
+    CTransaction txAbandoned(SpendCoinbases(std::vector<CTransaction>(1, coinbaseTxns[0]), coinbaseKey, scriptOther));
+    walletUTXO.SyncTransaction(txAbandoned, NULL);
+    BOOST_CHECK(!HaveAvailableCoin(walletUTXO, outpoint0));
+    BOOST_CHECK(walletUTXO.AbandonTransaction(txAbandoned.GetHash()));
+    BOOST_CHECK(HaveAvailableCoin(walletUTXO, outpoint0));
+
+    // A spend of both coinbases conflicted by a block spending only the first
+    std::vector<CTransaction> vFrom;
+    vFrom.push_back(coinbaseTxns[0]);
+    vFrom.push_back(coinbaseTxns[1]);
+    CTransaction txConflicted(SpendCoinbases(vFrom, coinbaseKey, scriptOther));
+    walletUTXO.SyncTransaction(txConflicted, NULL);
+    BOOST_CHECK(!HaveAvailableCoin(walletUTXO, outpoint0));
+    BOOST_CHECK(!HaveAvailableCoin(walletUTXO, outpoint1));
+    CMutableTransaction mtxConflicting = SpendCoinbases(std::vector<CTransaction>(1, coinbaseTxns[0]), coinbaseKey, CScript() << OP_TRUE);
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, mtxConflicting), scriptCoinbase);
+    BOOST_CHECK(walletUTXO.GetWalletTx(txConflicted.GetHash())->GetDepthInMainChain() < 0);
+    BOOST_CHECK(!HaveAvailableCoin(walletUTXO, outpoint0));
+    BOOST_CHECK(HaveAvailableCoin(walletUTXO, outpoint1));
+
+    // Transactions we sent to scripts that are imported later: one without a
+    // rescan as importaddress ... false does, one with a rescan
+    CKey keyImport, keyRescan;
+    keyImport.MakeNewKey(true);
+    keyRescan.MakeNewKey(true);
+    CScript scriptImport = GetScriptForDestination(keyImport.GetPubKey().GetID());
+    std::vector<CMutableTransaction> vSpends;
+    vSpends.push_back(SpendCoinbases(std::vector<CTransaction>(1, coinbaseTxns[2]), coinbaseKey, scriptImport));
+    vSpends.push_back(SpendCoinbases(std::vector<CTransaction>(1, coinbaseTxns[3]), coinbaseKey, GetScriptForDestination(keyRescan.GetPubKey().GetID())));
+    CreateAndProcessBlock(vSpends, scriptCoinbase);
+    COutPoint outpointImport(vSpends[0].GetHash(), 0), outpointRescan(vSpends[1].GetHash(), 0);
+    BOOST_CHECK(walletUTXO.GetWalletTx(outpointImport.hash) != NULL);
+    BOOST_CHECK(walletUTXO.GetWalletTx(outpointRescan.hash) != NULL);
+    BOOST_CHECK(!HaveAvailableCoin(walletUTXO, outpointImport));
+    BOOST_CHECK(!HaveAvailableCoin(walletUTXO, outpointRescan));
+
+    {
+        LOCK2(cs_main, walletUTXO.cs_wallet);
+        BOOST_CHECK(walletUTXO.AddWatchOnly(scriptImport));
+        walletUTXO.MarkDirty();
+    }
+    BOOST_CHECK(HaveAvailableCoin(walletUTXO, outpointImport));
+
+    {
+        LOCK(walletUTXO.cs_wallet);
+        walletUTXO.AddKeyPubKey(keyRescan, keyRescan.GetPubKey());
+    }
+    walletUTXO.ScanForWalletTransactions(chainActive.Genesis(), true);
+    BOOST_CHECK(HaveAvailableCoin(walletUTXO, outpointRescan));
+
+    UnregisterValidationInterface(&walletUTXO);
+}
+
+/**
+ * The rounds of an outpoint as they were computed before the walk became
+ * iterative, by recursing into every input of ours. Memoized, so it stays
+ * usable on wide graphs.
+ */
+static int GetRoundsRecursive(const CWallet& wallet, const COutPoint& outpoint, std::map<COutPoint, int>& mapMemo)
+{
+    std::map<COutPoint, int>::const_iterator it = mapMemo.find(outpoint);
+    if (it != mapMemo.end())
+        return it->second;
+
+    const CWalletTx* wtx = wallet.GetWalletTx(outpoint.hash);
+    if (wtx == NULL)
+        return -1;
+    if (outpoint.n >= wtx->vout.size())
+        return -4;
+    if (CPrivateSend::IsCollateralAmount(wtx->vout[outpoint.n].nValue))
+        return -3;
+    if (!CPrivateSend::IsDenominatedAmount(wtx->vout[outpoint.n].nValue))
+        return -2;
+    BOOST_FOREACH(const CTxOut& out, wtx->vout) {
+        if (!CPrivateSend::IsDenominatedAmount(out.nValue))
+            return 0;
+    }
+
+    int nShortest = -10;
+    BOOST_FOREACH(const CTxIn& txin, wtx->vin) {
+        if (!wallet.IsMine(txin))
+            continue;
+        int n = GetRoundsRecursive(wallet, txin.prevout, mapMemo);
+        if (n >= 0 && (n < nShortest || nShortest == -10))
+            nShortest = n;
+    }
+    int nRounds = nShortest == -10 ? 0 : std::min(nShortest + 1, 16);
+    mapMemo[outpoint] = nRounds;
+    return nRounds;
+}
+
+static CMutableTransaction CreateRoundsTx(const std::vector<COutPoint>& vPrevouts, const std::vector<CAmount>& vAmounts, const CScript& scriptTo)
+{
+    CMutableTransaction mtx;
+    BOOST_FOREACH(const COutPoint& prevout, vPrevouts) {
+        mtx.vin.push_back(CTxIn(prevout));
+    }
+    BOOST_FOREACH(const CAmount& nAmount, vAmounts) {
+        mtx.vout.push_back(CTxOut(nAmount, scriptTo));
+    }
+    return mtx;
+}
+
+static void CheckSameRounds(const CWallet& wallet, const std::vector<COutPoint>& vOutpoints)
+{
+    std::map<COutPoint, int> mapMemo;
+    LOCK(wallet.cs_wallet);
+    BOOST_FOREACH(const COutPoint& outpoint, vOutpoints) {
+        BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(outpoint), GetRoundsRecursive(wallet, outpoint, mapMemo));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(privatesend_rounds, TestChain100Setup)
+{
+    CPrivateSend::InitStandardDenominations();
+    std::vector<CAmount> vecDenoms = CPrivateSend::GetStandardDenominations();
+    CKey keyMine;
+    keyMine.MakeNewKey(true);
+    CScript scriptMine = GetScriptForDestination(keyMine.GetPubKey().GetID());
+    CWallet walletRounds;
+    {
+        LOCK(walletRounds.cs_wallet);
+        walletRounds.AddKeyPubKey(keyMine, keyMine.GetPubKey());
+    }
+    RegisterValidationInterface(&walletRounds);
+
+    // A chain of mixing transactions longer than the 16 rounds counted
+    std::vector<COutPoint> vChain;
+    COutPoint prevout(GetRandHash(), 0);
+    for (int i = 0; i < 20; i++) {
+        CTransaction tx(CreateRoundsTx(std::vector<COutPoint>(1, prevout), std::vector<CAmount>(2, vecDenoms[1]), scriptMine));
+        walletRounds.SyncTransaction(tx, NULL);
+        prevout = COutPoint(tx.GetHash(), 0);
+        vChain.push_back(prevout);
+    }
+    {
+        LOCK(walletRounds.cs_wallet);
+        // asking for the tip first walks the whole chain at once
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(vChain.back()), 16);
+        for (int i = 0; i < 20; i++)
+            BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(vChain[i]), std::min(i, 16));
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(COutPoint(vChain[0].hash, 2)), -4);
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(COutPoint(GetRandHash(), 0)), -1);
+    }
+
+    // A random graph of denominated, mixed, collateral and foreign spends
+    std::vector<COutPoint> vOutpoints(vChain);
+    std::vector<COutPoint> vUnspent;
+    for (int i = 0; i < 20; i++)
+        vUnspent.push_back(COutPoint(vChain[i].hash, 1));
+    for (int i = 0; i < 200; i++) {
+        std::vector<COutPoint> vPrevouts;
+        if (insecure_rand() % 4 == 0)
+            vPrevouts.push_back(COutPoint(GetRandHash(), 0));
+        int nInputs = 1 + insecure_rand() % 3;
+        for (int j = 0; j < nInputs && !vUnspent.empty(); j++) {
+            size_t nPos = insecure_rand() % vUnspent.size();
+            vPrevouts.push_back(vUnspent[nPos]);
+            vUnspent.erase(vUnspent.begin() + nPos);
+        }
+        std::vector<CAmount> vAmounts;
+        int nOutputs = 1 + insecure_rand() % 3;
+        for (int j = 0; j < nOutputs; j++) {
+            switch (insecure_rand() % 6) {
+                case 0: vAmounts.push_back(CPrivateSend::GetCollateralAmount() * (1 + insecure_rand() % 4)); break;
+                case 1: vAmounts.push_back(3 * COIN); break;
+                default: vAmounts.push_back(vecDenoms[insecure_rand() % vecDenoms.size()]);
+            }
+        }
+        CTransaction tx(CreateRoundsTx(vPrevouts, vAmounts, scriptMine));
+        walletRounds.SyncTransaction(tx, NULL);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            vOutpoints.push_back(COutPoint(tx.GetHash(), j));
+            vUnspent.push_back(COutPoint(tx.GetHash(), j));
+        }
+    }
+    // deepest first, then again from an empty cache in random order
+    std::reverse(vOutpoints.begin(), vOutpoints.end());
+    CheckSameRounds(walletRounds, vOutpoints);
+    {
+        LOCK(walletRounds.cs_wallet);
+        walletRounds.ClearPrivateSendRoundsCache();
+    }
+    BOOST_CHECK_EQUAL(walletRounds.GetPrivateSendRoundsCacheSize(), 0U);
+    std::random_shuffle(vOutpoints.begin(), vOutpoints.end(), GetRandInt);
+    CheckSameRounds(walletRounds, vOutpoints);
+    size_t nCached = walletRounds.GetPrivateSendRoundsCacheSize();
+    BOOST_CHECK(nCached >= vOutpoints.size());
+
+    // Abandoning drops the rounds of the transaction and of its descendants
+    BOOST_CHECK(walletRounds.AbandonTransaction(vChain[15].hash));
+    size_t nAbandoned = 0;
+    for (int i = 15; i < 20; i++) {
+        BOOST_CHECK(walletRounds.GetWalletTx(vChain[i].hash)->isAbandoned());
+        nAbandoned += 2;
+    }
+    BOOST_CHECK(walletRounds.GetPrivateSendRoundsCacheSize() <= nCached - nAbandoned);
+    CheckSameRounds(walletRounds, vOutpoints);
+
+    // So does a block conflicting with the transaction
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CTransaction txConflicted(SpendCoinbases(std::vector<CTransaction>(1, coinbaseTxns[0]), coinbaseKey, scriptMine));
+    walletRounds.SyncTransaction(txConflicted, NULL);
+    CTransaction txChild(CreateRoundsTx(std::vector<COutPoint>(1, COutPoint(txConflicted.GetHash(), 0)), std::vector<CAmount>(1, vecDenoms[0]), scriptMine));
+    walletRounds.SyncTransaction(txChild, NULL);
+    {
+        LOCK(walletRounds.cs_wallet);
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(COutPoint(txChild.GetHash(), 0)), 0);
+    }
+    nCached = walletRounds.GetPrivateSendRoundsCacheSize();
+    CMutableTransaction mtxConflicting = SpendCoinbases(std::vector<CTransaction>(1, coinbaseTxns[0]), coinbaseKey, CScript() << OP_TRUE);
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, mtxConflicting), scriptCoinbase);
+    BOOST_CHECK(walletRounds.GetWalletTx(txChild.GetHash())->GetDepthInMainChain() < 0);
+    BOOST_CHECK_EQUAL(walletRounds.GetPrivateSendRoundsCacheSize(), nCached - 2);
+
+    // A rescan after a key import can make more inputs ours
+    CKey keyImport;
+    keyImport.MakeNewKey(true);
+    std::vector<CAmount> vAmounts(2, vecDenoms[2]);
+    CMutableTransaction mtxParent = CreateRoundsTx(std::vector<COutPoint>(1, vChain[3]), vAmounts, scriptMine);
+    mtxParent.vout[1].scriptPubKey = GetScriptForDestination(keyImport.GetPubKey().GetID());
+    CTransaction txParent(mtxParent);
+    walletRounds.SyncTransaction(txParent, NULL);
+    CTransaction txSpend(CreateRoundsTx(std::vector<COutPoint>(1, COutPoint(txParent.GetHash(), 1)), std::vector<CAmount>(1, vecDenoms[2]), scriptMine));
+    walletRounds.SyncTransaction(txSpend, NULL);
+    {
+        LOCK(walletRounds.cs_wallet);
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(COutPoint(txParent.GetHash(), 0)), 4);
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(COutPoint(txSpend.GetHash(), 0)), 0);
+        walletRounds.AddKeyPubKey(keyImport, keyImport.GetPubKey());
+    }
+    walletRounds.ScanForWalletTransactions(chainActive.Genesis(), true);
+    {
+        LOCK(walletRounds.cs_wallet);
+        BOOST_CHECK_EQUAL(walletRounds.GetRealOutpointPrivateSendRounds(COutPoint(txSpend.GetHash(), 0)), 5);
+    }
+
+    UnregisterValidationInterface(&walletRounds);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
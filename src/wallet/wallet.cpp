@@ -9,6 +9,7 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "chain.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
@@ -621,6 +622,20 @@ set<uint256> CWallet::GetConflicts(const uint256& txid) const
 
 void CWallet::Flush(bool shutdown)
 {
+    {
+        LOCK(cs_wallet);
+        if (fFileBacked && !setOutpointRoundsDirty.empty()) {
+            CWalletDB walletdb(strWalletFile);
+            walletdb.TxnBegin();
+            BOOST_FOREACH(const COutPoint& outpoint, setOutpointRoundsDirty) {
+                std::map<COutPoint, int>::const_iterator it = mapOutpointRoundsCache.find(outpoint);
+                if (it != mapOutpointRoundsCache.end())
+                    walletdb.WritePrivateSendRounds(outpoint, it->second);
+            }
+            walletdb.TxnCommit();
+            setOutpointRoundsDirty.clear();
+        }
+    }
     bitdb.Flush(shutdown);
 }
 
@@ -731,6 +746,36 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+void CWallet::UpdateWalletUTXO(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = it->second;
+    for (unsigned int i = 0; i < wtx.vout.size(); ++i) {
+        if (IsMine(wtx.vout[i]) && !IsSpent(hash, i)) {
+            setWalletUTXO.insert(COutPoint(hash, i));
+        }
+    }
+}
+
+void CWallet::GetWalletUTXOTxes(std::vector<const CWalletTx*>& vwtx) const
+{
+    AssertLockHeld(cs_wallet);
+    vwtx.clear();
+    // Outpoints are ordered by hash, so the outputs of a transaction are next to each other
+    uint256 hashPrev;
+    BOOST_FOREACH(const COutPoint& outpoint, setWalletUTXO) {
+        if (outpoint.hash == hashPrev)
+            continue;
+        hashPrev = outpoint.hash;
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+        if (it != mapWallet.end())
+            vwtx.push_back(&it->second);
+    }
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -901,9 +946,13 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
 void CWallet::MarkDirty()
 {
     {
-        LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        LOCK2(cs_main, cs_wallet);
+        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
             item.second.MarkDirty();
+            // Keys or scripts imported without a rescan may have made outputs
+            // of transactions we already know ours
+            UpdateWalletUTXO(item.first);
+        }
     }
 
     fAnonymizableTallyCached = false;
@@ -989,12 +1038,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                              wtxIn.hashBlock.ToString());
             }
             AddToSpends(hash);
-            for(int i = 0; i < wtx.vout.size(); ++i) {
-                if (IsMine(wtx.vout[i]) && !IsSpent(hash, i)) {
-                    setWalletUTXO.insert(COutPoint(hash, i));
-                }
+            // Wallet transactions spending this one were seen first, the rounds
+            // cached for them didn't count it
+            if (!mapOutpointRoundsCache.empty()) {
+                TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(hash, 0));
+                if (iter != mapTxSpends.end() && iter->first.hash == hash)
+                    ClearPrivateSendRoundsCache(pwalletdb);
             }
         }
+        // Also for updated transactions, as imported keys may have made more outputs ours
+        UpdateWalletUTXO(hash);
 
         bool fUpdated = false;
         if (!fInsertedNew)
@@ -1132,6 +1185,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.setAbandoned();
             wtx.MarkDirty();
             wtx.WriteToDisk(&walletdb);
+            ErasePrivateSendRounds(now, &walletdb);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(hashTx, 0));
@@ -1145,8 +1199,10 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateWalletUTXO(txin.prevout.hash);
+                }
             }
         }
     }
@@ -1197,6 +1253,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
             wtx.WriteToDisk(&walletdb);
+            ErasePrivateSendRounds(now, &walletdb);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
             while (iter != mapTxSpends.end() && iter->first.hash == now) {
@@ -1209,8 +1266,10 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateWalletUTXO(txin.prevout.hash);
+                }
             }
         }
     }
@@ -1271,90 +1330,160 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
     return 0;
 }
 
-// Recursively determine the rounds of a given input (How deep is the PrivateSend chain for a given input)
-int CWallet::GetRealOutpointPrivateSendRounds(const COutPoint& outpoint, int nRounds) const
+// Determine the rounds of a given input (How deep is the PrivateSend chain for a given input)
+int CWallet::GetRealOutpointPrivateSendRounds(const COutPoint& outpoint) const
 {
-    static std::map<uint256, CMutableTransaction> mDenomWtxes;
+    AssertLockHeld(cs_wallet);
 
-    if(nRounds >= 16) return 15; // 16 rounds max
+    const CWalletTx* wtx = GetWalletTx(outpoint.hash);
+    if (wtx == NULL)
+        return -1;
 
-    uint256 hash = outpoint.hash;
-    unsigned int nout = outpoint.n;
+    // bounds check
+    if (outpoint.n >= wtx->vout.size()) {
+        // should never actually hit this
+        LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", outpoint.hash.ToString(), outpoint.n, -4);
+        return -4;
+    }
 
-    const CWalletTx* wtx = GetWalletTx(hash);
-    if(wtx != NULL)
-    {
-        std::map<uint256, CMutableTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        if (mdwi == mDenomWtxes.end()) {
-            // not known yet, let's add it
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CMutableTransaction(*wtx);
-        } else if(mDenomWtxes[hash].vout[nout].nRounds != -10) {
-            // found and it's not an initial value, just return it
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    std::map<COutPoint, int>::const_iterator it = mapOutpointRoundsCache.find(outpoint);
+    if (it != mapOutpointRoundsCache.end())
+        return it->second;
 
+    if (mapOutpointRoundsCache.size() >= MAX_PRIVATESEND_ROUNDS_CACHE_SIZE)
+        EvictPrivateSendRounds();
 
-        // bounds check
-        if (nout >= wtx->vout.size()) {
-            // should never actually hit this
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
-            return -4;
+    // Walk the in-wallet ancestors depth first. An outpoint stays on the stack
+    // until the rounds of all the inputs of its transaction are known.
+    std::vector<COutPoint> vStack(1, outpoint);
+    while (!vStack.empty()) {
+        const COutPoint current = vStack.back();
+        if (mapOutpointRoundsCache.count(current)) {
+            vStack.pop_back();
+            continue;
         }
 
-        if (CPrivateSend::IsCollateralAmount(wtx->vout[nout].nValue)) {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+        int nRounds;
+        const CWalletTx* pwtx = GetWalletTx(current.hash);
+        if (pwtx == NULL || current.n >= pwtx->vout.size()) {
+            // inputs are only followed when IsMine, should never actually hit this
+            nRounds = -4;
+        } else if (CPrivateSend::IsCollateralAmount(pwtx->vout[current.n].nValue)) {
+            nRounds = -3;
+        } else if (!CPrivateSend::IsDenominatedAmount(pwtx->vout[current.n].nValue)) {
+            //make sure the final output is non-denominate
+            nRounds = -2;
+        } else {
+            bool fAllDenoms = true;
+            BOOST_FOREACH(const CTxOut& out, pwtx->vout) {
+                fAllDenoms = fAllDenoms && CPrivateSend::IsDenominatedAmount(out.nValue);
+            }
 
-        //make sure the final output is non-denominate
-        if (!CPrivateSend::IsDenominatedAmount(wtx->vout[nout].nValue)) { //NOT DENOM
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
+            if (!fAllDenoms) {
+                // this one is denominated but there is another non-denominated output found in the same tx
+                nRounds = 0;
+            } else {
+                int nShortest = -10; // an initial value, should be no way to get this by calculations
+                bool fDenomFound = false;
+                bool fPending = false;
+                // only denoms here so let's look up
+                BOOST_FOREACH(const CTxIn& txinNext, pwtx->vin) {
+                    if (!IsMine(txinNext))
+                        continue;
+                    it = mapOutpointRoundsCache.find(txinNext.prevout);
+                    if (it == mapOutpointRoundsCache.end()) {
+                        vStack.push_back(txinNext.prevout);
+                        fPending = true;
+                        continue;
+                    }
+                    int n = it->second;
+                    // denom found, find the shortest chain or initially assign nShortest with the first found value
+                    if (n >= 0 && (n < nShortest || nShortest == -10)) {
+                        nShortest = n;
+                        fDenomFound = true;
+                    }
+                }
+                if (fPending)
+                    continue;
+                nRounds = fDenomFound
+                        ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
+                        : 0;            // too bad, we are the fist one in that chain
+            }
         }
 
-        bool fAllDenoms = true;
-        BOOST_FOREACH(CTxOut out, wtx->vout) {
-            fAllDenoms = fAllDenoms && CPrivateSend::IsDenominatedAmount(out.nValue);
-        }
+        mapOutpointRoundsCache[current] = nRounds;
+        setOutpointRoundsDirty.insert(current);
+        LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", current.hash.ToString(), current.n, nRounds);
+        vStack.pop_back();
+    }
 
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if (!fAllDenoms) {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    return mapOutpointRoundsCache[outpoint];
+}
 
-        int nShortest = -10; // an initial value, should be no way to get this by calculations
-        bool fDenomFound = false;
-        // only denoms here so let's look up
-        BOOST_FOREACH(CTxIn txinNext, wtx->vin) {
-            if (IsMine(txinNext)) {
-                int n = GetRealOutpointPrivateSendRounds(txinNext.prevout, nRounds + 1);
-                // denom found, find the shortest chain or initially assign nShortest with the first found value
-                if(n >= 0 && (n < nShortest || nShortest == -10)) {
-                    nShortest = n;
-                    fDenomFound = true;
-                }
-            }
-        }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
-                ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
-                : 0;            // too bad, we are the fist one in that chain
-        LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
+void CWallet::EvictPrivateSendRounds() const
+{
+    AssertLockHeld(cs_wallet);
+    // Sweep on from where the last eviction stopped, so entries which were
+    // just computed are the last to go
+    size_t nEvict = std::max<size_t>(MAX_PRIVATESEND_ROUNDS_CACHE_SIZE / 10, 1);
+    LogPrint("privatesend", "CWallet::EvictPrivateSendRounds -- cache full, evicting %d of %d entries\n", nEvict, mapOutpointRoundsCache.size());
+    std::map<COutPoint, int>::iterator it = mapOutpointRoundsCache.lower_bound(outpointRoundsEvictNext);
+    while (nEvict-- > 0 && !mapOutpointRoundsCache.empty()) {
+        if (it == mapOutpointRoundsCache.end())
+            it = mapOutpointRoundsCache.begin();
+        setOutpointRoundsDirty.erase(it->first);
+        mapOutpointRoundsCache.erase(it++);
     }
+    outpointRoundsEvictNext = it == mapOutpointRoundsCache.end() ? COutPoint() : it->first;
+}
 
-    return nRounds - 1;
+void CWallet::ErasePrivateSendRounds(const uint256& hash, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<COutPoint, int>::iterator it = mapOutpointRoundsCache.lower_bound(COutPoint(hash, 0));
+    while (it != mapOutpointRoundsCache.end() && it->first.hash == hash) {
+        setOutpointRoundsDirty.erase(it->first);
+        mapOutpointRoundsCache.erase(it++);
+    }
+    if (!fFileBacked || pwalletdb == NULL)
+        return;
+    // Evicted entries may still be stored, so go by the outputs of the transaction
+    const CWalletTx* wtx = GetWalletTx(hash);
+    if (wtx == NULL)
+        return;
+    for (unsigned int i = 0; i < wtx->vout.size(); i++) {
+        pwalletdb->ErasePrivateSendRounds(COutPoint(hash, i));
+    }
+}
+
+void CWallet::ClearPrivateSendRoundsCache(CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
+    mapOutpointRoundsCache.clear();
+    setOutpointRoundsDirty.clear();
+    outpointRoundsEvictNext.SetNull();
+    if (!fFileBacked)
+        return;
+    // Drop the stored copy right away, so a crash can't bring back stale rounds
+    if (pwalletdb) {
+        pwalletdb->ErasePrivateSendRounds();
+    } else {
+        CWalletDB(strWalletFile).ErasePrivateSendRounds();
+    }
+}
+
+void CWallet::LoadPrivateSendRounds(const COutPoint& outpoint, int nRounds)
+{
+    // What doesn't fit is computed again when needed
+    if (mapOutpointRoundsCache.size() < MAX_PRIVATESEND_ROUNDS_CACHE_SIZE)
+        mapOutpointRoundsCache.insert(std::make_pair(outpoint, nRounds));
 }
 
 // respect current settings
 int CWallet::GetOutpointPrivateSendRounds(const COutPoint& outpoint) const
 {
     LOCK(cs_wallet);
-    int realPrivateSendRounds = GetRealOutpointPrivateSendRounds(outpoint, 0);
+    int realPrivateSendRounds = GetRealOutpointPrivateSendRounds(outpoint);
     return realPrivateSendRounds > privateSendClient.nPrivateSendRounds ? privateSendClient.nPrivateSendRounds : realPrivateSendRounds;
 }
 
@@ -1704,10 +1833,194 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return pwalletdb->WriteTx(GetHash(), *this);
 }
 
+// Rescan pipeline limits: blocks read ahead, and transactions matched per batch
+static const size_t WALLET_SCAN_PREFETCH_BLOCKS = 1000;
+static const size_t WALLET_SCAN_PREFETCH_BYTES = 64 * 1000 * 1000;
+static const size_t WALLET_SCAN_BATCH_TXS = 4096;
+
+/**
+ * Read-only copy of the wallet's keys, scripts and watch-only set, so rescan
+ * workers can run IsMine() without taking cs_KeyStore for every lookup.
+ * Only used to tell whether a transaction can be ours at all: it has no
+ * private keys, so watch-only outputs always come out unsolvable.
+ */
+class CWalletScanKeyStore : public CKeyStore
+{
+private:
+    std::set<CKeyID> setKeys;
+    ScriptMap mapScripts;
+    WatchOnlySet setWatchOnly;
+
+public:
+    CWalletScanKeyStore(const CWallet& wallet)
+    {
+        AssertLockHeld(wallet.cs_wallet);
+        wallet.GetKeys(setKeys);
+        for (std::map<CKeyID, CHDPubKey>::const_iterator it = wallet.mapHdPubKeys.begin(); it != wallet.mapHdPubKeys.end(); ++it)
+            setKeys.insert(it->first);
+        LOCK(wallet.cs_KeyStore);
+        mapScripts = wallet.mapScripts;
+        setWatchOnly = wallet.setWatchOnly;
+    }
+
+    bool AddKeyPubKey(const CKey &key, const CPubKey &pubkey) { return false; }
+    bool HaveKey(const CKeyID &address) const { return setKeys.count(address) > 0; }
+    bool GetKey(const CKeyID &address, CKey& keyOut) const { return false; }
+    void GetKeys(std::set<CKeyID> &setAddress) const { setAddress = setKeys; }
+    bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const { return false; }
+
+    bool AddCScript(const CScript& redeemScript) { return false; }
+    bool HaveCScript(const CScriptID &hash) const { return mapScripts.count(hash) > 0; }
+    bool GetCScript(const CScriptID &hash, CScript& redeemScriptOut) const
+    {
+        ScriptMap::const_iterator it = mapScripts.find(hash);
+        if (it == mapScripts.end())
+            return false;
+        redeemScriptOut = it->second;
+        return true;
+    }
+
+    bool AddWatchOnly(const CScript &dest) { return false; }
+    bool RemoveWatchOnly(const CScript &dest) { return false; }
+    bool HaveWatchOnly(const CScript &dest) const { return setWatchOnly.count(dest) > 0; }
+    bool HaveWatchOnly() const { return !setWatchOnly.empty(); }
+};
+
+/** Rescan worker job: does any output of a transaction pay to the wallet */
+class CWalletScanCheck
+{
+private:
+    const CWalletScanKeyStore* pkeystore;
+    const CTransaction* ptx;
+    char* pfMine;
+
+public:
+    CWalletScanCheck() : pkeystore(NULL), ptx(NULL), pfMine(NULL) {}
+    CWalletScanCheck(const CWalletScanKeyStore* pkeystoreIn, const CTransaction* ptxIn, char* pfMineIn) :
+        pkeystore(pkeystoreIn), ptx(ptxIn), pfMine(pfMineIn) {}
+
+    bool operator()()
+    {
+        *pfMine = 0;
+        BOOST_FOREACH(const CTxOut& txout, ptx->vout) {
+            if (::IsMine(*pkeystore, txout.scriptPubKey) != ISMINE_NO) {
+                *pfMine = 1;
+                break;
+            }
+        }
+        return true;
+    }
+
+    void swap(CWalletScanCheck& check)
+    {
+        std::swap(pkeystore, check.pkeystore);
+        std::swap(ptx, check.ptx);
+        std::swap(pfMine, check.pfMine);
+    }
+};
+
+/** Check queue with -par worker threads which live as long as the rescan */
+class CWalletScanQueue
+{
+private:
+    boost::thread_group workers;
+
+public:
+    CCheckQueue<CWalletScanCheck> queue;
+
+    CWalletScanQueue() : queue(128)
+    {
+        // the scanning thread works along in CCheckQueueControl::Wait(), like ConnectBlock
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            workers.create_thread(boost::bind(&CCheckQueue<CWalletScanCheck>::Thread, &queue));
+    }
+
+    ~CWalletScanQueue()
+    {
+        workers.interrupt_all();
+        workers.join_all();
+    }
+};
+
+/**
+ * Reads the blocks of a rescan on its own thread, keeping at most
+ * WALLET_SCAN_PREFETCH_BLOCKS / WALLET_SCAN_PREFETCH_BYTES ahead of the consumer.
+ * The caller holds cs_main for the lifetime of the object, so the block
+ * positions can't change (e.g. by pruning) while they are read.
+ */
+class CWalletScanPrefetcher
+{
+private:
+    const std::vector<CBlockIndex*>& vIndex;
+    const Consensus::Params& consensusParams;
+
+    boost::mutex mutex;
+    boost::condition_variable condRead;
+    boost::condition_variable condConsume;
+    std::deque<std::pair<std::shared_ptr<const CBlock>, size_t> > queue;
+    size_t nQueuedBytes;
+    bool fStop;
+    boost::thread thread;
+
+    void Thread()
+    {
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            // a block we can't read is scanned as empty, same as before
+            if (!ReadBlockFromDisk(*pblock, vIndex[i], consensusParams))
+                pblock->SetNull();
+            size_t nSize = ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && !queue.empty() && (queue.size() >= WALLET_SCAN_PREFETCH_BLOCKS || nQueuedBytes + nSize > WALLET_SCAN_PREFETCH_BYTES))
+                condRead.wait(lock);
+            if (fStop)
+                return;
+            queue.push_back(std::make_pair(pblock, nSize));
+            nQueuedBytes += nSize;
+            condConsume.notify_one();
+        }
+    }
+
+public:
+    CWalletScanPrefetcher(const std::vector<CBlockIndex*>& vIndexIn, const Consensus::Params& consensusParamsIn) :
+        vIndex(vIndexIn), consensusParams(consensusParamsIn), nQueuedBytes(0), fStop(false)
+    {
+        thread = boost::thread(boost::bind(&CWalletScanPrefetcher::Thread, this));
+    }
+
+    ~CWalletScanPrefetcher()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condRead.notify_one();
+        thread.join();
+    }
+
+    /** The next block in vIndex order, waits for the reader if it isn't there yet */
+    std::shared_ptr<const CBlock> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty())
+            condConsume.wait(lock);
+        std::shared_ptr<const CBlock> pblock = queue.front().first;
+        nQueuedBytes -= queue.front().second;
+        queue.pop_front();
+        condRead.notify_one();
+        return pblock;
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read ahead by a CWalletScanPrefetcher. For every batch of them
+ * the outputs are matched against a snapshot of our keys on -par threads, only
+ * the candidates go through AddToWalletIfInvolvingMe in chain order.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -1724,32 +2037,87 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
+        // Rescans follow key imports, which may make more inputs of wallet transactions ours
+        ClearPrivateSendRoundsCache();
+
+        std::vector<CBlockIndex*> vIndex;
+        for (CBlockIndex* pindexScan = pindex; pindexScan; pindexScan = chainActive.Next(pindexScan))
+            vIndex.push_back(pindexScan);
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+
+        // cs_wallet is held throughout, so no keys can be added behind the snapshot's back
+        CWalletScanKeyStore keystore(*this);
+        CWalletScanQueue scanqueue;
+        CWalletScanPrefetcher prefetcher(vIndex, chainParams.GetConsensus());
+
+        size_t nNext = 0;
+        while (nNext < vIndex.size())
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            // Collect a batch of blocks large enough to keep the workers busy
+            std::vector<std::shared_ptr<const CBlock> > vBlocks;
+            size_t nTxCount = 0;
+            while (nNext + vBlocks.size() < vIndex.size() && nTxCount < WALLET_SCAN_BATCH_TXS) {
+                vBlocks.push_back(prefetcher.Next());
+                nTxCount += vBlocks.back()->vtx.size();
+            }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            // vector<char> rather than vector<bool>, workers write to neighbouring entries
+            std::vector<char> vMine(nTxCount, 0);
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                CCheckQueueControl<CWalletScanCheck> control(&scanqueue.queue);
+                std::vector<CWalletScanCheck> vChecks;
+                vChecks.reserve(nTxCount);
+                size_t nTx = 0;
+                BOOST_FOREACH(const std::shared_ptr<const CBlock>& pblock, vBlocks)
+                    BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx)
+                        vChecks.push_back(CWalletScanCheck(&keystore, ptx.get(), &vMine[nTx++]));
+                control.Add(vChecks);
+                control.Wait();
             }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+
+            size_t nTx = 0;
+            BOOST_FOREACH(const std::shared_ptr<const CBlock>& pblock, vBlocks)
+            {
+                pindex = vIndex[nNext++];
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx)
+                {
+                    // Whatever isn't paying to us can only matter if it spends from or conflicts with
+                    // the wallet, which depends on what this scan added so far and is checked here.
+                    if (!vMine[nTx++] && !IsScanCandidate(*ptx))
+                        continue;
+                    if (AddToWalletIfInvolvingMe(*ptx, pblock.get(), fUpdate))
+                        ret++;
+                }
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                }
             }
         }
+
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
 }
 
+bool CWallet::IsScanCandidate(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -2166,9 +2534,10 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2297,9 +2666,10 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
 
             nTotal += pcoin->GetDenominatedCredit(unconfirmed);
         }
@@ -2313,9 +2683,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2328,9 +2699,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -2342,9 +2714,10 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2358,9 +2731,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2373,9 +2747,10 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -2388,10 +2763,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -2430,9 +2806,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    (!IsLockedCoin((*it).first, i) || nCoinType == ONLY_1000) &&
+                    (!IsLockedCoin(wtxid, i) || nCoinType == ONLY_1000) &&
                     (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint(wtxid, i))))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
@@ -3065,9 +3441,10 @@ int CWallet::CountInputsWithAmount(CAmount nInputAmount)
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vwtx;
+        GetWalletUTXOTxes(vwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted()){
                 int nDepth = pcoin->GetDepthInMainChain(false);
 
@@ -3652,10 +4029,23 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
     {
         LOCK2(cs_main, cs_wallet);
         for (auto& pair : mapWallet) {
-            for(int i = 0; i < pair.second.vout.size(); ++i) {
-                if (IsMine(pair.second.vout[i]) && !IsSpent(pair.first, i)) {
-                    setWalletUTXO.insert(COutPoint(pair.first, i));
-                }
+            UpdateWalletUTXO(pair.first);
+        }
+        // Stored rounds of transactions that are no longer in the wallet are useless
+        std::vector<COutPoint> vStale;
+        std::map<COutPoint, int>::iterator it = mapOutpointRoundsCache.begin();
+        while (it != mapOutpointRoundsCache.end()) {
+            if (mapWallet.count(it->first.hash)) {
+                ++it;
+            } else {
+                vStale.push_back(it->first);
+                mapOutpointRoundsCache.erase(it++);
+            }
+        }
+        if (fFileBacked && !vStale.empty()) {
+            CWalletDB walletdb(strWalletFile);
+            BOOST_FOREACH(const COutPoint& outpoint, vStale) {
+                walletdb.ErasePrivateSendRounds(outpoint);
             }
         }
     }
@@ -4409,7 +4799,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock& block)
 
     // Locate the transaction
     for (nIndex = 0; nIndex < (int)block.vtx.size(); nIndex++)
-        if (block.vtx[nIndex] == *(CTransaction*)this)
+        if (*block.vtx[nIndex] == *(CTransaction*)this)
             break;
     if (nIndex == (int)block.vtx.size())
     {
@@ -4473,5 +4863,5 @@ int CMerkleTx::GetBlocksToMaturity() const
 bool CMerkleTx::AcceptToMemoryPool(bool fLimitFree, bool fRejectAbsurdFee)
 {
     CValidationState state;
-    return ::AcceptToMemoryPool(mempool, state, *this, fLimitFree, NULL, false, fRejectAbsurdFee);
+    return ::AcceptToMemoryPool(mempool, state, MakeTransactionRef(*this), fLimitFree, NULL, false, fRejectAbsurdFee);
 }
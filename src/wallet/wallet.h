@@ -68,6 +68,8 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 
 //! if set, all keys will be derived by using BIP39/BIP44
 static const bool DEFAULT_USE_HD_WALLET = false;
+//! Maximum number of outpoints kept in the PrivateSend rounds cache
+static const unsigned int MAX_PRIVATESEND_ROUNDS_CACHE_SIZE = 1000000;
 
 class CBlockIndex;
 class CCoinControl;
@@ -608,6 +610,8 @@ private:
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
+    friend class CWalletScanKeyStore;
+
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
      * all coins from coinControl are selected; Never select unconfirmed coins
@@ -635,6 +639,21 @@ private:
     mutable bool fAnonymizableTallyCachedNonDenom;
     mutable std::vector<CompactTallyItem> vecAnonymizableTallyCachedNonDenom;
 
+    /**
+     * PrivateSend rounds of wallet outpoints, see GetRealOutpointPrivateSendRounds.
+     * Rounds only depend on which wallet transactions spend which of our outputs,
+     * so entries stay valid until that graph changes. New entries are written to
+     * the wallet, one record per outpoint, on Flush().
+     */
+    mutable std::map<COutPoint, int> mapOutpointRoundsCache;
+    mutable std::set<COutPoint> setOutpointRoundsDirty;
+    /** Where EvictPrivateSendRounds() continues its sweep */
+    mutable COutPoint outpointRoundsEvictNext;
+    /** Drop a tenth of the cached rounds, the stored records are kept */
+    void EvictPrivateSendRounds() const;
+    /** Drop the cached and stored rounds of a transaction's outputs */
+    void ErasePrivateSendRounds(const uint256& hash, CWalletDB* pwalletdb);
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -645,13 +664,28 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Outputs that are ours and were unspent when last looked at. Outputs are
+     * added when their transaction enters the wallet and again when a spend
+     * of them is abandoned or conflicted, so every unspent output is in here;
+     * spent ones may linger until the wallet is reloaded. Balances and coin
+     * selection only look at the transactions in this set instead of all of
+     * mapWallet.
+     */
     std::set<COutPoint> setWalletUTXO;
+    /** Add the outputs of a wallet transaction that are ours and unspent to setWalletUTXO */
+    void UpdateWalletUTXO(const uint256& hash);
+    /** Wallet transactions that may still have unspent outputs of ours, each once */
+    void GetWalletUTXOTxes(std::vector<const CWalletTx*>& vwtx) const;
 
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /* Whether a transaction that doesn't pay to us still needs AddToWalletIfInvolvingMe during a rescan */
+    bool IsScanCandidate(const CTransaction& tx) const;
+
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
@@ -730,6 +764,9 @@ public:
         fAnonymizableTallyCachedNonDenom = false;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
+        mapOutpointRoundsCache.clear();
+        setOutpointRoundsDirty.clear();
+        outpointRoundsEvictNext.SetNull();
         
     }
 
@@ -793,10 +830,16 @@ public:
     int  CountInputsWithAmount(CAmount nInputAmount);
 
     // get the PrivateSend chain depth for a given input
-    int GetRealOutpointPrivateSendRounds(const COutPoint& outpoint, int nRounds) const;
+    int GetRealOutpointPrivateSendRounds(const COutPoint& outpoint) const;
     // respect current settings
     int GetOutpointPrivateSendRounds(const COutPoint& outpoint) const;
 
+    //! Forget all cached PrivateSend rounds, in memory and in the wallet file
+    void ClearPrivateSendRoundsCache(CWalletDB* pwalletdb = NULL);
+    //! Adds cached PrivateSend rounds read from the wallet file
+    void LoadPrivateSendRounds(const COutPoint& outpoint, int nRounds);
+    size_t GetPrivateSendRoundsCacheSize() const { LOCK(cs_wallet); return mapOutpointRoundsCache.size(); }
+
     bool IsDenominated(const COutPoint& outpoint) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
@@ -865,6 +908,7 @@ public:
      */
     int64_t IncOrderPosNext(CWalletDB *pwalletdb = NULL);
 
+    /** Recompute all balance caches and refill setWalletUTXO, e.g. after keys were imported */
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
@@ -612,6 +612,14 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "psround")
+        {
+            COutPoint outpoint;
+            int nRounds;
+            ssKey >> outpoint;
+            ssValue >> nRounds;
+            pwallet->LoadPrivateSendRounds(outpoint, nRounds);
+        }
         else if (strType == "hdpubkey")
         {
             CPubKey vchPubKey;
@@ -1188,3 +1196,56 @@ bool CWalletDB::WriteHDPubKey(const CHDPubKey& hdPubKey, const CKeyMetadata& key
 
     return Write(std::make_pair(std::string("hdpubkey"), hdPubKey.extPubKey.pubkey), hdPubKey, false);
 }
+
+bool CWalletDB::WritePrivateSendRounds(const COutPoint& outpoint, int nRounds)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("psround"), outpoint), nRounds);
+}
+
+bool CWalletDB::ErasePrivateSendRounds(const COutPoint& outpoint)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("psround"), outpoint));
+}
+
+bool CWalletDB::ErasePrivateSendRounds()
+{
+    // Collect the keys first and erase them once the cursor is closed
+    std::vector<COutPoint> vOutpoints;
+    Dbc* pcursor = GetCursor();
+    if (!pcursor)
+        return false;
+    unsigned int fFlags = DB_SET_RANGE;
+    while (true)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (fFlags == DB_SET_RANGE)
+            ssKey << std::string("psround");
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+        {
+            pcursor->close();
+            return false;
+        }
+
+        std::string strType;
+        ssKey >> strType;
+        if (strType != "psround")
+            break;
+        COutPoint outpoint;
+        ssKey >> outpoint;
+        vOutpoints.push_back(outpoint);
+    }
+    pcursor->close();
+
+    bool fResult = true;
+    BOOST_FOREACH(const COutPoint& outpoint, vOutpoints) {
+        fResult &= ErasePrivateSendRounds(outpoint);
+    }
+    return fResult;
+}
@@ -12,6 +12,7 @@
 #include "key.h"
 
 #include <list>
+#include <map>
 #include <stdint.h>
 #include <string>
 #include <utility>
@@ -24,6 +25,7 @@ class CAccountingEntry;
 struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
+class COutPoint;
 class CScript;
 class CWallet;
 class CWalletTx;
@@ -139,6 +141,12 @@ public:
     bool WriteCryptedHDChain(const CHDChain& chain);
     bool WriteHDPubKey(const CHDPubKey& hdPubKey, const CKeyMetadata& keyMeta);
 
+    //! write the cached PrivateSend rounds of a wallet outpoint, one record each
+    bool WritePrivateSendRounds(const COutPoint& outpoint, int nRounds);
+    bool ErasePrivateSendRounds(const COutPoint& outpoint);
+    //! erase the stored rounds of all outpoints
+    bool ErasePrivateSendRounds();
+
 private:
     CWalletDB(const CWalletDB&);
     void operator=(const CWalletDB&);